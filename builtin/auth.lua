@@ -29,71 +29,54 @@ end
 assert(minetest.string_to_privs("a,b").b == true)
 assert(minetest.privs_to_string({a=true,b=true}) == "a,b")
 
-minetest.auth_file_path = minetest.get_worldpath().."/auth.txt"
-minetest.auth_table = {}
-
-local function read_auth_file()
-	local newtable = {}
-	local file, errmsg = io.open(minetest.auth_file_path, 'rb')
-	if not file then
-		minetest.log("info", minetest.auth_file_path.." could not be opened for reading ("..errmsg.."); assuming new world")
-		return
-	end
-	for line in file:lines() do
-		if line ~= "" then
-			local name, password, privilegestring = string.match(line, "([^:]*):([^:]*):([^:]*)")
-			if not name or not password or not privilegestring then
-				error("Invalid line in auth.txt: "..dump(line))
-			end
-			local privileges = minetest.string_to_privs(privilegestring)
-			newtable[name] = {password=password, privileges=privileges}
-		end
+-- The entries are kept in auth.sqlite of the world by the engine; an
+-- auth.txt of an older world is imported into it when the server starts.
+
+local function read_auth_entry(name)
+	local password, privilegestring = minetest.get_auth_entry(name)
+	if not password then
+		return nil
 	end
-	io.close(file)
-	minetest.auth_table = newtable
-	minetest.notify_authentication_modified()
+	return {password=password, privileges=minetest.string_to_privs(privilegestring)}
 end
 
-local function save_auth_file()
-	local newtable = {}
-	-- Check table for validness before attempting to save
-	for name, stuff in pairs(minetest.auth_table) do
-		assert(type(name) == "string")
-		assert(name ~= "")
-		assert(type(stuff) == "table")
-		assert(type(stuff.password) == "string")
-		assert(type(stuff.privileges) == "table")
-	end
-	local file, errmsg = io.open(minetest.auth_file_path, 'w+b')
-	if not file then
-		error(minetest.auth_file_path.." could not be opened for writing: "..errmsg)
+local function write_auth_entry(name, password, privileges)
+	assert(type(name) == "string")
+	assert(name ~= "")
+	assert(type(password) == "string")
+	assert(type(privileges) == "table")
+	if not minetest.set_auth_entry(name, password, minetest.privs_to_string(privileges)) then
+		error("Could not save authentication data of player '"..name.."'")
 	end
-	for name, stuff in pairs(minetest.auth_table) do
-		local privstring = minetest.privs_to_string(stuff.privileges)
-		file:write(name..":"..stuff.password..":"..privstring..'\n')
-	end
-	io.close(file)
 end
 
-read_auth_file()
+-- Read-only view of the entries for mods that used the old Lua table;
+-- it can not be iterated and writes go through the auth handler
+minetest.auth_table = setmetatable({}, {
+	__index = function(t, name)
+		if type(name) ~= "string" then
+			return nil
+		end
+		return read_auth_entry(name)
+	end,
+	__newindex = function(t, name, value)
+		error("minetest.auth_table is read-only; use minetest.set_player_password and minetest.set_player_privs")
+	end,
+})
+
+-- Not written anymore; an existing auth.txt is renamed to auth.txt.imported
+minetest.auth_file_path = minetest.get_worldpath().."/auth.txt"
 
 minetest.builtin_auth_handler = {
 	get_auth = function(name)
 		assert(type(name) == "string")
-		-- Figure out what password to use for a new player (singleplayer
-		-- always has an empty password, otherwise use default, which is
-		-- usually empty too)
-		local new_password_hash = ""
-		-- If not in authentication table, return nil
-		if not minetest.auth_table[name] then
+		-- If not in authentication database, return nil
+		local entry = read_auth_entry(name)
+		if not entry then
 			return nil
 		end
 		-- Figure out what privileges the player should have.
-		-- Take a copy of the privilege table
-		local privileges = {}
-		for priv, _ in pairs(minetest.auth_table[name].privileges) do
-			privileges[priv] = true
-		end
+		local privileges = entry.privileges
 		-- If singleplayer, give all privileges except those marked as give_to_singleplayer = false
 		if minetest.is_singleplayer() then
 			for priv, def in pairs(minetest.registered_privileges) do
@@ -109,7 +92,7 @@ minetest.builtin_auth_handler = {
 		end
 		-- All done
 		return {
-			password = minetest.auth_table[name].password,
+			password = entry.password,
 			privileges = privileges,
 		}
 	end,
@@ -117,36 +100,37 @@ minetest.builtin_auth_handler = {
 		assert(type(name) == "string")
 		assert(type(password) == "string")
 		minetest.log('info', "Built-in authentication handler adding player '"..name.."'")
-		minetest.auth_table[name] = {
-			password = password,
-			privileges = minetest.string_to_privs(minetest.setting_get("default_privs")),
-		}
-		save_auth_file()
+		write_auth_entry(name, password,
+				minetest.string_to_privs(minetest.setting_get("default_privs")))
 	end,
 	set_password = function(name, password)
 		assert(type(name) == "string")
 		assert(type(password) == "string")
-		if not minetest.auth_table[name] then
+		local entry = read_auth_entry(name)
+		if not entry then
 			minetest.builtin_auth_handler.create_auth(name, password)
 		else
 			minetest.log('info', "Built-in authentication handler setting password of player '"..name.."'")
-			minetest.auth_table[name].password = password
-			save_auth_file()
+			write_auth_entry(name, password, entry.privileges)
 		end
 		return true
 	end,
 	set_privileges = function(name, privileges)
 		assert(type(name) == "string")
 		assert(type(privileges) == "table")
-		if not minetest.auth_table[name] then
-			minetest.builtin_auth_handler.create_auth(name, minetest.get_password_hash(name, minetest.setting_get("default_password")))
+		local entry = read_auth_entry(name)
+		local password
+		if entry then
+			password = entry.password
+		else
+			password = minetest.get_password_hash(name, minetest.setting_get("default_password"))
 		end
-		minetest.auth_table[name].privileges = privileges
+		write_auth_entry(name, password, privileges)
 		minetest.notify_authentication_modified(name)
-		save_auth_file()
 	end,
 	reload = function()
-		read_auth_file()
+		-- Nothing is cached on the Lua side
+		minetest.notify_authentication_modified()
 		return true
 	end,
 }
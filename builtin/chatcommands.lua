@@ -659,3 +659,52 @@ minetest.register_chatcommand("clearobjects", {
 		minetest.chat_send_all("*** Cleared all objects.")
 	end,
 })
+
+local function format_callback_profile(sort_by)
+	local profile = minetest.get_callback_profile()
+	table.sort(profile, function(a, b) return a[sort_by] > b[sort_by] end)
+	local lines = {}
+	for _, e in ipairs(profile) do
+		table.insert(lines, string.format("%-24s %-20s %8d calls %10.1f ms total %8.3f ms avg %8.3f ms max",
+				e.mod, e.kind, e.calls, e.time / 1000, e.time / e.calls / 1000, e.max / 1000))
+	end
+	return lines
+end
+
+minetest.register_chatcommand("profiler", {
+	params = "on | off | reset | print [<count>] | save",
+	description = "time Lua callbacks per mod and kind of callback",
+	privs = {server=true},
+	func = function(name, param)
+		local cmd, arg = string.match(param, "^([^ ]+) *(.*)")
+		cmd = cmd or "print"
+		if cmd == "on" or cmd == "off" then
+			minetest.set_callback_profiling(cmd == "on")
+			minetest.chat_send_player(name, "Callback profiling turned " .. cmd)
+		elseif cmd == "reset" then
+			minetest.reset_callback_profile()
+			minetest.chat_send_player(name, "Callback profile cleared")
+		elseif cmd == "print" then
+			local lines = format_callback_profile("time")
+			local count = tonumber(arg) or 10
+			if #lines == 0 then
+				minetest.chat_send_player(name, "Callback profile is empty (turn it on with /profiler on)")
+			end
+			for i = 1, math.min(count, #lines) do
+				minetest.chat_send_player(name, lines[i])
+			end
+		elseif cmd == "save" then
+			local path = minetest.get_worldpath() .. "/callback_profile.txt"
+			local file, err = io.open(path, "w")
+			if not file then
+				minetest.chat_send_player(name, "Failed to save callback profile: " .. err)
+				return
+			end
+			file:write(table.concat(format_callback_profile("time"), "\n") .. "\n")
+			file:close()
+			minetest.chat_send_player(name, "Callback profile saved to " .. path)
+		else
+			minetest.chat_send_player(name, "Invalid parameters (see /help profiler)")
+		end
+	end,
+})
@@ -58,21 +58,25 @@ minetest.register_entity("__builtin:item", {
 
 	get_staticdata = function(self)
 		--return self.itemstring
-		return minetest.serialize({
+		return minetest.serialize_binary({
 			itemstring = self.itemstring,
 			always_collect = self.always_collect,
 		})
 	end,
 
 	on_activate = function(self, staticdata)
-		if string.sub(staticdata, 1, string.len("return")) == "return" then
-			local data = minetest.deserialize(staticdata)
-			if data and type(data) == "table" then
-				self.itemstring = data.itemstring
-				self.always_collect = data.always_collect
-			end
+		local data = nil
+		if string.byte(staticdata, 1) == 0 then
+			data = minetest.deserialize_binary(staticdata)
+		elseif string.sub(staticdata, 1, string.len("return")) == "return" then
+			-- Saved by an older version
+			data = minetest.deserialize(staticdata)
 		else
-			self.itemstring = staticdata
+			data = {itemstring = staticdata}
+		end
+		if data and type(data) == "table" then
+			self.itemstring = data.itemstring
+			self.always_collect = data.always_collect
 		end
 		self.object:set_armor_groups({immortal=1})
 		self.object:setvelocity({x=0, y=2, z=0})
@@ -72,6 +72,7 @@ local function check_modname_prefix(name)
 end
 
 function minetest.register_abm(spec)
+	spec.mod_origin = minetest.get_current_modname() or "??"
 	-- Add to minetest.registered_abms
 	minetest.registered_abms[#minetest.registered_abms+1] = spec
 end
@@ -84,6 +85,7 @@ function minetest.register_entity(name, prototype)
 	name = check_modname_prefix(tostring(name))
 
 	prototype.name = name
+	prototype.mod_origin = minetest.get_current_modname() or "??"
 	prototype.__index = prototype  -- so that it can be used as a metatable
 
 	-- Add to minetest.registered_entities
@@ -100,6 +102,7 @@ function minetest.register_item(name, itemdef)
 		error("Unable to register item: Name is forbidden: " .. name)
 	end
 	itemdef.name = name
+	itemdef.mod_origin = minetest.get_current_modname() or "??"
 
 	-- Apply defaults and add to registered_* table
 	if itemdef.type == "node" then
@@ -289,29 +292,43 @@ minetest.register_item(":", {
 -- Callback registration
 --
 
-local function make_registration()
+-- Remember which mod registered a callback, for the callback profiler
+local function set_callback_origin(func, kind)
+	minetest.callback_origins[func] = {
+		kind = kind,
+		mod = minetest.get_current_modname() or "??",
+	}
+end
+
+local function make_registration(kind)
 	local t = {}
-	local registerfunc = function(func) table.insert(t, func) end
+	local registerfunc = function(func)
+		table.insert(t, func)
+		set_callback_origin(func, kind)
+	end
 	return t, registerfunc
 end
 
-local function make_registration_reverse()
+local function make_registration_reverse(kind)
 	local t = {}
-	local registerfunc = function(func) table.insert(t, 1, func) end
+	local registerfunc = function(func)
+		table.insert(t, 1, func)
+		set_callback_origin(func, kind)
+	end
 	return t, registerfunc
 end
 
-minetest.registered_on_chat_messages, minetest.register_on_chat_message = make_registration()
-minetest.registered_globalsteps, minetest.register_globalstep = make_registration()
-minetest.registered_on_shutdown, minetest.register_on_shutdown = make_registration()
-minetest.registered_on_punchnodes, minetest.register_on_punchnode = make_registration()
-minetest.registered_on_placenodes, minetest.register_on_placenode = make_registration()
-minetest.registered_on_dignodes, minetest.register_on_dignode = make_registration()
-minetest.registered_on_generateds, minetest.register_on_generated = make_registration()
-minetest.registered_on_newplayers, minetest.register_on_newplayer = make_registration()
-minetest.registered_on_dieplayers, minetest.register_on_dieplayer = make_registration()
-minetest.registered_on_respawnplayers, minetest.register_on_respawnplayer = make_registration()
-minetest.registered_on_joinplayers, minetest.register_on_joinplayer = make_registration()
-minetest.registered_on_leaveplayers, minetest.register_on_leaveplayer = make_registration()
-minetest.registered_on_player_receive_fields, minetest.register_on_player_receive_fields = make_registration_reverse()
+minetest.registered_on_chat_messages, minetest.register_on_chat_message = make_registration("on_chat_message")
+minetest.registered_globalsteps, minetest.register_globalstep = make_registration("globalstep")
+minetest.registered_on_shutdown, minetest.register_on_shutdown = make_registration("on_shutdown")
+minetest.registered_on_punchnodes, minetest.register_on_punchnode = make_registration("on_punchnode")
+minetest.registered_on_placenodes, minetest.register_on_placenode = make_registration("on_placenode")
+minetest.registered_on_dignodes, minetest.register_on_dignode = make_registration("on_dignode")
+minetest.registered_on_generateds, minetest.register_on_generated = make_registration("on_generated")
+minetest.registered_on_newplayers, minetest.register_on_newplayer = make_registration("on_newplayer")
+minetest.registered_on_dieplayers, minetest.register_on_dieplayer = make_registration("on_dieplayer")
+minetest.registered_on_respawnplayers, minetest.register_on_respawnplayer = make_registration("on_respawnplayer")
+minetest.registered_on_joinplayers, minetest.register_on_joinplayer = make_registration("on_joinplayer")
+minetest.registered_on_leaveplayers, minetest.register_on_leaveplayer = make_registration("on_leaveplayer")
+minetest.registered_on_player_receive_fields, minetest.register_on_player_receive_fields = make_registration_reverse("on_player_receive_fields")
 
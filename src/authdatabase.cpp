@@ -0,0 +1,185 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "authdatabase.h"
+#include <fstream>
+#include "exceptions.h"
+#include "log.h"
+
+AuthDatabase::AuthDatabase(const std::string &dbpath):
+	m_database(NULL),
+	m_database_read(NULL),
+	m_database_write(NULL),
+	m_database_import(NULL)
+{
+	int d;
+
+	d = sqlite3_open_v2(dbpath.c_str(), &m_database,
+			SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+	if(d != SQLITE_OK) {
+		errorstream<<"AuthDatabase: Failed to open "<<dbpath<<": "
+				<<sqlite3_errmsg(m_database)<<std::endl;
+		sqlite3_close(m_database);
+		throw FileNotGoodException("Cannot open auth database file");
+	}
+
+	d = sqlite3_exec(m_database,
+		"CREATE TABLE IF NOT EXISTS `auth` ("
+			"`name` TEXT NOT NULL PRIMARY KEY,"
+			"`password` TEXT NOT NULL,"
+			"`privileges` TEXT NOT NULL"
+		");"
+	, NULL, NULL, NULL);
+	if(d != SQLITE_OK) {
+		errorstream<<"AuthDatabase: Failed to create table: "
+				<<sqlite3_errmsg(m_database)<<std::endl;
+		sqlite3_close(m_database);
+		throw FileNotGoodException("Could not create auth database structure");
+	}
+
+	d = sqlite3_prepare(m_database,
+			"SELECT `password`, `privileges` FROM `auth` WHERE `name`=? LIMIT 1",
+			-1, &m_database_read, NULL);
+	if(d == SQLITE_OK)
+		d = sqlite3_prepare(m_database,
+				"REPLACE INTO `auth` VALUES(?, ?, ?)",
+				-1, &m_database_write, NULL);
+	if(d == SQLITE_OK)
+		d = sqlite3_prepare(m_database,
+				"INSERT OR IGNORE INTO `auth` VALUES(?, ?, ?)",
+				-1, &m_database_import, NULL);
+	if(d != SQLITE_OK) {
+		errorstream<<"AuthDatabase: Failed to prepare statements: "
+				<<sqlite3_errmsg(m_database)<<std::endl;
+		sqlite3_finalize(m_database_read);
+		sqlite3_finalize(m_database_write);
+		sqlite3_finalize(m_database_import);
+		sqlite3_close(m_database);
+		throw FileNotGoodException("Cannot prepare auth database statements");
+	}
+
+	infostream<<"AuthDatabase: Opened "<<dbpath<<std::endl;
+}
+
+AuthDatabase::~AuthDatabase()
+{
+	sqlite3_finalize(m_database_read);
+	sqlite3_finalize(m_database_write);
+	sqlite3_finalize(m_database_import);
+	sqlite3_close(m_database);
+}
+
+bool AuthDatabase::get(const std::string &name, std::string &password,
+		std::string &privileges)
+{
+	bool found = false;
+	sqlite3_bind_text(m_database_read, 1, name.c_str(), name.size(), NULL);
+	if(sqlite3_step(m_database_read) == SQLITE_ROW) {
+		const char *p = (const char *)sqlite3_column_text(m_database_read, 0);
+		const char *privs = (const char *)sqlite3_column_text(m_database_read, 1);
+		password = p ? p : "";
+		privileges = privs ? privs : "";
+		found = true;
+	}
+	sqlite3_reset(m_database_read);
+	return found;
+}
+
+static bool write_entry(sqlite3 *database, sqlite3_stmt *stmt,
+		const std::string &name, const std::string &password,
+		const std::string &privileges)
+{
+	sqlite3_bind_text(stmt, 1, name.c_str(), name.size(), NULL);
+	sqlite3_bind_text(stmt, 2, password.c_str(), password.size(), NULL);
+	sqlite3_bind_text(stmt, 3, privileges.c_str(), privileges.size(), NULL);
+	int written = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	if(written != SQLITE_DONE) {
+		errorstream<<"AuthDatabase: Failed to write entry of \""<<name
+				<<"\": "<<sqlite3_errmsg(database)<<std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool AuthDatabase::set(const std::string &name, const std::string &password,
+		const std::string &privileges)
+{
+	return write_entry(m_database, m_database_write,
+			name, password, privileges);
+}
+
+bool AuthDatabase::importAuthFile(const std::string &path, u32 &count)
+{
+	count = 0;
+	std::ifstream is(path.c_str(), std::ios_base::binary);
+	if(!is.good()) {
+		errorstream<<"AuthDatabase: Failed to open "<<path<<std::endl;
+		return false;
+	}
+
+	// One transaction for the whole file; otherwise every entry is
+	// synced to disk separately
+	if(sqlite3_exec(m_database, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK) {
+		errorstream<<"AuthDatabase: Failed to begin transaction: "
+				<<sqlite3_errmsg(m_database)<<std::endl;
+		return false;
+	}
+
+	u32 imported = 0;
+	std::string line;
+	while(std::getline(is, line))
+	{
+		if(line.empty())
+			continue;
+		size_t c1 = line.find(':');
+		size_t c2 = (c1 == std::string::npos) ?
+				std::string::npos : line.find(':', c1 + 1);
+		if(c2 == std::string::npos) {
+			errorstream<<"AuthDatabase: Invalid line in "<<path<<": \""
+					<<line<<"\""<<std::endl;
+			continue;
+		}
+		std::string name = line.substr(0, c1);
+		std::string password = line.substr(c1 + 1, c2 - c1 - 1);
+		std::string privileges = line.substr(c2 + 1);
+		// Like the old reader, ignore anything after a third colon
+		privileges = privileges.substr(0, privileges.find(':'));
+		if(!write_entry(m_database, m_database_import,
+				name, password, privileges)) {
+			sqlite3_exec(m_database, "ROLLBACK;", NULL, NULL, NULL);
+			return false;
+		}
+		if(sqlite3_changes(m_database) > 0)
+			imported++;
+	}
+
+	if(is.bad() ||
+			sqlite3_exec(m_database, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+		errorstream<<"AuthDatabase: Failed to import "<<path<<": "
+				<<sqlite3_errmsg(m_database)<<std::endl;
+		sqlite3_exec(m_database, "ROLLBACK;", NULL, NULL, NULL);
+		return false;
+	}
+
+	count = imported;
+	return true;
+}
+
@@ -0,0 +1,72 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef AUTHDATABASE_HEADER
+#define AUTHDATABASE_HEADER
+
+#include <string>
+#include "irrlichttypes.h"
+
+extern "C" {
+	#include "sqlite3.h"
+}
+
+/*
+	Authentication data of a world, stored in an SQLite database
+	(auth.sqlite) so that a change only writes the entry of one player.
+
+	Structure of auth.sqlite:
+	Tables:
+		auth
+			(PK) name TEXT
+			password TEXT -- Password hash
+			privileges TEXT -- "priv1,priv2,..."
+*/
+class AuthDatabase
+{
+public:
+	AuthDatabase(const std::string &dbpath);
+	~AuthDatabase();
+
+	// Returns false if there is no entry for name
+	bool get(const std::string &name, std::string &password,
+			std::string &privileges);
+	// Adds or replaces the entry of name
+	bool set(const std::string &name, const std::string &password,
+			const std::string &privileges);
+
+	/*
+		Imports the lines of an auth.txt:
+			<name>:<password hash>:<privilege1,...>
+		Names that already have an entry are skipped; count is set to
+		the number of imported entries. Returns false and imports
+		nothing if the file can't be read or an entry can't be written.
+	*/
+	bool importAuthFile(const std::string &path, u32 &count);
+
+private:
+	sqlite3 *m_database;
+	sqlite3_stmt *m_database_read;
+	sqlite3_stmt *m_database_write;
+	sqlite3_stmt *m_database_import;
+};
+
+#endif
+
@@ -0,0 +1,962 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark.h"
+#include "irrlichttypes_bloated.h"
+#include "main.h" // g_settings
+#include "settings.h"
+#include "log.h"
+#include "debug.h"
+#include "constants.h"
+#include "porting.h"
+#include "filesys.h"
+#include "config.h"
+#include "gamedef.h"
+#include "itemdef.h"
+#include "nodedef.h"
+#include "craftdef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "mapgen.h"
+#include "emerge.h"
+#include "heightmapcache.h"
+#include "environment.h"
+#include "content_abm.h"
+#include "collision.h"
+#include "connection.h"
+#include "serialization.h"
+#include "noise.h"
+#include "util/numeric.h"
+#include "util/string.h"
+#include "util/timetaker.h"
+#include "json/json.h"
+#include <sstream>
+#include <fstream>
+
+// Seed of the generated benchmark worlds and of myrand()
+#define BENCHMARK_SEED 13337
+
+// File that marks a directory as a benchmark scratch directory
+#define BENCHMARK_DIR_MARKER "minetestbenchmark_scratch.txt"
+
+// First port tried by the connection benchmark
+#define BENCHMARK_PORT 30399
+
+/*
+	Scratch directory
+*/
+
+bool init_benchmark_dir(const std::string &dir)
+{
+	std::string marker = dir + DIR_DELIM + BENCHMARK_DIR_MARKER;
+	if(!fs::GetDirListing(dir).empty() && !fs::PathExists(marker))
+	{
+		errorstream<<"\""<<dir<<"\" is not empty and not a benchmark "
+				"directory; not using it"<<std::endl;
+		return false;
+	}
+	if(!fs::CreateAllDirs(dir))
+	{
+		errorstream<<"Could not create \""<<dir<<"\""<<std::endl;
+		return false;
+	}
+	std::ofstream of(marker.c_str());
+	if(!of.good())
+	{
+		errorstream<<"Could not write \""<<marker<<"\""<<std::endl;
+		return false;
+	}
+	of<<"Scratch directory of minetestbenchmark, deleted after a run"
+			<<std::endl;
+
+	// Left behind by an interrupted run
+	std::string world_path = get_benchmark_world_path(dir);
+	if(fs::PathExists(world_path))
+		fs::RecursiveDelete(world_path);
+	return true;
+}
+
+std::string get_benchmark_world_path(const std::string &dir)
+{
+	return dir + DIR_DELIM + "world";
+}
+
+void remove_benchmark_dir(const std::string &dir)
+{
+	std::string marker = dir + DIR_DELIM + BENCHMARK_DIR_MARKER;
+	if(!fs::PathExists(marker))
+		return;
+	std::string world_path = get_benchmark_world_path(dir);
+	if(fs::PathExists(world_path))
+		fs::RecursiveDelete(world_path);
+	fs::DeleteSingleFileOrEmptyDirectory(marker);
+	// Only if nothing else was put there
+	fs::DeleteSingleFileOrEmptyDirectory(dir);
+}
+
+/*
+	A fixed set of item and node definitions, enough for the built-in
+	mapgens and the C++ ABMs. Registered under the same names as in the
+	default game, with the mapgen aliases pointing to them.
+*/
+
+static void define_benchmark_node(IWritableItemDefManager *idef,
+		IWritableNodeDefManager *ndef, const std::string &name,
+		const ContentFeatures &f0, const char *alias=NULL)
+{
+	ItemDefinition itemdef;
+	itemdef.type = ITEM_NODE;
+	itemdef.name = name;
+	idef->registerItem(itemdef);
+	if(alias)
+		idef->registerAlias(alias, name);
+	ContentFeatures f = f0;
+	f.name = name;
+	ndef->set(name, f);
+}
+
+static void define_benchmark_liquid(IWritableItemDefManager *idef,
+		IWritableNodeDefManager *ndef, const std::string &name,
+		u8 light_source, const char *alias)
+{
+	ContentFeatures f;
+	f.param_type = CPT_LIGHT;
+	f.light_propagates = true;
+	f.walkable = false;
+	f.pointable = false;
+	f.diggable = false;
+	f.buildable_to = true;
+	f.light_source = light_source;
+	f.liquid_alternative_flowing = name + "_flowing";
+	f.liquid_alternative_source = name + "_source";
+	f.liquid_viscosity = 1;
+	f.groups["liquid"] = 3;
+
+	f.drawtype = NDT_LIQUID;
+	f.liquid_type = LIQUID_SOURCE;
+	define_benchmark_node(idef, ndef, name + "_source", f, alias);
+
+	f.drawtype = NDT_FLOWINGLIQUID;
+	f.liquid_type = LIQUID_FLOWING;
+	f.param_type_2 = CPT2_FLOWINGLIQUID;
+	define_benchmark_node(idef, ndef, name + "_flowing", f);
+}
+
+static void define_benchmark_nodes(IWritableItemDefManager *idef,
+		IWritableNodeDefManager *ndef)
+{
+	ContentFeatures solid;
+	solid.is_ground_content = true;
+	define_benchmark_node(idef, ndef, "default:stone", solid, "mapgen_stone");
+	define_benchmark_node(idef, ndef, "default:dirt", solid, "mapgen_dirt");
+	define_benchmark_node(idef, ndef, "default:dirt_with_grass", solid,
+			"mapgen_dirt_with_grass");
+	define_benchmark_node(idef, ndef, "default:sand", solid, "mapgen_sand");
+	define_benchmark_node(idef, ndef, "default:gravel", solid, "mapgen_gravel");
+	define_benchmark_node(idef, ndef, "default:desert_sand", solid,
+			"mapgen_desert_sand");
+	define_benchmark_node(idef, ndef, "default:desert_stone", solid,
+			"mapgen_desert_stone");
+	define_benchmark_node(idef, ndef, "default:clay", solid);
+	define_benchmark_node(idef, ndef, "default:cobble", solid, "mapgen_cobble");
+	define_benchmark_node(idef, ndef, "default:mossycobble", solid,
+			"mapgen_mossycobble");
+	define_benchmark_node(idef, ndef, "default:tree", solid, "mapgen_tree");
+	define_benchmark_node(idef, ndef, "default:jungletree", solid,
+			"mapgen_jungletree");
+
+	ContentFeatures leaves;
+	leaves.drawtype = NDT_ALLFACES_OPTIONAL;
+	leaves.param_type = CPT_LIGHT;
+	leaves.light_propagates = true;
+	define_benchmark_node(idef, ndef, "default:leaves", leaves,
+			"mapgen_leaves");
+	define_benchmark_node(idef, ndef, "default:jungleleaves", leaves,
+			"mapgen_jungleleaves");
+
+	ContentFeatures plant;
+	plant.drawtype = NDT_PLANTLIKE;
+	plant.param_type = CPT_LIGHT;
+	plant.light_propagates = true;
+	plant.sunlight_propagates = true;
+	plant.walkable = false;
+	plant.buildable_to = true;
+	define_benchmark_node(idef, ndef, "default:junglegrass", plant,
+			"mapgen_junglegrass");
+	define_benchmark_node(idef, ndef, "default:apple", plant,
+			"mapgen_apple");
+
+	ContentFeatures torch = plant;
+	torch.drawtype = NDT_TORCHLIKE;
+	torch.light_source = LIGHT_MAX - 1;
+	define_benchmark_node(idef, ndef, "default:torch", torch);
+
+	define_benchmark_liquid(idef, ndef, "default:water", 0,
+			"mapgen_water_source");
+	define_benchmark_liquid(idef, ndef, "default:lava", LIGHT_MAX - 1,
+			"mapgen_lava_source");
+
+	ndef->updateAliases(idef);
+}
+
+/*
+	A game definition that owns the benchmark definitions.
+	It can't provide textures, sounds or events; nothing on the server
+	side needs them.
+*/
+
+class BenchmarkGameDef : public IGameDef
+{
+public:
+	BenchmarkGameDef():
+		m_itemdef(createItemDefManager()),
+		m_nodedef(createNodeDefManager()),
+		m_craftdef(createCraftDefManager())
+	{
+		define_benchmark_nodes(m_itemdef, m_nodedef);
+	}
+	~BenchmarkGameDef()
+	{
+		delete m_craftdef;
+		delete m_nodedef;
+		delete m_itemdef;
+	}
+
+	IItemDefManager* getItemDefManager(){ return m_itemdef; }
+	INodeDefManager* getNodeDefManager(){ return m_nodedef; }
+	ICraftDefManager* getCraftDefManager(){ return m_craftdef; }
+	ITextureSource* getTextureSource(){ return NULL; }
+	IShaderSource* getShaderSource(){ return NULL; }
+	u16 allocateUnknownNodeId(const std::string &name)
+	{
+		return m_nodedef->allocateDummy(name);
+	}
+	ISoundManager* getSoundManager(){ return NULL; }
+	MtEventManager* getEventManager(){ return NULL; }
+
+private:
+	IWritableItemDefManager *m_itemdef;
+	IWritableNodeDefManager *m_nodedef;
+	IWritableCraftDefManager *m_craftdef;
+};
+
+/*
+	A scratch world: ServerMap, ServerEnvironment (without Lua) and an
+	EmergeManager with a single mapgen, driven directly from this thread
+	the same way EmergeThread drives them. It is made in the world path
+	of a scratch directory and deleted afterwards.
+*/
+
+class BenchmarkWorld
+{
+public:
+	BenchmarkWorld(IGameDef *gamedef, const std::string &mg_name,
+			const std::string &dir):
+		m_dir(get_benchmark_world_path(dir))
+	{
+		g_settings->set("mg_name", mg_name);
+		g_settings->set("fixed_map_seed", itos(BENCHMARK_SEED));
+		g_settings->set("num_emerge_threads", "1");
+
+		if(fs::PathExists(m_dir))
+			fs::RecursiveDelete(m_dir);
+		fs::CreateAllDirs(m_dir);
+
+		emerge = new EmergeManager(gamedef, NULL);
+		MapgenParams *mgparams = emerge->getParamsFromSettings(g_settings);
+		if(mgparams == NULL)
+			throw BaseException("Invalid mapgen parameters");
+		emerge->initMapgens(mgparams);
+		mapgen = emerge->mapgen[0];
+
+		map = new ServerMap(m_dir, gamedef, emerge);
+		// The environment owns the map
+		env = new ServerEnvironment(map, NULL, gamedef, NULL);
+	}
+
+	~BenchmarkWorld()
+	{
+		delete env;
+		delete emerge;
+		fs::RecursiveDelete(m_dir);
+	}
+
+	s16 getChunkSize()
+	{
+		return map->getMapgenParams()->chunksize;
+	}
+
+	// Generates the chunk containing blockpos like EmergeThread does
+	bool generateChunk(v3s16 blockpos)
+	{
+		BlockMakeData data;
+		if(!map->initBlockMake(&data, blockpos))
+			return false;
+		mapgen->makeChunk(&data);
+		std::map<v3s16, MapBlock*> modified_blocks;
+		map->finishBlockMake(&data, modified_blocks);
+		return true;
+	}
+
+	// Generates a square of chunks around the origin
+	// and returns the blocks that ended up in it.
+	void generateArea(s16 radius_chunks, std::vector<MapBlock*> &blocks)
+	{
+		s16 cs = getChunkSize();
+		for(s16 x = -radius_chunks; x <= radius_chunks; x++)
+		for(s16 z = -radius_chunks; z <= radius_chunks; z++)
+			generateChunk(v3s16(x * cs, 0, z * cs));
+
+		s16 r = radius_chunks * cs + cs / 2;
+		v3s16 p;
+		for(p.X = -r; p.X <= r; p.X++)
+		for(p.Y = -cs / 2; p.Y <= cs / 2; p.Y++)
+		for(p.Z = -r; p.Z <= r; p.Z++)
+		{
+			MapBlock *block = map->getBlockNoCreateNoEx(p);
+			if(block && block->isGenerated())
+				blocks.push_back(block);
+		}
+	}
+
+	EmergeManager *emerge;
+	Mapgen *mapgen;
+	ServerMap *map;
+	ServerEnvironment *env;
+
+private:
+	std::string m_dir;
+};
+
+/*
+	Benchmarks
+*/
+
+struct BenchmarkBase
+{
+	std::vector<BenchmarkResult> results;
+
+	void report(const std::string &name, u32 iterations, u32 time_ms,
+			double amount, const std::string &unit)
+	{
+		BenchmarkResult r;
+		r.name = name;
+		r.iterations = iterations;
+		r.time_ms = time_ms;
+		r.amount = amount;
+		r.unit = unit;
+		infostream<<"Benchmark "<<name<<": "<<amount<<" "<<unit
+				<<" in "<<time_ms<<"ms ("<<r.perSecond()<<" "<<unit
+				<<"/s)"<<std::endl;
+		results.push_back(r);
+	}
+};
+
+/*
+	Ores like those of the default game: scattered with and without
+	noise, and a sheet
+*/
+static NoiseParams g_benchmark_ore_noise = {0, 1, v3f(100, 100, 100), 591, 3, 0.7};
+
+static void add_benchmark_ore(EmergeManager *emerge, OreType type,
+		const std::string &name, s16 scarcity, s16 num_ores, s16 size,
+		s16 height_max, NoiseParams *np)
+{
+	Ore *ore = createOre(type);
+	ore->ore_name       = name;
+	ore->wherein_name   = "mapgen_stone";
+	ore->clust_scarcity = scarcity;
+	ore->clust_num_ores = num_ores;
+	ore->clust_size     = size;
+	ore->height_min     = -31000;
+	ore->height_max     = height_max;
+	ore->nthresh        = 0.1;
+	ore->np             = np;
+	emerge->ores.push_back(ore);
+}
+
+static void add_benchmark_ores(EmergeManager *emerge)
+{
+	add_benchmark_ore(emerge, ORE_SCATTER, "default:cobble",
+			8 * 8 * 8, 8, 3, 64, NULL);
+	add_benchmark_ore(emerge, ORE_SCATTER, "default:gravel",
+			6 * 6 * 6, 5, 3, -16, &g_benchmark_ore_noise);
+	add_benchmark_ore(emerge, ORE_SCATTER, "default:mossycobble",
+			4 * 4 * 4, 3, 2, -64, &g_benchmark_ore_noise);
+	add_benchmark_ore(emerge, ORE_SHEET, "default:clay",
+			1, 1, 4, 0, &g_benchmark_ore_noise);
+}
+
+struct BenchmarkMapgen: public BenchmarkBase
+{
+	void generate(BenchmarkWorld &world, const std::string &name)
+	{
+		s16 cs = world.getChunkSize();
+		u32 chunks = 0;
+		TimeTaker timer("mapgen benchmark");
+		for(s16 x = 0; x < 4; x++)
+		for(s16 z = 0; z < 2; z++)
+		{
+			if(world.generateChunk(v3s16(x * cs, 0, z * cs)))
+				chunks++;
+		}
+		u32 dtime = timer.stop(true);
+		report(name, chunks, dtime, chunks, "chunks");
+	}
+
+	void Run(IGameDef *gamedef, const std::string &dir)
+	{
+		const char *mapgens[] = {"v6", "indev", "singlenode"};
+		for(u32 i = 0; i < sizeof(mapgens) / sizeof(*mapgens); i++)
+		{
+			BenchmarkWorld world(gamedef, mapgens[i], dir);
+			generate(world, std::string("mapgen_") + mapgens[i]);
+		}
+
+		BenchmarkWorld world(gamedef, "v6", dir);
+		add_benchmark_ores(world.emerge);
+		// Ores are resolved when the mapgens are created
+		for(u32 i = 0; i < world.emerge->ores.size(); i++)
+			world.emerge->ores[i]->resolveNodeNames(gamedef->ndef());
+		generate(world, "mapgen_v6_ores");
+		for(u32 i = 0; i < world.emerge->ores.size(); i++)
+			delete world.emerge->ores[i];
+		world.emerge->ores.clear();
+	}
+};
+
+struct BenchmarkMapBlockSerialization: public BenchmarkBase
+{
+	void runFormat(IGameDef *gamedef, std::vector<MapBlock*> &blocks,
+			bool disk, const std::string &suffix)
+	{
+		const u8 version = SER_FMT_VER_HIGHEST;
+		const u32 repeats = 4;
+		std::vector<std::string> serialized;
+		serialized.reserve(blocks.size());
+		double bytes = 0;
+
+		TimeTaker timer("serialize benchmark");
+		for(u32 r = 0; r < repeats; r++)
+		{
+			serialized.clear();
+			for(u32 i = 0; i < blocks.size(); i++)
+			{
+				std::ostringstream os(std::ios_base::binary);
+				blocks[i]->serialize(os, version, disk);
+				serialized.push_back(os.str());
+			}
+		}
+		u32 dtime = timer.stop(true);
+		for(u32 i = 0; i < serialized.size(); i++)
+			bytes += serialized[i].size();
+		report("mapblock_serialize_" + suffix, repeats, dtime,
+				repeats * blocks.size(), "blocks");
+
+		TimeTaker timer2("deserialize benchmark");
+		for(u32 r = 0; r < repeats; r++)
+		{
+			for(u32 i = 0; i < serialized.size(); i++)
+			{
+				MapBlock block(NULL, blocks[i]->getPos(), gamedef);
+				std::istringstream is(serialized[i], std::ios_base::binary);
+				block.deSerialize(is, version, disk);
+			}
+		}
+		dtime = timer2.stop(true);
+		report("mapblock_deserialize_" + suffix, repeats, dtime,
+				repeats * blocks.size(), "blocks");
+		report("mapblock_serialized_size_" + suffix, 1, 0,
+				bytes / MYMAX(serialized.size(), 1), "bytes/block");
+	}
+
+	void Run(IGameDef *gamedef, std::vector<MapBlock*> &blocks)
+	{
+		runFormat(gamedef, blocks, true, "disk");
+		runFormat(gamedef, blocks, false, "network");
+	}
+};
+
+struct BenchmarkABM: public BenchmarkBase
+{
+	void Run(IGameDef *gamedef, BenchmarkWorld &world,
+			std::vector<MapBlock*> &blocks)
+	{
+		const u32 repeats = 4;
+		add_legacy_abms(world.env, gamedef->ndef());
+
+		TimeTaker timer("abm benchmark");
+		for(u32 r = 0; r < repeats; r++)
+		{
+			for(u32 i = 0; i < blocks.size(); i++)
+				world.env->activateBlock(blocks[i], 60);
+		}
+		u32 dtime = timer.stop(true);
+		report("abm_pass", repeats, dtime, repeats * blocks.size(), "blocks");
+	}
+};
+
+struct BenchmarkLiquid: public BenchmarkBase
+{
+	/*
+		Flood: a 128x32x128 box high up in the air with a stone floor
+		and a ceiling of water sources, flowing until it settles
+	*/
+	void flood(IGameDef *gamedef, BenchmarkWorld &world,
+			const std::string &threads, const std::string &name)
+	{
+		INodeDefManager *ndef = gamedef->ndef();
+		ServerMap *map = world.map;
+		content_t c_stone = ndef->getId("mapgen_stone");
+		content_t c_water = ndef->getId("mapgen_water_source");
+
+		v3s16 bmin(0, 40, 0);
+		v3s16 bmax(7, 41, 7);
+		v3s16 nmin = bmin * MAP_BLOCKSIZE;
+		v3s16 nmax = (bmax + v3s16(1,1,1)) * MAP_BLOCKSIZE - v3s16(1,1,1);
+		v3s16 p;
+		for(p.X = bmin.X; p.X <= bmax.X; p.X++)
+		for(p.Y = bmin.Y; p.Y <= bmax.Y; p.Y++)
+		for(p.Z = bmin.Z; p.Z <= bmax.Z; p.Z++)
+			map->createBlock(p);
+		for(p.X = nmin.X; p.X <= nmax.X; p.X++)
+		for(p.Y = nmin.Y; p.Y <= nmax.Y; p.Y++)
+		for(p.Z = nmin.Z; p.Z <= nmax.Z; p.Z++)
+		{
+			MapNode n(CONTENT_AIR);
+			if(p.Y == nmin.Y)
+				n.setContent(c_stone);
+			else if(p.Y == nmax.Y)
+				n.setContent(c_water);
+			map->setNode(p, n);
+			if(p.Y == nmax.Y)
+				map->transforming_liquid_add(p);
+		}
+
+		// Without a time budget every step handles the whole queue
+		std::string old_budget = g_settings->get("liquid_step_budget");
+		std::string old_threads = g_settings->get("liquid_threads");
+		g_settings->set("liquid_step_budget", "0");
+		g_settings->set("liquid_threads", threads);
+		std::map<v3s16, MapBlock*> modified_blocks;
+		u32 steps = 0;
+		double nodes = 0;
+		TimeTaker timer("liquid benchmark");
+		while(map->transforming_liquid_size() != 0 && steps < 10000)
+		{
+			nodes += map->transforming_liquid_size();
+			map->transformLiquids(modified_blocks);
+			steps++;
+		}
+		u32 dtime = timer.stop(true);
+		g_settings->set("liquid_step_budget", old_budget);
+		g_settings->set("liquid_threads", old_threads);
+		report(name, steps, dtime, nodes, "nodes");
+	}
+
+	void Run(IGameDef *gamedef, BenchmarkWorld &world)
+	{
+		flood(gamedef, world, "1", "liquid_transform");
+		// As many threads as there are processors
+		flood(gamedef, world, "", "liquid_transform_threaded");
+	}
+};
+
+struct BenchmarkCollision: public BenchmarkBase
+{
+	void Run(IGameDef *gamedef, BenchmarkWorld &world)
+	{
+		const u32 objects = 200;
+		const u32 steps = 200;
+		const f32 dtime = 0.05;
+		aabb3f box(-BS*0.3, -BS*1.0, -BS*0.3, BS*0.3, BS*0.75, BS*0.3);
+		PseudoRandom pr(BENCHMARK_SEED);
+
+		std::vector<v3f> positions;
+		std::vector<v3f> speeds;
+		for(u32 i = 0; i < objects; i++)
+		{
+			positions.push_back(v3f(pr.range(-30, 30), pr.range(0, 30),
+					pr.range(-30, 30)) * BS);
+			speeds.push_back(v3f(pr.range(-4, 4), 0, pr.range(-4, 4)) * BS);
+		}
+
+		TimeTaker timer("collision benchmark");
+		for(u32 j = 0; j < steps; j++)
+		{
+			for(u32 i = 0; i < objects; i++)
+			{
+				v3f accel(0, -9.81 * BS, 0);
+				collisionMoveSimple(world.env, gamedef, BS*0.25, box,
+						BS*0.6, dtime, positions[i], speeds[i], accel);
+			}
+		}
+		u32 dtime_ms = timer.stop(true);
+		report("collision_move", steps, dtime_ms, objects * steps, "moves");
+	}
+};
+
+struct BenchmarkGetNode: public BenchmarkBase
+{
+	void Run(BenchmarkWorld &world)
+	{
+		s16 cs = world.getChunkSize();
+		s16 r = (cs + cs / 2) * MAP_BLOCKSIZE;
+		s16 h = cs / 2 * MAP_BLOCKSIZE;
+		u32 sum = 0;
+
+		// Row by row, as the lighting and mesh code reads nodes
+		u32 repeats = 4;
+		u32 nodes = 0;
+		TimeTaker timer("getnode sequential benchmark");
+		for(u32 i = 0; i < repeats; i++)
+		{
+			v3s16 p;
+			for(p.Z = -r; p.Z < r; p.Z++)
+			for(p.Y = -h; p.Y < h; p.Y++)
+			for(p.X = -r; p.X < r; p.X++)
+			{
+				sum += world.map->getNodeNoEx(p).getContent();
+				nodes++;
+			}
+		}
+		u32 dtime = timer.stop(true);
+		report("getnode_sequential", repeats, dtime, nodes, "nodes");
+
+		// Scattered over the area, as object and ABM code reads nodes
+		PseudoRandom pr(BENCHMARK_SEED);
+		std::vector<v3s16> positions;
+		for(u32 i = 0; i < 100000; i++)
+			positions.push_back(v3s16(pr.range(-r, r - 1),
+					pr.range(-h, h - 1), pr.range(-r, r - 1)));
+		repeats = 50;
+		TimeTaker timer2("getnode random benchmark");
+		for(u32 i = 0; i < repeats; i++)
+		{
+			for(u32 j = 0; j < positions.size(); j++)
+				sum += world.map->getNodeNoEx(positions[j]).getContent();
+		}
+		dtime = timer2.stop(true);
+		report("getnode_random", repeats, dtime,
+				repeats * positions.size(), "nodes");
+
+		verbosestream<<"getnode benchmark checksum: "<<sum<<std::endl;
+	}
+};
+
+struct BenchmarkGroundLevel: public BenchmarkBase
+{
+	void Run(BenchmarkWorld &world)
+	{
+		// Spawn searches and generate distance checks, around the origin
+		PseudoRandom pr(BENCHMARK_SEED);
+		std::vector<v2s16> points;
+		for(u32 i = 0; i < 100000; i++)
+			points.push_back(v2s16(pr.range(-500, 500),
+					pr.range(-500, 500)));
+		s32 sum = 0;
+
+		TimeTaker timer("ground level noise benchmark");
+		for(u32 i = 0; i < points.size(); i++)
+			sum += world.mapgen->getGroundLevelAtPoint(points[i]);
+		u32 dtime = timer.stop(true);
+		report("ground_level_noise", 1, dtime, points.size(), "points");
+
+		u32 repeats = 4;
+		world.emerge->heightmap->clear();
+		TimeTaker timer2("ground level cache benchmark");
+		for(u32 i = 0; i < repeats; i++)
+		{
+			for(u32 j = 0; j < points.size(); j++)
+				sum -= world.emerge->getGroundLevelAtPoint(points[j]);
+		}
+		dtime = timer2.stop(true);
+		report("ground_level_cached", repeats, dtime,
+				repeats * points.size(), "points");
+
+		verbosestream<<"ground level benchmark checksum: "<<sum<<std::endl;
+	}
+};
+
+struct BenchmarkLighting: public BenchmarkBase
+{
+	// Places n at every position in turn, updating the lighting
+	void place(BenchmarkWorld &world, const std::vector<v3s16> &positions,
+			MapNode n, const std::string &name)
+	{
+		std::map<v3s16, MapBlock*> modified_blocks;
+		TimeTaker timer("lighting place benchmark");
+		for(u32 i = 0; i < positions.size(); i++)
+			world.map->addNodeAndUpdate(positions[i], n, modified_blocks);
+		u32 dtime = timer.stop(true);
+		report(name, 1, dtime, positions.size(), "nodes");
+	}
+
+	// Digs every position in turn, updating the lighting
+	void dig(BenchmarkWorld &world, const std::vector<v3s16> &positions,
+			const std::string &name)
+	{
+		std::map<v3s16, MapBlock*> modified_blocks;
+		TimeTaker timer("lighting dig benchmark");
+		for(u32 i = 0; i < positions.size(); i++)
+			world.map->removeNodeAndUpdate(positions[i], modified_blocks);
+		u32 dtime = timer.stop(true);
+		report(name, 1, dtime, positions.size(), "nodes");
+	}
+
+	/*
+		Caves: a 3x3 tunnel dug through the stone, lit by torches, and
+		filled up again. Only artificial light changes.
+	*/
+	void runCave(IGameDef *gamedef, BenchmarkWorld &world)
+	{
+		INodeDefManager *ndef = gamedef->ndef();
+		s16 r = (world.getChunkSize() + world.getChunkSize() / 2)
+				* MAP_BLOCKSIZE;
+		s16 y = -20;
+		std::vector<v3s16> tunnel;
+		std::vector<v3s16> torches;
+		for(s16 x = -r + 1; x < r - 1; x++)
+		{
+			for(s16 dy = -1; dy <= 1; dy++)
+			for(s16 z = -1; z <= 1; z++)
+				tunnel.push_back(v3s16(x, y + dy, z));
+			if(x % 8 == 0)
+				torches.push_back(v3s16(x, y - 1, 0));
+		}
+
+		dig(world, tunnel, "lighting_cave_dig");
+
+		// Lighting and darkening the tunnel again and again
+		MapNode torch(ndef->getId("default:torch"));
+		const u32 repeats = 20;
+		std::map<v3s16, MapBlock*> modified_blocks;
+		TimeTaker timer("lighting torch benchmark");
+		for(u32 j = 0; j < repeats; j++)
+		{
+			for(u32 i = 0; i < torches.size(); i++)
+				world.map->addNodeAndUpdate(torches[i], torch,
+						modified_blocks);
+			for(u32 i = 0; i < torches.size(); i++)
+				world.map->removeNodeAndUpdate(torches[i], modified_blocks);
+		}
+		u32 dtime = timer.stop(true);
+		report("lighting_cave_torch", repeats, dtime,
+				repeats * torches.size() * 2, "nodes");
+
+		// Filling the tunnel blocks the light of the torches
+		place(world, torches, torch, "lighting_cave_place_torch");
+		place(world, tunnel, MapNode(ndef->getId("mapgen_stone")),
+				"lighting_cave_place");
+	}
+
+	/*
+		Open terrain: a roof built over the ground in the sunlight, node
+		by node, and taken down again. Every node changes the sunlight
+		of the column below it.
+	*/
+	void runSurface(IGameDef *gamedef, BenchmarkWorld &world)
+	{
+		INodeDefManager *ndef = gamedef->ndef();
+		const s16 size = 32;
+		s16 ground = -MAP_GENERATION_LIMIT;
+		for(s16 x = 0; x < size; x++)
+		for(s16 z = 0; z < size; z++)
+			ground = MYMAX(ground, world.map->findGroundLevel(v2s16(x, z)));
+		// Above the trees
+		s16 y = ground + 8;
+		// The ground may be above the generated area; generate the
+		// chunk of the roof and the one above it, for the sky
+		s16 cs = world.getChunkSize();
+		v3s16 roof_blockpos = getNodeBlockPos(v3s16(0, y, 0));
+		world.generateChunk(roof_blockpos);
+		world.generateChunk(roof_blockpos + v3s16(0, cs, 0));
+		if(world.map->getNodeNoEx(v3s16(0, y, 0)).getLight(LIGHTBANK_DAY,
+				ndef) != LIGHT_SUN)
+			errorstream<<"BenchmarkLighting: no sunlight at the roof"<<std::endl;
+
+		std::vector<v3s16> roof;
+		for(s16 z = 0; z < size; z++)
+		for(s16 x = 0; x < size; x++)
+			roof.push_back(v3s16(x, y, z));
+
+		place(world, roof, MapNode(ndef->getId("mapgen_stone")),
+				"lighting_surface_place");
+		dig(world, roof, "lighting_surface_dig");
+	}
+
+	void Run(IGameDef *gamedef, BenchmarkWorld &world)
+	{
+		runCave(gamedef, world);
+		runSurface(gamedef, world);
+	}
+};
+
+struct BenchmarkConnection: public BenchmarkBase
+{
+	// Returns a port no other socket is bound to, or 0
+	static u16 findFreePort()
+	{
+		for(u16 port = BENCHMARK_PORT; port < BENCHMARK_PORT + 100; port++)
+		{
+			try{
+				UDPSocket socket;
+				socket.Bind(port);
+				return port;
+			}
+			catch(SocketException &e){}
+		}
+		return 0;
+	}
+
+	void Run(u16 port)
+	{
+		const u32 proto_id = 0xad26846a;
+		const u32 packet_count = 2000;
+		const u32 packet_size = 1000;
+
+		if(port == 0)
+			port = findFreePort();
+		if(port == 0)
+		{
+			errorstream<<"BenchmarkConnection: no free port"<<std::endl;
+			return;
+		}
+
+		con::Connection server(proto_id, 512, 5.0);
+		con::Connection client(proto_id, 512, 5.0);
+		server.SetTimeoutMs(10);
+		client.SetTimeoutMs(10);
+		server.Serve(port);
+		client.Connect(Address(127,0,0,1, port));
+
+		u16 peer_id;
+		SharedBuffer<u8> data;
+		u32 wait_start = porting::getTimeMs();
+		while(!client.Connected())
+		{
+			try{ client.Receive(peer_id, data); }
+			catch(con::NoIncomingDataException &e){}
+			try{ server.Receive(peer_id, data); }
+			catch(con::NoIncomingDataException &e){}
+			if(porting::getTimeMs() - wait_start > 5000)
+			{
+				errorstream<<"BenchmarkConnection: could not connect"
+						<<std::endl;
+				return;
+			}
+		}
+
+		SharedBuffer<u8> packet(packet_size);
+		for(u32 i = 0; i < packet_size; i++)
+			packet[i] = i & 0xff;
+
+		u32 received = 0;
+		TimeTaker timer("connection benchmark");
+		for(u32 i = 0; i < packet_count; i++)
+			client.Send(PEER_ID_SERVER, 0, packet, true);
+		while(received < packet_count && timer.getTime() < 60000)
+		{
+			try{
+				server.Receive(peer_id, data);
+				received++;
+			}
+			catch(con::NoIncomingDataException &e){}
+		}
+		u32 dtime = timer.stop(true);
+		report("connection_reliable_loopback", received, dtime,
+				(double)received * packet_size, "bytes");
+	}
+};
+
+// args is the parenthesized argument list of Run()
+#define BENCHMARK_RUN(X, args)\
+if(filter.empty() || lowercase(#X).find(lowercase(filter)) != std::string::npos)\
+{\
+	X x;\
+	infostream<<"Running " #X <<std::endl;\
+	x.Run args;\
+	results.insert(results.end(), x.results.begin(), x.results.end());\
+}
+
+#define BENCHMARK1(X, a) BENCHMARK_RUN(X, (a))
+#define BENCHMARK2(X, a, b) BENCHMARK_RUN(X, (a, b))
+#define BENCHMARK3(X, a, b, c) BENCHMARK_RUN(X, (a, b, c))
+
+bool run_benchmarks(std::vector<BenchmarkResult> &results,
+		const std::string &filter, const std::string &world_dir, u16 port)
+{
+	DSTACK(__FUNCTION_NAME);
+
+	if(!init_benchmark_dir(world_dir))
+		return false;
+
+	infostream<<"run_benchmarks() started"<<std::endl;
+
+	mysrand(BENCHMARK_SEED);
+	BenchmarkGameDef gamedef;
+
+	BENCHMARK2(BenchmarkMapgen, &gamedef, world_dir);
+	{
+		// These share one generated v6 world
+		BenchmarkWorld world(&gamedef, "v6", world_dir);
+		std::vector<MapBlock*> blocks;
+		world.generateArea(1, blocks);
+		infostream<<"run_benchmarks(): generated "<<blocks.size()
+				<<" blocks"<<std::endl;
+		BENCHMARK2(BenchmarkMapBlockSerialization, &gamedef, blocks);
+		BENCHMARK2(BenchmarkCollision, &gamedef, world);
+		BENCHMARK1(BenchmarkGetNode, world);
+		BENCHMARK1(BenchmarkGroundLevel, world);
+		BENCHMARK2(BenchmarkLighting, &gamedef, world);
+		BENCHMARK2(BenchmarkLiquid, &gamedef, world);
+		BENCHMARK3(BenchmarkABM, &gamedef, world, blocks);
+	}
+	BENCHMARK1(BenchmarkConnection, port);
+
+	remove_benchmark_dir(world_dir);
+	infostream<<"run_benchmarks() finished"<<std::endl;
+	return true;
+}
+
+void write_benchmark_results(std::ostream &os,
+		const std::vector<BenchmarkResult> &results)
+{
+	Json::Value root;
+	root["version"] = VERSION_STRING;
+	root["build"] = BUILD_INFO;
+	root["seed"] = BENCHMARK_SEED;
+	Json::Value list(Json::arrayValue);
+	for(u32 i = 0; i < results.size(); i++)
+	{
+		const BenchmarkResult &r = results[i];
+		Json::Value v;
+		v["name"] = r.name;
+		v["iterations"] = r.iterations;
+		v["time_ms"] = r.time_ms;
+		v["amount"] = r.amount;
+		v["unit"] = r.unit;
+		v["per_second"] = r.perSecond();
+		list.append(v);
+	}
+	root["benchmarks"] = list;
+	Json::StyledWriter writer;
+	os<<writer.write(root);
+}
+
@@ -0,0 +1,89 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef BENCHMARK_HEADER
+#define BENCHMARK_HEADER
+
+#include "irrlichttypes.h"
+#include <string>
+#include <vector>
+#include <iostream>
+
+/*
+	Result of a single benchmark.
+
+	amount is the amount of work done during time_ms, in units of unit
+	(eg. 40 "chunks" or 1048576 "bytes").
+*/
+struct BenchmarkResult
+{
+	std::string name;
+	u32 iterations;
+	u32 time_ms;
+	double amount;
+	std::string unit;
+
+	BenchmarkResult():
+		iterations(0),
+		time_ms(0),
+		amount(0)
+	{}
+
+	double perSecond() const
+	{
+		if(time_ms == 0)
+			return 0;
+		return amount * 1000.0 / time_ms;
+	}
+};
+
+/*
+	Makes dir the scratch directory of a benchmark run, marked as such.
+	A directory that exists, is not empty and was not made by the
+	benchmarks is left alone and false is returned, so that a mistyped
+	path can't wipe a real world.
+*/
+bool init_benchmark_dir(const std::string &dir);
+// Where the worlds go in a scratch directory
+std::string get_benchmark_world_path(const std::string &dir);
+// Deletes what init_benchmark_dir() and the worlds put in dir
+void remove_benchmark_dir(const std::string &dir);
+
+/*
+	Runs the headless benchmarks of the server subsystems.
+
+	Everything is run with fixed seeds and a synthetic set of node
+	definitions so that results are comparable between builds.
+
+	filter: if not empty, only benchmarks whose name contains it are run
+	dir: scratch directory for the generated worlds (see
+	     init_benchmark_dir()); deleted afterwards
+	port: UDP port of the connection benchmark; 0 picks a free one
+
+	Returns false if dir can't be used.
+*/
+bool run_benchmarks(std::vector<BenchmarkResult> &results,
+		const std::string &filter, const std::string &dir, u16 port);
+
+// Writes the results as JSON
+void write_benchmark_results(std::ostream &os,
+		const std::vector<BenchmarkResult> &results);
+
+#endif
+
@@ -0,0 +1,329 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+	Entry point of minetestbenchmark, a headless executable that runs the
+	benchmarks in benchmark.cpp and writes the results as JSON.
+
+	With --bots it instead load tests a server with synthetic clients
+	(botclient.h). Without --address a server is started in this process
+	and the bots connect to it over loopback.
+
+	It is built like the dedicated server (SERVER defined, no Irrlicht)
+	and provides the same globals as main.cpp does.
+*/
+
+#include "main.h"
+#include "benchmark.h"
+#include "botclient.h"
+#include "server.h"
+#include "subgame.h"
+#include "irrlichttypes_bloated.h"
+#include "debug.h"
+#include "log.h"
+#include "settings.h"
+#include "defaultsettings.h"
+#include "profiler.h"
+#include "porting.h"
+#include "filesys.h"
+#include "socket.h"
+#include "serialization.h"
+#include "gettime.h"
+#include "config.h"
+#include "util/string.h"
+#include <iostream>
+#include <fstream>
+#include <locale.h>
+
+/*
+	Settings
+*/
+Settings main_settings;
+Settings *g_settings = &main_settings;
+
+// Global profiler
+Profiler main_profiler;
+Profiler *g_profiler = &main_profiler;
+
+/*
+	Debug streams
+*/
+
+// Connection
+std::ostream *dout_con_ptr = &dummyout;
+std::ostream *derr_con_ptr = &verbosestream;
+
+// Server
+std::ostream *dout_server_ptr = &infostream;
+std::ostream *derr_server_ptr = &errorstream;
+
+// Client
+std::ostream *dout_client_ptr = &infostream;
+std::ostream *derr_client_ptr = &errorstream;
+
+/*
+	gettime.h implementation
+*/
+
+u32 getTimeMs()
+{
+	return porting::getTimeMs();
+}
+
+class StderrLogOutput: public ILogOutput
+{
+public:
+	/* line: Full line with timestamp, level and thread */
+	void printLog(const std::string &line)
+	{
+		std::cerr<<line<<std::endl;
+	}
+} main_stderr_log_out;
+
+static int run_bots(Settings &cmd_args, const std::string &world_dir,
+		std::vector<BenchmarkResult> &results)
+{
+	BotRunParams params;
+	params.count = stoi(cmd_args.get("bots"));
+	if(cmd_args.exists("duration"))
+		params.duration = stof(cmd_args.get("duration"));
+	if(cmd_args.exists("bot-pattern"))
+		params.pattern = bot_move_pattern_from_string(
+				cmd_args.get("bot-pattern"));
+	if(cmd_args.exists("bot-password"))
+		params.password = cmd_args.get("bot-password");
+
+	u16 port = 30000;
+	if(cmd_args.exists("port"))
+		port = cmd_args.getU16("port");
+
+	std::string address = "";
+	if(cmd_args.exists("address"))
+		address = cmd_args.get("address");
+
+	if(address != "")
+	{
+		try{
+			params.address.Resolve(address.c_str());
+		}
+		catch(ResolveError &e){
+			errorstream<<"Couldn't resolve address \""<<address<<"\""
+					<<std::endl;
+			return 1;
+		}
+		params.address.setPort(port);
+		run_bot_clients(results, params);
+		return 0;
+	}
+
+	/*
+		Start a server with a fresh world for the bots
+	*/
+
+	SubgameSpec gamespec = findSubgame(g_settings->get("default_game"));
+	if(cmd_args.exists("gameid"))
+		gamespec = findSubgame(cmd_args.get("gameid"));
+	if(!gamespec.isValid()){
+		errorstream<<"Subgame ["<<gamespec.id<<"] could not be found."
+				<<std::endl;
+		return 1;
+	}
+
+	// Never a world of the user; see init_benchmark_dir()
+	if(!init_benchmark_dir(world_dir))
+		return 1;
+	std::string world_path = get_benchmark_world_path(world_dir);
+	if(!initializeWorld(world_path, gamespec.id)){
+		errorstream<<"Could not create world at ["<<world_path<<"]"
+				<<std::endl;
+		remove_benchmark_dir(world_dir);
+		return 1;
+	}
+
+	// There is no real admin; let the bots in however many there are
+	g_settings->set("max_users", itos(params.count + 1));
+	g_settings->set("server_announce", "false");
+
+	{
+		Server server(world_path, "", gamespec, false);
+		server.start(port);
+		params.address = Address(127,0,0,1, port);
+		params.server = &server;
+		run_bot_clients(results, params);
+	}
+
+	remove_benchmark_dir(world_dir);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int retval = 0;
+
+	log_add_output_maxlev(&main_stderr_log_out, LMT_ACTION);
+	log_register_thread("main");
+
+	// Force '.' as the decimal point so that the JSON is valid
+	setlocale(LC_NUMERIC, "C");
+
+	/*
+		Parse command line
+	*/
+
+	std::map<std::string, ValueSpec> allowed_options;
+	allowed_options.insert(std::make_pair("help", ValueSpec(VALUETYPE_FLAG,
+			"Show allowed options")));
+	allowed_options.insert(std::make_pair("output", ValueSpec(VALUETYPE_STRING,
+			"Write results to file instead of stdout")));
+	allowed_options.insert(std::make_pair("filter", ValueSpec(VALUETYPE_STRING,
+			"Only run benchmarks whose name contains this")));
+	allowed_options.insert(std::make_pair("world", ValueSpec(VALUETYPE_STRING,
+			"Scratch directory for the worlds (new or empty; deleted afterwards)")));
+	allowed_options.insert(std::make_pair("bots", ValueSpec(VALUETYPE_STRING,
+			"Load test a server with this many bot clients")));
+	allowed_options.insert(std::make_pair("bot-pattern", ValueSpec(VALUETYPE_STRING,
+			"Bot movement: idle, circle, line or random")));
+	allowed_options.insert(std::make_pair("bot-password", ValueSpec(VALUETYPE_STRING,
+			"Password of the bots")));
+	allowed_options.insert(std::make_pair("duration", ValueSpec(VALUETYPE_STRING,
+			"Length of the bot run in seconds")));
+	allowed_options.insert(std::make_pair("address", ValueSpec(VALUETYPE_STRING,
+			"Server to connect the bots to ('' = start one)")));
+	allowed_options.insert(std::make_pair("port", ValueSpec(VALUETYPE_STRING,
+			"Set network port (UDP)")));
+	allowed_options.insert(std::make_pair("gameid", ValueSpec(VALUETYPE_STRING,
+			"Game of the started server")));
+	allowed_options.insert(std::make_pair("config", ValueSpec(VALUETYPE_STRING,
+			"Load configuration from specified file")));
+	allowed_options.insert(std::make_pair("info", ValueSpec(VALUETYPE_FLAG,
+			"Print more information to console")));
+	allowed_options.insert(std::make_pair("verbose", ValueSpec(VALUETYPE_FLAG,
+			"Print even more information to console")));
+
+	Settings cmd_args;
+
+	bool ret = cmd_args.parseCommandLine(argc, argv, allowed_options);
+
+	if(ret == false || cmd_args.getFlag("help") || cmd_args.exists("nonopt1"))
+	{
+		dstream<<"Allowed options:"<<std::endl;
+		for(std::map<std::string, ValueSpec>::iterator
+				i = allowed_options.begin();
+				i != allowed_options.end(); ++i)
+		{
+			std::ostringstream os1(std::ios::binary);
+			os1<<"  --"<<i->first;
+			if(i->second.type != VALUETYPE_FLAG)
+				os1<<" <value>";
+			dstream<<padStringRight(os1.str(), 24);
+			if(i->second.help != NULL)
+				dstream<<i->second.help;
+			dstream<<std::endl;
+		}
+		return cmd_args.getFlag("help") ? 0 : 1;
+	}
+
+	if(cmd_args.getFlag("info") || cmd_args.getFlag("verbose"))
+		log_add_output(&main_stderr_log_out, LMT_INFO);
+	if(cmd_args.getFlag("verbose"))
+		log_add_output(&main_stderr_log_out, LMT_VERBOSE);
+
+	porting::signal_handler_init();
+	porting::initializePaths();
+
+	debug_stacks_init();
+	DSTACK(__FUNCTION_NAME);
+
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	infostream<<PROJECT_NAME<<"benchmark"
+			<<" with SER_FMT_VER_HIGHEST="<<(int)SER_FMT_VER_HIGHEST
+			<<", "<<BUILD_INFO<<std::endl;
+
+	set_default_settings(g_settings);
+
+	sockets_init();
+	atexit(sockets_cleanup);
+
+	if(cmd_args.exists("config"))
+	{
+		bool r = g_settings->readConfigFile(cmd_args.get("config").c_str());
+		if(r == false)
+		{
+			errorstream<<"Could not read configuration from \""
+					<<cmd_args.get("config")<<"\""<<std::endl;
+			return 1;
+		}
+	}
+
+	debugstreams_init(false, NULL);
+
+	std::string world_dir = porting::path_user + DIR_DELIM + "benchmark_world";
+	if(cmd_args.exists("world"))
+		world_dir = cmd_args.get("world");
+	std::string filter;
+	if(cmd_args.exists("filter"))
+		filter = cmd_args.get("filter");
+
+	std::vector<BenchmarkResult> results;
+	if(cmd_args.exists("bots"))
+	{
+		retval = run_bots(cmd_args, world_dir, results);
+		if(retval != 0)
+			return retval;
+	}
+	else
+	{
+		// A free port unless one is given
+		u16 port = 0;
+		if(cmd_args.exists("port"))
+			port = cmd_args.getU16("port");
+		if(!run_benchmarks(results, filter, world_dir, port))
+			return 1;
+	}
+
+	if(cmd_args.exists("output"))
+	{
+		std::string path = cmd_args.get("output");
+		std::ofstream of(path.c_str());
+		if(!of.good())
+		{
+			errorstream<<"Could not open \""<<path<<"\" for writing"
+					<<std::endl;
+			retval = 1;
+		}
+		else
+		{
+			write_benchmark_results(of, results);
+			actionstream<<"Wrote "<<results.size()<<" benchmark results to \""
+					<<path<<"\""<<std::endl;
+		}
+	}
+	else
+	{
+		write_benchmark_results(std::cout, results);
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER(errorstream)
+
+	debugstreams_deinit();
+
+	return retval;
+}
+
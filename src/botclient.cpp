@@ -0,0 +1,683 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "botclient.h"
+#include "clientserver.h"
+#include "constants.h"
+#include "serialization.h"
+#include "mapblock.h" // getNodeBlockPos
+#include "player.h" // PLAYERNAME_SIZE
+#include "server.h"
+#include "porting.h"
+#include "debug.h"
+#include "log.h"
+#include "util/serialize.h"
+#include "util/string.h"
+#include "util/numeric.h"
+#include "util/pointedthing.h"
+#include <algorithm>
+#include <sstream>
+#include <cmath>
+
+// Walking speed of the bots; the server allows up to 2.5 times this
+#define BOT_SPEED (BS * 4.0)
+// Edits and blocks not answered in this time are given up on
+#define BOT_INTERACT_TIMEOUT_MS 10000
+#define BOT_BLOCK_TIMEOUT_MS 60000
+
+BotMovePattern bot_move_pattern_from_string(const std::string &s)
+{
+	if(s == "idle")
+		return BOTMOVE_IDLE;
+	if(s == "line")
+		return BOTMOVE_LINE;
+	if(s == "random")
+		return BOTMOVE_RANDOM;
+	return BOTMOVE_CIRCLE;
+}
+
+u32 LatencySamples::percentile(float p) const
+{
+	if(m_samples.empty())
+		return 0;
+	std::vector<u32> sorted = m_samples;
+	u32 i = MYMIN((u32)(p / 100.0 * sorted.size()), sorted.size() - 1);
+	std::nth_element(sorted.begin(), sorted.begin() + i, sorted.end());
+	return sorted[i];
+}
+
+/*
+	Edits waiting for the server; values are the times they were sent
+*/
+
+// Returns the number of edits that timed out
+static u32 expire_pending(std::map<v3s16, u32> &pending, u32 now)
+{
+	u32 expired = 0;
+	for(std::map<v3s16, u32>::iterator i = pending.begin();
+			i != pending.end();)
+	{
+		if(now - i->second > BOT_INTERACT_TIMEOUT_MS)
+		{
+			expired++;
+			pending.erase(i++);
+		}
+		else
+			++i;
+	}
+	return expired;
+}
+
+// Returns false if there was no edit at p
+static bool finish_pending(std::map<v3s16, u32> &pending, v3s16 p,
+		LatencySamples &latency, u32 now)
+{
+	std::map<v3s16, u32>::iterator i = pending.find(p);
+	if(i == pending.end())
+		return false;
+	latency.add(now - i->second);
+	pending.erase(i);
+	return true;
+}
+
+static void finish_pending_in_block(std::map<v3s16, u32> &pending,
+		v3s16 blockpos, LatencySamples &latency, u32 now)
+{
+	for(std::map<v3s16, u32>::iterator i = pending.begin();
+			i != pending.end();)
+	{
+		if(getNodeBlockPos(i->first) == blockpos)
+		{
+			latency.add(now - i->second);
+			pending.erase(i++);
+		}
+		else
+			++i;
+	}
+}
+
+/*
+	BotClient
+*/
+
+BotClient::BotClient(const std::string &name, const std::string &password,
+		BotMovePattern pattern, u32 seed):
+	blocks_received(0),
+	bytes_received(0),
+	digs_sent(0),
+	digs_lost(0),
+	places_sent(0),
+	places_lost(0),
+	m_name(name),
+	m_pattern(pattern),
+	m_pr(seed),
+	m_con(PROTOCOL_ID, 512, CONNECTION_TIMEOUT),
+	m_server_ser_ver(SER_FMT_VER_INVALID),
+	m_joined(false),
+	m_access_denied(false),
+	m_connect_time(0),
+	m_init_timer(0),
+	m_position(0,0,0),
+	m_speed(0,0,0),
+	m_spawn_position(0,0,0),
+	m_yaw(0),
+	m_move_time(0),
+	m_send_timer(0),
+	m_rtt_timer(0),
+	m_last_blockpos(0,-32768,0),
+	m_interact_timer(0),
+	m_interact_state(0)
+{
+	// Same as what the real client sends
+	if(password != "")
+		m_password = translatePassword(name, narrow_to_wide(password));
+
+	// Never block in receive()
+	m_con.SetTimeoutMs(0);
+
+	m_yaw = m_pr.range(0, 359);
+	m_interact_timer = m_pr.range(20, 80) / 10.0;
+}
+
+BotClient::~BotClient()
+{
+	m_con.Disconnect();
+}
+
+void BotClient::connect(Address address)
+{
+	m_connect_time = porting::getTimeMs();
+	m_con.Connect(address);
+}
+
+void BotClient::disconnect()
+{
+	m_con.Disconnect();
+}
+
+void BotClient::send(SharedBuffer<u8> data, bool reliable, u8 channel)
+{
+	m_con.Send(PEER_ID_SERVER, channel, data, reliable);
+}
+
+void BotClient::step(float dtime)
+{
+	receive();
+
+	if(m_access_denied)
+		return;
+
+	if(!m_joined)
+	{
+		// Resend until the server answers, like Client does
+		m_init_timer -= dtime;
+		if(m_init_timer <= 0.0)
+		{
+			m_init_timer = 2.0;
+			sendInit();
+		}
+		return;
+	}
+
+	sendGotBlocks();
+	move(dtime);
+	interact(dtime);
+
+	m_send_timer += dtime;
+	if(m_send_timer >= 0.1)
+	{
+		m_send_timer = 0;
+		sendPlayerPos();
+	}
+
+	m_rtt_timer += dtime;
+	if(m_rtt_timer >= 1.0)
+	{
+		m_rtt_timer = 0;
+		try{
+			rtt.add(m_con.GetPeerAvgRTT(PEER_ID_SERVER) * 1000);
+		}
+		catch(con::PeerNotFoundException &e){
+		}
+	}
+
+	u32 now = porting::getTimeMs();
+	digs_lost += expire_pending(m_pending_digs, now);
+	places_lost += expire_pending(m_pending_places, now);
+	for(std::map<v3s16, u32>::iterator
+			i = m_waited_blocks.begin();
+			i != m_waited_blocks.end();)
+	{
+		if(now - i->second > BOT_BLOCK_TIMEOUT_MS)
+			m_waited_blocks.erase(i++);
+		else
+			++i;
+	}
+}
+
+void BotClient::receive()
+{
+	for(;;)
+	{
+		u16 sender_peer_id;
+		SharedBuffer<u8> data;
+		u32 datasize;
+		try{
+			datasize = m_con.Receive(sender_peer_id, data);
+		}
+		catch(con::NoIncomingDataException &e){
+			return;
+		}
+		catch(con::InvalidIncomingDataException &e){
+			infostream<<"BotClient("<<m_name<<")::receive(): "
+					"InvalidIncomingDataException: what()="
+					<<e.what()<<std::endl;
+			continue;
+		}
+		if(sender_peer_id != PEER_ID_SERVER)
+			continue;
+		bytes_received += datasize;
+		processData(*data, datasize);
+	}
+}
+
+void BotClient::processData(u8 *data, u32 datasize)
+{
+	if(datasize < 2)
+		return;
+
+	ToClientCommand command = (ToClientCommand)readU16(&data[0]);
+	u32 now = porting::getTimeMs();
+
+	if(command == TOCLIENT_INIT)
+	{
+		if(datasize < 2+1+6 || m_joined)
+			return;
+
+		u8 deployed = data[2];
+		if(deployed > SER_FMT_VER_HIGHEST)
+		{
+			errorstream<<"BotClient("<<m_name<<"): TOCLIENT_INIT: Server "
+					<<"sent unsupported ser_fmt_ver"<<std::endl;
+			return;
+		}
+		m_server_ser_ver = deployed;
+
+		v3s16 playerpos_s16 = readV3S16(&data[2+1]);
+		m_position = intToFloat(playerpos_s16, BS) - v3f(0, BS/2, 0);
+		m_spawn_position = m_position;
+
+		m_joined = true;
+		join_latency.add(now - m_connect_time);
+
+		SharedBuffer<u8> reply(2);
+		writeU16(&reply[0], TOSERVER_INIT2);
+		send(reply, true, 1);
+		return;
+	}
+
+	if(command == TOCLIENT_ACCESS_DENIED)
+	{
+		m_access_denied = true;
+		m_access_denied_reason = L"Unknown";
+		if(datasize >= 4)
+		{
+			std::string datastring((char*)&data[2], datasize-2);
+			std::istringstream is(datastring, std::ios_base::binary);
+			m_access_denied_reason = deSerializeWideString(is);
+		}
+		errorstream<<"BotClient("<<m_name<<"): access denied: "
+				<<wide_to_narrow(m_access_denied_reason)<<std::endl;
+		return;
+	}
+
+	if(m_server_ser_ver == SER_FMT_VER_INVALID)
+		return;
+
+	if(command == TOCLIENT_BLOCKDATA)
+	{
+		if(datasize < 8)
+			return;
+		v3s16 p = readV3S16(&data[2]);
+		blocks_received++;
+		m_received_blocks.insert(p);
+		m_gotblocks.push_back(p);
+
+		std::map<v3s16, u32>::iterator i = m_waited_blocks.find(p);
+		if(i != m_waited_blocks.end())
+		{
+			block_latency.add(now - i->second);
+			m_waited_blocks.erase(i);
+		}
+
+		// The server resends the whole block when an edit was refused
+		finish_pending_in_block(m_pending_digs, p, dig_latency, now);
+		finish_pending_in_block(m_pending_places, p, place_latency, now);
+	}
+	else if(command == TOCLIENT_ADDNODE || command == TOCLIENT_REMOVENODE)
+	{
+		if(datasize < 8)
+			return;
+		nodeChanged(readV3S16(&data[2]));
+	}
+	else if(command == TOCLIENT_MOVE_PLAYER)
+	{
+		if(datasize < 2+12)
+			return;
+		// Restart the pattern from wherever the server put us
+		m_position = readV3F1000(&data[2]);
+		m_spawn_position = m_position;
+		m_move_time = 0;
+	}
+	else if(command == TOCLIENT_ANNOUNCE_MEDIA)
+	{
+		// Bots don't need any media; tell the server we are done so
+		// that it starts sending blocks
+		SharedBuffer<u8> reply(2);
+		writeU16(&reply[0], TOSERVER_RECEIVED_MEDIA);
+		send(reply, true);
+	}
+	// Everything else is ignored
+}
+
+void BotClient::sendInit()
+{
+	SharedBuffer<u8> data(2+1+PLAYERNAME_SIZE+PASSWORD_SIZE+2+2);
+	writeU16(&data[0], TOSERVER_INIT);
+	writeU8(&data[2], SER_FMT_VER_HIGHEST);
+	memset((char*)&data[3], 0, PLAYERNAME_SIZE);
+	snprintf((char*)&data[3], PLAYERNAME_SIZE, "%s", m_name.c_str());
+	memset((char*)&data[23], 0, PASSWORD_SIZE);
+	snprintf((char*)&data[23], PASSWORD_SIZE, "%s", m_password.c_str());
+	writeU16(&data[51], CLIENT_PROTOCOL_VERSION_MIN);
+	writeU16(&data[53], CLIENT_PROTOCOL_VERSION_MAX);
+	send(data, false);
+}
+
+void BotClient::sendGotBlocks()
+{
+	/*
+		[0] u16 command
+		[2] u8 count
+		[3] v3s16 pos_0
+		[3+6] v3s16 pos_1
+		...
+	*/
+	while(!m_gotblocks.empty())
+	{
+		u32 count = MYMIN(m_gotblocks.size(), 255);
+		SharedBuffer<u8> reply(2+1+6*count);
+		writeU16(&reply[0], TOSERVER_GOTBLOCKS);
+		reply[2] = count;
+		for(u32 i = 0; i < count; i++)
+			writeV3S16(&reply[2+1+6*i], m_gotblocks[i]);
+		send(reply, true, 1);
+		m_gotblocks.erase(m_gotblocks.begin(), m_gotblocks.begin() + count);
+	}
+}
+
+void BotClient::sendPlayerPos()
+{
+	/*
+		[0] u16 command
+		[2] v3s32 position*100
+		[2+12] v3s32 speed*100
+		[2+12+12] s32 pitch*100
+		[2+12+12+4] s32 yaw*100
+		[2+12+12+4+4] u32 keyPressed
+	*/
+	v3s32 position(m_position.X*100, m_position.Y*100, m_position.Z*100);
+	v3s32 speed(m_speed.X*100, m_speed.Y*100, m_speed.Z*100);
+	SharedBuffer<u8> data(2+12+12+4+4+4);
+	writeU16(&data[0], TOSERVER_PLAYERPOS);
+	writeV3S32(&data[2], position);
+	writeV3S32(&data[2+12], speed);
+	writeS32(&data[2+12+12], 0);
+	writeS32(&data[2+12+12+4], m_yaw * 100);
+	writeU32(&data[2+12+12+4+4], m_speed == v3f(0,0,0) ? 0 : 1);
+	send(data, false);
+}
+
+void BotClient::sendInteract(u8 action, v3s16 p_under, v3s16 p_above)
+{
+	PointedThing pointed;
+	pointed.type = POINTEDTHING_NODE;
+	pointed.node_undersurface = p_under;
+	pointed.node_abovesurface = p_above;
+
+	std::ostringstream os(std::ios_base::binary);
+	writeU16(os, TOSERVER_INTERACT);
+	writeU8(os, action);
+	writeU16(os, 0);
+	std::ostringstream tmp_os(std::ios::binary);
+	pointed.serialize(tmp_os);
+	os<<serializeLongString(tmp_os.str());
+
+	std::string s = os.str();
+	SharedBuffer<u8> data((u8*)s.c_str(), s.size());
+	send(data, true);
+}
+
+void BotClient::move(float dtime)
+{
+	m_move_time += dtime;
+	v3f oldpos = m_position;
+
+	switch(m_pattern)
+	{
+	case BOTMOVE_IDLE:
+		break;
+	case BOTMOVE_CIRCLE: {
+		// A circle through the spawn point, 8...16 nodes in radius
+		f32 radius = BS * (8 + (m_yaw / 360.0) * 8);
+		f32 a0 = m_yaw * core::DEGTORAD;
+		f32 a = a0 + m_move_time * BOT_SPEED / radius;
+		v3f center = m_spawn_position - v3f(cos(a0), 0, sin(a0)) * radius;
+		m_position = center + v3f(cos(a), 0, sin(a)) * radius;
+		break; }
+	case BOTMOVE_LINE: {
+		f32 a = m_yaw * core::DEGTORAD;
+		m_position = m_spawn_position
+				+ v3f(cos(a), 0, sin(a)) * BOT_SPEED * m_move_time;
+		break; }
+	case BOTMOVE_RANDOM: {
+		// Turn to a random direction every few seconds
+		if(m_move_time > 3.0)
+		{
+			m_move_time = 0;
+			m_yaw = m_pr.range(0, 359);
+		}
+		f32 a = m_yaw * core::DEGTORAD;
+		m_position += v3f(cos(a), 0, sin(a)) * BOT_SPEED * dtime;
+		break; }
+	}
+
+	if(dtime > 0.001)
+		m_speed = (m_position - oldpos) / dtime;
+
+	v3s16 blockpos = getNodeBlockPos(floatToInt(m_position, BS));
+	if(blockpos != m_last_blockpos)
+		blockEntered(blockpos);
+}
+
+void BotClient::interact(float dtime)
+{
+	/*
+		Dig the node under the player and place it back, going through
+		the same start digging -> digging completed -> place sequence as
+		a player would. The digging time has to be long enough to get
+		past the server's cheat prevention.
+	*/
+	m_interact_timer -= dtime;
+	if(m_interact_timer > 0)
+		return;
+
+	u32 now = porting::getTimeMs();
+
+	switch(m_interact_state)
+	{
+	case 0:
+		m_interact_p = floatToInt(m_position, BS) - v3s16(0,1,0);
+		sendInteract(0, m_interact_p, m_interact_p + v3s16(0,1,0));
+		m_interact_timer = 1.5;
+		m_interact_state = 1;
+		break;
+	case 1:
+		sendInteract(2, m_interact_p, m_interact_p + v3s16(0,1,0));
+		m_pending_digs[m_interact_p] = now;
+		digs_sent++;
+		m_interact_timer = 1.0;
+		m_interact_state = 2;
+		break;
+	case 2:
+		// The dug node normally ends up in the wielded slot
+		sendInteract(3, m_interact_p - v3s16(0,1,0), m_interact_p);
+		m_pending_places[m_interact_p] = now;
+		places_sent++;
+		m_interact_timer = m_pr.range(30, 70) / 10.0;
+		m_interact_state = 0;
+		break;
+	}
+}
+
+void BotClient::blockEntered(v3s16 blockpos)
+{
+	m_last_blockpos = blockpos;
+	if(m_received_blocks.find(blockpos) != m_received_blocks.end())
+		return;
+	if(m_waited_blocks.find(blockpos) != m_waited_blocks.end())
+		return;
+	m_waited_blocks[blockpos] = porting::getTimeMs();
+}
+
+void BotClient::nodeChanged(v3s16 p)
+{
+	// A dig and a place of the same node are answered in order
+	u32 now = porting::getTimeMs();
+	if(finish_pending(m_pending_digs, p, dig_latency, now))
+		return;
+	finish_pending(m_pending_places, p, place_latency, now);
+}
+
+/*
+	Running a swarm of bots
+*/
+
+static void report_latency(std::vector<BenchmarkResult> &results,
+		const std::string &name, const LatencySamples &samples, u32 time_ms)
+{
+	const float percentiles[] = {50, 90, 99};
+	const char *suffixes[] = {"p50", "p90", "p99"};
+	for(u32 i = 0; i < 3; i++)
+	{
+		BenchmarkResult r;
+		r.name = name + "_" + suffixes[i];
+		r.iterations = samples.size();
+		r.time_ms = time_ms;
+		r.amount = samples.percentile(percentiles[i]);
+		r.unit = "ms";
+		results.push_back(r);
+	}
+}
+
+void run_bot_clients(std::vector<BenchmarkResult> &results,
+		const BotRunParams &params)
+{
+	DSTACK(__FUNCTION_NAME);
+
+	infostream<<"run_bot_clients(): "<<params.count<<" bots to "
+			<<params.address.serializeString()<<":"
+			<<params.address.getPort()<<std::endl;
+
+	std::vector<BotClient*> bots;
+	const float step = 0.05;
+	float join_timer = 0;
+	u32 start_time = porting::getTimeMs();
+	u32 last_time = start_time;
+
+	for(;;)
+	{
+		u32 time = porting::getTimeMs();
+		if(time - start_time >= params.duration * 1000)
+			break;
+		float dtime = MYMAX(time - last_time, 1) / 1000.0;
+		last_time = time;
+
+		// Connect more bots
+		join_timer += dtime * params.join_per_second;
+		while(join_timer >= 1.0 && bots.size() < params.count)
+		{
+			join_timer -= 1.0;
+			u32 i = bots.size();
+			BotClient *bot = new BotClient(
+					params.name_prefix + itos(i), params.password,
+					params.pattern, i * 7919 + 1);
+			bot->connect(params.address);
+			bots.push_back(bot);
+		}
+		if(bots.size() == params.count)
+			join_timer = 0;
+
+		if(params.server)
+			params.server->step(dtime);
+
+		for(u32 i = 0; i < bots.size(); i++)
+			bots[i]->step(dtime);
+
+		u32 busy = porting::getTimeMs() - time;
+		if(busy < step * 1000)
+			sleep_ms(step * 1000 - busy);
+	}
+
+	u32 time_ms = porting::getTimeMs() - start_time;
+
+	LatencySamples join_latency;
+	LatencySamples block_latency;
+	LatencySamples dig_latency;
+	LatencySamples place_latency;
+	LatencySamples rtt;
+	u32 joined = 0;
+	u32 denied = 0;
+	double blocks = 0;
+	double bytes = 0;
+	u32 digs_sent = 0;
+	u32 digs_lost = 0;
+	u32 places_sent = 0;
+	u32 places_lost = 0;
+	for(u32 i = 0; i < bots.size(); i++)
+	{
+		BotClient *bot = bots[i];
+		if(bot->isJoined())
+			joined++;
+		if(bot->isAccessDenied())
+			denied++;
+		join_latency.add(bot->join_latency);
+		block_latency.add(bot->block_latency);
+		dig_latency.add(bot->dig_latency);
+		place_latency.add(bot->place_latency);
+		rtt.add(bot->rtt);
+		blocks += bot->blocks_received;
+		bytes += bot->bytes_received;
+		digs_sent += bot->digs_sent;
+		digs_lost += bot->digs_lost;
+		places_sent += bot->places_sent;
+		places_lost += bot->places_lost;
+		delete bot;
+	}
+
+	infostream<<"run_bot_clients(): "<<joined<<"/"<<params.count
+			<<" bots joined, "<<denied<<" denied access"<<std::endl;
+
+	BenchmarkResult r;
+	r.name = "bots_joined";
+	r.iterations = params.count;
+	r.time_ms = time_ms;
+	r.amount = joined;
+	r.unit = "bots";
+	results.push_back(r);
+
+	r.name = "bots_blocks_received";
+	r.amount = blocks;
+	r.unit = "blocks";
+	results.push_back(r);
+
+	r.name = "bots_bytes_received";
+	r.amount = bytes;
+	r.unit = "bytes";
+	results.push_back(r);
+
+	r.name = "bots_digs_lost";
+	r.iterations = digs_sent;
+	r.amount = digs_lost;
+	r.unit = "digs";
+	results.push_back(r);
+
+	r.name = "bots_places_lost";
+	r.iterations = places_sent;
+	r.amount = places_lost;
+	r.unit = "places";
+	results.push_back(r);
+
+	report_latency(results, "bots_join_latency", join_latency, time_ms);
+	report_latency(results, "bots_block_latency", block_latency, time_ms);
+	report_latency(results, "bots_dig_latency", dig_latency, time_ms);
+	report_latency(results, "bots_place_latency", place_latency, time_ms);
+	report_latency(results, "bots_rtt", rtt, time_ms);
+}
+
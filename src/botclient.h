@@ -0,0 +1,211 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef BOTCLIENT_HEADER
+#define BOTCLIENT_HEADER
+
+#include "irrlichttypes_bloated.h"
+#include "connection.h"
+#include "benchmark.h"
+#include "noise.h" // PseudoRandom
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+
+class Server;
+
+/*
+	Synthetic clients for load testing a server.
+
+	A bot speaks the network protocol directly on top of con::Connection.
+	It has no map, no node definitions and no rendering; received blocks
+	are acknowledged and only their positions are remembered, so a single
+	process can run hundreds of them.
+*/
+
+enum BotMovePattern
+{
+	BOTMOVE_IDLE, // Stand still at the spawn point
+	BOTMOVE_CIRCLE, // Walk in a circle around the spawn point
+	BOTMOVE_LINE, // Walk straight away from the spawn point
+	BOTMOVE_RANDOM // Random walk
+};
+
+BotMovePattern bot_move_pattern_from_string(const std::string &s);
+
+/*
+	Millisecond samples of which percentiles are reported
+*/
+class LatencySamples
+{
+public:
+	void add(u32 ms)
+	{
+		m_samples.push_back(ms);
+	}
+	void add(const LatencySamples &other)
+	{
+		m_samples.insert(m_samples.end(),
+				other.m_samples.begin(), other.m_samples.end());
+	}
+	u32 size() const
+	{
+		return m_samples.size();
+	}
+	// p is in the range 0...100
+	u32 percentile(float p) const;
+
+private:
+	std::vector<u32> m_samples;
+};
+
+class BotClient
+{
+public:
+	BotClient(const std::string &name, const std::string &password,
+			BotMovePattern pattern, u32 seed);
+	~BotClient();
+
+	void connect(Address address);
+	void disconnect();
+
+	/*
+		Handles received packets, sends the position and does the
+		scripted actions. Never blocks.
+	*/
+	void step(float dtime);
+
+	const std::string & getName() const
+	{ return m_name; }
+	bool isJoined() const
+	{ return m_joined; }
+	bool isAccessDenied() const
+	{ return m_access_denied; }
+	const std::wstring & getAccessDeniedReason() const
+	{ return m_access_denied_reason; }
+
+	// Time from connect() to TOCLIENT_INIT
+	LatencySamples join_latency;
+	// Time from entering a block to receiving it
+	LatencySamples block_latency;
+	/*
+		Time from a dig or a place to the resulting node update.
+		Places are counted apart from digs: the bot places whatever the
+		server put in its wielded slot, which may be nothing, and a place
+		without an item gets no response.
+	*/
+	LatencySamples dig_latency;
+	LatencySamples place_latency;
+	// Smoothed RTT of the connection, sampled once a second
+	LatencySamples rtt;
+
+	u32 blocks_received;
+	u32 bytes_received;
+	u32 digs_sent;
+	u32 digs_lost;
+	u32 places_sent;
+	u32 places_lost;
+
+private:
+	void send(SharedBuffer<u8> data, bool reliable, u8 channel=0);
+	void receive();
+	void processData(u8 *data, u32 datasize);
+	void sendInit();
+	void sendGotBlocks();
+	void sendPlayerPos();
+	void sendInteract(u8 action, v3s16 p_under, v3s16 p_above);
+	void move(float dtime);
+	void interact(float dtime);
+	void blockEntered(v3s16 blockpos);
+	void nodeChanged(v3s16 p);
+
+	std::string m_name;
+	std::string m_password;
+	BotMovePattern m_pattern;
+	PseudoRandom m_pr;
+	con::Connection m_con;
+
+	u8 m_server_ser_ver;
+	bool m_joined;
+	bool m_access_denied;
+	std::wstring m_access_denied_reason;
+	u32 m_connect_time;
+	float m_init_timer;
+
+	v3f m_position;
+	v3f m_speed;
+	v3f m_spawn_position;
+	float m_yaw;
+	float m_move_time;
+	float m_send_timer;
+	float m_rtt_timer;
+
+	// Blocks that have been received at least once
+	std::set<v3s16> m_received_blocks;
+	// Blocks waiting to be acknowledged to the server
+	std::vector<v3s16> m_gotblocks;
+	// Blocks the player has entered but not received; value is time in ms
+	std::map<v3s16, u32> m_waited_blocks;
+	v3s16 m_last_blockpos;
+
+	// Digging and placing the node under the player
+	float m_interact_timer;
+	u32 m_interact_state;
+	v3s16 m_interact_p;
+	// Nodes edited but not yet updated by the server; value is time in ms
+	std::map<v3s16, u32> m_pending_digs;
+	std::map<v3s16, u32> m_pending_places;
+};
+
+/*
+	Connects count bots to a server and runs them for duration seconds.
+	Bots are connected gradually, join_per_second at a time.
+
+	Reports join, block arrival, dig, place and RTT percentiles and the
+	total block throughput.
+
+	If server is set, it is stepped from the same loop as the bots.
+*/
+struct BotRunParams
+{
+	Address address;
+	u32 count;
+	float duration;
+	float join_per_second;
+	BotMovePattern pattern;
+	std::string name_prefix;
+	std::string password;
+	Server *server;
+
+	BotRunParams():
+		count(10),
+		duration(60),
+		join_per_second(10),
+		pattern(BOTMOVE_CIRCLE),
+		name_prefix("bot"),
+		server(NULL)
+	{}
+};
+
+void run_bot_clients(std::vector<BenchmarkResult> &results,
+		const BotRunParams &params);
+
+#endif
+
@@ -588,7 +588,8 @@ void Client::step(float dtime)
 		std::list<v3s16> deleted_blocks;
 		m_env.getMap().timerUpdate(map_timer_and_unload_dtime,
 				g_settings->getFloat("client_unload_unused_data_timeout"),
-				&deleted_blocks);
+				g_settings->getFloat("client_pack_unused_data_timeout"),
+				0, &deleted_blocks);
 				
 		/*if(deleted_blocks.size() > 0)
 			infostream<<"Client: Unloaded "<<deleted_blocks.size()
@@ -2611,6 +2612,7 @@ void Client::addUpdateMeshTask(v3s16 p, bool ack_to_server, bool urgent)
 		data->fill(b);
 		data->setCrack(m_crack_level, m_crack_pos);
 		data->setSmoothLighting(g_settings->getBool("smooth_lighting"));
+		data->setDayNightRatio(m_env.getDayNightRatio());
 	}
 
 	// Debug wait
@@ -471,6 +471,9 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 	// For limiting number of mesh animations per frame
 	u32 mesh_animate_count = 0;
 	u32 mesh_animate_count_far = 0;
+
+	// Meshes whose day/night colors are outdated, with their distances
+	std::vector<std::pair<float, MapBlockMesh*> > daynight_meshes;
 	
 	// Blocks that were drawn and had a mesh
 	u32 blocks_drawn = 0;
@@ -521,8 +524,7 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 				bool animated = mapBlockMesh->animate(
 						faraway,
 						animation_time,
-						crack,
-						daynight_ratio);
+						crack);
 				if(animated)
 					mesh_animate_count++;
 				if(animated && faraway)
@@ -532,6 +534,11 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 			{
 				mapBlockMesh->decreaseAnimationForceTimer();
 			}
+			// Day/night transitions are done below, nearest first
+			if(pass == scene::ESNRP_SOLID &&
+					mapBlockMesh->needsDayNightUpdate(daynight_ratio))
+				daynight_meshes.push_back(
+						std::make_pair(d, mapBlockMesh));
 		}
 
 		/*
@@ -570,6 +577,28 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 		}
 	}
 	
+	/*
+		Update day/night colors of a bounded number of meshes per frame,
+		starting from the nearest ones. The rest are updated on the
+		following frames.
+	*/
+	if(!daynight_meshes.empty())
+	{
+		ScopeProfiler sp(g_profiler, prefix+"day/night updates", SPT_AVG);
+		u32 daynight_update_limit = m_control.range_all ? 200 : 50;
+		if(daynight_meshes.size() > daynight_update_limit)
+		{
+			std::partial_sort(daynight_meshes.begin(),
+					daynight_meshes.begin() + daynight_update_limit,
+					daynight_meshes.end());
+			daynight_meshes.resize(daynight_update_limit);
+		}
+		for(u32 i = 0; i < daynight_meshes.size(); i++)
+			daynight_meshes[i].second->updateDayNight(daynight_ratio);
+		g_profiler->avg("CM: day/night updated meshes",
+				daynight_meshes.size());
+	}
+
 	std::list<MeshBufList> &lists = drawbufs.lists;
 	
 	int timecheck_counter = 0;
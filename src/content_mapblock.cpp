@@ -962,10 +962,12 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 			tile_nocrack.material_flags &= ~MATERIAL_FLAG_CRACK;
 			
 			// A hack to put wood the right way around in the posts
-			ITextureSource *tsrc = data->m_gamedef->tsrc();
 			TileSpec tile_rot = tile;
-			tile_rot.texture = tsrc->getTexture(tsrc->getTextureName(
-					tile.texture.id) + "^[transformR90");
+			if(tile.variants != NULL && tile.variants->rotated90 != NULL)
+			{
+				tile_rot.variants = tile.variants->rotated90;
+				tile_rot.texture = tile_rot.variants->single;
+			}
 					
 			u16 l = getInteriorLight(n, 1, data);
 			video::SColor c = MapBlock_LightColor(255, l, decode_light(f.light_source));
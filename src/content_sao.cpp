@@ -389,7 +389,7 @@ LuaEntitySAO::~LuaEntitySAO()
 {
 	if(m_registered){
 		lua_State *L = m_env->getLua();
-		scriptapi_luaentity_rm(L, m_id);
+		scriptapi_luaentity_rm(L, m_id, &m_lua_refs);
 	}
 }
 
@@ -399,15 +399,17 @@ void LuaEntitySAO::addedToEnvironment(u32 dtime_s)
 	
 	// Create entity from name
 	lua_State *L = m_env->getLua();
-	m_registered = scriptapi_luaentity_add(L, m_id, m_init_name.c_str());
+	m_registered = scriptapi_luaentity_add(L, m_id, m_init_name.c_str(),
+			&m_lua_refs);
 	
 	if(m_registered){
 		// Get properties
-		scriptapi_luaentity_get_properties(L, m_id, &m_prop);
+		scriptapi_luaentity_get_properties(L, &m_lua_refs, &m_prop);
 		// Initialize HP from properties
 		m_hp = m_prop.hp_max;
 		// Activate entity, supplying serialized state
-		scriptapi_luaentity_activate(L, m_id, m_init_state.c_str(), dtime_s);
+		scriptapi_luaentity_activate(L, &m_lua_refs, m_init_state,
+				dtime_s);
 	}
 }
 
@@ -517,7 +519,7 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 
 	if(m_registered){
 		lua_State *L = m_env->getLua();
-		scriptapi_luaentity_step(L, m_id, dtime);
+		scriptapi_luaentity_step(L, &m_lua_refs, dtime);
 	}
 
 	if(send_recommended == false)
@@ -628,7 +630,8 @@ std::string LuaEntitySAO::getStaticData()
 	// state
 	if(m_registered){
 		lua_State *L = m_env->getLua();
-		std::string state = scriptapi_luaentity_get_staticdata(L, m_id);
+		std::string state = scriptapi_luaentity_get_staticdata(L,
+				&m_lua_refs);
 		os<<serializeLongString(state);
 	} else {
 		os<<serializeLongString(m_init_state);
@@ -690,7 +693,7 @@ int LuaEntitySAO::punch(v3f dir,
 	}
 
 	lua_State *L = m_env->getLua();
-	scriptapi_luaentity_punch(L, m_id, puncher,
+	scriptapi_luaentity_punch(L, &m_lua_refs, puncher,
 			time_from_last_punch, toolcap, dir);
 
 	return result.wear;
@@ -704,7 +707,7 @@ void LuaEntitySAO::rightClick(ServerActiveObject *clicker)
 	if(isAttached())
 		return;
 	lua_State *L = m_env->getLua();
-	scriptapi_luaentity_rightclick(L, m_id, clicker);
+	scriptapi_luaentity_rightclick(L, &m_lua_refs, clicker);
 }
 
 void LuaEntitySAO::setPos(v3f pos)
@@ -29,6 +29,45 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 ServerActiveObject* createItemSAO(ServerEnvironment *env, v3f pos,
 		const std::string itemstring);
 
+// The callbacks of a LuaEntitySAO that LuaEntityRefs keeps
+enum LuaEntityCallback
+{
+	LUAENTITY_ON_STEP,
+	LUAENTITY_ON_PUNCH,
+	LUAENTITY_ON_RIGHTCLICK,
+	LUAENTITY_CALLBACK_COUNT
+};
+
+/*
+	Lua registry reference to the table of a LuaEntitySAO, so that calling
+	its callbacks doesn't need a lookup in minetest.luaentities.
+	Managed by scriptapi_entity.cpp. 0 = none.
+*/
+struct LuaEntityRefs
+{
+	int object;
+	// Callback profiler slot of on_step
+	u32 step_profile_slot;
+	/*
+		Registry references to the callbacks (-1 = LUA_REFNIL = none),
+		valid while callback_version is the current one (0 = never)
+	*/
+	int callbacks[LUAENTITY_CALLBACK_COUNT];
+	u32 callback_version;
+	// The callbacks can change unnoticed and are looked up on every call
+	bool lookup_callbacks;
+
+	LuaEntityRefs():
+		object(0),
+		step_profile_slot(0),
+		callback_version(0),
+		lookup_callbacks(false)
+	{
+		for(u32 i = 0; i < LUAENTITY_CALLBACK_COUNT; i++)
+			callbacks[i] = -1;
+	}
+};
+
 /*
 	LuaEntitySAO needs some internals exposed.
 */
@@ -86,6 +125,7 @@ class LuaEntitySAO : public ServerActiveObject
 	std::string m_init_name;
 	std::string m_init_state;
 	bool m_registered;
+	LuaEntityRefs m_lua_refs;
 	struct ObjectProperties m_prop;
 	
 	s16 m_hp;
@@ -88,6 +88,7 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("address", "");
 	settings->setDefault("random_input", "false");
 	settings->setDefault("client_unload_unused_data_timeout", "600");
+	settings->setDefault("client_pack_unused_data_timeout", "60");
 	settings->setDefault("enable_fog", "true");
 	settings->setDefault("fov", "72");
 	settings->setDefault("view_bobbing", "true");
@@ -95,6 +96,7 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("new_style_leaves", "true");
 	settings->setDefault("smooth_lighting", "true");
 	settings->setDefault("enable_texture_atlas", "false");
+	settings->setDefault("texture_generation_threads", "");
 	settings->setDefault("texture_path", "");
 	settings->setDefault("shader_path", "");
 	settings->setDefault("video_driver", "opengl");
@@ -164,6 +166,7 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("enable_rollback_recording", "false");
 
 	settings->setDefault("profiler_print_interval", "0");
+	settings->setDefault("callback_profiling", "false");
 	settings->setDefault("enable_mapgen_debug_info", "false");
 	settings->setDefault("active_object_send_range_blocks", "3");
 	settings->setDefault("active_block_range", "2");
@@ -176,6 +179,9 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("time_send_interval", "5");
 	settings->setDefault("time_speed", "72");
 	settings->setDefault("server_unload_unused_data_timeout", "29");
+	settings->setDefault("server_pack_unused_data_timeout", "10");
+	settings->setDefault("server_unload_max_blocks", "4000");
+	settings->setDefault("map_save_threads", "");
 	settings->setDefault("server_map_save_interval", "5.3");
 	settings->setDefault("full_block_send_enable_min_time_from_building", "2.0");
 	settings->setDefault("dedicated_server_step", "0.1");
@@ -209,6 +215,8 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("liquid_update", "1.0");
 	settings->setDefault("liquid_relax", "2");
 	settings->setDefault("liquid_fast_flood", "1");
+	settings->setDefault("liquid_step_budget", "50");
+	settings->setDefault("liquid_threads", "");
 	settings->setDefault("underground_springs", "1");
 
 	//mapgen stuff
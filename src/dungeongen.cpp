@@ -326,36 +326,17 @@ void DungeonGen::makeRoom(v3s16 roomsize, v3s16 roomplace)
 	}
 
 	// Fill with air
-	for (s16 z = 1; z < roomsize.Z - 1; z++)
-	for (s16 y = 1; y < roomsize.Y - 1; y++)
-	for (s16 x = 1; x < roomsize.X - 1; x++)
-	{
-		v3s16 p = roomplace + v3s16(x, y, z);
-		if (vmanip->m_area.contains(p) == false)
-			continue;
-		u32 vi = vmanip->m_area.index(p);
-		vmanip->m_flags[vi] |= VMANIP_FLAG_DUNGEON_UNTOUCHABLE;
-		vmanip->m_data[vi]   = n_air;
-	}
+	vmanip->setNodes(VoxelArea(roomplace + v3s16(1, 1, 1),
+			roomplace + roomsize - v3s16(2, 2, 2)),
+			n_air, 0, VMANIP_FLAG_DUNGEON_UNTOUCHABLE);
 }
 
 
 void DungeonGen::makeFill(v3s16 place, v3s16 size,
 		u8 avoid_flags, MapNode n, u8 or_flags)
 {
-	for (s16 z = 0; z < size.Z; z++)
-	for (s16 y = 0; y < size.Y; y++)
-	for (s16 x = 0; x < size.X; x++)
-	{
-		v3s16 p = place + v3s16(x, y, z);
-		if (vmanip->m_area.contains(p) == false)
-			continue;
-		u32 vi = vmanip->m_area.index(p);
-		if (vmanip->m_flags[vi] & avoid_flags)
-			continue;
-		vmanip->m_flags[vi] |= or_flags;
-		vmanip->m_data[vi]   = n;
-	}
+	vmanip->setNodes(VoxelArea(place, place + size - v3s16(1, 1, 1)),
+			n, avoid_flags, or_flags);
 }
 
 
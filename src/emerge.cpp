@@ -41,6 +41,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapgen_v6.h"
 #include "mapgen_indev.h"
 #include "mapgen_singlenode.h"
+#include "heightmapcache.h"
+#include "noisemapcache.h"
 
 
 /////////////////////////////// Emerge Manager ////////////////////////////////
@@ -51,8 +53,11 @@ EmergeManager::EmergeManager(IGameDef *gamedef, BiomeDefManager *bdef) {
 	registerMapgen("indev", new MapgenFactoryIndev());
 	registerMapgen("singlenode", new MapgenFactorySinglenode());
 
+	this->ndef     = gamedef->getNodeDefManager();
 	this->biomedef = bdef ? bdef : new BiomeDefManager(gamedef);
 	this->params   = NULL;
+	this->heightmap = NULL;
+	this->noisemaps = new NoiseMapCache(NOISE_MAP_CACHE_VALUES);
 	
 	mapgen_debug_info = g_settings->getBool("enable_mapgen_debug_info");
 
@@ -85,6 +90,9 @@ EmergeManager::EmergeManager(IGameDef *gamedef, BiomeDefManager *bdef) {
 
 
 EmergeManager::~EmergeManager() {
+	// The heightmap source uses mapgen[0]
+	delete heightmap;
+
 	for (unsigned int i = 0; i != emergethread.size(); i++) {
 		emergethread[i]->setRun(false);
 		emergethread[i]->qevent.signal();
@@ -93,6 +101,10 @@ EmergeManager::~EmergeManager() {
 		delete mapgen[i];
 	}
 	
+	for (unsigned int i = 0; i != decorations.size(); i++)
+		delete decorations[i];
+	
+	delete noisemaps;
 	delete biomedef;
 	delete params;
 }
@@ -104,6 +116,12 @@ void EmergeManager::initMapgens(MapgenParams *mgparams) {
 	if (mapgen.size())
 		return;
 	
+	// The mapgens share the ores and decorations and must not change them
+	for (unsigned int i = 0; i != ores.size(); i++)
+		ores[i]->resolveNodeNames(ndef);
+	for (unsigned int i = 0; i != decorations.size(); i++)
+		decorations[i]->resolveNodeNames(ndef);
+	
 	this->params = mgparams;
 	for (unsigned int i = 0; i != emergethread.size(); i++) {
 		mg = createMapgen(params->mg_name, 0, params);
@@ -115,6 +133,9 @@ void EmergeManager::initMapgens(MapgenParams *mgparams) {
 		}
 		mapgen.push_back(mg);
 	}
+
+	heightmap = new HeightmapCache(mapgen[0]->createHeightmapSource(),
+		HEIGHTMAP_CACHE_TILES);
 }
 
 
@@ -150,6 +171,7 @@ bool EmergeManager::enqueueBlockEmerge(u16 peer_id, v3s16 p, bool allow_generate
 		bedata = new BlockEmergeData;
 		bedata->flags = flags;
 		bedata->peer_requested = peer_id;
+		bedata->time_enqueued = porting::getTimeMs();
 		blocks_enqueued.insert(std::make_pair(p, bedata));
 		
 		peer_queue_count[peer_id] = count + 1;
@@ -179,21 +201,21 @@ int EmergeManager::getGroundLevelAtPoint(v2s16 p) {
 		return 0;
 	}
 	
-	return mapgen[0]->getGroundLevelAtPoint(p);
+	return heightmap->getGroundLevel(p);
 }
 
 
 bool EmergeManager::isBlockUnderground(v3s16 blockpos) {
-	/*
-	v2s16 p = v2s16((blockpos.X * MAP_BLOCKSIZE) + MAP_BLOCKSIZE / 2,
-					(blockpos.Y * MAP_BLOCKSIZE) + MAP_BLOCKSIZE / 2);
-	int ground_level = getGroundLevelAtPoint(p);
-	return blockpos.Y * (MAP_BLOCKSIZE + 1) <= min(water_level, ground_level);
-	*/
-
-	//yuck, but then again, should i bother being accurate?
-	//the height of the nodes in a single block is quite variable
-	return blockpos.Y * (MAP_BLOCKSIZE + 1) <= params->water_level;
+	if (!heightmap)
+		return blockpos.Y * (MAP_BLOCKSIZE + 1) <= params->water_level;
+
+	// The height of the nodes in a single block is quite variable,
+	// so go by the lowest ground of the sector
+	s16 ground_min, ground_max;
+	heightmap->getGroundLevelRange(v2s16(blockpos.X, blockpos.Z),
+		ground_min, ground_max);
+	return blockpos.Y * (MAP_BLOCKSIZE + 1) <=
+		MYMIN(params->water_level, ground_min);
 }
 
 
@@ -269,9 +291,131 @@ void EmergeManager::registerMapgen(std::string mgname, MapgenFactory *mgfactory)
 }
 
 
+///////////////////////////// Chunk Scheduler /////////////////////////////////
+
+ChunkScheduler::ChunkScheduler() {
+	m_mutex.Init();
+}
+
+
+bool ChunkScheduler::Area::conflicts(const Area &other) const {
+	return min.X - 1 <= other.max.X + 1 && other.min.X - 1 <= max.X + 1 &&
+		   min.Y - 1 <= other.max.Y + 1 && other.min.Y - 1 <= max.Y + 1 &&
+		   min.Z - 1 <= other.max.Z + 1 && other.min.Z - 1 <= max.Z + 1;
+}
+
+
+bool ChunkScheduler::isFree(const Area &chunk) {
+	for (unsigned int i = 0; i != m_generating.size(); i++) {
+		if (m_generating[i].conflicts(chunk))
+			return false;
+	}
+	return true;
+}
+
+
+bool ChunkScheduler::tryStart(v3s16 blockpos_min, v3s16 blockpos_max) {
+	JMutexAutoLock lock(m_mutex);
+	Area chunk;
+	chunk.min = blockpos_min;
+	chunk.max = blockpos_max;
+	if (!isFree(chunk))
+		return false;
+	m_generating.push_back(chunk);
+	return true;
+}
+
+
+void ChunkScheduler::finish(v3s16 blockpos_min) {
+	JMutexAutoLock lock(m_mutex);
+	for (unsigned int i = 0; i != m_generating.size(); i++) {
+		if (m_generating[i].min == blockpos_min) {
+			m_generating.erase(m_generating.begin() + i);
+			return;
+		}
+	}
+}
+
+
+void ChunkScheduler::defer(v3s16 p, u8 flags, u32 time_enqueued,
+		v3s16 blockpos_min, v3s16 blockpos_max) {
+	JMutexAutoLock lock(m_mutex);
+	DeferredBlock d;
+	d.p = p;
+	d.flags = flags;
+	d.time_enqueued = time_enqueued;
+	d.chunk.min = blockpos_min;
+	d.chunk.max = blockpos_max;
+	m_deferred.push_back(d);
+}
+
+
+bool ChunkScheduler::popDeferred(v3s16 *p, u8 *flags, u32 *time_enqueued) {
+	JMutexAutoLock lock(m_mutex);
+	for (std::list<DeferredBlock>::iterator i = m_deferred.begin();
+			i != m_deferred.end(); ++i) {
+		if (!isFree(i->chunk))
+			continue;
+		*p = i->p;
+		*flags = i->flags;
+		*time_enqueued = i->time_enqueued;
+		m_deferred.erase(i);
+		return true;
+	}
+	return false;
+}
+
+
+u32 ChunkScheduler::getDeferredCount() {
+	JMutexAutoLock lock(m_mutex);
+	return m_deferred.size();
+}
+
+
+ChunkGuard::ChunkGuard(EmergeManager *emerge):
+	m_emerge(emerge),
+	m_started(false)
+{
+}
+
+
+ChunkGuard::~ChunkGuard() {
+	finish();
+}
+
+
+bool ChunkGuard::tryStart(v3s16 blockpos_min, v3s16 blockpos_max) {
+	m_started = m_emerge->chunks.tryStart(blockpos_min, blockpos_max);
+	m_blockpos_min = blockpos_min;
+	return m_started;
+}
+
+
+void ChunkGuard::finish() {
+	if (!m_started)
+		return;
+	m_started = false;
+	m_emerge->chunks.finish(m_blockpos_min);
+
+	// Wake up the threads for blocks that waited for this chunk
+	if (m_emerge->chunks.getDeferredCount() > 0) {
+		for (unsigned int i = 0; i != m_emerge->emergethread.size(); i++)
+			m_emerge->emergethread[i]->qevent.signal();
+	}
+}
+
+
 ////////////////////////////// Emerge Thread ////////////////////////////////// 
 
-bool EmergeThread::popBlockEmerge(v3s16 *pos, u8 *flags) {
+/*
+	Blocks stay in blocks_enqueued, so that they are not queued again,
+	until removeBlockEmerge() is called once they are not deferred
+*/
+bool EmergeThread::popBlockEmerge(v3s16 *pos, u8 *flags, u32 *time_enqueued) {
+	// Blocks waiting for a neighbouring chunk come first
+	if (emerge->chunks.popDeferred(pos, flags, time_enqueued))
+		return true;
+
 	std::map<v3s16, BlockEmergeData *>::iterator iter;
 	JMutexAutoLock queuelock(emerge->queuemutex);
 
@@ -288,18 +432,32 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, u8 *flags) {
 
 	BlockEmergeData *bedata = iter->second;
 	*flags = bedata->flags;
+	*time_enqueued = bedata->time_enqueued;
 	
+	return true;
+}
+
+
+void EmergeThread::removeBlockEmerge(v3s16 p) {
+	JMutexAutoLock queuelock(emerge->queuemutex);
+
+	std::map<v3s16, BlockEmergeData *>::iterator iter;
+	iter = emerge->blocks_enqueued.find(p);
+	if (iter == emerge->blocks_enqueued.end())
+		return;
+
+	BlockEmergeData *bedata = iter->second;
 	emerge->peer_queue_count[bedata->peer_requested]--;
 
 	delete bedata;
 	emerge->blocks_enqueued.erase(iter);
-	
-	return true;
 }
 
 
-bool EmergeThread::getBlockOrStartGen(v3s16 p, MapBlock **b, 
-									BlockMakeData *data, bool allow_gen) {
+bool EmergeThread::getBlockOrStartGen(v3s16 p, u8 flags, u32 time_enqueued,
+						MapBlock **b, BlockMakeData *data,
+						ChunkGuard *chunk, bool *deferred) {
+	bool allow_gen = flags & BLOCK_EMERGE_ALLOWGEN;
 	v2s16 p2d(p.X, p.Z);
 	//envlock: usually takes <=1ms, sometimes 90ms or ~400ms to acquire
 	JMutexAutoLock envlock(m_server->m_env_mutex); 
@@ -318,9 +476,27 @@ bool EmergeThread::getBlockOrStartGen(v3s16 p, MapBlock **b,
 	// If could not load and allowed to generate,
 	// start generation inside this same envlock
 	if (allow_gen && (block == NULL || !block->isGenerated())) {
+		v3s16 blockpos_min, blockpos_max;
+		map->getChunkBlockRange(p, blockpos_min, blockpos_max);
+
+		// Let another thread finish what touches the chunk first
+		if (!chunk->tryStart(blockpos_min, blockpos_max)) {
+			EMERGE_DBG_OUT("deferred, chunk in use");
+			g_profiler->add("EmergeThread: blocks deferred", 1);
+			emerge->chunks.defer(p, flags, time_enqueued,
+				blockpos_min, blockpos_max);
+			*b = NULL;
+			*deferred = true;
+			return false;
+		}
+
 		EMERGE_DBG_OUT("generating");
 		*b = block;
-		return map->initBlockMake(data, p);
+		if (!map->initBlockMake(data, p)) {
+			chunk->finish();
+			return false;
+		}
+		return true;
 	}
 	
 	*b = block;
@@ -337,6 +513,7 @@ void *EmergeThread::Thread() {
 	v3s16 last_tried_pos(-32768,-32768,-32768); // For error output
 	v3s16 p;
 	u8 flags;
+	u32 time_enqueued;
 	
 	map    = (ServerMap *)&(m_server->m_env->getMap());
 	emerge = m_server->m_emerge;
@@ -345,17 +522,21 @@ void *EmergeThread::Thread() {
 	
 	while (getRun())
 	try {
-		if (!popBlockEmerge(&p, &flags)) {
+		if (!popBlockEmerge(&p, &flags, &time_enqueued)) {
 			qevent.wait();
 			continue;
 		}
 
 		last_tried_pos = p;
-		if (blockpos_over_limit(p))
+		if (blockpos_over_limit(p)) {
+			removeBlockEmerge(p);
 			continue;
+		}
 
 		bool allow_generate = flags & BLOCK_EMERGE_ALLOWGEN;
 		EMERGE_DBG_OUT("p=" PP(p) " allow_generate=" << allow_generate);
+		g_profiler->avg("EmergeThread: queue wait time (ms)",
+			porting::getTimeMs() - time_enqueued);
 		
 		/*
 			Try to fetch block from memory or disk.
@@ -364,8 +545,17 @@ void *EmergeThread::Thread() {
 		BlockMakeData data;
 		MapBlock *block = NULL;
 		std::map<v3s16, MapBlock *> modified_blocks;
-		
-		if (getBlockOrStartGen(p, &block, &data, allow_generate)) {
+		ChunkGuard chunk(emerge);
+		bool deferred = false;
+
+		bool generate = getBlockOrStartGen(p, flags, time_enqueued,
+			&block, &data, &chunk, &deferred);
+		if (deferred)
+			continue;
+		// The block can be requested again from here on
+		removeBlockEmerge(p);
+
+		if (generate) {
 			{
 				ScopeProfiler sp(g_profiler, "EmergeThread: Mapgen::makeChunk", SPT_AVG);
 				TimeTaker t("mapgen::make_block()");
@@ -407,6 +597,9 @@ void *EmergeThread::Thread() {
 					
 					m_server->m_env->activateBlock(block, 0);
 				}
+
+				// The blocks around the chunk are not written anymore
+				chunk.finish();
 			}
 		}
 
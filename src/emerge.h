@@ -3,6 +3,7 @@
 
 #include <map>
 #include <queue>
+#include <list>
 #include "util/thread.h"
 
 #define BLOCK_EMERGE_ALLOWGEN (1<<0)
@@ -18,6 +19,8 @@ class Biome;
 class BiomeDefManager;
 class EmergeThread;
 class ManualMapVoxelManipulator;
+class HeightmapCache;
+class NoiseMapCache;
 
 #include "server.h"
 
@@ -42,6 +45,75 @@ struct BlockMakeData {
 struct BlockEmergeData {
 	u16 peer_requested;
 	u8 flags;
+	u32 time_enqueued;
+};
+
+/*
+	Keeps track of the chunks being generated by the emerge threads.
+
+	Generating a chunk reads and writes its blocks and a border of one
+	block around them, so chunks whose bordered areas overlap (the
+	neighbouring ones, also diagonally) must not be generated at the same
+	time, and neither must one chunk twice. A thread that needs such a
+	chunk defers its block here and goes on with other blocks; deferred
+	blocks are taken again once nothing conflicting is being generated.
+*/
+class ChunkScheduler {
+public:
+	ChunkScheduler();
+
+	// Marks the chunk from blockpos_min to blockpos_max as being
+	// generated; false if it conflicts with one being generated
+	bool tryStart(v3s16 blockpos_min, v3s16 blockpos_max);
+	void finish(v3s16 blockpos_min);
+
+	void defer(v3s16 p, u8 flags, u32 time_enqueued,
+			v3s16 blockpos_min, v3s16 blockpos_max);
+	// Takes a deferred block whose chunk can be started now
+	bool popDeferred(v3s16 *p, u8 *flags, u32 *time_enqueued);
+	u32 getDeferredCount();
+
+private:
+	struct Area {
+		v3s16 min;
+		v3s16 max;
+
+		// Whether the areas including the borders overlap
+		bool conflicts(const Area &other) const;
+	};
+
+	struct DeferredBlock {
+		v3s16 p;
+		u8 flags;
+		u32 time_enqueued;
+		Area chunk;
+	};
+
+	bool isFree(const Area &chunk);
+
+	JMutex m_mutex;
+	std::vector<Area> m_generating;
+	std::list<DeferredBlock> m_deferred;
+};
+
+/*
+	Holds a chunk started in the ChunkScheduler of an EmergeManager, so
+	that it is also finished when generating it throws
+*/
+class ChunkGuard {
+public:
+	ChunkGuard(EmergeManager *emerge);
+	~ChunkGuard();
+
+	bool tryStart(v3s16 blockpos_min, v3s16 blockpos_max);
+	// Finishes the chunk, if any, and wakes up the emerge threads
+	// for the blocks that were deferred
+	void finish();
+
+private:
+	EmergeManager *m_emerge;
+	bool m_started;
+	v3s16 m_blockpos_min;
 };
 
 class EmergeManager {
@@ -64,8 +136,15 @@ class EmergeManager {
 	std::map<u16, u16> peer_queue_count;
 
 	//Mapgen-related structures
+	INodeDefManager *ndef;
 	BiomeDefManager *biomedef;
 	std::vector<Ore *> ores;
+	std::vector<Decoration *> decorations;
+	ChunkScheduler chunks;
+	// Ground levels of the mapgen, for queries outside of generation
+	HeightmapCache *heightmap;
+	// 2D noise of the mapgens, shared by the chunks of a column
+	NoiseMapCache *noisemaps;
 
 	EmergeManager(IGameDef *gamedef, BiomeDefManager *bdef);
 	~EmergeManager();
@@ -121,9 +200,11 @@ class EmergeThread : public SimpleThread
 		}
 	}
 
-	bool popBlockEmerge(v3s16 *pos, u8 *flags);
-	bool getBlockOrStartGen(v3s16 p, MapBlock **b, 
-							BlockMakeData *data, bool allow_generate);
+	bool popBlockEmerge(v3s16 *pos, u8 *flags, u32 *time_enqueued);
+	void removeBlockEmerge(v3s16 p);
+	bool getBlockOrStartGen(v3s16 p, u8 flags, u32 time_enqueued,
+							MapBlock **b, BlockMakeData *data,
+							ChunkGuard *chunk, bool *deferred);
 };
 
 #endif
@@ -794,11 +794,11 @@ void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 	activateObjects(block, dtime_s);
 
 	// Run node timers
-	std::map<v3s16, NodeTimer> elapsed_timers =
-		block->m_node_timers.step((float)dtime_s);
+	std::vector<std::pair<v3s16, NodeTimer> > elapsed_timers;
+	block->m_node_timers.step((float)dtime_s, elapsed_timers);
 	if(!elapsed_timers.empty()){
 		MapNode n;
-		for(std::map<v3s16, NodeTimer>::iterator
+		for(std::vector<std::pair<v3s16, NodeTimer> >::iterator
 				i = elapsed_timers.begin();
 				i != elapsed_timers.end(); i++){
 			n = block->getNodeNoEx(i->first);
@@ -1106,6 +1106,9 @@ void ServerEnvironment::step(float dtime)
 		
 		float dtime = 1.0;
 
+		// Reused for all blocks
+		std::vector<std::pair<v3s16, NodeTimer> > elapsed_timers;
+
 		for(std::set<v3s16>::iterator
 				i = m_active_blocks.m_list.begin();
 				i != m_active_blocks.m_list.end(); ++i)
@@ -1131,11 +1134,10 @@ void ServerEnvironment::step(float dtime)
 						"Timestamp older than 60s (step)");
 
 			// Run node timers
-			std::map<v3s16, NodeTimer> elapsed_timers =
-				block->m_node_timers.step((float)dtime);
+			block->m_node_timers.step((float)dtime, elapsed_timers);
 			if(!elapsed_timers.empty()){
 				MapNode n;
-				for(std::map<v3s16, NodeTimer>::iterator
+				for(std::vector<std::pair<v3s16, NodeTimer> >::iterator
 						i = elapsed_timers.begin();
 						i != elapsed_timers.end(); i++){
 					n = block->getNodeNoEx(i->first);
@@ -0,0 +1,137 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "heightmapcache.h"
+#include "mapblock.h" // For getNodeSectorPos
+#include <jmutexautolock.h>
+
+HeightmapCache::HeightmapCache(HeightmapSource *source, u32 max_tiles):
+	m_source(source),
+	m_max_tiles(max_tiles > 0 ? max_tiles : 1)
+{
+	m_source_mutex.Init();
+}
+
+HeightmapCache::~HeightmapCache()
+{
+	clear();
+	delete m_source;
+}
+
+s16 HeightmapCache::getGroundLevel(v2s16 p)
+{
+	v2s16 sectorpos = getNodeSectorPos(p);
+	const Tile *tile = lockTile(sectorpos);
+	s16 level = tile->heights[getIndex(p, sectorpos)];
+	m_lock.readUnlock();
+	return level;
+}
+
+void HeightmapCache::getGroundLevelRange(v2s16 sectorpos, s16 &min, s16 &max)
+{
+	const Tile *tile = lockTile(sectorpos);
+	min = tile->min_height;
+	max = tile->max_height;
+	m_lock.readUnlock();
+}
+
+u32 HeightmapCache::getTileCount()
+{
+	m_lock.readLock();
+	u32 count = m_tiles.size();
+	m_lock.readUnlock();
+	return count;
+}
+
+void HeightmapCache::clear()
+{
+	m_lock.writeLock();
+	for(std::map<v2s16, Tile*>::iterator i = m_tiles.begin();
+			i != m_tiles.end(); ++i)
+		delete i->second;
+	m_tiles.clear();
+	m_clock.clear();
+	m_lock.writeUnlock();
+}
+
+const HeightmapCache::Tile * HeightmapCache::lockTile(v2s16 sectorpos)
+{
+	for(;;)
+	{
+		m_lock.readLock();
+		std::map<v2s16, Tile*>::iterator i = m_tiles.find(sectorpos);
+		if(i != m_tiles.end())
+		{
+			i->second->used = true;
+			return i->second;
+		}
+		m_lock.readUnlock();
+
+		// Another thread may drop it again before it is looked up
+		addTile(sectorpos);
+	}
+}
+
+void HeightmapCache::addTile(v2s16 sectorpos)
+{
+	Tile *tile = new Tile;
+	{
+		JMutexAutoLock lock(m_source_mutex);
+		m_source->getTile(sectorpos * MAP_BLOCKSIZE, MAP_BLOCKSIZE,
+				tile->heights);
+	}
+	tile->min_height = tile->heights[0];
+	tile->max_height = tile->heights[0];
+	for(u16 j = 1; j < HEIGHTMAP_TILE_NODES; j++)
+	{
+		if(tile->heights[j] < tile->min_height)
+			tile->min_height = tile->heights[j];
+		if(tile->heights[j] > tile->max_height)
+			tile->max_height = tile->heights[j];
+	}
+	tile->used = false;
+
+	m_lock.writeLock();
+	// Another thread may have added it in the meantime
+	if(m_tiles.find(sectorpos) != m_tiles.end())
+	{
+		m_lock.writeUnlock();
+		delete tile;
+		return;
+	}
+
+	while(m_tiles.size() >= m_max_tiles)
+	{
+		v2s16 p = m_clock.front();
+		m_clock.pop_front();
+		std::map<v2s16, Tile*>::iterator i = m_tiles.find(p);
+		if(i->second->used)
+		{
+			// Gets another round
+			i->second->used = false;
+			m_clock.push_back(p);
+			continue;
+		}
+		delete i->second;
+		m_tiles.erase(i);
+	}
+	m_clock.push_back(sectorpos);
+	m_tiles[sectorpos] = tile;
+	m_lock.writeUnlock();
+}
@@ -0,0 +1,114 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef HEIGHTMAPCACHE_HEADER
+#define HEIGHTMAPCACHE_HEADER
+
+#include "irrlichttypes.h"
+#include "irr_v2d.h"
+#include "constants.h"
+#include "util/thread.h"
+#include <list>
+#include <map>
+
+// Default number of sectors whose heightmap is kept
+#define HEIGHTMAP_CACHE_TILES 4096
+
+#define HEIGHTMAP_TILE_NODES (MAP_BLOCKSIZE * MAP_BLOCKSIZE)
+
+/*
+	Computes the ground level of square areas of the world from the
+	noise of a mapgen, without generating anything.
+	Only used by one thread at a time.
+*/
+class HeightmapSource
+{
+public:
+	virtual ~HeightmapSource() {}
+
+	/*
+		Fills size * size values, X first, of the area with the minimum
+		corner p0 (X, Z).
+	*/
+	virtual void getTile(v2s16 p0, s16 size, s16 *heights) = 0;
+};
+
+/*
+	Ground levels of the map as the mapgen would make them, kept per
+	sector (MAP_BLOCKSIZE * MAP_BLOCKSIZE nodes) for recently used
+	sectors.
+
+	Used from the server and the emerge threads. Sectors don't change
+	once added, so lookups only take the read lock; the write lock is
+	held to add a sector. Missing sectors are computed outside of the
+	lock, one at a time.
+
+	When full, the sector added first that wasn't looked up since it
+	was last passed over is dropped (the clock algorithm).
+*/
+class HeightmapCache
+{
+public:
+	// The cache owns source
+	HeightmapCache(HeightmapSource *source, u32 max_tiles);
+	~HeightmapCache();
+
+	s16 getGroundLevel(v2s16 p);
+	// Lowest and highest ground level in a sector
+	void getGroundLevelRange(v2s16 sectorpos, s16 &min, s16 &max);
+
+	u32 getTileCount();
+	void clear();
+
+private:
+	struct Tile
+	{
+		s16 heights[HEIGHTMAP_TILE_NODES];
+		s16 min_height;
+		s16 max_height;
+		/*
+			Set by lookups, which only hold the read lock; it is never
+			set to anything else there, and a lost write only makes a
+			recently used tile go first.
+		*/
+		bool used;
+	};
+
+	// Returns the tile of a sector with the read lock held
+	const Tile * lockTile(v2s16 sectorpos);
+	// Computes a sector and adds it unless another thread did
+	void addTile(v2s16 sectorpos);
+	static u16 getIndex(v2s16 p, v2s16 sectorpos)
+	{
+		return (p.Y - sectorpos.Y * MAP_BLOCKSIZE) * MAP_BLOCKSIZE
+				+ (p.X - sectorpos.X * MAP_BLOCKSIZE);
+	}
+
+	HeightmapSource *m_source;
+	JMutex m_source_mutex;
+
+	u32 m_max_tiles;
+	std::map<v2s16, Tile*> m_tiles;
+	// In the order they were added or last passed over
+	std::list<v2s16> m_clock;
+	RWLock m_lock;
+};
+
+#endif
+
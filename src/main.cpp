@@ -76,6 +76,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "subgame.h"
 #include "quicktune.h"
 #include "serverlist.h"
+#include "pregenerate.h"
 
 /*
 	Settings.
@@ -814,6 +815,109 @@ void SpeedTests()
 	}
 }
 
+#ifndef SERVER
+
+/*
+	Generates the textures of the minimal game the way the client does
+	after joining a server, using the null video driver so that no window
+	is needed.
+*/
+void TextureSpeedTests()
+{
+	IrrlichtDevice *device = createDevice(video::EDT_NULL);
+	if(device == NULL)
+	{
+		errorstream<<"Could not create a null video device"<<std::endl;
+		return;
+	}
+	video::IVideoDriver *driver = device->getVideoDriver();
+	ITimer *timer = device->getTimer();
+
+	SubgameSpec gamespec = findSubgame("minimal");
+	if(!gamespec.isValid())
+	{
+		errorstream<<"Game \"minimal\" not found"<<std::endl;
+		device->drop();
+		return;
+	}
+
+	IWritableTextureSource *tsrc = createTextureSource(device);
+
+	/*
+		Load the images of the game like media received from a server
+	*/
+	std::vector<std::string> paths;
+	fs::GetRecursiveSubPaths(gamespec.path, paths);
+	std::vector<std::string> files;
+	for(u32 i=0; i<paths.size(); i++)
+	{
+		const std::string &path = paths[i];
+		if(path.size() < 4 || path.substr(path.size() - 4) != ".png")
+			continue;
+		video::IImage *img = driver->createImageFromFile(path.c_str());
+		if(img == NULL)
+			continue;
+		std::string name = path.substr(path.find_last_of(DIR_DELIM_C) + 1);
+		tsrc->insertSourceImage(name, img);
+		img->drop();
+		files.push_back(name);
+	}
+	if(files.empty())
+	{
+		errorstream<<"No textures found in "<<gamespec.path<<std::endl;
+		delete tsrc;
+		device->drop();
+		return;
+	}
+
+	/*
+		Make names with the kinds of modifiers nodes and items use
+	*/
+	std::vector<std::string> names;
+	for(u32 i=0; i<files.size(); i++)
+	{
+		const std::string &f = files[i];
+		const std::string &f2 = files[(i + 1) % files.size()];
+		names.push_back(f);
+		names.push_back(f + "^[brighten");
+		names.push_back(f + "^[transformR90");
+		names.push_back(f + "^[verticalframe:2:1");
+		names.push_back(f + "^" + f2);
+		for(u32 j=0; j<5; j++)
+		{
+			names.push_back(f + "^" + f2 + "^[crack" + itos(j));
+			names.push_back(f + "^" + f2 + "^[cracko" + itos(j));
+		}
+	}
+	dstream<<files.size()<<" source images, "<<names.size()
+			<<" textures"<<std::endl;
+
+	{
+		u32 time1 = timer->getRealTime();
+		for(u32 i=0; i<names.size(); i++)
+			tsrc->getTextureIdDirect(names[i]);
+		dstream<<"Generating textures one by one took "
+				<<(timer->getRealTime() - time1)<<"ms"<<std::endl;
+	}
+
+	std::string threads_orig = g_settings->get("texture_generation_threads");
+	u32 threads_max = MYMAX(porting::getNumberOfProcessors(), 1);
+	for(u32 threads=1; threads<=threads_max; threads*=2)
+	{
+		g_settings->set("texture_generation_threads", itos(threads));
+		u32 time1 = timer->getRealTime();
+		tsrc->rebuildImagesAndTextures();
+		dstream<<"Rebuilding textures with "<<threads<<" thread(s) took "
+				<<(timer->getRealTime() - time1)<<"ms"<<std::endl;
+	}
+	g_settings->set("texture_generation_threads", threads_orig);
+
+	delete tsrc;
+	device->drop();
+}
+
+#endif
+
 static void print_worldspecs(const std::vector<WorldSpec> &worldspecs,
 		std::ostream &os)
 {
@@ -886,9 +990,13 @@ int main(int argc, char *argv[])
 			_("Set logfile path ('' = no logging)"))));
 	allowed_options.insert(std::make_pair("gameid", ValueSpec(VALUETYPE_STRING,
 			_("Set gameid (\"--gameid list\" prints available ones)"))));
+	allowed_options.insert(std::make_pair("pregenerate", ValueSpec(VALUETYPE_STRING,
+			_("Generate the area \"(x1,y1,z1) (x2,y2,z2)\" of the world and exit"))));
 #ifndef SERVER
 	allowed_options.insert(std::make_pair("speedtests", ValueSpec(VALUETYPE_FLAG,
 			_("Run speed tests"))));
+	allowed_options.insert(std::make_pair("texturespeedtests", ValueSpec(VALUETYPE_FLAG,
+			_("Run texture generation speed tests with the null video driver"))));
 	allowed_options.insert(std::make_pair("address", ValueSpec(VALUETYPE_STRING,
 			_("Address to connect to. ('' = local game)"))));
 	allowed_options.insert(std::make_pair("random-input", ValueSpec(VALUETYPE_FLAG,
@@ -1174,7 +1282,8 @@ int main(int argc, char *argv[])
 #ifdef SERVER
 	bool run_dedicated_server = true;
 #else
-	bool run_dedicated_server = cmd_args.getFlag("server");
+	bool run_dedicated_server = cmd_args.getFlag("server") ||
+			cmd_args.exists("pregenerate");
 #endif
 	g_settings->set("server_dedicated", run_dedicated_server ? "true" : "false");
 	if(run_dedicated_server)
@@ -1288,8 +1397,27 @@ int main(int argc, char *argv[])
 		}
 		verbosestream<<_("Using gameid")<<" ["<<gamespec.id<<"]"<<std::endl;
 
+		// Check the area before loading the world
+		v3s16 pregenerate_min, pregenerate_max;
+		if(cmd_args.exists("pregenerate") && !parse_pregenerate_area(
+				cmd_args.get("pregenerate"), pregenerate_min, pregenerate_max))
+		{
+			errorstream<<"Invalid area to pregenerate; expected"
+					" \"(x1,y1,z1) (x2,y2,z2)\""<<std::endl;
+			return 1;
+		}
+
 		// Create server
 		Server server(world_path, configpath, gamespec, false);
+
+		// Generate the area without starting the server
+		if(cmd_args.exists("pregenerate"))
+		{
+			WorldPregenerator pregenerator(&server,
+					pregenerate_min, pregenerate_max);
+			return pregenerator.run(kill) ? 0 : 1;
+		}
+
 		server.start(port);
 		
 		// Run server
@@ -1300,6 +1428,16 @@ int main(int argc, char *argv[])
 
 #ifndef SERVER // Exclude from dedicated server build
 
+	/*
+		Texture speed tests (without a window)
+	*/
+	if(cmd_args.getFlag("texturespeedtests"))
+	{
+		dstream<<"Running texture speed tests"<<std::endl;
+		TextureSpeedTests();
+		return 0;
+	}
+
 	/*
 		More parameters
 	*/
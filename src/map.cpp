@@ -36,6 +36,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "emerge.h"
 #include "mapgen_v6.h"
 #include "mapgen_indev.h"
+#include "maplight.h"
+#include "mapliquid.h"
+#include <algorithm>
 
 #define PP(x) "("<<(x).X<<","<<(x).Y<<","<<(x).Z<<")"
 
@@ -65,8 +68,12 @@ Map::Map(std::ostream &dout, IGameDef *gamedef):
 	m_gamedef(gamedef),
 	m_sector_cache(NULL)
 {
+	m_light = new MapLightEngine(this, gamedef->ndef());
+	m_liquid = new MapLiquidEngine(this, gamedef);
 	/*m_sector_mutex.Init();
 	assert(m_sector_mutex.IsInitialized());*/
+	for(u32 i = 0; i < 64; i++)
+		m_block_cache[i].valid = false;
 }
 
 Map::~Map()
@@ -79,6 +86,9 @@ Map::~Map()
 	{
 		delete i->second;
 	}
+
+	delete m_light;
+	delete m_liquid;
 }
 
 void Map::addEventReceiver(MapEventReceiver *event_receiver)
@@ -136,14 +146,22 @@ MapSector * Map::getSectorNoGenerate(v2s16 p)
 	return sector;
 }
 
-MapBlock * Map::getBlockNoCreateNoEx(v3s16 p3d)
+void Map::indexBlock(MapBlock *block)
 {
-	v2s16 p2d(p3d.X, p3d.Z);
-	MapSector * sector = getSectorNoGenerateNoEx(p2d);
-	if(sector == NULL)
-		return NULL;
-	MapBlock *block = sector->getBlockNoCreateNoEx(p3d.Y);
-	return block;
+	v3s16 p = block->getPos();
+	m_block_index.insert(p, block);
+	BlockCacheEntry &e = m_block_cache[blockCacheIndex(p)];
+	e.valid = true;
+	e.p = p;
+	e.block = block;
+}
+
+void Map::unindexBlock(v3s16 p)
+{
+	m_block_index.remove(p);
+	BlockCacheEntry &e = m_block_cache[blockCacheIndex(p)];
+	if(e.valid && e.p == p)
+		e.block = NULL;
 }
 
 MapBlock * Map::getBlockNoCreate(v3s16 p3d)
@@ -216,7 +234,7 @@ void Map::setNode(v3s16 p, MapNode & n)
 
 
 /*
-	Goes recursively through the neighbours of the node.
+	Goes through the neighbours of the nodes.
 
 	Alters only transparent nodes.
 
@@ -237,166 +255,16 @@ void Map::unspreadLight(enum LightBank bank,
 		std::set<v3s16> & light_sources,
 		std::map<v3s16, MapBlock*>  & modified_blocks)
 {
-	INodeDefManager *nodemgr = m_gamedef->ndef();
-
-	v3s16 dirs[6] = {
-		v3s16(0,0,1), // back
-		v3s16(0,1,0), // top
-		v3s16(1,0,0), // right
-		v3s16(0,0,-1), // front
-		v3s16(0,-1,0), // bottom
-		v3s16(-1,0,0), // left
-	};
-
 	if(from_nodes.size() == 0)
 		return;
 
-	u32 blockchangecount = 0;
-
-	std::map<v3s16, u8> unlighted_nodes;
-
-	/*
-		Initialize block cache
-	*/
-	v3s16 blockpos_last;
-	MapBlock *block = NULL;
-	// Cache this a bit, too
-	bool block_checked_in_modified = false;
-
+	m_light->clear();
 	for(std::map<v3s16, u8>::iterator j = from_nodes.begin();
 		j != from_nodes.end(); ++j)
-	{
-		v3s16 pos = j->first;
-		v3s16 blockpos = getNodeBlockPos(pos);
-
-		// Only fetch a new block if the block position has changed
-		try{
-			if(block == NULL || blockpos != blockpos_last){
-				block = getBlockNoCreate(blockpos);
-				blockpos_last = blockpos;
-
-				block_checked_in_modified = false;
-				blockchangecount++;
-			}
-		}
-		catch(InvalidPositionException &e)
-		{
-			continue;
-		}
-
-		if(block->isDummy())
-			continue;
-
-		// Calculate relative position in block
-		v3s16 relpos = pos - blockpos_last * MAP_BLOCKSIZE;
-
-		// Get node straight from the block
-		MapNode n = block->getNode(relpos);
-
-		u8 oldlight = j->second;
-
-		// Loop through 6 neighbors
-		for(u16 i=0; i<6; i++)
-		{
-			// Get the position of the neighbor node
-			v3s16 n2pos = pos + dirs[i];
-
-			// Get the block where the node is located
-			v3s16 blockpos = getNodeBlockPos(n2pos);
-
-			try
-			{
-				// Only fetch a new block if the block position has changed
-				try{
-					if(block == NULL || blockpos != blockpos_last){
-						block = getBlockNoCreate(blockpos);
-						blockpos_last = blockpos;
-
-						block_checked_in_modified = false;
-						blockchangecount++;
-					}
-				}
-				catch(InvalidPositionException &e)
-				{
-					continue;
-				}
-
-				// Calculate relative position in block
-				v3s16 relpos = n2pos - blockpos * MAP_BLOCKSIZE;
-				// Get node straight from the block
-				MapNode n2 = block->getNode(relpos);
-
-				bool changed = false;
-
-				//TODO: Optimize output by optimizing light_sources?
-
-				/*
-					If the neighbor is dimmer than what was specified
-					as oldlight (the light of the previous node)
-				*/
-				if(n2.getLight(bank, nodemgr) < oldlight)
-				{
-					/*
-						And the neighbor is transparent and it has some light
-					*/
-					if(nodemgr->get(n2).light_propagates
-							&& n2.getLight(bank, nodemgr) != 0)
-					{
-						/*
-							Set light to 0 and add to queue
-						*/
-
-						u8 current_light = n2.getLight(bank, nodemgr);
-						n2.setLight(bank, 0, nodemgr);
-						block->setNode(relpos, n2);
-
-						unlighted_nodes[n2pos] = current_light;
-						changed = true;
-
-						/*
-							Remove from light_sources if it is there
-							NOTE: This doesn't happen nearly at all
-						*/
-						/*if(light_sources.find(n2pos))
-						{
-							infostream<<"Removed from light_sources"<<std::endl;
-							light_sources.remove(n2pos);
-						}*/
-					}
-
-					/*// DEBUG
-					if(light_sources.find(n2pos) != NULL)
-						light_sources.remove(n2pos);*/
-				}
-				else{
-					light_sources.insert(n2pos);
-				}
-
-				// Add to modified_blocks
-				if(changed == true && block_checked_in_modified == false)
-				{
-					// If the block is not found in modified_blocks, add.
-					if(modified_blocks.find(blockpos) == modified_blocks.end())
-					{
-						modified_blocks[blockpos] = block;
-					}
-					block_checked_in_modified = true;
-				}
-			}
-			catch(InvalidPositionException &e)
-			{
-				continue;
-			}
-		}
-	}
-
-	/*infostream<<"unspreadLight(): Changed block "
-			<<blockchangecount<<" times"
-			<<" for "<<from_nodes.size()<<" nodes"
-			<<std::endl;*/
-
-	if(unlighted_nodes.size() > 0)
-		unspreadLight(bank, unlighted_nodes, light_sources, modified_blocks);
+		m_light->addUnlight(j->first, j->second);
+	m_light->unspread(bank);
+	m_light->getSources(light_sources);
+	m_light->getModifiedBlocks(modified_blocks);
 }
 
 /*
@@ -414,152 +282,22 @@ void Map::unLightNeighbors(enum LightBank bank,
 }
 
 /*
-	Lights neighbors of from_nodes, collects all them and then
-	goes on recursively.
+	Lights neighbors of from_nodes, and goes on from the nodes that
+	were lighted.
 */
 void Map::spreadLight(enum LightBank bank,
 		std::set<v3s16> & from_nodes,
 		std::map<v3s16, MapBlock*> & modified_blocks)
 {
-	INodeDefManager *nodemgr = m_gamedef->ndef();
-
-	const v3s16 dirs[6] = {
-		v3s16(0,0,1), // back
-		v3s16(0,1,0), // top
-		v3s16(1,0,0), // right
-		v3s16(0,0,-1), // front
-		v3s16(0,-1,0), // bottom
-		v3s16(-1,0,0), // left
-	};
-
 	if(from_nodes.size() == 0)
 		return;
 
-	u32 blockchangecount = 0;
-
-	std::set<v3s16> lighted_nodes;
-
-	/*
-		Initialize block cache
-	*/
-	v3s16 blockpos_last;
-	MapBlock *block = NULL;
-	// Cache this a bit, too
-	bool block_checked_in_modified = false;
-
+	m_light->clear();
 	for(std::set<v3s16>::iterator j = from_nodes.begin();
 		j != from_nodes.end(); ++j)
-	{
-		v3s16 pos = *j;
-		v3s16 blockpos = getNodeBlockPos(pos);
-
-		// Only fetch a new block if the block position has changed
-		try{
-			if(block == NULL || blockpos != blockpos_last){
-				block = getBlockNoCreate(blockpos);
-				blockpos_last = blockpos;
-
-				block_checked_in_modified = false;
-				blockchangecount++;
-			}
-		}
-		catch(InvalidPositionException &e)
-		{
-			continue;
-		}
-
-		if(block->isDummy())
-			continue;
-
-		// Calculate relative position in block
-		v3s16 relpos = pos - blockpos_last * MAP_BLOCKSIZE;
-
-		// Get node straight from the block
-		MapNode n = block->getNode(relpos);
-
-		u8 oldlight = n.getLight(bank, nodemgr);
-		u8 newlight = diminish_light(oldlight);
-
-		// Loop through 6 neighbors
-		for(u16 i=0; i<6; i++){
-			// Get the position of the neighbor node
-			v3s16 n2pos = pos + dirs[i];
-
-			// Get the block where the node is located
-			v3s16 blockpos = getNodeBlockPos(n2pos);
-
-			try
-			{
-				// Only fetch a new block if the block position has changed
-				try{
-					if(block == NULL || blockpos != blockpos_last){
-						block = getBlockNoCreate(blockpos);
-						blockpos_last = blockpos;
-
-						block_checked_in_modified = false;
-						blockchangecount++;
-					}
-				}
-				catch(InvalidPositionException &e)
-				{
-					continue;
-				}
-
-				// Calculate relative position in block
-				v3s16 relpos = n2pos - blockpos * MAP_BLOCKSIZE;
-				// Get node straight from the block
-				MapNode n2 = block->getNode(relpos);
-
-				bool changed = false;
-				/*
-					If the neighbor is brighter than the current node,
-					add to list (it will light up this node on its turn)
-				*/
-				if(n2.getLight(bank, nodemgr) > undiminish_light(oldlight))
-				{
-					lighted_nodes.insert(n2pos);
-					changed = true;
-				}
-				/*
-					If the neighbor is dimmer than how much light this node
-					would spread on it, add to list
-				*/
-				if(n2.getLight(bank, nodemgr) < newlight)
-				{
-					if(nodemgr->get(n2).light_propagates)
-					{
-						n2.setLight(bank, newlight, nodemgr);
-						block->setNode(relpos, n2);
-						lighted_nodes.insert(n2pos);
-						changed = true;
-					}
-				}
-
-				// Add to modified_blocks
-				if(changed == true && block_checked_in_modified == false)
-				{
-					// If the block is not found in modified_blocks, add.
-					if(modified_blocks.find(blockpos) == modified_blocks.end())
-					{
-						modified_blocks[blockpos] = block;
-					}
-					block_checked_in_modified = true;
-				}
-			}
-			catch(InvalidPositionException &e)
-			{
-				continue;
-			}
-		}
-	}
-
-	/*infostream<<"spreadLight(): Changed block "
-			<<blockchangecount<<" times"
-			<<" for "<<from_nodes.size()<<" nodes"
-			<<std::endl;*/
-
-	if(lighted_nodes.size() > 0)
-		spreadLight(bank, lighted_nodes, modified_blocks);
+		m_light->addSource(*j);
+	m_light->spread(bank);
+	m_light->getModifiedBlocks(modified_blocks);
 }
 
 /*
@@ -595,14 +333,11 @@ v3s16 Map::getBrightestNeighbour(enum LightBank bank, v3s16 p)
 	for(u16 i=0; i<6; i++){
 		// Get the position of the neighbor node
 		v3s16 n2pos = p + dirs[i];
-		MapNode n2;
-		try{
-			n2 = getNode(n2pos);
-		}
-		catch(InvalidPositionException &e)
-		{
+		v3s16 blockpos = getNodeBlockPos(n2pos);
+		MapBlock *block = getBlockNoCreateNoEx(blockpos);
+		if(block == NULL || block->isDummy())
 			continue;
-		}
+		MapNode n2 = block->getNodeNoCheck(n2pos - blockpos*MAP_BLOCKSIZE);
 		if(n2.getLight(bank, nodemgr) > brightest_light || found_something == false){
 			brightest_light = n2.getLight(bank, nodemgr);
 			brightest_pos = n2pos;
@@ -630,27 +365,32 @@ s16 Map::propagateSunlight(v3s16 start,
 	INodeDefManager *nodemgr = m_gamedef->ndef();
 
 	s16 y = start.Y;
+	v3s16 blockpos_last;
+	MapBlock *block = NULL;
+	MapNode *data = NULL;
 	for(; ; y--)
 	{
 		v3s16 pos(start.X, y, start.Z);
 
 		v3s16 blockpos = getNodeBlockPos(pos);
-		MapBlock *block;
-		try{
-			block = getBlockNoCreate(blockpos);
-		}
-		catch(InvalidPositionException &e)
-		{
-			break;
+		if(block == NULL || blockpos != blockpos_last){
+			block = getBlockNoCreateNoEx(blockpos);
+			if(block == NULL)
+				break;
+			data = block->getData();
+			if(data == NULL)
+				break;
+			blockpos_last = blockpos;
 		}
 
 		v3s16 relpos = pos - blockpos*MAP_BLOCKSIZE;
-		MapNode n = block->getNode(relpos);
+		MapNode &n = data[relpos.Z*MAP_BLOCKSIZE*MAP_BLOCKSIZE
+				+ relpos.Y*MAP_BLOCKSIZE + relpos.X];
 
 		if(nodemgr->get(n).sunlight_propagates)
 		{
 			n.setLight(LIGHTBANK_DAY, LIGHT_SUN, nodemgr);
-			block->setNode(relpos, n);
+			block->raiseModified(MOD_STATE_WRITE_NEEDED, "setNode");
 
 			modified_blocks[blockpos] = block;
 		}
@@ -674,21 +414,11 @@ void Map::updateLighting(enum LightBank bank,
 
 	//TimeTaker timer("updateLighting");
 
-	// For debugging
-	//bool debug=true;
-	//u32 count_was = modified_blocks.size();
-
-	std::map<v3s16, MapBlock*> blocks_to_update;
+	m_light->clear();
 
+	// Sunlighted nodes found by MapBlock::propagateSunlight()
 	std::set<v3s16> light_sources;
 
-	std::map<v3s16, u8> unlight_from;
-
-	int num_bottom_invalid = 0;
-
-	{
-	//TimeTaker t("first stuff");
-
 	for(std::map<v3s16, MapBlock*>::iterator i = a_blocks.begin();
 		i != a_blocks.end(); ++i)
 	{
@@ -703,57 +433,40 @@ void Map::updateLighting(enum LightBank bank,
 			v3s16 pos = block->getPos();
 			v3s16 posnodes = block->getPosRelative();
 			modified_blocks[pos] = block;
-			blocks_to_update[pos] = block;
 
 			/*
 				Clear all light from block
 			*/
+			MapNode *data = block->getData();
 			for(s16 z=0; z<MAP_BLOCKSIZE; z++)
-			for(s16 x=0; x<MAP_BLOCKSIZE; x++)
 			for(s16 y=0; y<MAP_BLOCKSIZE; y++)
+			for(s16 x=0; x<MAP_BLOCKSIZE; x++)
 			{
-
-				try{
-					v3s16 p(x,y,z);
-					MapNode n = block->getNode(p);
-					u8 oldlight = n.getLight(bank, nodemgr);
-					n.setLight(bank, 0, nodemgr);
-					block->setNode(p, n);
-
-					// If node sources light, add to list
-					u8 source = nodemgr->get(n).light_source;
-					if(source != 0)
-						light_sources.insert(p + posnodes);
-
-					// Collect borders for unlighting
-					if((x==0 || x == MAP_BLOCKSIZE-1
-					|| y==0 || y == MAP_BLOCKSIZE-1
-					|| z==0 || z == MAP_BLOCKSIZE-1)
-					&& oldlight != 0)
-					{
-						v3s16 p_map = p + posnodes;
-						unlight_from[p_map] = oldlight;
-					}
-				}
-				catch(InvalidPositionException &e)
+				MapNode &n = data[z*MAP_BLOCKSIZE*MAP_BLOCKSIZE
+						+ y*MAP_BLOCKSIZE + x];
+				u8 oldlight = n.getLight(bank, nodemgr);
+				n.setLight(bank, 0, nodemgr);
+
+				// If node sources light, add to list
+				u8 source = nodemgr->get(n).light_source;
+				if(source != 0)
+					m_light->addSource(v3s16(x,y,z) + posnodes);
+
+				// Collect borders for unlighting
+				if((x==0 || x == MAP_BLOCKSIZE-1
+				|| y==0 || y == MAP_BLOCKSIZE-1
+				|| z==0 || z == MAP_BLOCKSIZE-1)
+				&& oldlight != 0)
 				{
-					/*
-						This would happen when dealing with a
-						dummy block.
-					*/
-					//assert(0);
-					infostream<<"updateLighting(): InvalidPositionException"
-							<<std::endl;
+					m_light->addUnlight(v3s16(x,y,z) + posnodes, oldlight);
 				}
 			}
+			block->raiseModified(MOD_STATE_WRITE_NEEDED, "setNode");
 
 			if(bank == LIGHTBANK_DAY)
 			{
 				bool bottom_valid = block->propagateSunlight(light_sources);
 
-				if(!bottom_valid)
-					num_bottom_invalid++;
-
 				// If bottom is valid, we're done.
 				if(bottom_valid)
 					break;
@@ -769,133 +482,29 @@ void Map::updateLighting(enum LightBank bank,
 				assert(0);
 			}
 
-			/*infostream<<"Bottom for sunlight-propagated block ("
-					<<pos.X<<","<<pos.Y<<","<<pos.Z<<") not valid"
-					<<std::endl;*/
-
 			// Bottom sunlight is not valid; get the block and loop to it
 
 			pos.Y--;
-			try{
-				block = getBlockNoCreate(pos);
-			}
-			catch(InvalidPositionException &e)
-			{
-				assert(0);
-			}
-
+			block = getBlockNoCreateNoEx(pos);
+			assert(block != NULL);
+			if(block == NULL)
+				break;
 		}
 	}
 
-	}
-
-	/*
-		Enable this to disable proper lighting for speeding up map
-		generation for testing or whatever
-	*/
-#if 0
-	//if(g_settings->get(""))
-	{
-		core::map<v3s16, MapBlock*>::Iterator i;
-		i = blocks_to_update.getIterator();
-		for(; i.atEnd() == false; i++)
-		{
-			MapBlock *block = i.getNode()->getValue();
-			v3s16 p = block->getPos();
-			block->setLightingExpired(false);
-		}
-		return;
-	}
-#endif
+	for(std::set<v3s16>::iterator i = light_sources.begin();
+			i != light_sources.end(); ++i)
+		m_light->addSource(*i);
 
-#if 1
 	{
 		//TimeTaker timer("unspreadLight");
-		unspreadLight(bank, unlight_from, light_sources, modified_blocks);
+		m_light->unspread(bank);
 	}
-
-	/*if(debug)
-	{
-		u32 diff = modified_blocks.size() - count_was;
-		count_was = modified_blocks.size();
-		infostream<<"unspreadLight modified "<<diff<<std::endl;
-	}*/
-
 	{
 		//TimeTaker timer("spreadLight");
-		spreadLight(bank, light_sources, modified_blocks);
-	}
-
-	/*if(debug)
-	{
-		u32 diff = modified_blocks.size() - count_was;
-		count_was = modified_blocks.size();
-		infostream<<"spreadLight modified "<<diff<<std::endl;
-	}*/
-#endif
-
-#if 0
-	{
-		//MapVoxelManipulator vmanip(this);
-
-		// Make a manual voxel manipulator and load all the blocks
-		// that touch the requested blocks
-		ManualMapVoxelManipulator vmanip(this);
-
-		{
-		//TimeTaker timer("initialEmerge");
-
-		core::map<v3s16, MapBlock*>::Iterator i;
-		i = blocks_to_update.getIterator();
-		for(; i.atEnd() == false; i++)
-		{
-			MapBlock *block = i.getNode()->getValue();
-			v3s16 p = block->getPos();
-
-			// Add all surrounding blocks
-			vmanip.initialEmerge(p - v3s16(1,1,1), p + v3s16(1,1,1));
-
-			/*
-				Add all surrounding blocks that have up-to-date lighting
-				NOTE: This doesn't quite do the job (not everything
-					  appropriate is lighted)
-			*/
-			/*for(s16 z=-1; z<=1; z++)
-			for(s16 y=-1; y<=1; y++)
-			for(s16 x=-1; x<=1; x++)
-			{
-				v3s16 p2 = p + v3s16(x,y,z);
-				MapBlock *block = getBlockNoCreateNoEx(p2);
-				if(block == NULL)
-					continue;
-				if(block->isDummy())
-					continue;
-				if(block->getLightingExpired())
-					continue;
-				vmanip.initialEmerge(p2, p2);
-			}*/
-
-			// Lighting of block will be updated completely
-			block->setLightingExpired(false);
-		}
-		}
-
-		{
-			//TimeTaker timer("unSpreadLight");
-			vmanip.unspreadLight(bank, unlight_from, light_sources, nodemgr);
-		}
-		{
-			//TimeTaker timer("spreadLight");
-			vmanip.spreadLight(bank, light_sources, nodemgr);
-		}
-		{
-			//TimeTaker timer("blitBack");
-			vmanip.blitBack(modified_blocks);
-		}
-		/*infostream<<"emerge_time="<<emerge_time<<std::endl;
-		emerge_time = 0;*/
+		m_light->spread(bank);
 	}
-#endif
+	m_light->getModifiedBlocks(modified_blocks);
 
 	//m_dout<<"Done ("<<getTimestamp()<<")"<<std::endl;
 }
@@ -940,7 +549,9 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 	v3s16 bottompos = p + v3s16(0,-1,0);
 
 	bool node_under_sunlight = true;
-	std::set<v3s16> light_sources;
+
+	// Collects the nodes that will spread light again in both banks
+	m_light->clear();
 
 	/*
 		Collect old node for rollback
@@ -980,7 +591,7 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 
 		// Add the block of the added node to modified_blocks
 		v3s16 blockpos = getNodeBlockPos(p);
-		MapBlock * block = getBlockNoCreate(blockpos);
+		MapBlock * block = getBlockNoCreateNoEx(blockpos);
 		assert(block != NULL);
 		modified_blocks[blockpos] = block;
 
@@ -991,7 +602,8 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 		// to 0.
 		// This also collects the nodes at the border which will spread
 		// light again into this.
-		unLightNeighbors(bank, p, lightwas, light_sources, modified_blocks);
+		m_light->addUnlight(p, lightwas);
+		m_light->unspread(bank);
 
 		n.setLight(bank, 0, ndef);
 	}
@@ -1042,9 +654,8 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 
 			if(n2.getLight(LIGHTBANK_DAY, ndef) == LIGHT_SUN)
 			{
-				unLightNeighbors(LIGHTBANK_DAY,
-						n2pos, n2.getLight(LIGHTBANK_DAY, ndef),
-						light_sources, modified_blocks);
+				m_light->addUnlight(n2pos, LIGHT_SUN);
+				m_light->unspread(LIGHTBANK_DAY);
 				n2.setLight(LIGHTBANK_DAY, 0, ndef);
 				setNode(n2pos, n2);
 			}
@@ -1060,8 +671,9 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 		/*
 			Spread light from all nodes that might be capable of doing so
 		*/
-		spreadLight(bank, light_sources, modified_blocks);
+		m_light->spread(bank);
 	}
+	m_light->getModifiedBlocks(modified_blocks);
 
 	/*
 		Update information about whether day and night light differ
@@ -1153,7 +765,8 @@ void Map::removeNodeAndUpdate(v3s16 p,
 	{
 	}
 
-	std::set<v3s16> light_sources;
+	// Collects the nodes that will spread light again in both banks
+	m_light->clear();
 
 	enum LightBank banks[] =
 	{
@@ -1167,9 +780,8 @@ void Map::removeNodeAndUpdate(v3s16 p,
 		/*
 			Unlight neighbors (in case the node is a light source)
 		*/
-		unLightNeighbors(bank, p,
-				getNode(p).getLight(bank, ndef),
-				light_sources, modified_blocks);
+		m_light->addUnlight(p, getNode(p).getLight(bank, ndef));
+		m_light->unspread(bank);
 	}
 
 	/*
@@ -1194,12 +806,13 @@ void Map::removeNodeAndUpdate(v3s16 p,
 		/*
 			Recalculate lighting
 		*/
-		spreadLight(bank, light_sources, modified_blocks);
+		m_light->spread(bank);
 	}
+	m_light->clearSources();
 
 	// Add the block of the removed node to modified_blocks
 	v3s16 blockpos = getNodeBlockPos(p);
-	MapBlock * block = getBlockNoCreate(blockpos);
+	MapBlock * block = getBlockNoCreateNoEx(blockpos);
 	assert(block != NULL);
 	modified_blocks[blockpos] = block;
 
@@ -1216,27 +829,17 @@ void Map::removeNodeAndUpdate(v3s16 p,
 		m_dout<<DTIME<<" -> ybottom="<<ybottom<<std::endl;*/
 		s16 y = p.Y;
 		for(; y >= ybottom; y--)
-		{
-			v3s16 p2(p.X, y, p.Z);
-			/*m_dout<<DTIME<<"lighting neighbors of node ("
-					<<p2.X<<","<<p2.Y<<","<<p2.Z<<")"
-					<<std::endl;*/
-			lightNeighbors(LIGHTBANK_DAY, p2, modified_blocks);
-		}
+			m_light->addSource(v3s16(p.X, y, p.Z));
+		m_light->spread(LIGHTBANK_DAY);
+		m_light->clearSources();
 	}
 	else
 	{
 		// Set the lighting of this node to 0
 		// TODO: Is this needed? Lighting is cleared up there already.
-		try{
-			MapNode n = getNode(p);
-			n.setLight(LIGHTBANK_DAY, 0, ndef);
-			setNode(p, n);
-		}
-		catch(InvalidPositionException &e)
-		{
-			assert(0);
-		}
+		MapNode n = getNode(p);
+		n.setLight(LIGHTBANK_DAY, 0, ndef);
+		setNode(p, n);
 	}
 
 	for(s32 i=0; i<2; i++)
@@ -1245,14 +848,11 @@ void Map::removeNodeAndUpdate(v3s16 p,
 
 		// Get the brightest neighbour node and propagate light from it
 		v3s16 n2p = getBrightestNeighbour(bank, p);
-		try{
-			MapNode n2 = getNode(n2p);
-			lightNeighbors(bank, n2p, modified_blocks);
-		}
-		catch(InvalidPositionException &e)
-		{
-		}
+		m_light->addSource(n2p);
+		m_light->spread(bank);
+		m_light->clearSources();
 	}
+	m_light->getModifiedBlocks(modified_blocks);
 
 	/*
 		Update information about whether day and night light differ
@@ -1421,34 +1021,56 @@ bool Map::getDayNightDiff(v3s16 blockpos)
 	return false;
 }
 
+struct UnloadCandidate
+{
+	MapSector *sector;
+	MapBlock *block;
+
+	UnloadCandidate(MapSector *sector_, MapBlock *block_):
+		sector(sector_),
+		block(block_)
+	{}
+
+	// Orders the least recently used blocks first
+	bool operator<(const UnloadCandidate &other) const
+	{
+		return block->getUsageTimer() > other.block->getUsageTimer();
+	}
+};
+
 /*
 	Updates usage timers
 */
-void Map::timerUpdate(float dtime, float unload_timeout,
-		std::list<v3s16> *unloaded_blocks)
+void Map::timerUpdate(float dtime, float unload_timeout, float pack_timeout,
+		u32 max_unloaded_blocks, std::list<v3s16> *unloaded_blocks)
 {
 	bool save_before_unloading = (mapType() == MAPTYPE_SERVER);
 
 	// Profile modified reasons
 	Profiler modprofiler;
 
+	std::vector<UnloadCandidate> candidates;
 	std::list<v2s16> sector_deletion_queue;
 	u32 deleted_blocks_count = 0;
 	u32 saved_blocks_count = 0;
 	u32 block_count_all = 0;
+	u32 packed_blocks_count = 0;
+	u32 packed_blocks_all = 0;
+	u32 packed_bytes_all = 0;
 
-	beginSave();
+	/*
+		Update timers and find the blocks to unload
+	*/
+	std::vector<MapBlock*> blocks;
 	for(std::map<v2s16, MapSector*>::iterator si = m_sectors.begin();
 		si != m_sectors.end(); ++si)
 	{
 		MapSector *sector = si->second;
 
-		bool all_blocks_deleted = true;
-
-		std::list<MapBlock*> blocks;
+		blocks.clear();
 		sector->getBlocks(blocks);
 
-		for(std::list<MapBlock*>::iterator i = blocks.begin();
+		for(std::vector<MapBlock*>::iterator i = blocks.begin();
 				i != blocks.end(); ++i)
 		{
 			MapBlock *block = (*i);
@@ -1457,42 +1079,98 @@ void Map::timerUpdate(float dtime, float unload_timeout,
 
 			if(block->refGet() == 0 && block->getUsageTimer() > unload_timeout)
 			{
-				v3s16 p = block->getPos();
-
-				// Save if modified
-				if(block->getModified() != MOD_STATE_CLEAN
-						&& save_before_unloading)
-				{
-					modprofiler.add(block->getModifiedReason(), 1);
-					saveBlock(block);
-					saved_blocks_count++;
-				}
-
-				// Delete from memory
-				sector->deleteBlock(block);
-
-				if(unloaded_blocks)
-					unloaded_blocks->push_back(p);
-
-				deleted_blocks_count++;
+				candidates.push_back(UnloadCandidate(sector, block));
 			}
 			else
 			{
-				all_blocks_deleted = false;
 				block_count_all++;
+
+				// Pack node data that hasn't been accessed in a while
+				if(pack_timeout >= 0 && !block->isDataPacked()
+						&& block->getPackTimer() > pack_timeout)
+				{
+					block->packData();
+					packed_blocks_count++;
+				}
+				if(block->isDataPacked())
+				{
+					packed_blocks_all++;
+					packed_bytes_all += block->getPackedDataMemoryUsage();
+				}
 			}
 		}
+	}
 
-		if(all_blocks_deleted)
+	/*
+		Leave the most recently used blocks for the next time if there
+		are too many
+	*/
+	if(max_unloaded_blocks != 0 && candidates.size() > max_unloaded_blocks)
+	{
+		std::nth_element(candidates.begin(),
+				candidates.begin() + max_unloaded_blocks, candidates.end());
+		block_count_all += candidates.size() - max_unloaded_blocks;
+		candidates.erase(candidates.begin() + max_unloaded_blocks,
+				candidates.end());
+	}
+
+	/*
+		Save the modified blocks all at once
+	*/
+	if(save_before_unloading)
+	{
+		std::vector<MapBlock*> modified_blocks;
+		for(std::vector<UnloadCandidate>::iterator i = candidates.begin();
+				i != candidates.end(); ++i)
 		{
-			sector_deletion_queue.push_back(si->first);
+			MapBlock *block = i->block;
+			if(block->getModified() != MOD_STATE_CLEAN)
+			{
+				modprofiler.add(block->getModifiedReason(), 1);
+				modified_blocks.push_back(block);
+			}
 		}
+		if(!modified_blocks.empty())
+			saveBlocks(modified_blocks);
+		saved_blocks_count = modified_blocks.size();
+	}
+
+	/*
+		Delete the blocks from memory
+	*/
+	for(std::vector<UnloadCandidate>::iterator i = candidates.begin();
+			i != candidates.end(); ++i)
+	{
+		v3s16 p = i->block->getPos();
+		i->sector->deleteBlock(i->block);
+
+		if(unloaded_blocks)
+			unloaded_blocks->push_back(p);
+
+		deleted_blocks_count++;
 	}
-	endSave();
 
 	// Finally delete the empty sectors
+	for(std::map<v2s16, MapSector*>::iterator si = m_sectors.begin();
+		si != m_sectors.end(); ++si)
+	{
+		if(si->second->empty())
+			sector_deletion_queue.push_back(si->first);
+	}
 	deleteSectors(sector_deletion_queue);
 
+	g_profiler->avg("Map: blocks in memory", block_count_all);
+	g_profiler->avg("Map: packed blocks", packed_blocks_all);
+	g_profiler->avg("Map: packed data KiB", packed_bytes_all / 1024);
+	if(packed_blocks_count != 0)
+	{
+		PrintInfo(verbosestream); // ServerMap/ClientMap:
+		verbosestream<<"Packed "<<packed_blocks_count<<" blocks; "
+				<<packed_blocks_all<<"/"<<block_count_all
+				<<" blocks packed in "<<(packed_bytes_all / 1024)
+				<<" KiB"<<std::endl;
+	}
+
 	if(deleted_blocks_count != 0)
 	{
 		PrintInfo(infostream); // ServerMap/ClientMap:
@@ -1587,7 +1265,6 @@ void Map::PrintInfo(std::ostream &out)
 	out<<"Map: ";
 }
 
-#define WATER_DROP_BOOST 4
 
 enum NeighborType {
 	NEIGHBOR_UPPER,
@@ -1636,6 +1313,9 @@ void Map::transformLiquidsFinite(std::map<v3s16, MapBlock*> & modified_blocks)
 	u32 loopcount = 0;
 	u32 initial_size = m_transforming_liquid.size();
 
+	u32 budget_ms = g_settings->getU16("liquid_step_budget");
+	u32 start_ms = porting::getTimeMs();
+
 	u8 relax = g_settings->getS16("liquid_relax");
 	bool fast_flood = g_settings->getS16("liquid_fast_flood");
 	int water_level = g_settings->getS16("water_level");
@@ -1649,7 +1329,8 @@ void Map::transformLiquidsFinite(std::map<v3s16, MapBlock*> & modified_blocks)
 	while (m_transforming_liquid.size() > 0)
 	{
 		// This should be done here so that it is done when continue is used
-		if (loopcount >= initial_size || loopcount >= 1000)
+		if (loopcount >= initial_size || (budget_ms != 0
+				&& porting::getTimeMs() - start_ms >= budget_ms))
 			break;
 		loopcount++;
 		/*
@@ -1961,277 +1642,30 @@ void Map::transformLiquidsFinite(std::map<v3s16, MapBlock*> & modified_blocks)
 	updateLighting(lighting_modified_blocks, modified_blocks);
 }
 
+// Number of threads transformLiquids() uses
+static u32 get_liquid_threads()
+{
+	if(g_settings->get("liquid_threads").empty())
+		return MYMAX(porting::getNumberOfProcessors(), 1);
+	return MYMAX(g_settings->getU16("liquid_threads"), 1);
+}
+
 void Map::transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks)
 {
 
 	if (g_settings->getBool("liquid_finite"))
 		return Map::transformLiquidsFinite(modified_blocks);
 
-	INodeDefManager *nodemgr = m_gamedef->ndef();
-
 	DSTACK(__FUNCTION_NAME);
 	//TimeTaker timer("transformLiquids()");
 
-	u32 loopcount = 0;
-	u32 initial_size = m_transforming_liquid.size();
-
-	/*if(initial_size != 0)
-		infostream<<"transformLiquids(): initial_size="<<initial_size<<std::endl;*/
-
-	// list of nodes that due to viscosity have not reached their max level height
-	UniqueQueue<v3s16> must_reflow;
-
 	// List of MapBlocks that will require a lighting update (due to lava)
 	std::map<v3s16, MapBlock*> lighting_modified_blocks;
 
-	while(m_transforming_liquid.size() != 0)
-	{
-		// This should be done here so that it is done when continue is used
-		if(loopcount >= initial_size || loopcount >= 10000)
-			break;
-		loopcount++;
-
-		/*
-			Get a queued transforming liquid node
-		*/
-		v3s16 p0 = m_transforming_liquid.pop_front();
-
-		MapNode n0 = getNodeNoEx(p0);
-
-		/*
-			Collect information about current node
-		 */
-		s8 liquid_level = -1;
-		content_t liquid_kind = CONTENT_IGNORE;
-		LiquidType liquid_type = nodemgr->get(n0).liquid_type;
-		switch (liquid_type) {
-			case LIQUID_SOURCE:
-				liquid_level = LIQUID_LEVEL_SOURCE;
-				liquid_kind = nodemgr->getId(nodemgr->get(n0).liquid_alternative_flowing);
-				break;
-			case LIQUID_FLOWING:
-				liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
-				liquid_kind = n0.getContent();
-				break;
-			case LIQUID_NONE:
-				// if this is an air node, it *could* be transformed into a liquid. otherwise,
-				// continue with the next node.
-				if (n0.getContent() != CONTENT_AIR)
-					continue;
-				liquid_kind = CONTENT_AIR;
-				break;
-		}
-
-		/*
-			Collect information about the environment
-		 */
-		const v3s16 *dirs = g_6dirs;
-		NodeNeighbor sources[6]; // surrounding sources
-		int num_sources = 0;
-		NodeNeighbor flows[6]; // surrounding flowing liquid nodes
-		int num_flows = 0;
-		NodeNeighbor airs[6]; // surrounding air
-		int num_airs = 0;
-		NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
-		int num_neutrals = 0;
-		bool flowing_down = false;
-		for (u16 i = 0; i < 6; i++) {
-			NeighborType nt = NEIGHBOR_SAME_LEVEL;
-			switch (i) {
-				case 1:
-					nt = NEIGHBOR_UPPER;
-					break;
-				case 4:
-					nt = NEIGHBOR_LOWER;
-					break;
-			}
-			v3s16 npos = p0 + dirs[i];
-			NodeNeighbor nb = {getNodeNoEx(npos), nt, npos};
-			switch (nodemgr->get(nb.n.getContent()).liquid_type) {
-				case LIQUID_NONE:
-					if (nb.n.getContent() == CONTENT_AIR) {
-						airs[num_airs++] = nb;
-						// if the current node is a water source the neighbor
-						// should be enqueded for transformation regardless of whether the
-						// current node changes or not.
-						if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
-							m_transforming_liquid.push_back(npos);
-						// if the current node happens to be a flowing node, it will start to flow down here.
-						if (nb.t == NEIGHBOR_LOWER) {
-							flowing_down = true;
-						}
-					} else {
-						neutrals[num_neutrals++] = nb;
-					}
-					break;
-				case LIQUID_SOURCE:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = nodemgr->getId(nodemgr->get(nb.n).liquid_alternative_flowing);
-					if (nodemgr->getId(nodemgr->get(nb.n).liquid_alternative_flowing) != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						// Do not count bottom source, it will screw things up
-						if(dirs[i].Y != -1)
-							sources[num_sources++] = nb;
-					}
-					break;
-				case LIQUID_FLOWING:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = nodemgr->getId(nodemgr->get(nb.n).liquid_alternative_flowing);
-					if (nodemgr->getId(nodemgr->get(nb.n).liquid_alternative_flowing) != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						flows[num_flows++] = nb;
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					}
-					break;
-			}
-		}
-
-		/*
-			decide on the type (and possibly level) of the current node
-		 */
-		content_t new_node_content;
-		s8 new_node_level = -1;
-		s8 max_node_level = -1;
-		if ((num_sources >= 2 && nodemgr->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
-			// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
-			// or the flowing alternative of the first of the surrounding sources (if it's air), so
-			// it's perfectly safe to use liquid_kind here to determine the new node content.
-			new_node_content = nodemgr->getId(nodemgr->get(liquid_kind).liquid_alternative_source);
-		} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
-			// liquid_kind is set properly, see above
-			new_node_content = liquid_kind;
-			max_node_level = new_node_level = LIQUID_LEVEL_MAX;
-		} else {
-			// no surrounding sources, so get the maximum level that can flow into this node
-			for (u16 i = 0; i < num_flows; i++) {
-				u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
-				switch (flows[i].t) {
-					case NEIGHBOR_UPPER:
-						if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
-							max_node_level = LIQUID_LEVEL_MAX;
-							if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
-								max_node_level = nb_liquid_level + WATER_DROP_BOOST;
-						} else if (nb_liquid_level > max_node_level)
-							max_node_level = nb_liquid_level;
-						break;
-					case NEIGHBOR_LOWER:
-						break;
-					case NEIGHBOR_SAME_LEVEL:
-						if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
-							nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level) {
-							max_node_level = nb_liquid_level - 1;
-						}
-						break;
-				}
-			}
-
-			u8 viscosity = nodemgr->get(liquid_kind).liquid_viscosity;
-			if (viscosity > 1 && max_node_level != liquid_level) {
-				// amount to gain, limited by viscosity
-				// must be at least 1 in absolute value
-				s8 level_inc = max_node_level - liquid_level;
-				if (level_inc < -viscosity || level_inc > viscosity)
-					new_node_level = liquid_level + level_inc/viscosity;
-				else if (level_inc < 0)
-					new_node_level = liquid_level - 1;
-				else if (level_inc > 0)
-					new_node_level = liquid_level + 1;
-				if (new_node_level != max_node_level)
-					must_reflow.push_back(p0);
-			} else
-				new_node_level = max_node_level;
-
-			if (new_node_level >= 0)
-				new_node_content = liquid_kind;
-			else
-				new_node_content = CONTENT_AIR;
-
-		}
-
-		/*
-			check if anything has changed. if not, just continue with the next node.
-		 */
-		if (new_node_content == n0.getContent() && (nodemgr->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
-										 ((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
-										 ((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
-										 == flowing_down)))
-			continue;
-
-
-		/*
-			update the current node
-		 */
-		//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
-		if (nodemgr->get(new_node_content).liquid_type == LIQUID_FLOWING) {
-			// set level to last 3 bits, flowing down bit to 4th bit
-			n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
-		} else {
-			// set the liquid level and flow bit to 0
-			n0.param2 = ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
-		}
-		n0.setContent(new_node_content);
-
-		// Find out whether there is a suspect for this action
-		std::string suspect;
-		if(m_gamedef->rollback()){
-			suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
-		}
-
-		if(!suspect.empty()){
-			// Blame suspect
-			RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
-			// Get old node for rollback
-			RollbackNode rollback_oldnode(this, p0, m_gamedef);
-			// Set node
-			setNode(p0, n0);
-			// Report
-			RollbackNode rollback_newnode(this, p0, m_gamedef);
-			RollbackAction action;
-			action.setSetNode(p0, rollback_oldnode, rollback_newnode);
-			m_gamedef->rollback()->reportAction(action);
-		} else {
-			// Set node
-			setNode(p0, n0);
-		}
-
-		v3s16 blockpos = getNodeBlockPos(p0);
-		MapBlock *block = getBlockNoCreateNoEx(blockpos);
-		if(block != NULL) {
-			modified_blocks[blockpos] =  block;
-			// If node emits light, MapBlock requires lighting update
-			if(nodemgr->get(n0).light_source != 0)
-				lighting_modified_blocks[block->getPos()] = block;
-		}
+	m_liquid->transform(m_transforming_liquid, get_liquid_threads(),
+			g_settings->getU16("liquid_step_budget"),
+			modified_blocks, lighting_modified_blocks);
 
-		/*
-			enqueue neighbors for update if neccessary
-		 */
-		switch (nodemgr->get(n0.getContent()).liquid_type) {
-			case LIQUID_SOURCE:
-			case LIQUID_FLOWING:
-				// make sure source flows into all neighboring nodes
-				for (u16 i = 0; i < num_flows; i++)
-					if (flows[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(flows[i].p);
-				for (u16 i = 0; i < num_airs; i++)
-					if (airs[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(airs[i].p);
-				break;
-			case LIQUID_NONE:
-				// this flow has turned to air; neighboring flows might need to do the same
-				for (u16 i = 0; i < num_flows; i++)
-					m_transforming_liquid.push_back(flows[i].p);
-				break;
-		}
-	}
-	//infostream<<"Map::transformLiquids(): loopcount="<<loopcount<<std::endl;
-	while (must_reflow.size() > 0)
-		m_transforming_liquid.push_back(must_reflow.pop_front());
 	updateLighting(lighting_modified_blocks, modified_blocks);
 }
 
@@ -2350,7 +1784,8 @@ ServerMap::ServerMap(std::string savedir, IGameDef *gamedef, EmergeManager *emer
 	m_map_metadata_changed(true),
 	m_database(NULL),
 	m_database_read(NULL),
-	m_database_write(NULL)
+	m_database_write(NULL),
+	m_save_pool("BlockSerializerThread")
 {
 	verbosestream<<__FUNCTION_NAME<<std::endl;
 
@@ -2492,19 +1927,26 @@ ServerMap::~ServerMap()
 #endif
 }
 
-bool ServerMap::initBlockMake(BlockMakeData *data, v3s16 blockpos)
+void ServerMap::getChunkBlockRange(v3s16 blockpos,
+		v3s16 &blockpos_min, v3s16 &blockpos_max)
 {
-	bool enable_mapgen_debug_info = m_emerge->mapgen_debug_info;
-	EMERGE_DBG_OUT("initBlockMake(): " PP(blockpos) " - " PP(blockpos));
-
 	s16 chunksize = m_mgparams->chunksize;
 	s16 coffset = -chunksize / 2;
 	v3s16 chunk_offset(coffset, coffset, coffset);
 	v3s16 blockpos_div = getContainerPos(blockpos - chunk_offset, chunksize);
-	v3s16 blockpos_min = blockpos_div * chunksize;
-	v3s16 blockpos_max = blockpos_div * chunksize + v3s16(1,1,1)*(chunksize-1);
+	blockpos_min = blockpos_div * chunksize;
+	blockpos_max = blockpos_div * chunksize + v3s16(1,1,1)*(chunksize-1);
 	blockpos_min += chunk_offset;
 	blockpos_max += chunk_offset;
+}
+
+bool ServerMap::initBlockMake(BlockMakeData *data, v3s16 blockpos)
+{
+	bool enable_mapgen_debug_info = m_emerge->mapgen_debug_info;
+	EMERGE_DBG_OUT("initBlockMake(): " PP(blockpos) " - " PP(blockpos));
+
+	v3s16 blockpos_min, blockpos_max;
+	getChunkBlockRange(blockpos, blockpos_min, blockpos_max);
 
 	v3s16 extra_borders(1,1,1);
 
@@ -3292,8 +2734,7 @@ void ServerMap::save(ModifiedState save_level)
 	u32 block_count = 0;
 	u32 block_count_all = 0; // Number of blocks in memory
 
-	// Don't do anything with sqlite unless something is really saved
-	bool save_started = false;
+	std::vector<MapBlock*> modified_blocks;
 
 	for(std::map<v2s16, MapSector*>::iterator i = m_sectors.begin();
 		i != m_sectors.end(); ++i)
@@ -3318,27 +2759,17 @@ void ServerMap::save(ModifiedState save_level)
 
 			if(block->getModified() >= (u32)save_level)
 			{
-				// Lazy beginSave()
-				if(!save_started){
-					beginSave();
-					save_started = true;
-				}
-
 				modprofiler.add(block->getModifiedReason(), 1);
 
-				saveBlock(block);
+				modified_blocks.push_back(block);
 				block_count++;
-
-				/*infostream<<"ServerMap: Written block ("
-						<<block->getPos().X<<","
-						<<block->getPos().Y<<","
-						<<block->getPos().Z<<")"
-						<<std::endl;*/
 			}
 		}
 	}
-	if(save_started)
-		endSave();
+
+	// Don't do anything with sqlite unless something is really saved
+	if(!modified_blocks.empty())
+		saveBlocks(modified_blocks);
 
 	/*
 		Only print if something happened or saved whole map
@@ -3667,6 +3098,75 @@ void ServerMap::endSave() {
 		infostream<<"WARNING: endSave() failed, map might not have saved.";
 }
 
+/*
+	Serialized form of a block in the database:
+	[0] u8 serialization version
+	[1] data
+*/
+static void serialize_block(MapBlock *block, std::string &data)
+{
+	// Format used for writing
+	u8 version = SER_FMT_VER_HIGHEST;
+
+	std::ostringstream o(std::ios_base::binary);
+	o.write((char*)&version, 1);
+
+	// Write basic data
+	block->serialize(o, version, true);
+
+	data = o.str();
+}
+
+/*
+	Hands out the blocks of ServerMap::saveBlocks() to the threads
+	serializing them
+*/
+class BlockSerializer : public WorkerPool::Job
+{
+public:
+	BlockSerializer(const std::vector<MapBlock*> &blocks,
+			std::vector<std::string> &data):
+		m_blocks(blocks),
+		m_data(data),
+		m_next(0)
+	{
+		m_mutex.Init();
+	}
+
+	// Serializes blocks until none are left
+	void work()
+	{
+		for(;;)
+		{
+			u32 i;
+			{
+				JMutexAutoLock lock(m_mutex);
+				if(m_next >= m_blocks.size())
+					return;
+				i = m_next++;
+			}
+			serialize_block(m_blocks[i], m_data[i]);
+		}
+	}
+
+private:
+	const std::vector<MapBlock*> &m_blocks;
+	std::vector<std::string> &m_data;
+	u32 m_next;
+	JMutex m_mutex;
+};
+
+// Not worth starting a thread for fewer blocks than this
+#define BLOCKS_PER_SAVE_THREAD 16
+
+// Number of threads saveBlocks() serializes with
+static u32 get_map_save_threads()
+{
+	if(g_settings->get("map_save_threads").empty())
+		return MYMAX(porting::getNumberOfProcessors(), 1);
+	return MYMAX(g_settings->getU16("map_save_threads"), 1);
+}
+
 void ServerMap::saveBlock(MapBlock *block)
 {
 	DSTACK(__FUNCTION_NAME);
@@ -3681,48 +3181,70 @@ void ServerMap::saveBlock(MapBlock *block)
 		return;
 	}
 
-	// Format used for writing
-	u8 version = SER_FMT_VER_HIGHEST;
-	// Get destination
-	v3s16 p3d = block->getPos();
+	std::string data;
+	serialize_block(block, data);
+
+	// We just wrote it to the disk so clear modified flag
+	if(saveBlockData(block->getPos(), data))
+		block->resetModified();
+}
 
+void ServerMap::saveBlocks(const std::vector<MapBlock*> &blocks)
+{
+	DSTACK(__FUNCTION_NAME);
 
-#if 0
-	v2s16 p2d(p3d.X, p3d.Z);
-	std::string sectordir = getSectorDir(p2d);
+	// Dummy blocks are not written
+	std::vector<MapBlock*> saved;
+	saved.reserve(blocks.size());
+	for(u32 i = 0; i < blocks.size(); i++)
+	{
+		if(!blocks[i]->isDummy())
+			saved.push_back(blocks[i]);
+	}
+	if(saved.empty())
+		return;
 
-	createDirs(sectordir);
+	/*
+		Serialize and compress in parallel. The threads only touch the
+		blocks given to them; the references keep the blocks from being
+		unloaded meanwhile.
+	*/
+	std::vector<std::string> data(saved.size());
+	for(u32 i = 0; i < saved.size(); i++)
+		saved[i]->refGrab();
+	{
+		ScopeProfiler sp(g_profiler, "ServerMap: serialize blocks", SPT_AVG);
+		BlockSerializer serializer(saved, data);
+		u32 num_threads = MYMIN(get_map_save_threads(),
+				(saved.size() + BLOCKS_PER_SAVE_THREAD - 1)
+				/ BLOCKS_PER_SAVE_THREAD);
+		m_save_pool.run(&serializer, num_threads);
+	}
 
-	std::string fullpath = sectordir+DIR_DELIM+getBlockFilename(p3d);
-	std::ofstream o(fullpath.c_str(), std::ios_base::binary);
-	if(o.good() == false)
-		throw FileNotGoodException("Cannot open block data");
-#endif
 	/*
-		[0] u8 serialization version
-		[1] data
+		Write everything in one transaction
 	*/
+	beginSave();
+	for(u32 i = 0; i < saved.size(); i++)
+	{
+		// We just wrote it to the disk so clear modified flag
+		if(saveBlockData(saved[i]->getPos(), data[i]))
+			saved[i]->resetModified();
+		saved[i]->refDrop();
+	}
+	endSave();
+}
 
+bool ServerMap::saveBlockData(v3s16 p3d, const std::string &data)
+{
 	verifyDatabase();
 
-	std::ostringstream o(std::ios_base::binary);
-
-	o.write((char*)&version, 1);
-
-	// Write basic data
-	block->serialize(o, version, true);
-
-	// Write block to database
-
-	std::string tmp = o.str();
-	const char *bytes = tmp.c_str();
-
 	bool success = true;
 	if(sqlite3_bind_int64(m_database_write, 1, getBlockAsInteger(p3d)) != SQLITE_OK) {
 		infostream<<"WARNING: Block position failed to bind: "<<sqlite3_errmsg(m_database)<<std::endl;
 		success = false;
 	}
-	if(sqlite3_bind_blob(m_database_write, 2, (void *)bytes, o.tellp(), NULL) != SQLITE_OK) { // TODO this mught not be the right length
+	if(sqlite3_bind_blob(m_database_write, 2, (void *)data.c_str(), data.size(), NULL) != SQLITE_OK) {
 		infostream<<"WARNING: Block data failed to bind: "<<sqlite3_errmsg(m_database)<<std::endl;
 		success = false;
 	}
@@ -3735,9 +3257,7 @@ void ServerMap::saveBlock(MapBlock *block)
 	// Make ready for later reuse
 	sqlite3_reset(m_database_write);
 
-	// We just wrote it to the disk so clear modified flag
-	if (success)
-		block->resetModified();
+	return success;
 }
 
 void ServerMap::loadBlock(std::string sectordir, std::string blockfile, MapSector *sector, bool save_after_load)
@@ -4252,7 +3772,8 @@ void ManualMapVoxelManipulator::blitBackAll(
 		v3s16 p = i->first;
 		MapBlock *block = m_map->getBlockNoCreateNoEx(p);
 		bool existed = !(i->second & VMANIP_BLOCK_DATA_INEXIST);
-		if(existed == false)
+		// The block may have been unloaded since it was read
+		if(existed == false || block == NULL)
 		{
 			continue;
 		}
@@ -28,6 +28,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <set>
 #include <map>
 #include <list>
+#include <vector>
 
 #include "irrlichttypes_bloated.h"
 #include "mapnode.h"
@@ -36,7 +37,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapgen.h" //for BlockMakeData and EmergeManager
 #include "modifiedstate.h"
 #include "util/container.h"
+#include "util/thread.h"
 #include "nodetimer.h"
+#include "mapblockindex.h"
+#include "mapliquid.h"
 
 extern "C" {
 	#include "sqlite3.h"
@@ -50,6 +54,8 @@ class NodeMetadata;
 class IGameDef;
 class IRollbackReportSink;
 class EmergeManager;
+class MapLightEngine;
+class MapLiquidEngine;
 struct BlockMakeData;
 
 
@@ -187,7 +193,24 @@ class Map /*: public NodeContainer*/
 	// Returns InvalidPositionException if not found
 	MapBlock * getBlockNoCreate(v3s16 p);
 	// Returns NULL if not found
-	MapBlock * getBlockNoCreateNoEx(v3s16 p);
+	MapBlock * getBlockNoCreateNoEx(v3s16 p)
+	{
+		BlockCacheEntry &e = m_block_cache[blockCacheIndex(p)];
+		if(e.valid && e.p == p)
+			return e.block;
+		MapBlock *block = m_block_index.get(p);
+		e.valid = true;
+		e.p = p;
+		e.block = block;
+		return block;
+	}
+
+	/*
+		Called by MapSector when a block is added to or removed from it.
+		Keeps the block index and lookup cache up to date.
+	*/
+	void indexBlock(MapBlock *block);
+	void unindexBlock(v3s16 p);
 
 	/* Server overrides */
 	virtual MapBlock * emergeBlock(v3s16 p, bool allow_generate=true)
@@ -268,16 +291,21 @@ class Map /*: public NodeContainer*/
 
 	virtual void save(ModifiedState save_level){assert(0);};
 
-	// Server implements this.
-	// Client leaves it as no-op.
+	// Server implements these.
+	// Client leaves them as no-op.
 	virtual void saveBlock(MapBlock *block){};
+	virtual void saveBlocks(const std::vector<MapBlock*> &blocks){};
 
 	/*
 		Updates usage timers and unloads unused blocks and sectors.
 		Saves modified blocks before unloading on MAPTYPE_SERVER.
+		At most max_unloaded_blocks blocks (0 = no limit) are unloaded,
+		the ones unused for the longest time first.
+		Packs the node data of blocks that haven't been accessed in
+		pack_timeout seconds (negative = never).
 	*/
-	void timerUpdate(float dtime, float unload_timeout,
-			std::list<v3s16> *unloaded_blocks=NULL);
+	void timerUpdate(float dtime, float unload_timeout, float pack_timeout,
+			u32 max_unloaded_blocks, std::list<v3s16> *unloaded_blocks=NULL);
 
 	// Deletes sectors and their blocks from memory
 	// Takes cache into account
@@ -344,8 +372,37 @@ class Map /*: public NodeContainer*/
 	MapSector *m_sector_cache;
 	v2s16 m_sector_cache_p;
 
+	// All blocks of all sectors by position
+	MapBlockIndex m_block_index;
+
+	/*
+		Direct-mapped cache in front of m_block_index. A 4x4x4 block
+		neighbourhood maps to distinct entries. Misses are cached too
+		(block=NULL) and are overwritten by indexBlock().
+
+		The map is only accessed by one thread at a time (the environment
+		lock on the server, the main thread on the client), so one cache
+		per map serves as the per-thread cache.
+	*/
+	struct BlockCacheEntry
+	{
+		bool valid;
+		v3s16 p;
+		MapBlock *block;
+	};
+	static u32 blockCacheIndex(v3s16 p)
+	{
+		return (p.X & 3) | ((p.Y & 3) << 2) | ((p.Z & 3) << 4);
+	}
+	BlockCacheEntry m_block_cache[64];
+
 	// Queued transforming water nodes
-	UniqueQueue<v3s16> m_transforming_liquid;
+	LiquidQueue m_transforming_liquid;
+
+	// Used by the lighting functions
+	MapLightEngine *m_light;
+	// Used by transformLiquids()
+	MapLiquidEngine *m_liquid;
 };
 
 /*
@@ -379,6 +436,9 @@ class ServerMap : public Map
 	/*
 		Blocks are generated by using these and makeBlock().
 	*/
+	// Gets the blocks of the chunk containing blockpos
+	void getChunkBlockRange(v3s16 blockpos,
+			v3s16 &blockpos_min, v3s16 &blockpos_max);
 	bool initBlockMake(BlockMakeData *data, v3s16 blockpos);
 	MapBlock *finishBlockMake(BlockMakeData *data,
 			std::map<v3s16, MapBlock*> &changed_blocks);
@@ -459,6 +519,14 @@ class ServerMap : public Map
 	//bool deFlushSector(v2s16 p2d);
 
 	void saveBlock(MapBlock *block);
+	/*
+		Serializes the blocks in worker threads and writes them in a
+		single transaction. The caller must keep the blocks from being
+		modified until this returns.
+	*/
+	void saveBlocks(const std::vector<MapBlock*> &blocks);
+	// Writes serialized block data; returns false on failure
+	bool saveBlockData(v3s16 p, const std::string &data);
 	// This will generate a sector with getSector if not found.
 	void loadBlock(std::string sectordir, std::string blockfile, MapSector *sector, bool save_after_load=false);
 	MapBlock* loadBlock(v3s16 p);
@@ -507,6 +575,9 @@ class ServerMap : public Map
 	sqlite3_stmt *m_database_read;
 	sqlite3_stmt *m_database_write;
 	sqlite3_stmt *m_database_list;
+
+	// Threads that serialize the blocks of saveBlocks()
+	WorkerPool m_save_pool;
 };
 
 #define VMANIP_BLOCK_DATA_INEXIST     1
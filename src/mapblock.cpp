@@ -20,6 +20,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapblock.h"
 
 #include <sstream>
+#include <map>
+#include <cstring> // memset
+#include <jmutexautolock.h>
 #include "map.h"
 // For g_settings
 #include "main.h"
@@ -39,6 +42,120 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define PP(x) "("<<(x).X<<","<<(x).Y<<","<<(x).Z<<")"
 
+/*
+	PackedNodeData
+*/
+
+void PackedNodeData::Channel::pack(const u16 *values, u32 count)
+{
+	/*
+		Build the palette. The map is only used for values not equal
+		to the previous one, which are rare in most blocks.
+	*/
+	std::map<u16, u16> palette_map;
+	std::vector<u16> index_of(count);
+	palette.clear();
+	u16 last_value = 0;
+	u16 last_index = 0;
+	for(u32 i = 0; i < count; i++)
+	{
+		u16 v = values[i];
+		if(i != 0 && v == last_value)
+		{
+			index_of[i] = last_index;
+			continue;
+		}
+		std::map<u16, u16>::iterator j = palette_map.find(v);
+		if(j == palette_map.end())
+		{
+			j = palette_map.insert(
+					std::make_pair(v, (u16)palette.size())).first;
+			palette.push_back(v);
+		}
+		last_value = v;
+		last_index = j->second;
+		index_of[i] = last_index;
+	}
+
+	u32 n = palette.size();
+	if(n <= 1)
+		bits = 0;
+	else if(n <= 2)
+		bits = 1;
+	else if(n <= 4)
+		bits = 2;
+	else if(n <= 16)
+		bits = 4;
+	else if(n <= 256)
+		bits = 8;
+	else
+		bits = 16;
+
+	indices.clear();
+	if(bits == 0)
+		return;
+	indices.resize((count * bits + 7) / 8, 0);
+	if(bits == 16)
+	{
+		// Too many values for a palette to pay off; store them as is
+		palette.clear();
+		for(u32 i = 0; i < count; i++)
+			writeU16(&indices[i * 2], values[i]);
+		return;
+	}
+	for(u32 i = 0; i < count; i++)
+	{
+		u32 bit = i * bits;
+		indices[bit >> 3] |= index_of[i] << (bit & 7);
+	}
+}
+
+u16 PackedNodeData::Channel::get(u32 i) const
+{
+	if(bits == 0)
+		return palette[0];
+	if(bits == 16)
+		return readU16(&indices[i * 2]);
+	u32 bit = i * bits;
+	u8 mask = (1 << bits) - 1;
+	return palette[(indices[bit >> 3] >> (bit & 7)) & mask];
+}
+
+void PackedNodeData::pack(const MapNode *nodes)
+{
+	const u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
+	u16 values[nodecount];
+
+	for(u32 i = 0; i < nodecount; i++)
+		values[i] = nodes[i].getContent();
+	m_content.pack(values, nodecount);
+
+	for(u32 i = 0; i < nodecount; i++)
+		values[i] = nodes[i].getParam1();
+	m_param1.pack(values, nodecount);
+
+	for(u32 i = 0; i < nodecount; i++)
+		values[i] = nodes[i].getParam2();
+	m_param2.pack(values, nodecount);
+}
+
+void PackedNodeData::unpack(MapNode *nodes) const
+{
+	const u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
+	for(u32 i = 0; i < nodecount; i++)
+		nodes[i] = MapNode(m_content.get(i), m_param1.get(i),
+				m_param2.get(i));
+}
+
+u32 PackedNodeData::getMemoryUsage() const
+{
+	return sizeof(*this)
+			+ (m_content.palette.size() + m_param1.palette.size()
+				+ m_param2.palette.size()) * sizeof(u16)
+			+ m_content.indices.size() + m_param1.indices.size()
+			+ m_param2.indices.size();
+}
+
 /*
 	MapBlock
 */
@@ -47,6 +164,7 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 		m_parent(parent),
 		m_pos(pos),
 		m_gamedef(gamedef),
+		m_packed_data(NULL),
 		m_modified(MOD_STATE_WRITE_NEEDED),
 		m_modified_reason("initial"),
 		m_modified_reason_too_long(false),
@@ -58,6 +176,7 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 		m_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
 		m_disk_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
 		m_usage_timer(0),
+		m_pack_timer(0),
 		m_refcount(0)
 {
 	data = NULL;
@@ -86,6 +205,27 @@ MapBlock::~MapBlock()
 
 	if(data)
 		delete[] data;
+	if(m_packed_data)
+		delete m_packed_data;
+}
+
+void MapBlock::packData()
+{
+	if(data == NULL)
+		return;
+	m_packed_data = new PackedNodeData;
+	m_packed_data->pack(data);
+	delete[] data;
+	data = NULL;
+}
+
+void MapBlock::unpackData()
+{
+	assert(data == NULL && m_packed_data != NULL);
+	data = new MapNode[MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE];
+	m_packed_data->unpack(data);
+	delete m_packed_data;
+	m_packed_data = NULL;
 }
 
 bool MapBlock::isValidPositionParent(v3s16 p)
@@ -107,7 +247,7 @@ MapNode MapBlock::getNodeParent(v3s16 p)
 	}
 	else
 	{
-		if(data == NULL)
+		if(!haveData())
 			throw InvalidPositionException();
 		return data[p.Z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + p.Y*MAP_BLOCKSIZE + p.X];
 	}
@@ -121,7 +261,7 @@ void MapBlock::setNodeParent(v3s16 p, MapNode & n)
 	}
 	else
 	{
-		if(data == NULL)
+		if(!haveData())
 			throw InvalidPositionException();
 		data[p.Z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + p.Y*MAP_BLOCKSIZE + p.X] = n;
 	}
@@ -141,7 +281,7 @@ MapNode MapBlock::getNodeParentNoEx(v3s16 p)
 	}
 	else
 	{
-		if(data == NULL)
+		if(!haveData())
 		{
 			return MapNode(CONTENT_IGNORE);
 		}
@@ -344,6 +484,9 @@ void MapBlock::copyTo(VoxelManipulator &dst)
 	v3s16 data_size(MAP_BLOCKSIZE, MAP_BLOCKSIZE, MAP_BLOCKSIZE);
 	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
 	
+	if(!haveData())
+		return;
+
 	// Copy from data to VoxelManipulator
 	dst.copyFrom(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
@@ -354,6 +497,9 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	v3s16 data_size(MAP_BLOCKSIZE, MAP_BLOCKSIZE, MAP_BLOCKSIZE);
 	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
 	
+	if(!haveData())
+		return;
+
 	// Copy from VoxelManipulator to data
 	dst.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
@@ -365,7 +511,7 @@ void MapBlock::actuallyUpdateDayNightDiff()
 	// Running this function un-expires m_day_night_differs
 	m_day_night_differs_expired = false;
 
-	if(data == NULL)
+	if(!haveData())
 	{
 		m_day_night_differs = false;
 		return;
@@ -414,7 +560,7 @@ void MapBlock::expireDayNightDiff()
 {
 	//INodeDefManager *nodemgr = m_gamedef->ndef();
 
-	if(data == NULL){
+	if(isDummy()){
 		m_day_night_differs = false;
 		m_day_night_differs_expired = false;
 		return;
@@ -452,41 +598,32 @@ s16 MapBlock::getGroundLevel(v2s16 p2d)
 /*
 	Serialization
 */
-// List relevant id-name pairs for ids in the block using nodedef
-// Renumbers the content IDs (starting at 0 and incrementing
-static void getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
+// List relevant id-name pairs for ids in the block using nodedef.
+// The global content ids are kept, so that loading the block again with
+// the same node definitions needs no remapping.
+static void getBlockNodeIdMapping(NameIdMapping *nimap, const MapNode *nodes,
 		INodeDefManager *nodedef)
 {
-	std::map<content_t, content_t> mapping;
+	bool seen[MAX_CONTENT+1];
+	memset(seen, 0, sizeof(seen));
 	std::set<content_t> unknown_contents;
-	content_t id_counter = 0;
 	for(u32 i=0; i<MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE; i++)
 	{
-		content_t global_id = nodes[i].getContent();
-		content_t id = CONTENT_IGNORE;
-
-		// Try to find an existing mapping
-		std::map<content_t, content_t>::iterator j = mapping.find(global_id);
-		if(j != mapping.end())
-		{
-			id = j->second;
-		}
-		else
-		{
-			// We have to assign a new mapping
-			id = id_counter++;
-			mapping.insert(std::make_pair(global_id, id));
-
-			const ContentFeatures &f = nodedef->get(global_id);
-			const std::string &name = f.name;
-			if(name == "")
-				unknown_contents.insert(global_id);
-			else
-				nimap->set(id, name);
+		content_t id = nodes[i].getContent();
+		if(id > MAX_CONTENT){
+			unknown_contents.insert(id);
+			continue;
 		}
+		if(seen[id])
+			continue;
+		seen[id] = true;
 
-		// Update the MapNode
-		nodes[i].setContent(id);
+		const ContentFeatures &f = nodedef->get(id);
+		const std::string &name = f.name;
+		if(name == "")
+			unknown_contents.insert(id);
+		else
+			nimap->set(id, name);
 	}
 	for(std::set<content_t>::const_iterator
 			i = unknown_contents.begin();
@@ -495,53 +632,161 @@ static void getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
 				<<"Name for node id "<<(*i)<<" not known"<<std::endl;
 	}
 }
-// Correct ids in the block to match nodedef based on names.
-// Unknown ones are added to nodedef.
-// Will not update itself to match id-name pairs in nodedef.
-static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
-		IGameDef *gamedef)
+
+/*
+	Tables translating the content ids of the name-id mapping of a block
+	to global content ids. Blocks near each other mostly contain the same
+	nodes and thus have the same mapping, so the last few tables are
+	kept. A table is valid while the id version of the node definitions
+	it was made with stays the same.
+*/
+
+// Table value of ids that have no name in the mapping
+#define CONTENT_ID_UNNAMED 0xffffffff
+#define CONTENT_ID_TRANSLATION_CACHE_SIZE 4
+
+class ContentIdTranslationCache
 {
-	INodeDefManager *nodedef = gamedef->ndef();
-	// This means the block contains incorrect ids, and we contain
-	// the information to convert those to names.
-	// nodedef contains information to convert our names to globally
-	// correct ids.
-	std::set<content_t> unnamed_contents;
-	std::set<std::string> unallocatable_contents;
-	for(u32 i=0; i<MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE; i++)
+public:
+	ContentIdTranslationCache():
+		m_next(0)
 	{
-		content_t local_id = nodes[i].getContent();
-		std::string name;
-		bool found = nimap->getName(local_id, name);
-		if(!found){
-			unnamed_contents.insert(local_id);
-			continue;
+		m_mutex.Init();
+	}
+
+	// Correct ids in the block to match nodedef based on names.
+	// Unknown ones are added to nodedef.
+	// Will not update itself to match id-name pairs in nodedef.
+	void translate(const NameIdMapping &nimap, MapNode *nodes,
+			IGameDef *gamedef)
+	{
+		JMutexAutoLock lock(m_mutex);
+
+		const Entry &e = getEntry(nimap, gamedef);
+
+		std::set<content_t> unnamed_contents;
+		u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
+		u32 table_size = e.table.size();
+		const u32 *table = table_size ? &e.table[0] : NULL;
+		if(e.identity)
+		{
+			// Nothing to change, but report ids without a name
+			for(u32 i=0; i<nodecount; i++)
+			{
+				content_t id = nodes[i].getContent();
+				if(id >= table_size || table[id] == CONTENT_ID_UNNAMED)
+					unnamed_contents.insert(id);
+			}
 		}
-		content_t global_id;
-		found = nodedef->getId(name, global_id);
-		if(!found){
-			global_id = gamedef->allocateUnknownNodeId(name);
-			if(global_id == CONTENT_IGNORE){
-				unallocatable_contents.insert(name);
-				continue;
+		else
+		{
+			for(u32 i=0; i<nodecount; i++)
+			{
+				content_t id = nodes[i].getContent();
+				if(id >= table_size || table[id] == CONTENT_ID_UNNAMED){
+					unnamed_contents.insert(id);
+					continue;
+				}
+				nodes[i].setContent(table[id]);
 			}
 		}
-		nodes[i].setContent(global_id);
-	}
-	for(std::set<content_t>::const_iterator
-			i = unnamed_contents.begin();
-			i != unnamed_contents.end(); i++){
-		errorstream<<"correctBlockNodeIds(): IGNORING ERROR: "
-				<<"Block contains id "<<(*i)
-				<<" with no name mapping"<<std::endl;
+
+		for(std::set<content_t>::const_iterator
+				i = unnamed_contents.begin();
+				i != unnamed_contents.end(); i++){
+			errorstream<<"correctBlockNodeIds(): IGNORING ERROR: "
+					<<"Block contains id "<<(*i)
+					<<" with no name mapping"<<std::endl;
+		}
 	}
-	for(std::set<std::string>::const_iterator
-			i = unallocatable_contents.begin();
-			i != unallocatable_contents.end(); i++){
-		errorstream<<"correctBlockNodeIds(): IGNORING ERROR: "
-				<<"Could not allocate global id for node name \""
-				<<(*i)<<"\""<<std::endl;
+
+private:
+	struct Entry
+	{
+		const INodeDefManager *ndef;
+		u32 id_version;
+		NameIdMapping nimap;
+		// Global id indexed by block id, or CONTENT_ID_UNNAMED
+		std::vector<u32> table;
+		// Whether every id maps to itself
+		bool identity;
+
+		Entry():
+			ndef(NULL),
+			id_version(0),
+			identity(false)
+		{}
+	};
+
+	const Entry & getEntry(const NameIdMapping &nimap, IGameDef *gamedef)
+	{
+		INodeDefManager *nodedef = gamedef->ndef();
+		for(u32 i=0; i<CONTENT_ID_TRANSLATION_CACHE_SIZE; i++)
+		{
+			const Entry &e = m_entries[i];
+			if(e.ndef == nodedef
+					&& e.id_version == nodedef->getIdVersion()
+					&& e.nimap == nimap)
+				return e;
+		}
+
+		Entry &e = m_entries[m_next];
+		m_next = (m_next + 1) % CONTENT_ID_TRANSLATION_CACHE_SIZE;
+
+		const std::map<u16, std::string> &id_to_name = nimap.getIdToName();
+		e.table.clear();
+		if(!id_to_name.empty())
+			e.table.resize((u32)id_to_name.rbegin()->first + 1,
+					CONTENT_ID_UNNAMED);
+		e.identity = true;
+		std::set<std::string> unallocatable_contents;
+		for(std::map<u16, std::string>::const_iterator
+				i = id_to_name.begin(); i != id_to_name.end(); i++)
+		{
+			const std::string &name = i->second;
+			content_t global_id;
+			bool found = nodedef->getId(name, global_id);
+			if(!found){
+				global_id = gamedef->allocateUnknownNodeId(name);
+				if(global_id == CONTENT_IGNORE){
+					unallocatable_contents.insert(name);
+					// Leave the nodes as they are
+					global_id = i->first;
+				}
+			}
+			e.table[i->first] = global_id;
+			if(global_id != i->first)
+				e.identity = false;
+		}
+		for(std::set<std::string>::const_iterator
+				i = unallocatable_contents.begin();
+				i != unallocatable_contents.end(); i++){
+			errorstream<<"correctBlockNodeIds(): IGNORING ERROR: "
+					<<"Could not allocate global id for node name \""
+					<<(*i)<<"\""<<std::endl;
+		}
+
+		// Allocating ids for unknown nodes changes the version
+		e.ndef = nodedef;
+		e.id_version = nodedef->getIdVersion();
+		e.nimap = nimap;
+		return e;
 	}
+
+	Entry m_entries[CONTENT_ID_TRANSLATION_CACHE_SIZE];
+	u32 m_next;
+	JMutex m_mutex;
+};
+
+static ContentIdTranslationCache g_content_id_translation_cache;
+
+// Correct ids in the block to match nodedef based on names.
+// Unknown ones are added to nodedef.
+// Will not update itself to match id-name pairs in nodedef.
+static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
+		IGameDef *gamedef)
+{
+	g_content_id_translation_cache.translate(*nimap, nodes, gamedef);
 }
 
 void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
@@ -549,7 +794,7 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
 	
-	if(data == NULL)
+	if(!haveData())
 	{
 		throw SerializationError("ERROR: Not writing dummy block.");
 	}
@@ -578,29 +823,13 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 	NameIdMapping nimap;
 	u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
 	if(disk)
-	{
-		MapNode *tmp_nodes = new MapNode[nodecount];
-		for(u32 i=0; i<nodecount; i++)
-			tmp_nodes[i] = data[i];
-		getBlockNodeIdMapping(&nimap, tmp_nodes, m_gamedef->ndef());
-
-		u8 content_width = 2;
-		u8 params_width = 2;
-		writeU8(os, content_width);
-		writeU8(os, params_width);
-		MapNode::serializeBulk(os, version, tmp_nodes, nodecount,
-				content_width, params_width, true);
-		delete[] tmp_nodes;
-	}
-	else
-	{
-		u8 content_width = 2;
-		u8 params_width = 2;
-		writeU8(os, content_width);
-		writeU8(os, params_width);
-		MapNode::serializeBulk(os, version, data, nodecount,
-				content_width, params_width, true);
-	}
+		getBlockNodeIdMapping(&nimap, data, m_gamedef->ndef());
+	u8 content_width = 2;
+	u8 params_width = 2;
+	writeU8(os, content_width);
+	writeU8(os, params_width);
+	MapNode::serializeBulk(os, version, data, nodecount,
+			content_width, params_width, true);
 	
 	/*
 		Node metadata
@@ -644,6 +873,9 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 
 	m_day_night_differs_expired = false;
 
+	// The node data is written in place
+	haveData();
+
 	if(version <= 21)
 	{
 		deSerialize_pre22(is, version, disk);
@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <jmutexautolock.h>
 #include <exception>
 #include <set>
+#include <vector>
 #include "debug.h"
 #include "irrlichttypes.h"
 #include "irr_v3d.h"
@@ -103,6 +104,40 @@ class NodeContainer
 };
 #endif
 
+/*
+	Node data of a MapBlock in a compact form, used for blocks whose
+	nodes haven't been accessed in a while.
+
+	Content, param1 and param2 are each stored as indices to a palette
+	of their distinct values, packed into as few bits as the palette
+	size allows. A uniform array (all air, all stone, constant light)
+	takes no space besides its single palette entry.
+*/
+class PackedNodeData
+{
+public:
+	void pack(const MapNode *nodes);
+	void unpack(MapNode *nodes) const;
+
+	// Approximate heap usage in bytes
+	u32 getMemoryUsage() const;
+
+private:
+	struct Channel
+	{
+		std::vector<u16> palette;
+		u8 bits;
+		std::vector<u8> indices;
+
+		void pack(const u16 *values, u32 count);
+		u16 get(u32 i) const;
+	};
+
+	Channel m_content;
+	Channel m_param1;
+	Channel m_param2;
+};
+
 /*
 	MapBlock itself
 */
@@ -127,6 +162,11 @@ class MapBlock /*: public NodeContainer*/
 	{
 		if(data != NULL)
 			delete[] data;
+		if(m_packed_data != NULL)
+		{
+			delete m_packed_data;
+			m_packed_data = NULL;
+		}
 		u32 l = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
 		data = new MapNode[l];
 		for(u32 i=0; i<l; i++){
@@ -142,7 +182,7 @@ class MapBlock /*: public NodeContainer*/
 
 	bool isDummy()
 	{
-		return (data == NULL);
+		return (data == NULL && m_packed_data == NULL);
 	}
 	void unDummify()
 	{
@@ -226,7 +266,7 @@ class MapBlock /*: public NodeContainer*/
 	{
 		if(m_lighting_expired)
 			return false;
-		if(data == NULL)
+		if(isDummy())
 			return false;
 		return true;
 	}
@@ -259,7 +299,7 @@ class MapBlock /*: public NodeContainer*/
 	
 	bool isValidPosition(v3s16 p)
 	{
-		if(data == NULL)
+		if(isDummy())
 			return false;
 		return (p.X >= 0 && p.X < MAP_BLOCKSIZE
 				&& p.Y >= 0 && p.Y < MAP_BLOCKSIZE
@@ -268,7 +308,7 @@ class MapBlock /*: public NodeContainer*/
 
 	MapNode getNode(s16 x, s16 y, s16 z)
 	{
-		if(data == NULL)
+		if(!haveData())
 			throw InvalidPositionException();
 		if(x < 0 || x >= MAP_BLOCKSIZE) throw InvalidPositionException();
 		if(y < 0 || y >= MAP_BLOCKSIZE) throw InvalidPositionException();
@@ -292,7 +332,7 @@ class MapBlock /*: public NodeContainer*/
 	
 	void setNode(s16 x, s16 y, s16 z, MapNode & n)
 	{
-		if(data == NULL)
+		if(!haveData())
 			throw InvalidPositionException();
 		if(x < 0 || x >= MAP_BLOCKSIZE) throw InvalidPositionException();
 		if(y < 0 || y >= MAP_BLOCKSIZE) throw InvalidPositionException();
@@ -312,7 +352,7 @@ class MapBlock /*: public NodeContainer*/
 
 	MapNode getNodeNoCheck(s16 x, s16 y, s16 z)
 	{
-		if(data == NULL)
+		if(!haveData())
 			throw InvalidPositionException();
 		return data[z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + y*MAP_BLOCKSIZE + x];
 	}
@@ -324,7 +364,7 @@ class MapBlock /*: public NodeContainer*/
 	
 	void setNodeNoCheck(s16 x, s16 y, s16 z, MapNode & n)
 	{
-		if(data == NULL)
+		if(!haveData())
 			throw InvalidPositionException();
 		data[z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + y*MAP_BLOCKSIZE + x] = n;
 		raiseModified(MOD_STATE_WRITE_NEEDED, "setNodeNoCheck");
@@ -335,6 +375,20 @@ class MapBlock /*: public NodeContainer*/
 		setNodeNoCheck(p.X, p.Y, p.Z, n);
 	}
 
+	/*
+		The node array itself, indexed by z*MAP_BLOCKSIZE*MAP_BLOCKSIZE
+		+ y*MAP_BLOCKSIZE + x. For bulk algorithms that would otherwise
+		go through getNode() and setNode() for every node.
+		Unpacks the data. Returns NULL for dummy blocks.
+		Changes made through it are not tracked; call raiseModified().
+	*/
+	MapNode * getData()
+	{
+		if(!haveData())
+			return NULL;
+		return data;
+	}
+
 	/*
 		These functions consult the parent container if the position
 		is not valid on this MapBlock.
@@ -426,12 +480,34 @@ class MapBlock /*: public NodeContainer*/
 	void incrementUsageTimer(float dtime)
 	{
 		m_usage_timer += dtime;
+		m_pack_timer += dtime;
 	}
 	u32 getUsageTimer()
 	{
 		return m_usage_timer;
 	}
 
+	/*
+		Packed node data (see PackedNodeData).
+
+		Accessing the nodes in any way unpacks the data again and
+		resets the pack timer, which otherwise counts along with the
+		usage timer.
+	*/
+	void packData();
+	bool isDataPacked()
+	{
+		return (m_packed_data != NULL);
+	}
+	u32 getPackedDataMemoryUsage()
+	{
+		return m_packed_data ? m_packed_data->getMemoryUsage() : 0;
+	}
+	float getPackTimer()
+	{
+		return m_pack_timer;
+	}
+
 	/*
 		See m_refcount
 	*/
@@ -486,13 +562,30 @@ class MapBlock /*: public NodeContainer*/
 
 	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
 
+	/*
+		Makes data available, unpacking it if needed, and restarts the
+		pack timer. Every access to the nodes goes through here.
+		Returns false if the block is a dummy.
+	*/
+	bool haveData()
+	{
+		m_pack_timer = 0;
+		if(data != NULL)
+			return true;
+		if(m_packed_data == NULL)
+			return false;
+		unpackData();
+		return true;
+	}
+	void unpackData();
+
 	/*
 		Used only internally, because changes can't be tracked
 	*/
 
 	MapNode & getNodeRef(s16 x, s16 y, s16 z)
 	{
-		if(data == NULL)
+		if(!haveData())
 			throw InvalidPositionException();
 		if(x < 0 || x >= MAP_BLOCKSIZE) throw InvalidPositionException();
 		if(y < 0 || y >= MAP_BLOCKSIZE) throw InvalidPositionException();
@@ -531,11 +624,16 @@ class MapBlock /*: public NodeContainer*/
 	IGameDef *m_gamedef;
 	
 	/*
-		If NULL, block is a dummy block.
+		If NULL and m_packed_data is NULL, block is a dummy block.
 		Dummy blocks are used for caching not-found-on-disk blocks.
 	*/
 	MapNode * data;
 
+	/*
+		If not NULL, the node data is packed and data is NULL.
+	*/
+	PackedNodeData *m_packed_data;
+
 	/*
 		- On the server, this is used for telling whether the
 		  block has been modified from the one on disk.
@@ -584,6 +682,12 @@ class MapBlock /*: public NodeContainer*/
 	*/
 	float m_usage_timer;
 
+	/*
+		Time since the nodes were last accessed or the block was loaded.
+		The data is packed when this reaches a timeout.
+	*/
+	float m_pack_timer;
+
 	/*
 		Reference count; currently used for determining if this block is in
 		the list of blocks to be drawn.
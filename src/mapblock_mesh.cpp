@@ -51,6 +51,7 @@ MeshMakeData::MeshMakeData(IGameDef *gamedef):
 	m_blockpos(-1337,-1337,-1337),
 	m_crack_pos_relative(-1337, -1337, -1337),
 	m_smooth_lighting(false),
+	m_daynight_ratio(1000),
 	m_gamedef(gamedef)
 {}
 
@@ -141,6 +142,11 @@ void MeshMakeData::setSmoothLighting(bool smooth_lighting)
 	m_smooth_lighting = smooth_lighting;
 }
 
+void MeshMakeData::setDayNightRatio(u32 daynight_ratio)
+{
+	m_daynight_ratio = daynight_ratio;
+}
+
 /*
 	Light and vertex color functions
 */
@@ -331,44 +337,73 @@ u16 getSmoothLight(v3s16 p, v3s16 corner, MeshMakeData *data)
 }
 
 /*
-	Converts from day + night color values (0..255)
-	and a given daynight_ratio to the final SColor shown on screen.
+	Lookup table for brightening the topside of nodes (no shaders).
+	Equals srgb_linear_multiply(i, 1.3, 255.0) truncated to u8.
 */
-static void finalColorBlend(video::SColor& result,
-		u8 day, u8 night, u32 daynight_ratio)
+struct TopsideBrightenTable
 {
-	s32 rg = (day * daynight_ratio + night * (1000-daynight_ratio)) / 1000;
-	s32 b = rg;
+	u8 values[256];
+
+	TopsideBrightenTable()
+	{
+		for(u32 i = 0; i < 256; i++)
+			values[i] = srgb_linear_multiply(i, 1.3, 255.0);
+	}
+};
+static const TopsideBrightenTable g_topside_brighten;
 
-	// Moonlight is blue
-	b += (day - night) / 13;
-	rg -= (day - night) / 23;
+/*
+	Converts from day + night color values (0..255)
+	and a given daynight_ratio to the final SColor shown on screen.
 
+	Works on a whole vertex array at once, the day, night and topside
+	arrays being parallel to it. Alpha of the vertex colors is kept.
+*/
+static void finalColorBlend(video::S3DVertex *vertices,
+		const u8 *day, const u8 *night, const u8 *topside, u32 count,
+		u32 daynight_ratio)
+{
 	// Emphase blue a bit in darker places
 	// Each entry of this array represents a range of 8 blue levels
-	static u8 emphase_blue_when_dark[32] = {
+	static const u8 emphase_blue_when_dark[32] = {
 		1, 4, 6, 6, 6, 5, 4, 3, 2, 1, 0, 0, 0, 0, 0, 0,
 		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	};
-	if(b < 0)
-		b = 0;
-	if(b > 255)
-		b = 255;
-	b += emphase_blue_when_dark[b / 8];
-
 	// Artificial light is yellow-ish
-	static u8 emphase_yellow_when_artificial[16] = {
+	static const u8 emphase_yellow_when_artificial[16] = {
 		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 10, 15, 15, 15
 	};
-	rg += emphase_yellow_when_artificial[night/16];
-	if(rg < 0)
-		rg = 0;
-	if(rg > 255)
-		rg = 255;
-
-	result.setRed(rg);
-	result.setGreen(rg);
-	result.setBlue(b);
+	const u8 *brighten = g_topside_brighten.values;
+	const s32 dr = daynight_ratio;
+	const s32 nr = 1000 - daynight_ratio;
+
+	for(u32 i = 0; i < count; i++)
+	{
+		s32 d = day[i];
+		s32 n = night[i];
+		s32 rg = (d * dr + n * nr) / 1000;
+		s32 b = rg;
+
+		// Moonlight is blue
+		b += (d - n) / 13;
+		rg -= (d - n) / 23;
+
+		b = rangelim(b, 0, 255);
+		b += emphase_blue_when_dark[b / 8];
+
+		rg += emphase_yellow_when_artificial[n / 16];
+		rg = rangelim(rg, 0, 255);
+
+		// Brighten topside (no shaders)
+		if(topside[i])
+		{
+			rg = brighten[rg];
+			b = brighten[b];
+		}
+
+		u32 &color = vertices[i].Color.color;
+		color = (color & 0xff000000) | (rg << 16) | (rg << 8) | (b & 0xff);
+	}
 }
 
 /*
@@ -641,16 +676,21 @@ TileSpec getNodeTileN(MapNode mn, v3s16 p, u8 tileindex, MeshMakeData *data)
 {
 	INodeDefManager *ndef = data->m_gamedef->ndef();
 	TileSpec spec = ndef->get(mn).tiles[tileindex];
+	// Node definition tiles always have their variants after
+	// updateTextures(); the mesh update thread must not resolve textures
+	// by name
+	if(spec.variants == NULL)
+		return spec;
 	// Apply temporary crack
 	if(p == data->m_crack_pos_relative)
 	{
 		spec.material_flags |= MATERIAL_FLAG_CRACK;
-		spec.texture = data->m_gamedef->tsrc()->getTextureRawAP(spec.texture);
+		spec.texture = spec.variants->single;
 	}
 	// If animated, replace tile texture with one without texture atlas
 	if(spec.material_flags & MATERIAL_FLAG_ANIMATION_VERTICAL_FRAMES)
 	{
-		spec.texture = data->m_gamedef->tsrc()->getTextureRawAP(spec.texture);
+		spec.texture = spec.variants->single;
 	}
 	return spec;
 }
@@ -717,8 +757,6 @@ TileSpec getNodeTile(MapNode mn, v3s16 p, v3s16 dir, MeshMakeData *data)
 	u16 tile_index=facedir*16 + dir_i;
 	TileSpec spec = getNodeTileN(mn, p, dir_to_tile[tile_index], data);
 	spec.rotation=dir_to_tile[tile_index + 1];
-	std::string name = data->m_gamedef->tsrc()->getTextureName(spec.texture.id);
-	spec.texture = data->m_gamedef->tsrc()->getTexture(name);
 	return spec;
 }
 
@@ -1020,8 +1058,8 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data):
 	m_animation_force_timer(0), // force initial animation
 	m_last_crack(-1),
 	m_crack_materials(),
-	m_last_daynight_ratio((u32) -1),
-	m_daynight_diffs()
+	m_last_daynight_ratio(data->m_daynight_ratio),
+	m_daynight_lights()
 {
 	// 4-21ms for MAP_BLOCKSIZE=16  (NOTE: probably outdated)
 	// 24-155ms for MAP_BLOCKSIZE=32  (NOTE: probably outdated)
@@ -1108,20 +1146,15 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data):
 
 		// Generate animation data
 		// - Cracks
-		if(p.tile.material_flags & MATERIAL_FLAG_CRACK)
+		if((p.tile.material_flags & MATERIAL_FLAG_CRACK) &&
+				p.tile.variants != NULL)
 		{
-			ITextureSource *tsrc = data->m_gamedef->tsrc();
-			std::string crack_basename = tsrc->getTextureName(p.tile.texture.id);
-			if(p.tile.material_flags & MATERIAL_FLAG_CRACK_OVERLAY)
-				crack_basename += "^[cracko";
-			else
-				crack_basename += "^[crack";
-			m_crack_materials.insert(std::make_pair(i, crack_basename));
+			m_crack_materials.insert(std::make_pair(i, p.tile));
 		}
 		// - Texture animation
-		if(p.tile.material_flags & MATERIAL_FLAG_ANIMATION_VERTICAL_FRAMES)
+		if((p.tile.material_flags & MATERIAL_FLAG_ANIMATION_VERTICAL_FRAMES) &&
+				p.tile.variants != NULL && !p.tile.variants->frames.empty())
 		{
-			ITextureSource *tsrc = data->m_gamedef->tsrc();
 			// Add to MapBlockMesh in order to animate these tiles
 			m_animation_tiles[i] = p.tile;
 			m_animation_frames[i] = 0;
@@ -1135,30 +1168,34 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data):
 				m_animation_frame_offsets[i] = 0;
 			}
 			// Replace tile texture with the first animation frame
-			std::ostringstream os(std::ios::binary);
-			os<<tsrc->getTextureName(p.tile.texture.id);
-			os<<"^[verticalframe:"<<(int)p.tile.animation_frame_count<<":0";
-			p.tile.texture = tsrc->getTexture(os.str());
+			p.tile.texture = p.tile.variants->frames[0];
 		}
 		// - Classic lighting (shaders handle this by themselves)
-		if(!enable_shaders)
+		if(!enable_shaders && !p.vertices.empty())
 		{
-			for(u32 j = 0; j < p.vertices.size(); j++)
+			DayNightLights lights;
+			lights.buffer = i;
+			u32 count = p.vertices.size();
+			lights.day.resize(count);
+			lights.night.resize(count);
+			lights.topside.resize(count);
+			bool has_diffs = false;
+			for(u32 j = 0; j < count; j++)
 			{
-				video::SColor &vc = p.vertices[j].Color;
-				// Set initial real color and store for later updates
-				u8 day = vc.getRed();
-				u8 night = vc.getGreen();
-				finalColorBlend(vc, day, night, 1000);
-				if(day != night)
-					m_daynight_diffs[i][j] = std::make_pair(day, night);
-				// Brighten topside (no shaders)
-				if(p.vertices[j].Normal.Y > 0.5)
-				{
-					vc.setRed  (srgb_linear_multiply(vc.getRed(),   1.3, 255.0));
-					vc.setGreen(srgb_linear_multiply(vc.getGreen(), 1.3, 255.0));
-					vc.setBlue (srgb_linear_multiply(vc.getBlue(),  1.3, 255.0));
-				}
+				const video::S3DVertex &v = p.vertices[j];
+				lights.day[j] = v.Color.getRed();
+				lights.night[j] = v.Color.getGreen();
+				lights.topside[j] = (v.Normal.Y > 0.5);
+				if(lights.day[j] != lights.night[j])
+					has_diffs = true;
+			}
+			// Set initial real color and store for later updates
+			finalColorBlend(&p.vertices[0], &lights.day[0],
+					&lights.night[0], &lights.topside[0], count,
+					m_last_daynight_ratio);
+			if(has_diffs)
+			{
+				m_daynight_lights.push_back(lights);
 			}
 		}
 
@@ -1225,7 +1262,6 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data):
 	// Check if animation is required for this mesh
 	m_has_animation =
 		!m_crack_materials.empty() ||
-		!m_daynight_diffs.empty() ||
 		!m_animation_tiles.empty();
 }
 
@@ -1235,7 +1271,7 @@ MapBlockMesh::~MapBlockMesh()
 	m_mesh = NULL;
 }
 
-bool MapBlockMesh::animate(bool faraway, float time, int crack, u32 daynight_ratio)
+bool MapBlockMesh::animate(bool faraway, float time, int crack)
 {
 	if(!m_has_animation)
 	{
@@ -1248,18 +1284,15 @@ bool MapBlockMesh::animate(bool faraway, float time, int crack, u32 daynight_rat
 	// Cracks
 	if(crack != m_last_crack)
 	{
-		for(std::map<u32, std::string>::iterator
+		ITextureSource *tsrc = m_gamedef->getTextureSource();
+		for(std::map<u32, TileSpec>::iterator
 				i = m_crack_materials.begin();
 				i != m_crack_materials.end(); i++)
 		{
 			scene::IMeshBuffer *buf = m_mesh->getMeshBuffer(i->first);
-			std::string basename = i->second;
-
-			// Create new texture name from original
-			ITextureSource *tsrc = m_gamedef->getTextureSource();
-			std::ostringstream os;
-			os<<basename<<crack;
-			AtlasPointer ap = tsrc->getTexture(os.str());
+			const TileSpec &tile = i->second;
+			bool overlay = tile.material_flags & MATERIAL_FLAG_CRACK_OVERLAY;
+			AtlasPointer ap = tile.variants->getCrack(tsrc, crack, overlay);
 			buf->getMaterial().setTexture(0, ap.atlas);
 		}
 
@@ -1283,49 +1316,30 @@ bool MapBlockMesh::animate(bool faraway, float time, int crack, u32 daynight_rat
 		m_animation_frames[i->first] = frame;
 
 		scene::IMeshBuffer *buf = m_mesh->getMeshBuffer(i->first);
-		ITextureSource *tsrc = m_gamedef->getTextureSource();
 
-		// Create new texture name from original
-		std::ostringstream os(std::ios::binary);
-		os<<tsrc->getTextureName(tile.texture.id);
-		os<<"^[verticalframe:"<<(int)tile.animation_frame_count<<":"<<frame;
 		// Set the texture
-		AtlasPointer ap = tsrc->getTexture(os.str());
+		AtlasPointer ap = tile.variants->frames[frame];
 		buf->getMaterial().setTexture(0, ap.atlas);
 	}
 
-	// Day-night transition
-	if(daynight_ratio != m_last_daynight_ratio)
+	return true;
+}
+
+void MapBlockMesh::updateDayNight(u32 daynight_ratio)
+{
+	if(daynight_ratio == m_last_daynight_ratio)
+		return;
+
+	for(std::vector<DayNightLights>::iterator
+			i = m_daynight_lights.begin();
+			i != m_daynight_lights.end(); ++i)
 	{
-		for(std::map<u32, std::map<u32, std::pair<u8, u8> > >::iterator
-				i = m_daynight_diffs.begin();
-				i != m_daynight_diffs.end(); i++)
-		{
-			scene::IMeshBuffer *buf = m_mesh->getMeshBuffer(i->first);
-			video::S3DVertex *vertices = (video::S3DVertex*)buf->getVertices();
-			for(std::map<u32, std::pair<u8, u8 > >::iterator
-					j = i->second.begin();
-					j != i->second.end(); j++)
-			{
-				u32 vertexIndex = j->first;
-				u8 day = j->second.first;
-				u8 night = j->second.second;
-				finalColorBlend(vertices[vertexIndex].Color,
-						day, night, daynight_ratio);
-				// Brighten topside (no shaders)
-				if(vertices[vertexIndex].Normal.Y > 0.5)
-				{
-					video::SColor &vc = vertices[vertexIndex].Color;
-					vc.setRed  (srgb_linear_multiply(vc.getRed(),   1.3, 255.0));
-					vc.setGreen(srgb_linear_multiply(vc.getGreen(), 1.3, 255.0));
-					vc.setBlue (srgb_linear_multiply(vc.getBlue(),  1.3, 255.0));
-				}
-			}
-		}
-		m_last_daynight_ratio = daynight_ratio;
+		scene::IMeshBuffer *buf = m_mesh->getMeshBuffer(i->buffer);
+		video::S3DVertex *vertices = (video::S3DVertex*)buf->getVertices();
+		finalColorBlend(vertices, &i->day[0], &i->night[0],
+				&i->topside[0], i->day.size(), daynight_ratio);
 	}
-
-	return true;
+	m_last_daynight_ratio = daynight_ratio;
 }
 
 /*
@@ -40,6 +40,8 @@ struct MeshMakeData
 	v3s16 m_blockpos;
 	v3s16 m_crack_pos_relative;
 	bool m_smooth_lighting;
+	// Day/night ratio the vertex colours are made for
+	u32 m_daynight_ratio;
 	IGameDef *m_gamedef;
 
 	MeshMakeData(IGameDef *gamedef);
@@ -64,6 +66,12 @@ struct MeshMakeData
 		Enable or disable smooth lighting
 	*/
 	void setSmoothLighting(bool smooth_lighting);
+
+	/*
+		Set the day/night ratio (0 .. 1000) of the time the mesh is
+		made at
+	*/
+	void setDayNightRatio(u32 daynight_ratio);
 };
 
 /*
@@ -87,10 +95,19 @@ class MapBlockMesh
 	// Main animation function, parameters:
 	//   faraway: whether the block is far away from the camera (~50 nodes)
 	//   time: the global animation time, 0 .. 60 (repeats every minute)
-	//   daynight_ratio: 0 .. 1000
 	//   crack: -1 .. CRACK_ANIMATION_LENGTH-1 (-1 for off)
 	// Returns true if anything has been changed.
-	bool animate(bool faraway, float time, int crack, u32 daynight_ratio);
+	bool animate(bool faraway, float time, int crack);
+
+	// Day/night transitions are handled separately from animate() so that
+	// the caller can spread them over several frames, nearest meshes first.
+	//   daynight_ratio: 0 .. 1000
+	bool needsDayNightUpdate(u32 daynight_ratio) const
+	{
+		return !m_daynight_lights.empty() &&
+				daynight_ratio != m_last_daynight_ratio;
+	}
+	void updateDayNight(u32 daynight_ratio);
 
 	scene::SMesh* getMesh()
 	{
@@ -119,8 +136,8 @@ class MapBlockMesh
 	// Animation info: cracks
 	// Last crack value passed to animate()
 	int m_last_crack;
-	// Maps mesh buffer (i.e. material) indices to base texture names
-	std::map<u32, std::string> m_crack_materials;
+	// Maps mesh buffer (i.e. material) indices to cracked tiles
+	std::map<u32, TileSpec> m_crack_materials;
 
 	// Animation info: texture animationi
 	// Maps meshbuffers to TileSpecs
@@ -129,10 +146,21 @@ class MapBlockMesh
 	std::map<u32, int> m_animation_frame_offsets;
 	
 	// Animation info: day/night transitions
-	// Last daynight_ratio value passed to animate()
+	// Last daynight_ratio value passed to updateDayNight()
 	u32 m_last_daynight_ratio;
-	// For each meshbuffer, maps vertex indices to (day,night) pairs
-	std::map<u32, std::map<u32, std::pair<u8, u8> > > m_daynight_diffs;
+	// Day and night light of every vertex of a meshbuffer, stored as
+	// flat arrays parallel to the vertex array of the meshbuffer.
+	// Only meshbuffers that have some vertex with differing day and
+	// night light are listed.
+	struct DayNightLights
+	{
+		u32 buffer;
+		std::vector<u8> day;
+		std::vector<u8> night;
+		// Nonzero for vertices that get the topside brightening
+		std::vector<u8> topside;
+	};
+	std::vector<DayNightLights> m_daynight_lights;
 };
 
 
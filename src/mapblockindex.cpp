@@ -0,0 +1,110 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mapblockindex.h"
+#include <cassert>
+
+#define MAPBLOCKINDEX_MIN_CAPACITY 256
+
+MapBlockIndex::MapBlockIndex():
+	m_slots(MAPBLOCKINDEX_MIN_CAPACITY),
+	m_mask(MAPBLOCKINDEX_MIN_CAPACITY - 1),
+	m_count(0)
+{
+}
+
+void MapBlockIndex::insert(v3s16 p, MapBlock *block)
+{
+	assert(block != NULL);
+
+	if((m_count + 1) * 2 > m_slots.size())
+		resize(m_slots.size() * 2);
+
+	for(u32 i = hash(p) & m_mask;; i = (i + 1) & m_mask)
+	{
+		Slot &slot = m_slots[i];
+		if(slot.block == NULL)
+		{
+			slot.pos = p;
+			slot.block = block;
+			m_count++;
+			return;
+		}
+		if(slot.pos == p)
+		{
+			slot.block = block;
+			return;
+		}
+	}
+}
+
+void MapBlockIndex::remove(v3s16 p)
+{
+	u32 i = hash(p) & m_mask;
+	for(;; i = (i + 1) & m_mask)
+	{
+		if(m_slots[i].block == NULL)
+			return;
+		if(m_slots[i].pos == p)
+			break;
+	}
+
+	/*
+		Shift back the entries that follow in the same run whose home
+		slot is not between the hole and themselves
+	*/
+	u32 hole = i;
+	for(u32 j = (i + 1) & m_mask;; j = (j + 1) & m_mask)
+	{
+		Slot &slot = m_slots[j];
+		if(slot.block == NULL)
+			break;
+		u32 home = hash(slot.pos) & m_mask;
+		bool movable = (hole <= j) ?
+				(home <= hole || home > j) :
+				(home <= hole && home > j);
+		if(movable)
+		{
+			m_slots[hole] = slot;
+			hole = j;
+		}
+	}
+	m_slots[hole] = Slot();
+	m_count--;
+
+	// Give memory back after a large unload
+	if(m_slots.size() > MAPBLOCKINDEX_MIN_CAPACITY
+			&& m_count * 8 < m_slots.size())
+		resize(m_slots.size() / 2);
+}
+
+void MapBlockIndex::resize(u32 capacity)
+{
+	std::vector<Slot> old;
+	old.swap(m_slots);
+	m_slots.resize(capacity);
+	m_mask = capacity - 1;
+	m_count = 0;
+	for(u32 i = 0; i < old.size(); i++)
+	{
+		if(old[i].block != NULL)
+			insert(old[i].pos, old[i].block);
+	}
+}
+
@@ -0,0 +1,87 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef MAPBLOCKINDEX_HEADER
+#define MAPBLOCKINDEX_HEADER
+
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+#include <vector>
+
+class MapBlock;
+
+/*
+	Hash table from block positions to the loaded MapBlocks of a Map.
+
+	Open addressing with linear probing; removal shifts the following
+	entries back so that no tombstones are needed. The table is kept at
+	most half full, so a lookup rarely looks at more than two slots.
+*/
+class MapBlockIndex
+{
+public:
+	MapBlockIndex();
+
+	static u32 hash(v3s16 p)
+	{
+		u32 h = (u32)(u16)p.X * 73856093
+				^ (u32)(u16)p.Y * 19349663
+				^ (u32)(u16)p.Z * 83492791;
+		return h ^ (h >> 16);
+	}
+
+	MapBlock * get(v3s16 p) const
+	{
+		for(u32 i = hash(p) & m_mask;; i = (i + 1) & m_mask)
+		{
+			const Slot &slot = m_slots[i];
+			if(slot.block == NULL)
+				return NULL;
+			if(slot.pos == p)
+				return slot.block;
+		}
+	}
+
+	// Replaces an existing entry at p
+	void insert(v3s16 p, MapBlock *block);
+	void remove(v3s16 p);
+
+	u32 size() const
+	{
+		return m_count;
+	}
+
+private:
+	struct Slot
+	{
+		v3s16 pos;
+		MapBlock *block; // NULL = empty
+
+		Slot(): block(NULL) {}
+	};
+
+	void resize(u32 capacity);
+
+	std::vector<Slot> m_slots;
+	u32 m_mask;
+	u32 m_count;
+};
+
+#endif
+
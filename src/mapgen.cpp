@@ -34,6 +34,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "main.h" // For g_profiler
 #include "treegen.h"
 #include "mapgen_v6.h"
+#include "heightmapcache.h"
+#include "schematic.h"
 
 FlagDesc flagdesc_mapgen[] = {
 	{"trees",          MG_TREES},
@@ -45,6 +47,13 @@ FlagDesc flagdesc_mapgen[] = {
 	{NULL,			   0}
 };
 
+FlagDesc flagdesc_deco[] = {
+	{"place_center_x",  DECO_PLACE_CENTER_X},
+	{"place_center_z",  DECO_PLACE_CENTER_Z},
+	{"force_placement", DECO_FORCE_PLACEMENT},
+	{NULL,              0}
+};
+
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -86,11 +95,45 @@ void Ore::resolveNodeNames(INodeDefManager *ndef) {
 }
 
 
+OreBuffers::~OreBuffers() {
+	for (std::map<const Ore *, Noise *>::iterator
+			i = m_noise.begin(); i != m_noise.end(); ++i)
+		delete i->second;
+}
+
+
+Noise *OreBuffers::getNoise2D(const Ore *ore, int sx, int sy) {
+	Noise *&noise = m_noise[ore];
+	if (!noise)
+		noise = new Noise(ore->np, 0, sx, sy);
+	else if (noise->sx != sx || noise->sy != sy)
+		noise->setSize(sx, sy);
+	return noise;
+}
+
+
+static void place_ore_cluster(ManualMapVoxelManipulator *vm, PseudoRandom &pr,
+		v3s16 p0, int csize, int orechance, MapNode n_ore, content_t wherein) {
+	for (int z1 = 0; z1 != csize; z1++)
+	for (int y1 = 0; y1 != csize; y1++)
+	for (int x1 = 0; x1 != csize; x1++) {
+		if (pr.range(1, orechance) != 1)
+			continue;
+		
+		u32 i = vm->m_area.index(p0.X + x1, p0.Y + y1, p0.Z + z1);
+		if (vm->m_data[i].getContent() == wherein)
+			vm->m_data[i] = n_ore;
+	}
+}
+
+
 void OreScatter::generate(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax) {
 	if (nmin.Y > height_max || nmax.Y < height_min)
 		return;
 	
-	resolveNodeNames(mg->ndef);
+	// Names are resolved before generating starts
+	if (ore == CONTENT_IGNORE)
+		return;
 	
 	MapNode n_ore(ore);
 	ManualMapVoxelManipulator *vm = mg->vm;
@@ -108,24 +151,37 @@ void OreScatter::generate(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax) {
 	int orechance = (csize * csize * csize) / clust_num_ores;
 	int nclusters = volume / clust_scarcity;
 
+	if (!np) {
+		for (int i = 0; i != nclusters; i++) {
+			int x0 = pr.range(nmin.X, nmax.X - csize + 1);
+			int y0 = pr.range(ymin,   ymax   - csize + 1);
+			int z0 = pr.range(nmin.Z, nmax.Z - csize + 1);
+			place_ore_cluster(vm, pr, v3s16(x0, y0, z0), csize, orechance,
+				n_ore, wherein);
+		}
+		return;
+	}
+	
+	// Pick all clusters first, so their noise is computed in one batch
+	std::vector<v3s16> &points = mg->ore_buffers.points;
+	std::vector<float> &values = mg->ore_buffers.values;
+	points.resize(nclusters);
+	values.resize(nclusters);
 	for (int i = 0; i != nclusters; i++) {
 		int x0 = pr.range(nmin.X, nmax.X - csize + 1);
 		int y0 = pr.range(ymin,   ymax   - csize + 1);
 		int z0 = pr.range(nmin.Z, nmax.Z - csize + 1);
-		
-		if (np && (NoisePerlin3D(np, x0, y0, z0, mg->seed) < nthresh))
+		points[i] = v3s16(x0, y0, z0);
+	}
+	if (nclusters == 0)
+		return;
+	noise3d_perlin_points(np, &points[0], nclusters, mg->seed, &values[0]);
+	
+	for (int i = 0; i != nclusters; i++) {
+		if (values[i] < nthresh)
 			continue;
-		
-		for (int z1 = 0; z1 != csize; z1++)
-		for (int y1 = 0; y1 != csize; y1++)
-		for (int x1 = 0; x1 != csize; x1++) {
-			if (pr.range(1, orechance) != 1)
-				continue;
-			
-			u32 i = vm->m_area.index(x0 + x1, y0 + y1, z0 + z1);
-			if (vm->m_data[i].getContent() == wherein)
-				vm->m_data[i] = n_ore;
-		}
+		place_ore_cluster(vm, pr, points[i], csize, orechance,
+			n_ore, wherein);
 	}
 }
 
@@ -134,7 +190,9 @@ void OreSheet::generate(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax) {
 	if (nmin.Y > height_max || nmax.Y < height_min)
 		return;
 
-	resolveNodeNames(mg->ndef);
+	// Names are resolved before generating starts
+	if (ore == CONTENT_IGNORE)
+		return;
 
 	MapNode n_ore(ore);
 	ManualMapVoxelManipulator *vm = mg->vm;
@@ -154,11 +212,9 @@ void OreSheet::generate(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax) {
 	int max_height = clust_size;
 	int y_start = pr.range(ymin, ymax - max_height);
 	
-	if (!noise) {
-		int sx = nmax.X - nmin.X + 1;
-		int sz = nmax.Z - nmin.Z + 1;
-		noise = new Noise(np, 0, sx, sz);
-	}
+	int sx = nmax.X - nmin.X + 1;
+	int sz = nmax.Z - nmin.Z + 1;
+	Noise *noise = mg->ore_buffers.getNoise2D(this, sx, sz);
 	noise->seed = mg->seed + y_start;
 	noise->perlinMap2D(x0, z0);
 	
@@ -184,6 +240,80 @@ void OreSheet::generate(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax) {
 }
 
 
+Decoration::~Decoration() {
+	delete np;
+	delete schematic;
+}
+
+
+void Decoration::resolveNodeNames(INodeDefManager *ndef) {
+	if (c_place_on == CONTENT_IGNORE) {
+		c_place_on = ndef->getId(place_on_name);
+		if (c_place_on == CONTENT_IGNORE)
+			errorstream << "Decoration::resolveNodeNames: place_on node '"
+				<< place_on_name << "' not defined" << std::endl;
+	}
+	
+	if (schematic)
+		schematic->resolveNodeNames(ndef);
+}
+
+
+void Decoration::generate(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax) {
+	// Decorations stand on surfaces below the top of the chunk
+	if (nmin.Y + 1 > height_max || nmax.Y < height_min)
+		return;
+	
+	// Names are resolved before generating starts
+	if (c_place_on == CONTENT_IGNORE || !schematic)
+		return;
+	
+	ManualMapVoxelManipulator *vm = mg->vm;
+	v3s16 em = vm->m_area.getExtent();
+	PseudoRandom pr(blockseed + 53);
+	
+	for (int z0 = nmin.Z; z0 <= nmax.Z; z0 += sidelen)
+	for (int x0 = nmin.X; x0 <= nmax.X; x0 += sidelen) {
+		int x1 = MYMIN(x0 + sidelen - 1, nmax.X);
+		int z1 = MYMIN(z0 + sidelen - 1, nmax.Z);
+		
+		float amount = np ? NoisePerlin2D(np, (x0 + x1) / 2,
+			(z0 + z1) / 2, mg->seed) : fill_ratio;
+		int count = amount * (x1 - x0 + 1) * (z1 - z0 + 1);
+		
+		for (int i = 0; i < count; i++) {
+			s16 x = pr.range(x0, x1);
+			s16 z = pr.range(z0, z1);
+			
+			// Find the surface of the column
+			u32 vi = vm->m_area.index(x, nmax.Y, z);
+			s16 y = nmax.Y;
+			while (y >= nmin.Y && vm->m_data[vi].getContent() == CONTENT_AIR) {
+				vm->m_area.add_y(em, vi, -1);
+				y--;
+			}
+			
+			// The surface of a chunk filled to the top is above it
+			if (y < nmin.Y || y == nmax.Y ||
+				vm->m_data[vi].getContent() != c_place_on)
+				continue;
+			if (y + 1 < height_min || y + 1 > height_max)
+				continue;
+			
+			int rot = (rotation < 0) ? pr.range(0, 3) : rotation;
+			v3s16 size = schematic->getRotatedSize(rot);
+			v3s16 p(x, y + 1, z);
+			if (flags & DECO_PLACE_CENTER_X)
+				p.X -= (size.X - 1) / 2;
+			if (flags & DECO_PLACE_CENTER_Z)
+				p.Z -= (size.Z - 1) / 2;
+			
+			schematic->place(vm, p, rot, flags & DECO_FORCE_PLACEMENT, pr);
+		}
+	}
+}
+
+
 void Mapgen::updateLiquid(UniqueQueue<v3s16> *trans_liquid, v3s16 nmin, v3s16 nmax) {
 	bool isliquid, wasliquid;
 	v3s16 em  = vm->m_area.getExtent();
@@ -334,6 +464,33 @@ void Mapgen::calcLightingOld(v3s16 nmin, v3s16 nmax) {
 }
 
 
+/*
+	Asks the mapgen for the ground level of every point; for mapgens
+	that have no faster way
+*/
+class HeightmapSourcePoints : public HeightmapSource {
+public:
+	HeightmapSourcePoints(Mapgen *mapgen):
+		mapgen(mapgen)
+	{}
+
+	void getTile(v2s16 p0, s16 size, s16 *heights) {
+		int index = 0;
+		for (s16 z = p0.Y; z != p0.Y + size; z++)
+		for (s16 x = p0.X; x != p0.X + size; x++, index++)
+			heights[index] = mapgen->getGroundLevelAtPoint(v2s16(x, z));
+	}
+
+private:
+	Mapgen *mapgen;
+};
+
+
+HeightmapSource *Mapgen::createHeightmapSource() {
+	return new HeightmapSourcePoints(this);
+}
+
+
 //////////////////////// Mapgen V6 parameter read/write
 
 bool MapgenV6Params::readParams(Settings *settings) {
@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "noise.h"
 #include "settings.h"
 #include <map>
+#include <vector>
 
 /////////////////// Mapgen flags
 #define MG_TREES         0x01
@@ -38,6 +39,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 extern FlagDesc flagdesc_mapgen[];
 
+// Decoration flags
+#define DECO_PLACE_CENTER_X  0x01
+#define DECO_PLACE_CENTER_Z  0x02
+#define DECO_FORCE_PLACEMENT 0x04
+
+extern FlagDesc flagdesc_deco[];
+
 class BiomeDefManager;
 class Biome;
 class EmergeManager;
@@ -47,6 +55,9 @@ class VoxelManipulator;
 class INodeDefManager;
 struct BlockMakeData;
 class VoxelArea;
+class Ore;
+class HeightmapSource;
+class Schematic;
 
 struct MapgenParams {
 	std::string mg_name;
@@ -67,6 +78,26 @@ struct MapgenParams {
 	virtual void writeParams(Settings *settings) {};
 };
 
+/*
+	Buffers used while generating ores. Every mapgen has its own, so the
+	Ore definitions, which all emerge threads share, are only read while
+	generating.
+*/
+class OreBuffers {
+public:
+	// Positions of scattered clusters and the noise at them
+	std::vector<v3s16> points;
+	std::vector<float> values;
+
+	~OreBuffers();
+
+	// Returns the 2D noise map of ore, of sx * sy values
+	Noise *getNoise2D(const Ore *ore, int sx, int sy);
+
+private:
+	std::map<const Ore *, Noise *> m_noise;
+};
+
 class Mapgen {
 public:
 	int seed;
@@ -75,6 +106,9 @@ class Mapgen {
 	int id;
 	ManualMapVoxelManipulator *vm;
 	INodeDefManager *ndef;
+	OreBuffers ore_buffers;
+
+	virtual ~Mapgen() {}
 
 	void updateLiquid(UniqueQueue<v3s16> *trans_liquid, v3s16 nmin, v3s16 nmax);
 	void setLighting(v3s16 nmin, v3s16 nmax, u8 light);
@@ -84,6 +118,12 @@ class Mapgen {
 
 	virtual void makeChunk(BlockMakeData *data) {};
 	virtual int getGroundLevelAtPoint(v2s16 p) = 0;
+	/*
+		Returns a new source of the ground levels of this mapgen, which
+		can be used while it generates. By default the ground level of
+		every point is asked from getGroundLevelAtPoint().
+	*/
+	virtual HeightmapSource *createHeightmapSource();
 
 	//Legacy functions for Farmesh (pending removal)
 	static bool get_have_beach(u64 seed, v2s16 p2d);
@@ -117,16 +157,17 @@ class Ore {
 	s16 height_max;
 	float nthresh;      // threshhold for noise at which an ore is placed 
 	NoiseParams *np;    // noise for distribution of clusters (NULL for uniform scattering)
-	Noise *noise;
 	
 	Ore() {
 		ore     = CONTENT_IGNORE;
 		wherein = CONTENT_IGNORE;
 		np      = NULL;
-		noise   = NULL;
 	}
+	virtual ~Ore() {}
 	
+	// Called once all nodes are defined, before the mapgens are used
 	void resolveNodeNames(INodeDefManager *ndef);
+	// Keeps its state in mg->ore_buffers, so mapgens can run in parallel
 	virtual void generate(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax) = 0;
 };
 
@@ -140,5 +181,40 @@ class OreSheet : public Ore {
 
 Ore *createOre(OreType type);
 
+/*
+	Places a schematic on the surface of the ground, a number of times
+	per sidelen * sidelen square of a chunk given by fill_ratio or by
+	the noise at the square. The surface is the highest node of a column
+	in the chunk that is not air, and has to be place_on.
+*/
+class Decoration {
+public:
+	std::string place_on_name;
+
+	content_t c_place_on;
+	s16 sidelen;         // size of the squares the chunk is divided into
+	float fill_ratio;    // decorations per node of a square
+	NoiseParams *np;     // noise for the fill ratio (NULL for fill_ratio)
+	s16 height_min;
+	s16 height_max;
+	s8 rotation;         // quarter turns, or -1 for a random rotation
+	u32 flags;
+	Schematic *schematic;
+	
+	Decoration() {
+		c_place_on = CONTENT_IGNORE;
+		np         = NULL;
+		rotation   = 0;
+		flags      = 0;
+		schematic  = NULL;
+	}
+	// Owns np and schematic
+	~Decoration();
+	
+	// Called once all nodes are defined, before the mapgens are used
+	void resolveNodeNames(INodeDefManager *ndef);
+	void generate(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax);
+};
+
 #endif
 
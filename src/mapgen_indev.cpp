@@ -116,22 +116,22 @@ void MapgenIndev::calculateNoise() {
 	int z = node_min.Z;
 	// Need to adjust for the original implementation's +.5 offset...
 	if (!(flags & MG_FLAT)) {
-		noiseindev_terrain_base->perlinMap2D(
+		makeNoiseMap2D(noiseindev_terrain_base,
 			x + 0.5 * noiseindev_terrain_base->npindev->spread.X * farscale(noiseindev_terrain_base->npindev->farspread, x, z),
 			z + 0.5 * noiseindev_terrain_base->npindev->spread.Z * farscale(noiseindev_terrain_base->npindev->farspread, x, z));
 		noiseindev_terrain_base->transformNoiseMapFarScale(x, y, z);
 
-		noiseindev_terrain_higher->perlinMap2D(
+		makeNoiseMap2D(noiseindev_terrain_higher,
 			x + 0.5 * noiseindev_terrain_higher->npindev->spread.X * farscale(noiseindev_terrain_higher->npindev->farspread, x, z),
 			z + 0.5 * noiseindev_terrain_higher->npindev->spread.Z * farscale(noiseindev_terrain_higher->npindev->farspread, x, z));
 		noiseindev_terrain_higher->transformNoiseMapFarScale(x, y, z);
 
-		noiseindev_steepness->perlinMap2D(
+		makeNoiseMap2D(noiseindev_steepness,
 			x + 0.5 * noiseindev_steepness->npindev->spread.X * farscale(noiseindev_steepness->npindev->farspread, x, z),
 			z + 0.5 * noiseindev_steepness->npindev->spread.Z * farscale(noiseindev_steepness->npindev->farspread, x, z));
 		noiseindev_steepness->transformNoiseMapFarScale(x, y, z);
 
-		noise_height_select->perlinMap2D(
+		makeNoiseMap2D(noise_height_select,
 			x + 0.5 * noise_height_select->np->spread.X,
 			z + 0.5 * noise_height_select->np->spread.Z);
 
@@ -149,7 +149,7 @@ void MapgenIndev::calculateNoise() {
 		);
 		noiseindev_float_islands2->transformNoiseMapFarScale(x, y, z);
 
-		noiseindev_float_islands3->perlinMap2D(
+		makeNoiseMap2D(noiseindev_float_islands3,
 			x + 0.5 * noiseindev_float_islands3->npindev->spread.X * farscale(noiseindev_float_islands3->npindev->farspread, x, z),
 			z + 0.5 * noiseindev_float_islands3->npindev->spread.Z * farscale(noiseindev_float_islands3->npindev->farspread, x, z));
 		noiseindev_float_islands3->transformNoiseMapFarScale(x, y, z);
@@ -157,16 +157,16 @@ void MapgenIndev::calculateNoise() {
 	}
 	
 	if (!(flags & MG_FLAT)) {
-		noiseindev_mud->perlinMap2D(
+		makeNoiseMap2D(noiseindev_mud,
 			x + 0.5 * noiseindev_mud->npindev->spread.X * farscale(noiseindev_mud->npindev->farspread, x, y, z),
 			z + 0.5 * noiseindev_mud->npindev->spread.Z * farscale(noiseindev_mud->npindev->farspread, x, y, z));
 		noiseindev_mud->transformNoiseMapFarScale(x, y, z);
 	}
-	noise_beach->perlinMap2D(
+	makeNoiseMap2D(noise_beach,
 		x + 0.2 * noise_beach->np->spread.X,
 		z + 0.7 * noise_beach->np->spread.Z);
 
-	noise_biome->perlinMap2D(
+	makeNoiseMap2D(noise_biome,
 		x + 0.6 * noiseindev_biome->npindev->spread.X * farscale(noiseindev_biome->npindev->farspread, x, z),
 		z + 0.2 * noiseindev_biome->npindev->spread.Z * farscale(noiseindev_biome->npindev->farspread, x, z));
 }
@@ -245,6 +245,11 @@ float MapgenIndev::baseTerrainLevelFromMap(int index) {
 							steepness,    height_select);
 }
 
+HeightmapSource *MapgenIndev::createHeightmapSource() {
+	// The terrain noise of indev depends on the distance from the origin
+	return Mapgen::createHeightmapSource();
+}
+
 float MapgenIndev::getMudAmount(int index) {
 	if (flags & MG_FLAT)
 		return AVERAGE_MUD_AMOUNT;
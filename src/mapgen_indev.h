@@ -132,6 +132,7 @@ class MapgenIndev : public MapgenV6 {
 
 	float baseTerrainLevelFromNoise(v2s16 p);
 	float baseTerrainLevelFromMap(int index);
+	HeightmapSource *createHeightmapSource();
 	float getMudAmount(int index);
 	void defineCave(Cave & cave, PseudoRandom ps, v3s16 node_min, bool large_cave);
 	void generateSomething();
@@ -35,6 +35,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "dungeongen.h"
 #include "treegen.h"
 #include "mapgen_v6.h"
+#include "heightmapcache.h"
+#include "noisemapcache.h"
 
 /////////////////// Mapgen V6 perlin noise default values
 NoiseParams nparams_v6_def_terrain_base =
@@ -91,6 +93,9 @@ MapgenV6::MapgenV6(int mapgenid, MapgenV6Params *params, EmergeManager *emerge)
 	noise_mud            = new Noise(params->np_mud,            seed, csize.X, csize.Y);
 	noise_beach          = new Noise(params->np_beach,          seed, csize.X, csize.Y);
 	noise_biome          = new Noise(params->np_biome,          seed, csize.X, csize.Y);
+
+	surface_map = new s16[csize.X * csize.Z];
+	biome_map   = new BiomeType[csize.X * csize.Z];
 }
 
 
@@ -102,6 +107,9 @@ MapgenV6::~MapgenV6() {
 	delete noise_mud;
 	delete noise_beach;
 	delete noise_biome;
+
+	delete[] surface_map;
+	delete[] biome_map;
 }
 
 
@@ -238,6 +246,99 @@ int MapgenV6::getGroundLevelAtPoint(v2s16 p) {
 }
 
 
+/*
+	Computes the same noise maps as calculateNoise() for a tile, with
+	noise objects of its own
+*/
+class HeightmapSourceV6 : public HeightmapSource {
+public:
+	HeightmapSourceV6(MapgenV6 *mapgen):
+		mapgen(mapgen),
+		size(0),
+		noise_terrain_base(NULL),
+		noise_terrain_higher(NULL),
+		noise_steepness(NULL),
+		noise_height_select(NULL)
+	{}
+
+	~HeightmapSourceV6() {
+		deleteNoise();
+	}
+
+	void getTile(v2s16 p0, s16 size, s16 *heights) {
+		if (size != this->size) {
+			deleteNoise();
+			createNoise(size);
+		}
+
+		int x = p0.X;
+		int z = p0.Y;
+		bool flat = mapgen->flags & MG_FLAT;
+		if (!flat) {
+			noise_terrain_base->perlinMap2D(
+				x + 0.5 * noise_terrain_base->np->spread.X,
+				z + 0.5 * noise_terrain_base->np->spread.Z);
+			noise_terrain_base->transformNoiseMap();
+
+			noise_terrain_higher->perlinMap2D(
+				x + 0.5 * noise_terrain_higher->np->spread.X,
+				z + 0.5 * noise_terrain_higher->np->spread.Z);
+			noise_terrain_higher->transformNoiseMap();
+
+			noise_steepness->perlinMap2D(
+				x + 0.5 * noise_steepness->np->spread.X,
+				z + 0.5 * noise_steepness->np->spread.Z);
+			noise_steepness->transformNoiseMap();
+
+			noise_height_select->perlinMap2D(
+				x + 0.5 * noise_height_select->np->spread.X,
+				z + 0.5 * noise_height_select->np->spread.Z);
+		}
+
+		int index = 0;
+		for (s16 pz = p0.Y; pz != p0.Y + size; pz++)
+		for (s16 px = p0.X; px != p0.X + size; px++, index++) {
+			float level = flat ? mapgen->water_level :
+				mapgen->baseTerrainLevel(
+					noise_terrain_base->result[index],
+					noise_terrain_higher->result[index],
+					noise_steepness->result[index],
+					noise_height_select->result[index]);
+			heights[index] = level + AVERAGE_MUD_AMOUNT;
+		}
+	}
+
+private:
+	void createNoise(s16 size) {
+		this->size = size;
+		int seed = mapgen->seed;
+		noise_terrain_base   = new Noise(mapgen->noise_terrain_base->np,   seed, size, size);
+		noise_terrain_higher = new Noise(mapgen->noise_terrain_higher->np, seed, size, size);
+		noise_steepness      = new Noise(mapgen->noise_steepness->np,      seed, size, size);
+		noise_height_select  = new Noise(mapgen->noise_height_select->np,  seed, size, size);
+	}
+
+	void deleteNoise() {
+		delete noise_terrain_base;
+		delete noise_terrain_higher;
+		delete noise_steepness;
+		delete noise_height_select;
+	}
+
+	MapgenV6 *mapgen;
+	s16 size;
+	Noise *noise_terrain_base;
+	Noise *noise_terrain_higher;
+	Noise *noise_steepness;
+	Noise *noise_height_select;
+};
+
+
+HeightmapSource *MapgenV6::createHeightmapSource() {
+	return new HeightmapSourceV6(this);
+}
+
+
 //////////////////////// Noise functions
 
 float MapgenV6::getMudAmount(v2s16 p) {
@@ -464,10 +565,20 @@ void MapgenV6::makeChunk(BlockMakeData *data) {
 	if (flags & MG_TREES)
 		placeTreesAndJungleGrass();
 
-	// Generate the registered ores
-	for (unsigned int i = 0; i != emerge->ores.size(); i++) {
-		Ore *ore = emerge->ores[i];
-		ore->generate(this, blockseed + i, node_min, node_max);
+	// The ores and decorations are registered in the emerge manager,
+	// which the tests don't have
+	if (emerge) {
+		// Generate the registered ores
+		for (unsigned int i = 0; i != emerge->ores.size(); i++) {
+			Ore *ore = emerge->ores[i];
+			ore->generate(this, blockseed + i, node_min, node_max);
+		}
+
+		// Place the registered decorations
+		for (unsigned int i = 0; i != emerge->decorations.size(); i++) {
+			Decoration *deco = emerge->decorations[i];
+			deco->generate(this, blockseed + i, node_min, node_max);
+		}
 	}
 
 	// Calculate lighting
@@ -477,42 +588,50 @@ void MapgenV6::makeChunk(BlockMakeData *data) {
 }
 
 
+void MapgenV6::makeNoiseMap2D(Noise *noise, float x, float y) {
+	if (emerge)
+		emerge->noisemaps->perlinMap2D(noise, x, y);
+	else
+		noise->perlinMap2D(x, y);
+}
+
+
 void MapgenV6::calculateNoise() {
 	int x = node_min.X;
 	int z = node_min.Z;
 
 	// Need to adjust for the original implementation's +.5 offset...
 	if (!(flags & MG_FLAT)) {
-		noise_terrain_base->perlinMap2D(
+		makeNoiseMap2D(noise_terrain_base,
 			x + 0.5 * noise_terrain_base->np->spread.X,
 			z + 0.5 * noise_terrain_base->np->spread.Z);
 		noise_terrain_base->transformNoiseMap();
 
-		noise_terrain_higher->perlinMap2D(
+		makeNoiseMap2D(noise_terrain_higher,
 			x + 0.5 * noise_terrain_higher->np->spread.X,
 			z + 0.5 * noise_terrain_higher->np->spread.Z);
 		noise_terrain_higher->transformNoiseMap();
 
-		noise_steepness->perlinMap2D(
+		makeNoiseMap2D(noise_steepness,
 			x + 0.5 * noise_steepness->np->spread.X,
 			z + 0.5 * noise_steepness->np->spread.Z);
 		noise_steepness->transformNoiseMap();
 
-		noise_height_select->perlinMap2D(
+		makeNoiseMap2D(noise_height_select,
 			x + 0.5 * noise_height_select->np->spread.X,
 			z + 0.5 * noise_height_select->np->spread.Z);
 
-		noise_mud->perlinMap2D(
+		makeNoiseMap2D(noise_mud,
 			x + 0.5 * noise_mud->np->spread.X,
 			z + 0.5 * noise_mud->np->spread.Z);
 		noise_mud->transformNoiseMap();
 	}
 
-	noise_beach->perlinMap2D(
+	makeNoiseMap2D(noise_beach,
 		x + 0.2 * noise_beach->np->spread.X,
 		z + 0.7 * noise_beach->np->spread.Z);
 
-	noise_biome->perlinMap2D(
+	makeNoiseMap2D(noise_biome,
 		x + 0.6 * noise_biome->np->spread.X,
 		z + 0.2 * noise_biome->np->spread.Z);
 }
@@ -524,33 +643,55 @@ int MapgenV6::generateGround() {
 	MapNode n_stone(c_stone), n_desert_stone(c_desert_stone);
 	int stone_surface_max_y = -MAP_GENERATION_LIMIT;
 	u32 index = 0;
-	
+
+	// Surface height and biome of every column first, so that the nodes
+	// can then be filled in the order they are in memory
 	for (s16 z = node_min.Z; z <= node_max.Z; z++)
 	for (s16 x = node_min.X; x <= node_max.X; x++, index++) {
-		// Surface height
 		s16 surface_y = (s16)baseTerrainLevelFromMap(index);
-		
+		surface_map[index] = surface_y;
+		biome_map[index]   = getBiome(index, v2s16(x, z));
+
 		// Log it
 		if (surface_y > stone_surface_max_y)
 			stone_surface_max_y = surface_y;
+	}
+
+	// Fill ground with stone, one row of X at a time
+	for (s16 z = node_min.Z; z <= node_max.Z; z++) {
+		u32 index_row = (z - node_min.Z) * ystride;
+
+		s16 row_surface_max_y = -MAP_GENERATION_LIMIT;
+		for (s16 x = 0; x < central_area_size.X; x++)
+			row_surface_max_y = MYMAX(row_surface_max_y,
+				surface_map[index_row + x]);
 
-		BiomeType bt = getBiome(index, v2s16(x, z));
-		
-		// Fill ground with stone
-		v3s16 em = vm->m_area.getExtent();
-		u32 i = vm->m_area.index(x, node_min.Y, z);
 		for (s16 y = node_min.Y; y <= node_max.Y; y++) {
-			if (vm->m_data[i].getContent() == CONTENT_IGNORE) {
-				if (y <= surface_y) {
-					vm->m_data[i] = (y > water_level && bt == BT_DESERT) ? 
+			MapNode *row = &vm->m_data[vm->m_area.index(node_min.X, y, z)];
+
+			// Above the ground of the whole row
+			if (y > row_surface_max_y) {
+				MapNode n = (y <= water_level) ? n_water_source : n_air;
+				for (s16 x = 0; x < central_area_size.X; x++) {
+					if (row[x].getContent() == CONTENT_IGNORE)
+						row[x] = n;
+				}
+				continue;
+			}
+
+			for (s16 x = 0; x < central_area_size.X; x++) {
+				if (row[x].getContent() != CONTENT_IGNORE)
+					continue;
+				index = index_row + x;
+				if (y <= surface_map[index]) {
+					row[x] = (y > water_level && biome_map[index] == BT_DESERT) ?
 						n_desert_stone : n_stone;
 				} else if (y <= water_level) {
-					vm->m_data[i] = n_water_source;
+					row[x] = n_water_source;
 				} else {
-					vm->m_data[i] = n_air;
+					row[x] = n_air;
 				}
 			}
-			vm->m_area.add_y(em, i, 1);
 		}
 	}
 	
@@ -565,20 +706,21 @@ void MapgenV6::addMud() {
 	MapNode n_sand(c_sand), n_desert_sand(c_desert_sand);
 	MapNode addnode;
 
+	v3s16 em = vm->m_area.getExtent();
 	u32 index = 0;
 	for (s16 z = node_min.Z; z <= node_max.Z; z++)
 	for (s16 x = node_min.X; x <= node_max.X; x++, index++) {
-		// Randomize mud amount
-		s16 mud_add_amount = getMudAmount(index) / 2.0 + 0.5;
-
 		// Find ground level
-		s16 surface_y = find_stone_level(v2s16(x, z)); /////////////////optimize this!
-		
+		s16 surface_y = find_stone_level(v2s16(x, z));
+
 		// Handle area not found
 		if (surface_y == vm->m_area.MinEdge.Y - 1)
 			continue;
-		
-		BiomeType bt = getBiome(index, v2s16(x, z));
+
+		// Randomize mud amount
+		s16 mud_add_amount = getMudAmount(index) / 2.0 + 0.5;
+
+		BiomeType bt = biome_map[index];
 		addnode = (bt == BT_DESERT) ? n_desert_sand : n_dirt;
 
 		if (bt == BT_DESERT && surface_y + mud_add_amount <= water_level + 1) {
@@ -601,18 +743,10 @@ void MapgenV6::addMud() {
 			vm->m_data[i] = n_dirt;
 
 		// Add mud on ground
-		s16 mudcount = 0;
-		v3s16 em = vm->m_area.getExtent();
-		s16 y_start = surface_y + 1;
-		i = vm->m_area.index(x, y_start, z);
-		for (s16 y = y_start; y <= node_max.Y; y++) {
-			if (mudcount >= mud_add_amount)
-				break;
-
-			vm->m_data[i] = addnode;
-			mudcount++;
-
+		s16 y_end = MYMIN(node_max.Y, surface_y + mud_add_amount);
+		for (s16 y = surface_y + 1; y <= y_end; y++) {
 			vm->m_area.add_y(em, i, 1);
+			vm->m_data[i] = addnode;
 		}
 	}
 }
@@ -1034,6 +1168,8 @@ void MapgenV6::generateCaves(int max_stone_y) {
 		MapNode airnode(CONTENT_AIR);
 		MapNode waternode(c_water_source);
 		MapNode lavanode(c_lava_source);
+		content_t keep[4] = {CONTENT_IGNORE, CONTENT_AIR,
+			c_water_source, c_lava_source};
 
 		/*
 			Generate some tunnel starting from orp
@@ -1140,56 +1276,38 @@ void MapgenV6::generateCaves(int max_stone_y) {
 					{
 						s16 maxabsxz = MYMAX(abs(x0), abs(z0));
 						s16 si2 = rs/2 - MYMAX(0, maxabsxz-rs/7-1);
-						for(s16 y0=-si2; y0<=si2; y0++)
-						{
-							/*// Make better floors in small caves
-							if(y0 <= -rs/2 && rs<=7)
-								continue;*/
-							if (cave.large_cave_is_flat) {
-								// Make large caves not so tall
-								if (rs > 7 && abs(y0) >= rs/3)
-									continue;
-							}
+						s16 y0_min = -si2;
+						s16 y0_max = si2;
+						if (cave.large_cave_is_flat && rs > 7) {
+							// Make large caves not so tall
+							y0_min = MYMAX(y0_min, -(rs/3-1));
+							y0_max = MYMIN(y0_max, rs/3-1);
+						}
 
-							s16 z = cp.Z + z0;
-							s16 y = cp.Y + y0;
-							s16 x = cp.X + x0;
-							v3s16 p(x,y,z);
-							p += of;
-
-							if(vm->m_area.contains(p) == false)
-								continue;
-
-							u32 i = vm->m_area.index(p);
-
-							if(large_cave) {
-								if (cave.flooded && full_node_min.Y < water_level &&
-									full_node_max.Y > water_level) {
-									if (p.Y <= water_level)
-										vm->m_data[i] = waternode;
-									else
-										vm->m_data[i] = airnode;
-								} else if (cave.flooded && full_node_max.Y < water_level) {
-									if (p.Y < startp.Y - 2)
-										vm->m_data[i] = lavanode;
-									else
-										vm->m_data[i] = airnode;
-								} else {
-									vm->m_data[i] = airnode;
-								}
+						// The column of the tunnel at x0, z0
+						v3s16 p = of + cp + v3s16(x0, y0_min, z0);
+						s16 y_max = of.Y + cp.Y + y0_max;
+
+						if(large_cave) {
+							if (cave.flooded && full_node_min.Y < water_level &&
+								full_node_max.Y > water_level) {
+								vm->setColumn(p, MYMIN(y_max, water_level),
+									waternode);
+								vm->setColumn(v3s16(p.X, MYMAX(p.Y, water_level + 1), p.Z),
+									y_max, airnode);
+							} else if (cave.flooded && full_node_max.Y < water_level) {
+								vm->setColumn(p, MYMIN(y_max, startp.Y - 3),
+									lavanode);
+								vm->setColumn(v3s16(p.X, MYMAX(p.Y, startp.Y - 2), p.Z),
+									y_max, airnode);
 							} else {
-								// Don't replace air or water or lava or ignore
-								if (vm->m_data[i].getContent() == CONTENT_IGNORE ||
-									vm->m_data[i].getContent() == CONTENT_AIR ||
-									vm->m_data[i].getContent() == c_water_source ||
-									vm->m_data[i].getContent() == c_lava_source)
-									continue;
-
-								vm->m_data[i] = airnode;
-
-								// Set tunnel flag
-								vm->m_flags[i] |= VMANIP_FLAG_CAVE;
+								vm->setColumn(p, y_max, airnode);
 							}
+						} else {
+							// Don't replace air or water or lava or ignore,
+							// set tunnel flag
+							vm->replaceColumn(p, y_max, airnode,
+								keep, 4, VMANIP_FLAG_CAVE);
 						}
 					}
 				}
@@ -105,6 +105,11 @@ class MapgenV6 : public Mapgen {
 	v3s16 central_area_size;
 	int volume_nodes;
 
+	// Surface height and biome per column of the central area, in the
+	// order of the noise maps; set by generateGround
+	s16 *surface_map;
+	BiomeType *biome_map;
+
 	Noise *noise_terrain_base;
 	Noise *noise_terrain_higher;
 	Noise *noise_steepness;
@@ -135,6 +140,7 @@ class MapgenV6 : public Mapgen {
 	
 	void makeChunk(BlockMakeData *data);
 	int getGroundLevelAtPoint(v2s16 p);
+	HeightmapSource *createHeightmapSource();
 
 	float baseTerrainLevel(float terrain_base, float terrain_higher,
 						   float steepness, float height_select);
@@ -159,6 +165,8 @@ class MapgenV6 : public Mapgen {
 	
 	u32 get_blockseed(u64 seed, v3s16 p);
 	
+	// Makes the 2D map of noise, or takes it from the cache of emerge
+	void makeNoiseMap2D(Noise *noise, float x, float y);
 	virtual void calculateNoise();
 	int generateGround();
 	void addMud();
@@ -0,0 +1,334 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "maplight.h"
+#include "map.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "util/directiontables.h"
+#include <cassert>
+#include <cstring>
+
+#define NODES_PER_BLOCK (MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE)
+
+// Block number of missing and dummy blocks
+#define BLOCK_NONE 0xffffffff
+// Neighbouring block that has not been looked up yet
+#define BLOCK_UNKNOWN 0xfffffffe
+
+// Scratch flags of a node
+// Bucket the node is queued in plus one, or 0
+#define LIGHTFLAG_QUEUED 0x1f
+// The node is in m_sources
+#define LIGHTFLAG_SOURCE 0x80
+
+// Change of the node index when moving in a direction of g_6dirs inside
+// a block
+static const s16 g_light_dir_offset[6] = {
+	MAP_BLOCKSIZE * MAP_BLOCKSIZE, MAP_BLOCKSIZE, 1,
+	-MAP_BLOCKSIZE * MAP_BLOCKSIZE, -MAP_BLOCKSIZE, -1
+};
+// Change of the node index when moving in a direction into the next block
+static const s16 g_light_dir_wrap[6] = {
+	-(MAP_BLOCKSIZE - 1) * MAP_BLOCKSIZE * MAP_BLOCKSIZE,
+	-(MAP_BLOCKSIZE - 1) * MAP_BLOCKSIZE,
+	-(MAP_BLOCKSIZE - 1),
+	(MAP_BLOCKSIZE - 1) * MAP_BLOCKSIZE * MAP_BLOCKSIZE,
+	(MAP_BLOCKSIZE - 1) * MAP_BLOCKSIZE,
+	(MAP_BLOCKSIZE - 1)
+};
+// Shift of the coordinate along the direction in the node index
+static const u8 g_light_dir_shift[6] = {8, 4, 0, 8, 4, 0};
+// Coordinate at which moving in the direction leaves the block
+static const u16 g_light_dir_edge[6] = {
+	MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1, 0, 0, 0
+};
+
+MapLightEngine::MapLightEngine(Map *map, INodeDefManager *ndef):
+	m_map(map),
+	m_ndef(ndef),
+	m_top_bucket(-1)
+{
+}
+
+void MapLightEngine::clear()
+{
+	for(u16 i = 0; i <= LIGHT_SUN; i++)
+		m_buckets[i].clear();
+	m_top_bucket = -1;
+	m_sources.clear();
+
+	// Keep the memory; only clear the part that was used
+	if(!m_blocks.empty())
+		memset(&m_flags[0], 0, m_blocks.size() * NODES_PER_BLOCK);
+	m_blocks.clear();
+	m_block_numbers.clear();
+}
+
+void MapLightEngine::addUnlight(v3s16 p, u8 light)
+{
+	u32 entry;
+	if(!getEntry(p, entry))
+		return;
+	// A node added twice is unlighted from the last given light
+	getFlags(entry) &= ~LIGHTFLAG_QUEUED;
+	push(entry, light);
+}
+
+void MapLightEngine::unspread(enum LightBank bank)
+{
+	u32 entry;
+	u8 oldlight;
+	while(pop(entry, oldlight))
+	{
+		for(u16 i = 0; i < 6; i++)
+		{
+			u32 entry2;
+			if(!getNeighbor(entry, i, entry2))
+				continue;
+			MapNode &n2 = getNode(entry2);
+			u8 light2 = n2.getLight(bank, m_ndef);
+
+			/*
+				If the neighbor is dimmer than the light of this node
+				was, it may have got its light from this node. Remove
+				its light and go on from it.
+				Otherwise it may light this node again.
+			*/
+			if(light2 < oldlight)
+			{
+				if(light2 != 0 && m_ndef->get(n2).light_propagates)
+				{
+					n2.setLight(bank, 0, m_ndef);
+					setModified(entry2);
+					push(entry2, light2);
+				}
+			}
+			else
+			{
+				pushSource(entry2);
+			}
+		}
+	}
+}
+
+void MapLightEngine::addSource(v3s16 p)
+{
+	u32 entry;
+	if(getEntry(p, entry))
+		pushSource(entry);
+}
+
+void MapLightEngine::spread(enum LightBank bank)
+{
+	for(u32 i = 0; i < m_sources.size(); i++)
+	{
+		u32 entry = m_sources[i];
+		push(entry, getNode(entry).getLight(bank, m_ndef));
+	}
+
+	u32 entry;
+	u8 queued_light;
+	while(pop(entry, queued_light))
+	{
+		u8 oldlight = getNode(entry).getLight(bank, m_ndef);
+		u8 newlight = diminish_light(oldlight);
+
+		for(u16 i = 0; i < 6; i++)
+		{
+			u32 entry2;
+			if(!getNeighbor(entry, i, entry2))
+				continue;
+			MapNode &n2 = getNode(entry2);
+			u8 light2 = n2.getLight(bank, m_ndef);
+
+			/*
+				If the neighbor is brighter than the current node,
+				queue it (it will light up this node on its turn)
+			*/
+			if(light2 > undiminish_light(oldlight))
+				push(entry2, light2);
+
+			/*
+				If the neighbor is dimmer than how much light this node
+				would spread on it, light it and queue it
+			*/
+			if(light2 < newlight && m_ndef->get(n2).light_propagates)
+			{
+				n2.setLight(bank, newlight, m_ndef);
+				setModified(entry2);
+				push(entry2, newlight);
+			}
+		}
+	}
+}
+
+void MapLightEngine::clearSources()
+{
+	for(u32 i = 0; i < m_sources.size(); i++)
+		getFlags(m_sources[i]) &= ~LIGHTFLAG_SOURCE;
+	m_sources.clear();
+}
+
+void MapLightEngine::getSources(std::set<v3s16> &sources)
+{
+	for(u32 i = 0; i < m_sources.size(); i++)
+		sources.insert(getPos(m_sources[i]));
+}
+
+void MapLightEngine::getModifiedBlocks(
+		std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	for(u32 i = 0; i < m_blocks.size(); i++)
+	{
+		if(m_blocks[i].modified)
+			modified_blocks[m_blocks[i].pos] = m_blocks[i].block;
+	}
+}
+
+u32 MapLightEngine::getBlock(v3s16 blockpos)
+{
+	std::map<v3s16, u32>::iterator i = m_block_numbers.find(blockpos);
+	if(i != m_block_numbers.end())
+		return i->second;
+
+	u32 number = BLOCK_NONE;
+	MapBlock *block = m_map->getBlockNoCreateNoEx(blockpos);
+	MapNode *data = block ? block->getData() : NULL;
+	if(data != NULL)
+	{
+		assert(m_blocks.size() < (1 << 20));
+		number = m_blocks.size();
+		LightBlock b;
+		b.block = block;
+		b.data = data;
+		b.pos = blockpos;
+		b.modified = false;
+		for(u16 j = 0; j < 6; j++)
+			b.neighbors[j] = BLOCK_UNKNOWN;
+		m_blocks.push_back(b);
+		if(m_flags.size() < m_blocks.size() * NODES_PER_BLOCK)
+			m_flags.resize(m_blocks.size() * NODES_PER_BLOCK, 0);
+	}
+	m_block_numbers[blockpos] = number;
+	return number;
+}
+
+u32 MapLightEngine::getNeighborBlock(u32 block, u16 dir)
+{
+	u32 number = m_blocks[block].neighbors[dir];
+	if(number == BLOCK_UNKNOWN)
+	{
+		number = getBlock(m_blocks[block].pos + g_6dirs[dir]);
+		// m_blocks may have been reallocated
+		m_blocks[block].neighbors[dir] = number;
+	}
+	return number;
+}
+
+bool MapLightEngine::getEntry(v3s16 p, u32 &entry)
+{
+	v3s16 blockpos = getNodeBlockPos(p);
+	u32 block = getBlock(blockpos);
+	if(block == BLOCK_NONE)
+		return false;
+	v3s16 relpos = p - blockpos * MAP_BLOCKSIZE;
+	entry = (block << 12) | (relpos.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE
+			+ relpos.Y * MAP_BLOCKSIZE + relpos.X);
+	return true;
+}
+
+bool MapLightEngine::getNeighbor(u32 entry, u16 dir, u32 &neighbor)
+{
+	u16 index = entry & 0xfff;
+	if(((index >> g_light_dir_shift[dir]) & (MAP_BLOCKSIZE - 1))
+			!= g_light_dir_edge[dir])
+	{
+		neighbor = entry + g_light_dir_offset[dir];
+		return true;
+	}
+	u32 block = getNeighborBlock(entry >> 12, dir);
+	if(block == BLOCK_NONE)
+		return false;
+	neighbor = (block << 12) | (u16)(index + g_light_dir_wrap[dir]);
+	return true;
+}
+
+v3s16 MapLightEngine::getPos(u32 entry)
+{
+	u16 index = entry & 0xfff;
+	return m_blocks[entry >> 12].pos * MAP_BLOCKSIZE + v3s16(
+			index & (MAP_BLOCKSIZE - 1),
+			(index >> 4) & (MAP_BLOCKSIZE - 1),
+			index >> 8);
+}
+
+void MapLightEngine::setModified(u32 entry)
+{
+	LightBlock &b = m_blocks[entry >> 12];
+	if(!b.modified)
+	{
+		b.modified = true;
+		b.block->raiseModified(MOD_STATE_WRITE_NEEDED, "setNode");
+	}
+}
+
+void MapLightEngine::push(u32 entry, u8 light)
+{
+	u8 &flags = getFlags(entry);
+	if((flags & LIGHTFLAG_QUEUED) >= light + 1)
+		return;
+	flags = (flags & ~LIGHTFLAG_QUEUED) | (light + 1);
+	m_buckets[light].push_back(entry);
+	if(light > m_top_bucket)
+		m_top_bucket = light;
+}
+
+bool MapLightEngine::pop(u32 &entry, u8 &light)
+{
+	while(m_top_bucket >= 0)
+	{
+		std::vector<u32> &bucket = m_buckets[m_top_bucket];
+		if(bucket.empty())
+		{
+			m_top_bucket--;
+			continue;
+		}
+		entry = bucket.back();
+		bucket.pop_back();
+		// Skip entries that were queued again in another bucket
+		u8 &flags = getFlags(entry);
+		if((flags & LIGHTFLAG_QUEUED) != m_top_bucket + 1)
+			continue;
+		flags &= ~LIGHTFLAG_QUEUED;
+		light = m_top_bucket;
+		return true;
+	}
+	return false;
+}
+
+void MapLightEngine::pushSource(u32 entry)
+{
+	u8 &flags = getFlags(entry);
+	if(flags & LIGHTFLAG_SOURCE)
+		return;
+	flags |= LIGHTFLAG_SOURCE;
+	m_sources.push_back(entry);
+}
+
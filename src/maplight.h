@@ -0,0 +1,135 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef MAPLIGHT_HEADER
+#define MAPLIGHT_HEADER
+
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+#include "light.h"
+#include "mapnode.h"
+#include <vector>
+#include <map>
+#include <set>
+
+class Map;
+class MapBlock;
+class INodeDefManager;
+
+/*
+	Spreads and removes light on the loaded blocks of a Map.
+
+	Nodes are referred to by packed 32-bit entries: the upper bits are
+	an engine-local number of the block, the lower 12 bits the index of
+	the node in the block. Neighbours inside a block are found by index
+	arithmetic, and the neighbouring blocks of every block are looked up
+	only once. Missing and dummy blocks are skipped.
+
+	Work is kept in one bucket per light level and the brightest bucket
+	is handled first, so no recursion and no sorted containers are
+	needed. Every block has a flat scratch array with a byte per node,
+	used to not queue a node twice. Blocks whose light is changed are
+	collected once per block.
+
+	Light sources found by unspread() are kept until clearSources(), so
+	the light removed from both banks can be spread again from the same
+	nodes, like Map::addNodeAndUpdate() does.
+
+	One engine is owned by each Map and reused; the map is only used by
+	one thread at a time.
+*/
+class MapLightEngine
+{
+public:
+	MapLightEngine(Map *map, INodeDefManager *ndef);
+
+	// Forgets all blocks, queued nodes, sources and modified blocks
+	void clear();
+
+	/*
+		Removing light: queue nodes whose light was light and has been
+		removed, then call unspread(). Dimmer neighbours are darkened in
+		turn; neighbours at least as bright are added to the sources.
+	*/
+	void addUnlight(v3s16 p, u8 light);
+	void unspread(enum LightBank bank);
+
+	/*
+		Spreading light from the sources (which are kept)
+	*/
+	void addSource(v3s16 p);
+	void spread(enum LightBank bank);
+	void clearSources();
+	void getSources(std::set<v3s16> &sources);
+
+	// Adds the blocks whose light has been changed
+	void getModifiedBlocks(std::map<v3s16, MapBlock*> &modified_blocks);
+
+private:
+	struct LightBlock
+	{
+		MapBlock *block;
+		MapNode *data;
+		v3s16 pos;
+		bool modified;
+		// Engine-local numbers of the neighbouring blocks
+		u32 neighbors[6];
+	};
+
+	// Returns the number of the block at blockpos, or BLOCK_NONE
+	u32 getBlock(v3s16 blockpos);
+	// Returns the number of the block next to block in direction dir
+	u32 getNeighborBlock(u32 block, u16 dir);
+	// Sets entry to the node at p; false if its block is not there
+	bool getEntry(v3s16 p, u32 &entry);
+	bool getNeighbor(u32 entry, u16 dir, u32 &neighbor);
+	v3s16 getPos(u32 entry);
+
+	MapNode & getNode(u32 entry)
+	{
+		return m_blocks[entry >> 12].data[entry & 0xfff];
+	}
+	u8 & getFlags(u32 entry)
+	{
+		return m_flags[entry];
+	}
+	void setModified(u32 entry);
+
+	// Queues entry in bucket light unless it is queued at light already
+	void push(u32 entry, u8 light);
+	// Takes the next entry from the brightest bucket; false if empty
+	bool pop(u32 &entry, u8 &light);
+	void pushSource(u32 entry);
+
+	Map *m_map;
+	INodeDefManager *m_ndef;
+
+	std::vector<LightBlock> m_blocks;
+	std::map<v3s16, u32> m_block_numbers;
+	// MAP_BLOCKSIZE^3 bytes for every block in m_blocks
+	std::vector<u8> m_flags;
+
+	std::vector<u32> m_buckets[LIGHT_SUN + 1];
+	s16 m_top_bucket;
+
+	std::vector<u32> m_sources;
+};
+
+#endif
+
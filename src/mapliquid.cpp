@@ -0,0 +1,541 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mapliquid.h"
+#include "map.h"
+#include "mapblock.h"
+#include "gamedef.h"
+#include "rollback_interface.h"
+#include "porting.h"
+#include "log.h"
+#include "debug.h"
+#include "util/directiontables.h"
+#include <jmutexautolock.h>
+#include <cassert>
+#include <cstring>
+
+#define WATER_DROP_BOOST 4
+
+// Not worth waking a thread for fewer queued nodes than this
+#define NODES_PER_LIQUID_THREAD 16384
+
+/*
+	LiquidQueue
+*/
+
+LiquidQueue::Block::Block():
+	first(0)
+{
+	memset(queued, 0, sizeof(queued));
+}
+
+void LiquidQueue::push_back(v3s16 p)
+{
+	v3s16 blockpos = getNodeBlockPos(p);
+	v3s16 relpos = p - blockpos * MAP_BLOCKSIZE;
+	u16 index = relpos.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE
+			+ relpos.Y * MAP_BLOCKSIZE + relpos.X;
+	Block &block = m_blocks[blockpos];
+	u8 bit = 1 << (index & 7);
+	if(block.queued[index >> 3] & bit)
+		return;
+	block.queued[index >> 3] |= bit;
+	block.nodes.push_back(index);
+	m_size++;
+}
+
+v3s16 LiquidQueue::pop_front()
+{
+	assert(m_size != 0);
+	std::map<v3s16, Block>::iterator i = m_blocks.upper_bound(m_last_block);
+	if(i == m_blocks.end())
+		i = m_blocks.begin();
+	m_last_block = i->first;
+	Block &block = i->second;
+	u16 index = block.nodes[block.first++];
+	block.queued[index >> 3] &= ~(1 << (index & 7));
+	v3s16 p = i->first * MAP_BLOCKSIZE + v3s16(
+			index & (MAP_BLOCKSIZE - 1),
+			(index >> 4) & (MAP_BLOCKSIZE - 1),
+			index >> 8);
+	if(block.first == block.nodes.size())
+		m_blocks.erase(i);
+	m_size--;
+	return p;
+}
+
+void LiquidQueue::takeAll(std::map<v3s16, std::vector<u16> > &blocks)
+{
+	for(std::map<v3s16, Block>::iterator
+			i = m_blocks.begin(); i != m_blocks.end(); i++)
+	{
+		Block &block = i->second;
+		std::vector<u16> &nodes = blocks[i->first];
+		nodes.insert(nodes.end(), block.nodes.begin() + block.first,
+				block.nodes.end());
+	}
+	m_blocks.clear();
+	m_size = 0;
+}
+
+/*
+	MapLiquidEngine
+*/
+
+MapLiquidEngine::MapLiquidEngine(Map *map, IGameDef *gamedef):
+	m_map(map),
+	m_gamedef(gamedef),
+	m_ndef(gamedef->ndef()),
+	m_info_id_version(0),
+	m_next(0),
+	m_start_ms(0),
+	m_budget_ms(0),
+	m_over_budget(false),
+	m_report_rollback(false),
+	m_nodes_per_thread(NODES_PER_LIQUID_THREAD),
+	m_last_thread_count(0),
+	m_pool("LiquidThread")
+{
+	m_mutex.Init();
+}
+
+void MapLiquidEngine::updateContentInfo()
+{
+	// Liquid alternatives are looked up by name, so the ids can change
+	// with the name-id mapping
+	if(!m_info.empty() && m_info_id_version == m_ndef->getIdVersion())
+		return;
+	m_info.resize(MAX_CONTENT + 1);
+	for(u32 c = 0; c <= MAX_CONTENT; c++)
+	{
+		const ContentFeatures &f = m_ndef->get(c);
+		ContentInfo &info = m_info[c];
+		info.liquid_type = f.liquid_type;
+		info.flowing = CONTENT_IGNORE;
+		info.source = CONTENT_IGNORE;
+		if(!f.liquid_alternative_flowing.empty())
+			info.flowing = m_ndef->getId(f.liquid_alternative_flowing);
+		if(!f.liquid_alternative_source.empty())
+			info.source = m_ndef->getId(f.liquid_alternative_source);
+		info.renewable = f.liquid_renewable;
+		info.viscosity = f.liquid_viscosity;
+		info.light_source = f.light_source != 0;
+	}
+	m_info_id_version = m_ndef->getIdVersion();
+}
+
+u32 MapLiquidEngine::transform(LiquidQueue &queue, u32 num_threads,
+		u32 budget_ms, std::map<v3s16, MapBlock*> &modified_blocks,
+		std::map<v3s16, MapBlock*> &lighting_modified_blocks)
+{
+	DSTACK(__FUNCTION_NAME);
+
+	if(queue.size() == 0)
+		return 0;
+
+	updateContentInfo();
+
+	m_start_ms = porting::getTimeMs();
+	m_budget_ms = budget_ms;
+	m_over_budget = false;
+
+	// Finding the suspect of a change reads the map through the cache
+	// of Map, which is not thread safe
+	m_report_rollback = m_gamedef->rollback() != NULL;
+	if(m_report_rollback)
+		num_threads = 1;
+
+	/*
+		Take everything queued and look up the blocks on this thread.
+		Getting the node arrays also unpacks the blocks.
+	*/
+	std::map<v3s16, std::vector<u16> > queued;
+	queue.takeAll(queued);
+	std::vector<Task> tasks(queued.size());
+	std::vector<Task*> phases[8];
+	u32 phase_nodes[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	u32 i = 0;
+	for(std::map<v3s16, std::vector<u16> >::iterator
+			j = queued.begin(); j != queued.end(); j++, i++)
+	{
+		Task &task = tasks[i];
+		task.blockpos = j->first;
+		task.nodes.swap(j->second);
+		task.done = false;
+		task.modified = false;
+		task.lighting_modified = false;
+		for(u16 k = 0; k < 7; k++)
+		{
+			v3s16 blockpos = task.blockpos;
+			if(k != 0)
+				blockpos += g_6dirs[k - 1];
+			task.blocks[k] = m_map->getBlockNoCreateNoEx(blockpos);
+			task.data[k] = task.blocks[k] ? task.blocks[k]->getData() : NULL;
+		}
+		u16 phase = (task.blockpos.X & 1) | ((task.blockpos.Y & 1) << 1)
+				| ((task.blockpos.Z & 1) << 2);
+		phases[phase].push_back(&task);
+		phase_nodes[phase] += task.nodes.size();
+	}
+
+	m_last_thread_count = 0;
+	for(u16 phase = 0; phase < 8; phase++)
+	{
+		if(isOverBudget())
+			break;
+		m_phase = phases[phase];
+		m_next = 0;
+		u32 phase_threads = MYMIN(num_threads, MYMIN(m_phase.size(),
+				phase_nodes[phase] / m_nodes_per_thread));
+		phase_threads = MYMAX(phase_threads, 1);
+		m_last_thread_count = MYMAX(m_last_thread_count, phase_threads);
+		m_pool.run(this, phase_threads);
+	}
+	m_phase.clear();
+
+	/*
+		Put back what was not handled in time, then queue what the
+		handled blocks asked for and what has to flow again
+	*/
+	u32 handled = 0;
+	for(i = 0; i < tasks.size(); i++)
+	{
+		Task &task = tasks[i];
+		if(task.done)
+		{
+			handled += task.nodes.size();
+			continue;
+		}
+		v3s16 p0 = task.blockpos * MAP_BLOCKSIZE;
+		for(u32 j = 0; j < task.nodes.size(); j++)
+		{
+			u16 index = task.nodes[j];
+			queue.push_back(p0 + v3s16(index & (MAP_BLOCKSIZE - 1),
+					(index >> 4) & (MAP_BLOCKSIZE - 1), index >> 8));
+		}
+	}
+	for(i = 0; i < tasks.size(); i++)
+	{
+		Task &task = tasks[i];
+		for(u32 j = 0; j < task.pushed.size(); j++)
+			queue.push_back(task.pushed[j]);
+		if(task.modified)
+			modified_blocks[task.blockpos] = task.blocks[0];
+		if(task.lighting_modified)
+			lighting_modified_blocks[task.blockpos] = task.blocks[0];
+	}
+	for(i = 0; i < tasks.size(); i++)
+	{
+		Task &task = tasks[i];
+		v3s16 p0 = task.blockpos * MAP_BLOCKSIZE;
+		for(u32 j = 0; j < task.reflow.size(); j++)
+		{
+			u16 index = task.reflow[j];
+			queue.push_back(p0 + v3s16(index & (MAP_BLOCKSIZE - 1),
+					(index >> 4) & (MAP_BLOCKSIZE - 1), index >> 8));
+		}
+	}
+
+	return handled;
+}
+
+void MapLiquidEngine::work()
+{
+	for(;;)
+	{
+		Task *task;
+		{
+			JMutexAutoLock lock(m_mutex);
+			if(m_next >= m_phase.size() || isOverBudget())
+				return;
+			task = m_phase[m_next++];
+		}
+		transformBlock(*task);
+	}
+}
+
+bool MapLiquidEngine::isOverBudget()
+{
+	if(!m_over_budget && m_budget_ms != 0
+			&& porting::getTimeMs() - m_start_ms >= m_budget_ms)
+		m_over_budget = true;
+	return m_over_budget;
+}
+
+void MapLiquidEngine::transformBlock(Task &task)
+{
+	// Nodes of missing and dummy blocks are dropped, as they used to be
+	if(task.data[0] != NULL)
+	{
+		for(u32 i = 0; i < task.nodes.size(); i++)
+		{
+			if(transformNode(task, task.nodes[i]))
+				task.modified = true;
+		}
+		if(task.modified)
+			task.blocks[0]->raiseModified(MOD_STATE_WRITE_NEEDED,
+					"transformLiquids");
+	}
+	task.done = true;
+}
+
+/*
+	A neighbouring node; which one is told by its direction in g_6dirs.
+	1 is the upper and 4 the lower neighbour.
+*/
+struct LiquidNeighbor
+{
+	MapNode n;
+	u16 dir;
+};
+
+#define LIQUID_DIR_UPPER 1
+#define LIQUID_DIR_LOWER 4
+
+bool MapLiquidEngine::transformNode(Task &task, u16 index)
+{
+	v3s16 relpos(index & (MAP_BLOCKSIZE - 1),
+			(index >> 4) & (MAP_BLOCKSIZE - 1), index >> 8);
+	v3s16 p0 = task.blockpos * MAP_BLOCKSIZE + relpos;
+	MapNode n0 = task.data[0][index];
+
+	/*
+		Collect information about current node
+	 */
+	s8 liquid_level = -1;
+	content_t liquid_kind = CONTENT_IGNORE;
+	LiquidType liquid_type = getInfo(n0.getContent()).liquid_type;
+	switch (liquid_type) {
+		case LIQUID_SOURCE:
+			liquid_level = LIQUID_LEVEL_SOURCE;
+			liquid_kind = getInfo(n0.getContent()).flowing;
+			break;
+		case LIQUID_FLOWING:
+			liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
+			liquid_kind = n0.getContent();
+			break;
+		case LIQUID_NONE:
+			// if this is an air node, it *could* be transformed into a liquid. otherwise,
+			// continue with the next node.
+			if (n0.getContent() != CONTENT_AIR)
+				return false;
+			liquid_kind = CONTENT_AIR;
+			break;
+	}
+
+	/*
+		Collect information about the environment
+	 */
+	LiquidNeighbor sources[6]; // surrounding sources
+	int num_sources = 0;
+	LiquidNeighbor flows[6]; // surrounding flowing liquid nodes
+	int num_flows = 0;
+	LiquidNeighbor airs[6]; // surrounding air
+	int num_airs = 0;
+	bool flowing_down = false;
+	for (u16 i = 0; i < 6; i++) {
+		LiquidNeighbor nb;
+		nb.dir = i;
+		// Missing blocks read as CONTENT_IGNORE, like getNodeNoEx()
+		MapNode *data = task.data[0];
+		v3s16 p = relpos + g_6dirs[i];
+		if ((u16)p.X >= MAP_BLOCKSIZE || (u16)p.Y >= MAP_BLOCKSIZE
+				|| (u16)p.Z >= MAP_BLOCKSIZE) {
+			data = task.data[i + 1];
+			p -= g_6dirs[i] * MAP_BLOCKSIZE;
+		}
+		if (data != NULL)
+			nb.n = data[p.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE
+					+ p.Y * MAP_BLOCKSIZE + p.X];
+		else
+			nb.n = MapNode(CONTENT_IGNORE);
+		const ContentInfo &nf = getInfo(nb.n.getContent());
+		switch (nf.liquid_type) {
+			case LIQUID_NONE:
+				if (nb.n.getContent() == CONTENT_AIR) {
+					airs[num_airs++] = nb;
+					// if the current node is a water source the neighbor
+					// should be enqueded for transformation regardless of whether the
+					// current node changes or not.
+					if (i != LIQUID_DIR_UPPER && liquid_type != LIQUID_NONE)
+						task.pushed.push_back(p0 + g_6dirs[i]);
+					// if the current node happens to be a flowing node, it will start to flow down here.
+					if (i == LIQUID_DIR_LOWER)
+						flowing_down = true;
+				}
+				break;
+			case LIQUID_SOURCE:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = nf.flowing;
+				// Do not count bottom source, it will screw things up
+				if (nf.flowing == liquid_kind && i != LIQUID_DIR_LOWER)
+					sources[num_sources++] = nb;
+				break;
+			case LIQUID_FLOWING:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = nf.flowing;
+				if (nf.flowing == liquid_kind) {
+					flows[num_flows++] = nb;
+					if (i == LIQUID_DIR_LOWER)
+						flowing_down = true;
+				}
+				break;
+		}
+	}
+
+	/*
+		decide on the type (and possibly level) of the current node
+	 */
+	const ContentInfo &kf = getInfo(liquid_kind);
+	content_t new_node_content;
+	s8 new_node_level = -1;
+	s8 max_node_level = -1;
+	if ((num_sources >= 2 && kf.renewable) || liquid_type == LIQUID_SOURCE) {
+		// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
+		// or the flowing alternative of the first of the surrounding sources (if it's air), so
+		// it's perfectly safe to use liquid_kind here to determine the new node content.
+		new_node_content = kf.source;
+	} else if (num_sources >= 1 && sources[0].dir != LIQUID_DIR_LOWER) {
+		// liquid_kind is set properly, see above
+		new_node_content = liquid_kind;
+		max_node_level = new_node_level = LIQUID_LEVEL_MAX;
+	} else {
+		// no surrounding sources, so get the maximum level that can flow into this node
+		for (u16 i = 0; i < num_flows; i++) {
+			u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
+			switch (flows[i].dir) {
+				case LIQUID_DIR_UPPER:
+					if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
+						max_node_level = LIQUID_LEVEL_MAX;
+						if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
+							max_node_level = nb_liquid_level + WATER_DROP_BOOST;
+					} else if (nb_liquid_level > max_node_level)
+						max_node_level = nb_liquid_level;
+					break;
+				case LIQUID_DIR_LOWER:
+					break;
+				default:
+					if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
+						nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level) {
+						max_node_level = nb_liquid_level - 1;
+					}
+					break;
+			}
+		}
+
+		u8 viscosity = kf.viscosity;
+		if (viscosity > 1 && max_node_level != liquid_level) {
+			// amount to gain, limited by viscosity
+			// must be at least 1 in absolute value
+			s8 level_inc = max_node_level - liquid_level;
+			if (level_inc < -viscosity || level_inc > viscosity)
+				new_node_level = liquid_level + level_inc/viscosity;
+			else if (level_inc < 0)
+				new_node_level = liquid_level - 1;
+			else if (level_inc > 0)
+				new_node_level = liquid_level + 1;
+			if (new_node_level != max_node_level)
+				task.reflow.push_back(index);
+		} else
+			new_node_level = max_node_level;
+
+		if (new_node_level >= 0)
+			new_node_content = liquid_kind;
+		else
+			new_node_content = CONTENT_AIR;
+	}
+
+	/*
+		check if anything has changed. if not, just continue with the next node.
+	 */
+	if (new_node_content == n0.getContent() && (liquid_type != LIQUID_FLOWING ||
+									 ((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
+									 ((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
+									 == flowing_down)))
+		return false;
+
+	// Never place CONTENT_IGNORE (a liquid without a source alternative)
+	if (new_node_content == CONTENT_IGNORE)
+		return false;
+
+	/*
+		update the current node
+	 */
+	const ContentInfo &nf0 = getInfo(new_node_content);
+	if (nf0.liquid_type == LIQUID_FLOWING) {
+		// set level to last 3 bits, flowing down bit to 4th bit
+		n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
+	} else {
+		// set the liquid level and flow bit to 0
+		n0.param2 = ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
+	}
+	n0.setContent(new_node_content);
+
+	// Find out whether there is a suspect for this action
+	std::string suspect;
+	if(m_report_rollback){
+		suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
+	}
+
+	if(!suspect.empty()){
+		// Blame suspect
+		RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
+		// Get old node for rollback
+		RollbackNode rollback_oldnode(m_map, p0, m_gamedef);
+		// Set node
+		task.data[0][index] = n0;
+		// Report
+		RollbackNode rollback_newnode(m_map, p0, m_gamedef);
+		RollbackAction action;
+		action.setSetNode(p0, rollback_oldnode, rollback_newnode);
+		m_gamedef->rollback()->reportAction(action);
+	} else {
+		// Set node
+		task.data[0][index] = n0;
+	}
+
+	// If node emits light, MapBlock requires lighting update
+	if(nf0.light_source)
+		task.lighting_modified = true;
+
+	/*
+		enqueue neighbors for update if neccessary
+	 */
+	switch (nf0.liquid_type) {
+		case LIQUID_SOURCE:
+		case LIQUID_FLOWING:
+			// make sure source flows into all neighboring nodes
+			for (u16 i = 0; i < num_flows; i++)
+				if (flows[i].dir != LIQUID_DIR_UPPER)
+					task.pushed.push_back(p0 + g_6dirs[flows[i].dir]);
+			for (u16 i = 0; i < num_airs; i++)
+				if (airs[i].dir != LIQUID_DIR_UPPER)
+					task.pushed.push_back(p0 + g_6dirs[airs[i].dir]);
+			break;
+		case LIQUID_NONE:
+			// this flow has turned to air; neighboring flows might need to do the same
+			for (u16 i = 0; i < num_flows; i++)
+				task.pushed.push_back(p0 + g_6dirs[flows[i].dir]);
+			break;
+	}
+	return true;
+}
+
@@ -0,0 +1,205 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef MAPLIQUID_HEADER
+#define MAPLIQUID_HEADER
+
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+#include "mapnode.h"
+#include "nodedef.h"
+#include "util/thread.h"
+#include <jmutex.h>
+#include <vector>
+#include <map>
+
+class Map;
+class MapBlock;
+class IGameDef;
+
+#define LIQUID_QUEUE_BLOCK_NODES \
+		(MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE)
+
+/*
+	The nodes whose liquid may have to be transformed, kept in one queue
+	per MapBlock. A node is in the queue at most once, like in a
+	UniqueQueue.
+*/
+class LiquidQueue
+{
+public:
+	LiquidQueue():
+		m_last_block(-32768,-32768,-32768),
+		m_size(0)
+	{}
+
+	void push_back(v3s16 p);
+	/*
+		Takes the first node of the block following the one taken from
+		last, so that the blocks take turns. Must not be empty.
+	*/
+	v3s16 pop_front();
+	u32 size() const
+	{
+		return m_size;
+	}
+
+	/*
+		Moves all queued nodes to blocks, as node indices in queue order
+		keyed by the position of their block, and empties the queue.
+	*/
+	void takeAll(std::map<v3s16, std::vector<u16> > &blocks);
+
+private:
+	struct Block
+	{
+		// Node indices; those before first have been popped
+		std::vector<u16> nodes;
+		u32 first;
+		// A bit for every node in nodes[first...]
+		u8 queued[LIQUID_QUEUE_BLOCK_NODES / 8];
+
+		Block();
+	};
+
+	std::map<v3s16, Block> m_blocks;
+	// Position of the block pop_front() took from last
+	v3s16 m_last_block;
+	u32 m_size;
+};
+
+/*
+	Transforms the queued liquid of a Map (the classic, not the finite
+	liquid), block by block.
+
+	All nodes queued at the start of a step are taken from the queue and
+	handled by their block. Neighbours are read straight from the node
+	arrays of the block and its six neighbours, which are looked up once
+	per step, and the node definitions needed are cached by content id.
+	A block only ever changes its own nodes.
+
+	So the blocks are handled in eight phases by the parity of their
+	coordinates. Blocks of one phase are never next to each other: none
+	of them reads what another one writes, and they can be handled by
+	several threads at once. Nodes queued by a block are collected with
+	it and added to the queue after the step, in block order, so the
+	result does not depend on the number of threads.
+
+	Each step can be given a time budget; blocks not handled when it has
+	run out stay queued for the next step.
+
+	The threads are kept in a WorkerPool between the phases and steps.
+*/
+class MapLiquidEngine : public WorkerPool::Job
+{
+public:
+	MapLiquidEngine(Map *map, IGameDef *gamedef);
+
+	/*
+		Does one step on the nodes in queue, with up to num_threads
+		threads (including the calling one) and in about budget_ms
+		milliseconds (0 = no limit).
+		Adds the changed blocks to modified_blocks, and those where a
+		node emitting light was placed to lighting_modified_blocks.
+		Returns the number of queued nodes that were handled.
+	*/
+	u32 transform(LiquidQueue &queue, u32 num_threads, u32 budget_ms,
+			std::map<v3s16, MapBlock*> &modified_blocks,
+			std::map<v3s16, MapBlock*> &lighting_modified_blocks);
+
+	// Handles blocks of the current phase until none are left
+	void work();
+
+	/*
+		A phase gets a thread for every this many queued nodes, up to
+		num_threads of transform()
+	*/
+	void setNodesPerThread(u32 nodes)
+	{
+		m_nodes_per_thread = nodes > 0 ? nodes : 1;
+	}
+	// Most threads a phase of the last transform() was handled with
+	u32 getLastThreadCount() const
+	{
+		return m_last_thread_count;
+	}
+
+private:
+	// What a step needs to know of the definition of a content id
+	struct ContentInfo
+	{
+		LiquidType liquid_type;
+		content_t flowing;
+		content_t source;
+		bool renewable;
+		u8 viscosity;
+		bool light_source;
+	};
+
+	struct Task
+	{
+		v3s16 blockpos;
+		// The block, then its neighbours in the directions of g_6dirs.
+		// NULL data for missing and dummy blocks.
+		MapBlock *blocks[7];
+		MapNode *data[7];
+		std::vector<u16> nodes;
+
+		// Results
+		bool done;
+		bool modified;
+		bool lighting_modified;
+		std::vector<v3s16> pushed;
+		std::vector<u16> reflow;
+	};
+
+	void updateContentInfo();
+	const ContentInfo & getInfo(content_t c) const
+	{
+		return m_info[c <= MAX_CONTENT ? c : CONTENT_IGNORE];
+	}
+	void transformBlock(Task &task);
+	// Returns whether the node changed
+	bool transformNode(Task &task, u16 index);
+	bool isOverBudget();
+
+	Map *m_map;
+	IGameDef *m_gamedef;
+	INodeDefManager *m_ndef;
+
+	std::vector<ContentInfo> m_info;
+	u32 m_info_id_version;
+
+	// State of the step, shared with the threads
+	std::vector<Task*> m_phase;
+	u32 m_next;
+	u32 m_start_ms;
+	u32 m_budget_ms;
+	bool m_over_budget;
+	// Set when the rollback is told about every change
+	bool m_report_rollback;
+	JMutex m_mutex;
+
+	u32 m_nodes_per_thread;
+	u32 m_last_thread_count;
+	WorkerPool m_pool;
+};
+
+#endif
+
@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <ostream>
 #include <map>
 #include <list>
+#include <vector>
 
 class MapBlock;
 class Map;
@@ -63,6 +64,12 @@ class MapSector
 	void deleteBlock(MapBlock *block);
 	
 	void getBlocks(std::list<MapBlock*> &dest);
+	void getBlocks(std::vector<MapBlock*> &dest);
+
+	bool empty()
+	{
+		return m_blocks.empty();
+	}
 	
 	// Always false at the moment, because sector contains no metadata.
 	bool differs_from_disk;
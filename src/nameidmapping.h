@@ -73,6 +73,12 @@ class NameIdMapping
 	u16 size() const{
 		return m_id_to_name.size();
 	}
+	const std::map<u16, std::string> & getIdToName() const{
+		return m_id_to_name;
+	}
+	bool operator==(const NameIdMapping &other) const{
+		return m_id_to_name == other.m_id_to_name;
+	}
 private:
 	std::map<u16, std::string> m_id_to_name;
 	std::map<std::string, u16> m_name_to_id;
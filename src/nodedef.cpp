@@ -349,6 +349,9 @@ void ContentFeatures::deSerialize(std::istream &is)
 	CNodeDefManager
 */
 
+// Source of id versions of all node definition managers
+static u32 g_node_id_version_counter = 0;
+
 class CNodeDefManager: public IWritableNodeDefManager
 {
 public:
@@ -356,6 +359,7 @@ class CNodeDefManager: public IWritableNodeDefManager
 	{
 		m_name_id_mapping.clear();
 		m_name_id_mapping_with_aliases.clear();
+		m_id_version = ++g_node_id_version_counter;
 
 		for(u16 i=0; i<=MAX_CONTENT; i++)
 		{
@@ -415,6 +419,12 @@ class CNodeDefManager: public IWritableNodeDefManager
 	}
 	virtual ~CNodeDefManager()
 	{
+#ifndef SERVER
+		for(std::map<std::pair<u32, u8>, TileVariants*>::iterator
+				i = m_tile_variants.begin();
+				i != m_tile_variants.end(); ++i)
+			delete i->second;
+#endif
 	}
 	virtual IWritableNodeDefManager* clone()
 	{
@@ -474,6 +484,10 @@ class CNodeDefManager: public IWritableNodeDefManager
 		getId(name, id);
 		return get(id);
 	}
+	virtual u32 getIdVersion() const
+	{
+		return m_id_version;
+	}
 	// IWritableNodeDefManager
 	virtual void set(content_t c, const ContentFeatures &def)
 	{
@@ -527,6 +541,7 @@ class CNodeDefManager: public IWritableNodeDefManager
 	{
 		std::set<std::string> all = idef->getAll();
 		m_name_id_mapping_with_aliases.clear();
+		m_id_version = ++g_node_id_version_counter;
 		for(std::set<std::string>::iterator
 				i = all.begin(); i != all.end(); i++)
 		{
@@ -718,6 +733,15 @@ class CNodeDefManager: public IWritableNodeDefManager
 					}
 				}
 			}
+			// Texture variants needed by mesh generation and animation
+			for(u16 j=0; j<6; j++){
+				f->tiles[j].variants = getTileVariants(tsrc,
+						f->tiles[j], f->drawtype == NDT_FENCELIKE);
+			}
+			for(u16 j=0; j<CF_SPECIAL_COUNT; j++){
+				f->special_tiles[j].variants = getTileVariants(tsrc,
+						f->special_tiles[j], false);
+			}
 		}
 #endif
 	}
@@ -777,7 +801,56 @@ class CNodeDefManager: public IWritableNodeDefManager
 	{
 		m_name_id_mapping.set(i, name);
 		m_name_id_mapping_with_aliases.insert(std::make_pair(name, i));
+		m_id_version = ++g_node_id_version_counter;
+	}
+#ifndef SERVER
+	/*
+		Gets the variants of the texture of a tile, resolving them if
+		they don't exist yet. Tiles with the same texture and animation
+		share them.
+	*/
+	TileVariants* getTileVariants(ITextureSource *tsrc, const TileSpec &tile,
+			bool rotate)
+	{
+		u8 frame_count = 0;
+		if(tile.material_flags & MATERIAL_FLAG_ANIMATION_VERTICAL_FRAMES)
+			frame_count = tile.animation_frame_count;
+		std::pair<u32, u8> key(tile.texture.id, frame_count);
+
+		TileVariants *v = NULL;
+		std::map<std::pair<u32, u8>, TileVariants*>::iterator n =
+				m_tile_variants.find(key);
+		if(n != m_tile_variants.end())
+		{
+			v = n->second;
+		}
+		else
+		{
+			v = new TileVariants();
+			if(g_settings->getBool("enable_texture_atlas"))
+				v->single = tsrc->getTextureRawAP(tile.texture);
+			else
+				v->single = tile.texture;
+			std::string single_name = tsrc->getTextureName(v->single.id);
+			for(u32 i=0; i<frame_count; i++)
+			{
+				std::ostringstream os(std::ios::binary);
+				os<<single_name<<"^[verticalframe:"<<(int)frame_count<<":"<<i;
+				v->frames.push_back(tsrc->getTexture(os.str()));
+			}
+			m_tile_variants[key] = v;
+		}
+
+		if(rotate && v->rotated90 == NULL)
+		{
+			TileSpec tile_rot;
+			tile_rot.texture = tsrc->getTexture(
+					tsrc->getTextureName(tile.texture.id) + "^[transformR90");
+			v->rotated90 = getTileVariants(tsrc, tile_rot, false);
+		}
+		return v;
 	}
+#endif
 private:
 	// Features indexed by id
 	ContentFeatures m_content_features[MAX_CONTENT+1];
@@ -787,6 +860,13 @@ class CNodeDefManager: public IWritableNodeDefManager
 	// item aliases too. Updated by updateAliases()
 	// Note: Not serialized.
 	std::map<std::string, content_t> m_name_id_mapping_with_aliases;
+	// See getIdVersion()
+	u32 m_id_version;
+#ifndef SERVER
+	// Texture variants of tiles; key is texture id and frame count.
+	// Filled by updateTextures()
+	std::map<std::pair<u32, u8>, TileVariants*> m_tile_variants;
+#endif
 };
 
 IWritableNodeDefManager* createNodeDefManager()
@@ -267,6 +267,9 @@ class INodeDefManager
 	virtual void getIds(const std::string &name, std::set<content_t> &result)
 			const=0;
 	virtual const ContentFeatures& get(const std::string &name) const=0;
+	// Changes whenever the ids returned by getId() may have changed.
+	// Different node definition managers never have the same version.
+	virtual u32 getIdVersion() const=0;
 	
 	virtual void serialize(std::ostream &os, u16 protocol_version)=0;
 };
@@ -287,6 +290,7 @@ class IWritableNodeDefManager : public INodeDefManager
 			const=0;
 	// If not found, returns the features of CONTENT_IGNORE
 	virtual const ContentFeatures& get(const std::string &name) const=0;
+	virtual u32 getIdVersion() const=0;
 
 	// Register node definition
 	virtual void set(content_t c, const ContentFeatures &def)=0;
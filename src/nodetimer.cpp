@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "log.h"
 #include "util/serialize.h"
 #include "constants.h" // MAP_BLOCKSIZE
+#include <algorithm>
 
 /*
 	NodeTimer
@@ -46,24 +47,26 @@ void NodeTimerList::serialize(std::ostream &os, u8 map_format_version) const
 {
 	if(map_format_version == 24){
 		// Version 0 is a placeholder for "nothing to see here; go away."
-		if(m_data.size() == 0){
+		if(activeCount() == 0){
 			writeU8(os, 0); // version
 			return;
 		}
 		writeU8(os, 1); // version
-		writeU16(os, m_data.size());
+		writeU16(os, activeCount());
 	}
 
 	if(map_format_version >= 25){
 		writeU8(os, 2+4+4);
-		writeU16(os, m_data.size());
+		writeU16(os, activeCount());
 	}
 
-	for(std::map<v3s16, NodeTimer>::const_iterator
+	for(std::map<v3s16, Entry>::const_iterator
 			i = m_data.begin();
 			i != m_data.end(); i++){
+		if(i->second.elapsed)
+			continue;
 		v3s16 p = i->first;
-		NodeTimer t = i->second;
+		NodeTimer t = i->second.getTimer(m_time);
 
 		u16 p16 = p.Z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + p.Y*MAP_BLOCKSIZE + p.X;
 		writeU16(os, p16);
@@ -73,7 +76,7 @@ void NodeTimerList::serialize(std::ostream &os, u8 map_format_version) const
 
 void NodeTimerList::deSerialize(std::istream &is, u8 map_format_version)
 {
-	m_data.clear();
+	clear();
 	
 	if(map_format_version == 24){
 		u8 timer_version = readU8(is);
@@ -123,31 +126,87 @@ void NodeTimerList::deSerialize(std::istream &is, u8 map_format_version)
 			continue;
 		}
 
-		m_data.insert(std::make_pair(p, t));
+		set(p, t);
+	}
+}
+
+void NodeTimerList::set(v3s16 p, NodeTimer t)
+{
+	// An elapsed timer set again is updated in place
+	Entry &e = m_data[p];
+	if(e.elapsed)
+		m_elapsed_count--;
+	e.elapsed = false;
+	e.timeout = t.timeout;
+	e.start = m_time - t.elapsed;
+	e.seq = m_next_seq++;
+
+	HeapEntry h;
+	h.expire = e.start + e.timeout;
+	h.p = p;
+	h.seq = e.seq;
+	m_heap.push_back(h);
+	std::push_heap(m_heap.begin(), m_heap.end());
+
+	// Don't let stale entries of replaced timers pile up
+	if(m_heap.size() > 2 * activeCount() + 16)
+		rebuildHeap();
+}
+
+void NodeTimerList::step(float dtime,
+		std::vector<std::pair<v3s16, NodeTimer> > &elapsed_timers)
+{
+	elapsed_timers.clear();
+	m_time += dtime;
+
+	// Drop the timers of the last step that were not set again
+	for(std::vector<v3s16>::iterator
+			i = m_elapsed.begin(); i != m_elapsed.end(); i++){
+		std::map<v3s16, Entry>::iterator n = m_data.find(*i);
+		if(n != m_data.end() && n->second.elapsed){
+			m_data.erase(n);
+			m_elapsed_count--;
+		}
+	}
+	m_elapsed.clear();
+
+	while(!m_heap.empty() && m_heap.front().expire <= m_time)
+	{
+		HeapEntry h = m_heap.front();
+		std::pop_heap(m_heap.begin(), m_heap.end());
+		m_heap.pop_back();
+
+		std::map<v3s16, Entry>::iterator n = m_data.find(h.p);
+		if(n == m_data.end() || n->second.seq != h.seq
+				|| n->second.elapsed)
+			continue; // Stale
+		elapsed_timers.push_back(std::make_pair(h.p,
+				n->second.getTimer(m_time)));
+		n->second.elapsed = true;
+		m_elapsed_count++;
+		m_elapsed.push_back(h.p);
+	}
+
+	// Restart counting when there is nothing to count for
+	if(activeCount() == 0){
+		m_heap.clear();
+		m_time = 0;
 	}
 }
 
-std::map<v3s16, NodeTimer> NodeTimerList::step(float dtime)
+void NodeTimerList::rebuildHeap()
 {
-	std::map<v3s16, NodeTimer> elapsed_timers;
-	// Increment timers
-	for(std::map<v3s16, NodeTimer>::iterator
+	m_heap.clear();
+	for(std::map<v3s16, Entry>::const_iterator
 			i = m_data.begin();
 			i != m_data.end(); i++){
-		v3s16 p = i->first;
-		NodeTimer t = i->second;
-		t.elapsed += dtime;
-		if(t.elapsed >= t.timeout)
-			elapsed_timers.insert(std::make_pair(p, t));
-		else
-			i->second = t;
-	}
-	// Delete elapsed timers
-	for(std::map<v3s16, NodeTimer>::const_iterator
-			i = elapsed_timers.begin();
-			i != elapsed_timers.end(); i++){
-		v3s16 p = i->first;
-		m_data.erase(p);
+		if(i->second.elapsed)
+			continue;
+		HeapEntry h;
+		h.expire = i->second.start + i->second.timeout;
+		h.p = i->first;
+		h.seq = i->second.seq;
+		m_heap.push_back(h);
 	}
-	return elapsed_timers;
+	std::make_heap(m_heap.begin(), m_heap.end());
 }
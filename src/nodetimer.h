@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "irrlichttypes_bloated.h"
 #include <iostream>
 #include <map>
+#include <vector>
 
 /*
 	NodeTimer provides per-node timed callback functionality.
@@ -49,12 +50,24 @@ class NodeTimer
 
 /*
 	List of timers of all the nodes of a block
+
+	Timers are kept in a min-heap ordered by the time they expire at,
+	so a step only looks at the timers that are due. Time is counted by
+	the list itself; a timer stores when it was started and its elapsed
+	time is derived from that.
+
+	Replaced and removed timers leave stale entries in the heap. They
+	are recognized by their sequence number and skipped when popped.
+
+	Elapsed timers stay in the list, counting as removed, until the next
+	step, so that setting one again right after the step updates it in
+	place.
 */
 
 class NodeTimerList
 {
 public:
-	NodeTimerList() {}
+	NodeTimerList(): m_time(0), m_next_seq(0), m_elapsed_count(0) {}
 	~NodeTimerList() {}
 	
 	void serialize(std::ostream &os, u8 map_format_version) const;
@@ -62,29 +75,81 @@ class NodeTimerList
 	
 	// Get timer
 	NodeTimer get(v3s16 p){
-		std::map<v3s16, NodeTimer>::iterator n = m_data.find(p);
-		if(n == m_data.end())
+		std::map<v3s16, Entry>::iterator n = m_data.find(p);
+		if(n == m_data.end() || n->second.elapsed)
 			return NodeTimer();
-		return n->second;
+		return n->second.getTimer(m_time);
 	}
 	// Deletes timer
 	void remove(v3s16 p){
-		m_data.erase(p);
+		std::map<v3s16, Entry>::iterator n = m_data.find(p);
+		if(n == m_data.end())
+			return;
+		if(n->second.elapsed)
+			m_elapsed_count--;
+		m_data.erase(n);
 	}
 	// Deletes old timer and sets a new one
-	void set(v3s16 p, NodeTimer t){
-		m_data[p] = t;
-	}
+	void set(v3s16 p, NodeTimer t);
 	// Deletes all timers
 	void clear(){
 		m_data.clear();
+		m_heap.clear();
+		m_elapsed.clear();
+		m_elapsed_count = 0;
+		m_time = 0;
 	}
 
-	// A step in time. Returns map of elapsed timers.
-	std::map<v3s16, NodeTimer> step(float dtime);
+	/*
+		A step in time. Removes the elapsed timers and stores them in
+		elapsed_timers, which is cleared first.
+	*/
+	void step(float dtime,
+			std::vector<std::pair<v3s16, NodeTimer> > &elapsed_timers);
 
 private:
-	std::map<v3s16, NodeTimer> m_data;
+	struct Entry
+	{
+		f32 timeout;
+		double start;
+		u32 seq;
+		// Returned by the last step and not set again
+		bool elapsed;
+
+		NodeTimer getTimer(double time) const
+		{
+			return NodeTimer(timeout, time - start);
+		}
+	};
+	struct HeapEntry
+	{
+		double expire;
+		v3s16 p;
+		u32 seq;
+
+		// std::push_heap makes a max-heap; invert to get the earliest first
+		bool operator<(const HeapEntry &other) const
+		{
+			return expire > other.expire;
+		}
+	};
+
+	void rebuildHeap();
+	// Number of timers that have not elapsed
+	u32 activeCount() const
+	{
+		return m_data.size() - m_elapsed_count;
+	}
+
+	std::map<v3s16, Entry> m_data;
+	std::vector<HeapEntry> m_heap;
+	double m_time;
+	u32 m_next_seq;
+	// Positions of the timers returned by the last step; some of them
+	// may have been set again or removed since
+	std::vector<v3s16> m_elapsed;
+	// Number of entries of m_data that are elapsed
+	u32 m_elapsed_count;
 };
 
 #endif
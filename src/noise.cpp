@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <math.h>
 #include "noise.h"
 #include <iostream>
+#include <vector>
 #include "debug.h"
 #include "util/numeric.h"
 
@@ -256,6 +257,78 @@ float noise3d_perlin_abs(float x, float y, float z, int seed,
 }
 
 
+/*
+	Goes octave by octave over all points, like Noise::perlinMap3D()
+	goes over a grid. Points close to each other share the corners of
+	their lattice cell, so the last cells of an octave are kept and their
+	corners are not computed again. The sums are the same as those of
+	noise3d_perlin().
+*/
+#define POINTS_CELL_CACHE_SIZE 64
+
+struct NoiseLatticeCell {
+	int x0, y0, z0;
+	bool valid;
+	float v[8];
+};
+
+void noise3d_perlin_points(NoiseParams *np, const v3s16 *points, int count,
+		int seed, float *result)
+{
+	NoiseLatticeCell cells[POINTS_CELL_CACHE_SIZE];
+	std::vector<v3f> pos(count);
+	for (int i = 0; i < count; i++) {
+		pos[i].X = (float)points[i].X / np->spread.X;
+		pos[i].Y = (float)points[i].Y / np->spread.Y;
+		pos[i].Z = (float)points[i].Z / np->spread.Z;
+		result[i] = 0;
+	}
+
+	float f = 1.0;
+	float g = 1.0;
+	for (int oct = 0; oct < np->octaves; oct++) {
+		int s = seed + np->seed + oct;
+		for (int j = 0; j < POINTS_CELL_CACHE_SIZE; j++)
+			cells[j].valid = false;
+
+		for (int i = 0; i < count; i++) {
+			float x = pos[i].X * f;
+			float y = pos[i].Y * f;
+			float z = pos[i].Z * f;
+			int x0 = myfloor(x);
+			int y0 = myfloor(y);
+			int z0 = myfloor(z);
+
+			NoiseLatticeCell &c = cells[(x0 & 3) | ((y0 & 3) << 2)
+					| ((z0 & 3) << 4)];
+			if (!c.valid || c.x0 != x0 || c.y0 != y0 || c.z0 != z0) {
+				c.x0 = x0;
+				c.y0 = y0;
+				c.z0 = z0;
+				c.valid = true;
+				c.v[0] = noise3d(x0,     y0,     z0,     s);
+				c.v[1] = noise3d(x0 + 1, y0,     z0,     s);
+				c.v[2] = noise3d(x0,     y0 + 1, z0,     s);
+				c.v[3] = noise3d(x0 + 1, y0 + 1, z0,     s);
+				c.v[4] = noise3d(x0,     y0,     z0 + 1, s);
+				c.v[5] = noise3d(x0 + 1, y0,     z0 + 1, s);
+				c.v[6] = noise3d(x0,     y0 + 1, z0 + 1, s);
+				c.v[7] = noise3d(x0 + 1, y0 + 1, z0 + 1, s);
+			}
+			result[i] += g * triLinearInterpolation(
+					c.v[0], c.v[1], c.v[2], c.v[3],
+					c.v[4], c.v[5], c.v[6], c.v[7],
+					x - (float)x0, y - (float)y0, z - (float)z0);
+		}
+		f *= 2.0;
+		g *= np->persist;
+	}
+
+	for (int i = 0; i < count; i++)
+		result[i] = np->offset + np->scale * result[i];
+}
+
+
 // -1->0, 0->1, 1->0
 float contour(float v)
 {
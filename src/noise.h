@@ -128,6 +128,10 @@ float noise3d_perlin(float x, float y, float z, int seed,
 float noise3d_perlin_abs(float x, float y, float z, int seed,
 		int octaves, float persistence);
 
+// Sets result[i] to NoisePerlin3D(np, p.X, p.Y, p.Z, seed) of points[i]
+void noise3d_perlin_points(NoiseParams *np, const v3s16 *points, int count,
+		int seed, float *result);
+
 inline float easeCurve(float t) {
 	return t * t * t * (t * (6.f * t - 15.f) + 10.f);
 }
@@ -0,0 +1,130 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "noisemapcache.h"
+#include "noise.h"
+#include <jmutexautolock.h>
+#include <cstring>
+
+NoiseMapCache::Key::Key(Noise *noise, float x, float y):
+	x(x),
+	y(y),
+	sx(noise->sx),
+	sy(noise->sy),
+	seed(noise->seed + noise->np->seed),
+	octaves(noise->np->octaves),
+	persist(noise->np->persist),
+	spread_x(noise->np->spread.X),
+	spread_y(noise->np->spread.Y)
+{
+}
+
+bool NoiseMapCache::Key::operator<(const Key &other) const
+{
+	if(x != other.x)
+		return x < other.x;
+	if(y != other.y)
+		return y < other.y;
+	if(sx != other.sx)
+		return sx < other.sx;
+	if(sy != other.sy)
+		return sy < other.sy;
+	if(seed != other.seed)
+		return seed < other.seed;
+	if(octaves != other.octaves)
+		return octaves < other.octaves;
+	if(persist != other.persist)
+		return persist < other.persist;
+	if(spread_x != other.spread_x)
+		return spread_x < other.spread_x;
+	return spread_y < other.spread_y;
+}
+
+NoiseMapCache::NoiseMapCache(u32 max_values):
+	m_max_values(max_values),
+	m_values(0)
+{
+	m_mutex.Init();
+}
+
+NoiseMapCache::~NoiseMapCache()
+{
+	clear();
+}
+
+float * NoiseMapCache::perlinMap2D(Noise *noise, float x, float y)
+{
+	Key key(noise, x, y);
+	u32 size = noise->sx * noise->sy;
+
+	{
+		JMutexAutoLock lock(m_mutex);
+		std::map<Key, Map>::iterator i = m_maps.find(key);
+		if(i != m_maps.end())
+		{
+			m_lru.splice(m_lru.begin(), m_lru, i->second.lru);
+			memcpy(noise->result, i->second.values, sizeof(float) * size);
+			return noise->result;
+		}
+	}
+
+	// Make it without holding the lock
+	noise->perlinMap2D(x, y);
+	if(size > m_max_values)
+		return noise->result;
+
+	JMutexAutoLock lock(m_mutex);
+	// Another thread may have added it in the meantime
+	if(m_maps.find(key) != m_maps.end())
+		return noise->result;
+
+	while(m_values + size > m_max_values)
+	{
+		std::map<Key, Map>::iterator last = m_maps.find(m_lru.back());
+		m_values -= last->first.sx * last->first.sy;
+		delete[] last->second.values;
+		m_maps.erase(last);
+		m_lru.pop_back();
+	}
+	m_lru.push_front(key);
+	Map &map = m_maps[key];
+	map.values = new float[size];
+	memcpy(map.values, noise->result, sizeof(float) * size);
+	map.lru = m_lru.begin();
+	m_values += size;
+	return noise->result;
+}
+
+u32 NoiseMapCache::getMapCount()
+{
+	JMutexAutoLock lock(m_mutex);
+	return m_maps.size();
+}
+
+void NoiseMapCache::clear()
+{
+	JMutexAutoLock lock(m_mutex);
+	for(std::map<Key, Map>::iterator i = m_maps.begin();
+			i != m_maps.end(); ++i)
+		delete[] i->second.values;
+	m_maps.clear();
+	m_lru.clear();
+	m_values = 0;
+}
+
@@ -0,0 +1,91 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef NOISEMAPCACHE_HEADER
+#define NOISEMAPCACHE_HEADER
+
+#include "irrlichttypes.h"
+#include <jmutex.h>
+#include <list>
+#include <map>
+
+class Noise;
+
+// Default number of noise values kept (4 bytes each)
+#define NOISE_MAP_CACHE_VALUES (2 * 1024 * 1024)
+
+/*
+	2D noise maps made by the mapgens, for the least recently used
+	parameters and areas.
+
+	The chunks at different heights of a column of the map have the same
+	2D noise. Only the raw values of perlinMap2D are kept, not anything
+	done to them afterwards (like transformNoiseMap), as that may depend
+	on the chunk. Shared by the mapgens of all emerge threads.
+*/
+class NoiseMapCache
+{
+public:
+	NoiseMapCache(u32 max_values);
+	~NoiseMapCache();
+
+	/*
+		Same as noise->perlinMap2D(x, y), but takes the values from the
+		cache if they have been made with the same parameters before.
+	*/
+	float * perlinMap2D(Noise *noise, float x, float y);
+
+	u32 getMapCount();
+	void clear();
+
+private:
+	struct Key
+	{
+		float x;
+		float y;
+		int sx;
+		int sy;
+		// The seed of the first octave
+		int seed;
+		int octaves;
+		float persist;
+		float spread_x;
+		float spread_y;
+
+		Key(Noise *noise, float x, float y);
+		bool operator<(const Key &other) const;
+	};
+
+	struct Map
+	{
+		float *values;
+		// Position in m_lru
+		std::list<Key>::iterator lru;
+	};
+
+	u32 m_max_values;
+	u32 m_values;
+	std::map<Key, Map> m_maps;
+	// Most recently used first
+	std::list<Key> m_lru;
+	JMutex m_mutex;
+};
+
+#endif
+
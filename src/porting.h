@@ -174,6 +174,28 @@ bool threadSetPriority(threadid_t tid, int prio);
 	}*/
 #endif
 
+/*
+	Microsecond clock for timing short sections of code.
+	Wraps around every 71 minutes; only use differences of it.
+*/
+#ifdef _WIN32 // Windows
+	inline u32 getTimeUs()
+	{
+		LARGE_INTEGER freq, t;
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&t);
+		return (u32)(t.QuadPart / freq.QuadPart * 1000000
+				+ t.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+	}
+#else // Posix
+	inline u32 getTimeUs()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec * 1000000 + tv.tv_usec;
+	}
+#endif
+
 } // namespace porting
 
 #endif // PORTING_HEADER
@@ -0,0 +1,295 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "pregenerate.h"
+#include "server.h"
+#include "emerge.h"
+#include "mapgen.h"
+#include "mapblock.h"
+#include "settings.h"
+#include "filesys.h"
+#include "log.h"
+#include "util/numeric.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+// Seconds after which generated blocks are saved and unloaded
+#define PREGENERATE_UNLOAD_TIMEOUT 10.0
+// Milliseconds after which a chunk that is not done is queued again
+#define PREGENERATE_CHUNK_TIMEOUT_MS 60000
+// Times a chunk is queued before it is skipped
+#define PREGENERATE_CHUNK_TRIES 3
+
+static std::string area_to_string(v3s16 nodepos_min, v3s16 nodepos_max)
+{
+	std::ostringstream os;
+	os<<PP(nodepos_min)<<" "<<PP(nodepos_max);
+	return os.str();
+}
+
+WorldPregenerator::WorldPregenerator(Server *server,
+		v3s16 nodepos_min, v3s16 nodepos_max):
+	m_server(server),
+	m_nodepos_min(nodepos_min),
+	m_nodepos_max(nodepos_max),
+	m_next(0),
+	m_failed(0)
+{
+	m_progress_path = server->getWorldPath() + DIR_DELIM + "pregenerate.txt";
+
+	ServerMap &map = server->m_env->getServerMap();
+	m_chunksize = map.getMapgenParams()->chunksize;
+
+	v3s16 chunk_max, unused;
+	map.getChunkBlockRange(getNodeBlockPos(nodepos_min), m_chunk_min, unused);
+	map.getChunkBlockRange(getNodeBlockPos(nodepos_max), chunk_max, unused);
+	m_chunk_count = (chunk_max - m_chunk_min) / m_chunksize + v3s16(1,1,1);
+	m_total = (u32)m_chunk_count.X * m_chunk_count.Y * m_chunk_count.Z;
+}
+
+bool WorldPregenerator::run(bool &kill)
+{
+	EmergeManager *emerge = m_server->m_emerge;
+	ServerMap &map = m_server->m_env->getServerMap();
+
+	loadProgress();
+	u32 done_start = m_next;
+	actionstream<<"Pregenerating "<<m_total<<" chunks from "
+			<<PP(m_nodepos_min)<<" to "<<PP(m_nodepos_max);
+	if(done_start != 0)
+		actionstream<<", continuing after "<<done_start;
+	actionstream<<std::endl;
+
+	// Enough to keep every emerge thread busy
+	u32 max_queued = emerge->emergethread.size() * 2 + 1;
+	u32 done = done_start;
+
+	IntervalLimiter liquid_interval;
+	IntervalLimiter unload_interval;
+	IntervalLimiter report_interval;
+	u32 time_start = porting::getTimeMs();
+	u32 time_last = time_start;
+
+	while(!kill)
+	{
+		// Queue chunks while the emerge threads take them
+		while(m_next < m_total && m_queued.size() < max_queued)
+		{
+			v3s16 p = getChunkPos(m_next);
+			// Chunks at the edge of the world are never generated
+			if(blockpos_over_limit(p - v3s16(1,1,1)) ||
+					blockpos_over_limit(p + v3s16(1,1,1) * m_chunksize))
+			{
+				m_next++;
+				done++;
+				continue;
+			}
+			if(!emerge->enqueueBlockEmerge(PEER_ID_INEXISTENT, p, true))
+				break;
+			QueuedChunk &chunk = m_queued[m_next];
+			chunk.blockpos = p;
+			chunk.time_queued_ms = porting::getTimeMs();
+			chunk.tries = 1;
+			m_next++;
+		}
+		if(m_next >= m_total && m_queued.empty())
+			break;
+
+		for(u32 i = 0; i != emerge->emergethread.size(); i++)
+			emerge->emergethread[i]->trigger();
+
+		sleep_ms(50);
+		u32 time_now = porting::getTimeMs();
+		float dtime = (float)(time_now - time_last) / 1000.0;
+		time_last = time_now;
+
+		{
+			JMutexAutoLock envlock(m_server->m_env_mutex);
+
+			for(std::map<u32, QueuedChunk>::iterator i = m_queued.begin();
+					i != m_queued.end();)
+			{
+				QueuedChunk &chunk = i->second;
+				if(isChunkDone(chunk.blockpos))
+				{
+					m_queued.erase(i++);
+					done++;
+					continue;
+				}
+				/*
+					The emerge threads drop a chunk they fail to make
+					without telling; queue it again, or give up on it
+				*/
+				if(time_now - chunk.time_queued_ms
+						< PREGENERATE_CHUNK_TIMEOUT_MS)
+				{
+					++i;
+					continue;
+				}
+				if(chunk.tries >= PREGENERATE_CHUNK_TRIES)
+				{
+					errorstream<<"WorldPregenerator: chunk at block "
+							<<PP(chunk.blockpos)<<" was not generated after "
+							<<chunk.tries<<" tries, skipping it"<<std::endl;
+					m_queued.erase(i++);
+					m_failed++;
+					continue;
+				}
+				if(emerge->enqueueBlockEmerge(PEER_ID_INEXISTENT,
+						chunk.blockpos, true))
+				{
+					infostream<<"WorldPregenerator: queueing chunk at block "
+							<<PP(chunk.blockpos)<<" again"<<std::endl;
+					chunk.time_queued_ms = time_now;
+					chunk.tries++;
+				}
+				++i;
+			}
+
+			// Let the liquids of the new chunks flow, like a server does
+			if(liquid_interval.step(dtime, 1.0))
+			{
+				std::map<v3s16, MapBlock*> modified_blocks;
+				map.transformLiquids(modified_blocks);
+			}
+
+			// Save and unload what is not needed anymore
+			if(unload_interval.step(dtime, 2.0))
+			{
+				map.timerUpdate(2.0, PREGENERATE_UNLOAD_TIMEOUT, -1, 0);
+			}
+		}
+
+		if(report_interval.step(dtime, 5.0))
+		{
+			saveProgress();
+			float seconds = (float)(time_now - time_start) / 1000.0;
+			actionstream<<"Pregenerated "<<done<<"/"<<m_total<<" chunks ("
+					<<(done * 100 / m_total)<<"%), "
+					<<((float)(done - done_start) / seconds)
+					<<" chunks/s"<<std::endl;
+		}
+	}
+
+	{
+		JMutexAutoLock envlock(m_server->m_env_mutex);
+		map.save(MOD_STATE_WRITE_NEEDED);
+	}
+
+	float seconds = (float)(porting::getTimeMs() - time_start) / 1000.0;
+	if(m_next < m_total || !m_queued.empty())
+	{
+		saveProgress();
+		actionstream<<"Pregeneration interrupted after "<<getDoneCount()
+				<<"/"<<m_total<<" chunks; run again to continue"<<std::endl;
+		return false;
+	}
+
+	fs::DeleteSingleFileOrEmptyDirectory(m_progress_path);
+	actionstream<<"Pregenerated "<<(m_total - m_failed)<<" chunks in "
+			<<seconds<<"s ("
+			<<((float)(m_total - done_start) / seconds)<<" chunks/s)"
+			<<std::endl;
+	if(m_failed != 0)
+	{
+		errorstream<<"WorldPregenerator: "<<m_failed<<" chunks were "
+				"skipped; run again to retry them"<<std::endl;
+		return false;
+	}
+	return true;
+}
+
+v3s16 WorldPregenerator::getChunkPos(u32 index)
+{
+	v3s16 p;
+	p.X = index % m_chunk_count.X;
+	index /= m_chunk_count.X;
+	p.Z = index % m_chunk_count.Z;
+	p.Y = index / m_chunk_count.Z;
+	return m_chunk_min + p * m_chunksize;
+}
+
+bool WorldPregenerator::isChunkDone(v3s16 blockpos)
+{
+	MapBlock *block = m_server->m_env->getServerMap()
+			.getBlockNoCreateNoEx(blockpos);
+	return block != NULL && block->isGenerated();
+}
+
+u32 WorldPregenerator::getDoneCount()
+{
+	if(m_queued.empty())
+		return m_next;
+	return m_queued.begin()->first;
+}
+
+void WorldPregenerator::loadProgress()
+{
+	m_next = 0;
+	if(!fs::PathExists(m_progress_path))
+		return;
+	Settings progress;
+	if(!progress.readConfigFile(m_progress_path.c_str()))
+		return;
+	// Only continue the same area
+	if(progress.get("area") != area_to_string(m_nodepos_min, m_nodepos_max))
+	{
+		infostream<<"WorldPregenerator: "<<m_progress_path
+				<<" is for another area, starting over"<<std::endl;
+		return;
+	}
+	m_next = MYMIN((u32)MYMAX(progress.getS32("done_chunks"), 0), m_total);
+}
+
+void WorldPregenerator::saveProgress()
+{
+	Settings progress;
+	progress.set("area", area_to_string(m_nodepos_min, m_nodepos_max));
+	progress.setS32("done_chunks", getDoneCount());
+
+	std::ofstream os(m_progress_path.c_str(), std::ios_base::binary);
+	if(os.good() == false)
+	{
+		errorstream<<"WorldPregenerator: could not open "
+				<<m_progress_path<<std::endl;
+		return;
+	}
+	progress.writeLines(os);
+}
+
+bool parse_pregenerate_area(const std::string &s,
+		v3s16 &nodepos_min, v3s16 &nodepos_max)
+{
+	int v[6];
+	if(sscanf(s.c_str(), " ( %d , %d , %d ) ( %d , %d , %d )",
+			&v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 6)
+		return false;
+	for(u32 i = 0; i < 6; i++)
+	{
+		if(v[i] < -MAP_GENERATION_LIMIT || v[i] > MAP_GENERATION_LIMIT)
+			return false;
+	}
+	nodepos_min = v3s16(MYMIN(v[0], v[3]), MYMIN(v[1], v[4]),
+			MYMIN(v[2], v[5]));
+	nodepos_max = v3s16(MYMAX(v[0], v[3]), MYMAX(v[1], v[4]),
+			MYMAX(v[2], v[5]));
+	return true;
+}
+
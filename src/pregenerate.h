@@ -0,0 +1,97 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef PREGENERATE_HEADER
+#define PREGENERATE_HEADER
+
+#include "irrlichttypes_bloated.h"
+#include <string>
+#include <map>
+
+class Server;
+
+/*
+	Generates an area of a world ahead of time, without clients.
+
+	Every chunk of the area is queued to the emerge threads of the
+	server, which load or generate it (running the on_generated
+	callbacks) as they do for clients, as many at once as there are
+	threads. Generated blocks are saved and unloaded as they age.
+
+	The chunks are handled in a fixed order and the number of chunks
+	before which all are done is kept in the world directory, so an
+	interrupted run continues from there. Chunks that are in the
+	database already are only loaded.
+
+	A chunk that is not done in time is queued again, and reported and
+	skipped when that does not help either.
+*/
+class WorldPregenerator
+{
+public:
+	WorldPregenerator(Server *server, v3s16 nodepos_min, v3s16 nodepos_max);
+
+	// Returns false if interrupted by kill or if chunks were skipped
+	bool run(bool &kill);
+
+private:
+	v3s16 getChunkPos(u32 index);
+	// Whether the chunk starting at blockpos has been generated
+	bool isChunkDone(v3s16 blockpos);
+	// The chunks before this one are done
+	u32 getDoneCount();
+	void loadProgress();
+	void saveProgress();
+
+	Server *m_server;
+	v3s16 m_nodepos_min;
+	v3s16 m_nodepos_max;
+	std::string m_progress_path;
+
+	// First block of the first chunk, and the number of chunks
+	v3s16 m_chunk_min;
+	v3s16 m_chunk_count;
+	s16 m_chunksize;
+	u32 m_total;
+
+	struct QueuedChunk
+	{
+		// First block of the chunk
+		v3s16 blockpos;
+		// When it was queued the last time
+		u32 time_queued_ms;
+		u32 tries;
+	};
+
+	u32 m_next;
+	// Queued chunks by index
+	std::map<u32, QueuedChunk> m_queued;
+	// Number of chunks skipped because they were not generated
+	u32 m_failed;
+};
+
+/*
+	Parses an area given as "(x1,y1,z1) (x2,y2,z2)" and sorts the
+	corners. Returns false if it is not one.
+*/
+bool parse_pregenerate_area(const std::string &s,
+		v3s16 &nodepos_min, v3s16 &nodepos_max);
+
+#endif
+
@@ -0,0 +1,279 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "schematic.h"
+#include "nodedef.h"
+#include "voxel.h"
+#include "noise.h"
+#include "serialization.h"
+#include "exceptions.h"
+#include "log.h"
+#include "util/serialize.h"
+#include <sstream>
+
+Schematic::Schematic():
+	m_size(0,0,0)
+{
+	m_palette.push_back("air");
+}
+
+void Schematic::resize(v3s16 size)
+{
+	m_size = size;
+	m_palette.clear();
+	m_palette.push_back("air");
+	m_indices.assign(getVolume(), 0);
+	m_probabilities.assign(getVolume(), SCHEMATIC_PROB_ALWAYS);
+	m_param2s.assign(getVolume(), 0);
+	m_content.clear();
+	m_facedir.clear();
+}
+
+void Schematic::setNode(v3s16 p, const std::string &name,
+		u8 probability, u8 param2)
+{
+	u16 index = 0;
+	while(index < m_palette.size() && m_palette[index] != name)
+		index++;
+	if(index == m_palette.size())
+	{
+		if(m_palette.size() == 65535)
+			throw BaseException("Schematic: too many different nodes");
+		m_palette.push_back(name);
+		m_content.clear();
+		m_facedir.clear();
+	}
+
+	u32 i = getIndex(p);
+	m_indices[i] = index;
+	m_probabilities[i] = probability;
+	m_param2s[i] = param2;
+}
+
+// Number of bits that holds every index to a palette of count entries
+static u8 get_index_bits(u32 count)
+{
+	u8 bits = 1;
+	while(((u32)1 << bits) < count)
+		bits++;
+	return bits;
+}
+
+void Schematic::serialize(std::ostream &os) const
+{
+	writeU32(os, SCHEMATIC_SIGNATURE);
+	writeU16(os, SCHEMATIC_VERSION);
+	writeV3S16(os, m_size);
+	writeU16(os, m_palette.size());
+	for(u32 i = 0; i < m_palette.size(); i++)
+		os<<serializeString(m_palette[i]);
+
+	u32 volume = getVolume();
+	u8 bits = get_index_bits(m_palette.size());
+	std::string data;
+	data.reserve(((u64)volume * bits + 7) / 8 + volume * 2);
+
+	// Pack the indices, low bits first
+	u32 buf = 0;
+	u8 buf_bits = 0;
+	for(u32 i = 0; i < volume; i++)
+	{
+		buf |= (u32)m_indices[i] << buf_bits;
+		buf_bits += bits;
+		while(buf_bits >= 8)
+		{
+			data += (char)(buf & 0xff);
+			buf >>= 8;
+			buf_bits -= 8;
+		}
+	}
+	if(buf_bits > 0)
+		data += (char)(buf & 0xff);
+
+	if(volume > 0)
+	{
+		data.append((const char*)&m_probabilities[0], volume);
+		data.append((const char*)&m_param2s[0], volume);
+	}
+	compressZlib(data, os);
+}
+
+void Schematic::deSerialize(std::istream &is)
+{
+	if(readU32(is) != SCHEMATIC_SIGNATURE)
+		throw SerializationError("Schematic: not a schematic");
+	u16 version = readU16(is);
+	if(version != SCHEMATIC_VERSION)
+		throw SerializationError("Schematic: unsupported version");
+	v3s16 size = readV3S16(is);
+	u16 palette_size = readU16(is);
+	if(!is.good())
+		throw SerializationError("Schematic: header not read");
+	if(size.X <= 0 || size.Y <= 0 || size.Z <= 0 || palette_size == 0)
+		throw SerializationError("Schematic: invalid size");
+	u64 volume = (u64)size.X * size.Y * size.Z;
+	if(volume > SCHEMATIC_MAX_VOLUME)
+		throw SerializationError("Schematic: too large");
+
+	std::vector<std::string> palette;
+	for(u16 i = 0; i < palette_size; i++)
+		palette.push_back(deSerializeString(is));
+
+	std::ostringstream os(std::ios_base::binary);
+	decompressZlib(is, os);
+	std::string data = os.str();
+
+	u8 bits = get_index_bits(palette_size);
+	u64 packed_size = (volume * bits + 7) / 8;
+	if(data.size() != packed_size + volume * 2)
+		throw SerializationError("Schematic: wrong amount of node data");
+
+	resize(size);
+	m_palette = palette;
+
+	// Unpack the indices
+	const u8 *packed = (const u8*)data.data();
+	u32 mask = ((u32)1 << bits) - 1;
+	u32 buf = 0;
+	u8 buf_bits = 0;
+	for(u32 i = 0; i < volume; i++)
+	{
+		while(buf_bits < bits)
+		{
+			buf |= (u32)*packed++ << buf_bits;
+			buf_bits += 8;
+		}
+		u16 index = buf & mask;
+		buf >>= bits;
+		buf_bits -= bits;
+		if(index >= palette_size)
+			throw SerializationError("Schematic: invalid palette index");
+		m_indices[i] = index;
+	}
+
+	const char *p = data.data() + packed_size;
+	m_probabilities.assign(p, p + volume);
+	m_param2s.assign(p + volume, p + volume * 2);
+}
+
+void Schematic::resolveNodeNames(INodeDefManager *ndef)
+{
+	m_content.resize(m_palette.size());
+	m_facedir.resize(m_palette.size());
+	for(u32 i = 0; i < m_palette.size(); i++)
+	{
+		content_t c = ndef->getId(m_palette[i]);
+		// Unknown nodes are left out like ignore
+		if(c == CONTENT_IGNORE && m_palette[i] != "ignore")
+		{
+			errorstream<<"Schematic::resolveNodeNames: node '"
+					<<m_palette[i]<<"' not defined"<<std::endl;
+		}
+		m_content[i] = c;
+		m_facedir[i] = c != CONTENT_IGNORE &&
+				ndef->get(c).param_type_2 == CPT2_FACEDIR;
+	}
+}
+
+v3s16 Schematic::getRotatedSize(int rotation) const
+{
+	if(rotation & 1)
+		return v3s16(m_size.Z, m_size.Y, m_size.X);
+	return m_size;
+}
+
+void Schematic::place(VoxelManipulator *vm, v3s16 p, int rotation,
+		bool force_placement, PseudoRandom &pr) const
+{
+	if(m_content.size() != m_palette.size() || getVolume() == 0)
+		return;
+	rotation &= 3;
+
+	/*
+		Where the first node of the schematic goes, and in which
+		directions its X and Z go in the map
+	*/
+	v3s16 start;
+	v3s16 dir_x;
+	v3s16 dir_z;
+	switch(rotation)
+	{
+	case 0:
+		start = p;
+		dir_x = v3s16(1,0,0);
+		dir_z = v3s16(0,0,1);
+		break;
+	case 1:
+		start = p + v3s16(0, 0, m_size.X - 1);
+		dir_x = v3s16(0,0,-1);
+		dir_z = v3s16(1,0,0);
+		break;
+	case 2:
+		start = p + v3s16(m_size.X - 1, 0, m_size.Z - 1);
+		dir_x = v3s16(-1,0,0);
+		dir_z = v3s16(0,0,-1);
+		break;
+	default:
+		start = p + v3s16(m_size.Z - 1, 0, 0);
+		dir_x = v3s16(0,0,1);
+		dir_z = v3s16(-1,0,0);
+		break;
+	}
+
+	VoxelArea &area = vm->m_area;
+	v3s16 em = area.getExtent();
+	s32 step_x = dir_x.X + dir_x.Z * em.X * em.Y;
+	// Only check every node if the schematic does not fit in vm
+	bool clip = !area.contains(VoxelArea(p,
+			p + getRotatedSize(rotation) - v3s16(1,1,1)));
+
+	u32 i = 0;
+	for(s16 z = 0; z < m_size.Z; z++)
+	for(s16 y = 0; y < m_size.Y; y++)
+	{
+		v3s16 pm = start + dir_z * z + v3s16(0, y, 0);
+		s32 vi = area.index(pm);
+		for(s16 x = 0; x < m_size.X; x++, i++, pm += dir_x, vi += step_x)
+		{
+			u8 prob = m_probabilities[i];
+			if(prob == SCHEMATIC_PROB_NEVER)
+				continue;
+			if(prob != SCHEMATIC_PROB_ALWAYS && pr.range(1, 255) > prob)
+				continue;
+
+			u16 index = m_indices[i];
+			content_t c = m_content[index];
+			if(c == CONTENT_IGNORE)
+				continue;
+			if(clip && !area.contains(pm))
+				continue;
+
+			MapNode &n = vm->m_data[vi];
+			if(!force_placement && n.getContent() != CONTENT_AIR &&
+					n.getContent() != CONTENT_IGNORE)
+				continue;
+
+			u8 param2 = m_param2s[i];
+			if(m_facedir[index])
+				param2 = (param2 & ~3) | ((param2 + rotation) & 3);
+			n = MapNode(c, 0, param2);
+		}
+	}
+}
+
@@ -0,0 +1,136 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef SCHEMATIC_HEADER
+#define SCHEMATIC_HEADER
+
+#include "irrlichttypes_bloated.h"
+#include "mapnode.h"
+#include <string>
+#include <vector>
+#include <iostream>
+
+class INodeDefManager;
+class VoxelManipulator;
+class PseudoRandom;
+
+#define SCHEMATIC_SIGNATURE 0x4d545343 // "MTSC"
+#define SCHEMATIC_VERSION 1
+
+// Largest number of nodes a schematic can have; 4 bytes each in memory
+#define SCHEMATIC_MAX_VOLUME (256 * 256 * 256)
+
+// Probabilities of the nodes of a schematic
+#define SCHEMATIC_PROB_NEVER 0
+#define SCHEMATIC_PROB_ALWAYS 255
+
+/*
+	A box of nodes that is placed into the map as a whole, like a tree or
+	a building.
+
+	The nodes refer to a palette of node names by index, so a schematic
+	can be made before the nodes are defined. Every node also has a
+	probability of being placed (out of 255) and a param2. Nodes named
+	"ignore" are never placed and keep what is in the map.
+
+	File format (numbers big endian):
+	u32 signature ("MTSC")
+	u16 version
+	v3s16 size
+	u16 palette size, and that many node names as serializeString
+	zlib compressed:
+		the palette index of every node, X first, then Y, then Z, each in
+		the least number of bits that holds every index, low bits first
+		u8 probability of every node
+		u8 param2 of every node
+*/
+class Schematic
+{
+public:
+	Schematic();
+
+	// Makes a schematic of air nodes
+	void resize(v3s16 size);
+	v3s16 getSize() const
+	{
+		return m_size;
+	}
+	u32 getVolume() const
+	{
+		return (u32)m_size.X * m_size.Y * m_size.Z;
+	}
+	u32 getIndex(v3s16 p) const
+	{
+		return ((u32)p.Z * m_size.Y + p.Y) * m_size.X + p.X;
+	}
+
+	void setNode(v3s16 p, const std::string &name,
+			u8 probability=SCHEMATIC_PROB_ALWAYS, u8 param2=0);
+	const std::string & getNodeName(v3s16 p) const
+	{
+		return m_palette[m_indices[getIndex(p)]];
+	}
+	u8 getProbability(v3s16 p) const
+	{
+		return m_probabilities[getIndex(p)];
+	}
+	u8 getParam2(v3s16 p) const
+	{
+		return m_param2s[getIndex(p)];
+	}
+	u32 getPaletteSize() const
+	{
+		return m_palette.size();
+	}
+
+	void serialize(std::ostream &os) const;
+	// Throws SerializationError
+	void deSerialize(std::istream &is);
+
+	// Called once all nodes are defined, before the schematic is placed
+	void resolveNodeNames(INodeDefManager *ndef);
+
+	// Size in the map when turned rotation quarter turns
+	v3s16 getRotatedSize(int rotation) const;
+	/*
+		Places the schematic with its minimum corner at p, turned
+		clockwise (seen from above) by rotation quarter turns. Only air
+		and ignore are replaced unless force_placement is set. The parts
+		outside of the area of vm are left out; which nodes are placed
+		by chance only depends on pr.
+	*/
+	void place(VoxelManipulator *vm, v3s16 p, int rotation,
+			bool force_placement, PseudoRandom &pr) const;
+
+private:
+	v3s16 m_size;
+	std::vector<std::string> m_palette;
+	// Per node, X first, then Y, then Z
+	std::vector<u16> m_indices;
+	std::vector<u8> m_probabilities;
+	std::vector<u8> m_param2s;
+
+	// Content of the palette entries, once resolved
+	std::vector<content_t> m_content;
+	// Whether the param2 of a palette entry is a facedir, which is turned
+	std::vector<bool> m_facedir;
+};
+
+#endif
+
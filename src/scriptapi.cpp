@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <iostream>
 #include <list>
+#include <fstream>
 extern "C" {
 #include <lua.h>
 #include <lualib.h>
@@ -31,6 +32,8 @@ extern "C" {
 #include "main.h" // For g_settings
 #include "biome.h"
 #include "emerge.h"
+#include "schematic.h"
+#include "filesys.h"
 #include "script.h"
 #include "rollback.h"
 
@@ -41,11 +44,14 @@ extern "C" {
 #include "scriptapi_nodemeta.h"
 #include "scriptapi_object.h"
 #include "scriptapi_noise.h"
+#include "scriptapi_voxelmanip.h"
 #include "scriptapi_common.h"
 #include "scriptapi_item.h"
 #include "scriptapi_content.h"
 #include "scriptapi_craft.h"
 #include "scriptapi_particles.h"
+#include "scriptapi_serialize.h"
+#include "scriptapi_profiler.h"
 
 /*****************************************************************************/
 /* Mod related                                                               */
@@ -361,10 +367,16 @@ void scriptapi_run_callbacks(lua_State *L, int nargs,
 		// key at index -2 and value at index -1
 		luaL_checktype(L, -1, LUA_TFUNCTION);
 		// Call function
-		for(int i = 0; i < nargs; i++)
-			lua_pushvalue(L, arg+i);
-		if(lua_pcall(L, nargs, 1, 0))
-			script_error(L, "error: %s", lua_tostring(L, -1));
+		{
+			u32 slot = CALLBACK_PROFILE_NONE;
+			if(g_callback_profiling)
+				slot = callback_profile_function_slot(L, -1);
+			CallbackProfileScope profile_scope(slot);
+			for(int i = 0; i < nargs; i++)
+				lua_pushvalue(L, arg+i);
+			if(lua_pcall(L, nargs, 1, 0))
+				script_error(L, "error: %s", lua_tostring(L, -1));
+		}
 
 		// Move return value to designated space in stack
 		// Or pop it
@@ -723,8 +735,6 @@ static int l_register_ore(lua_State *L)
 	ore->np = read_noiseparams(L, -1);
 	lua_pop(L, 1);
 	
-	ore->noise = NULL;
-	
 	if (ore->clust_scarcity <= 0 || ore->clust_num_ores <= 0) {
 		errorstream << "register_ore: clust_scarcity and clust_num_ores"
 			"must be greater than 0";
@@ -740,6 +750,226 @@ static int l_register_ore(lua_State *L)
 }
 
 
+/*
+	Whether path is relative and stays in the directory it is relative to,
+	that is, has no ".." component
+*/
+static bool is_contained_path(const std::string &path)
+{
+	if (path.empty() || path[0] == '/' || path[0] == '\\' ||
+			path.find(':') != std::string::npos)
+		return false;
+
+	size_t start = 0;
+	while (start <= path.size()) {
+		size_t end = path.find_first_of("/\\", start);
+		if (end == std::string::npos)
+			end = path.size();
+		if (path.compare(start, end - start, "..") == 0)
+			return false;
+		start = end + 1;
+	}
+	return true;
+}
+
+
+/*
+	Reads a schematic given as the path of a schematic file in the
+	directory of the mod being loaded, or as a table
+	{size = {x=, y=, z=}, data = {{name=, prob=, param2=}, ...}} with the
+	nodes X first, then Y, then Z. Returns NULL if it is neither.
+*/
+static Schematic *read_schematic(lua_State *L, int index)
+{
+	if (index < 0)
+		index = lua_gettop(L) + 1 + index;
+
+	if (lua_isstring(L, index)) {
+		std::string filename = lua_tostring(L, index);
+		if (!is_contained_path(filename)) {
+			errorstream << "read_schematic: " << filename << ": the path "
+				"must be relative to the mod and not contain \"..\""
+				<< std::endl;
+			return NULL;
+		}
+
+		lua_getfield(L, LUA_REGISTRYINDEX, "minetest_current_modname");
+		const ModSpec *mod = lua_isstring(L, -1) ?
+			get_server(L)->getModSpec(lua_tostring(L, -1)) : NULL;
+		lua_pop(L, 1);
+		if (!mod) {
+			errorstream << "read_schematic: " << filename << ": schematic "
+				"files can only be read while a mod is loaded" << std::endl;
+			return NULL;
+		}
+
+		std::string path = mod->path + DIR_DELIM + filename;
+		std::ifstream is(path.c_str(), std::ios_base::binary);
+		if (!is.good()) {
+			errorstream << "read_schematic: could not open "
+				<< path << std::endl;
+			return NULL;
+		}
+		Schematic *schem = new Schematic;
+		try {
+			schem->deSerialize(is);
+		} catch (SerializationError &e) {
+			errorstream << "read_schematic: " << path << ": "
+				<< e.what() << std::endl;
+			delete schem;
+			return NULL;
+		}
+		return schem;
+	}
+
+	if (!lua_istable(L, index))
+		return NULL;
+
+	lua_getfield(L, index, "size");
+	v3s16 size = read_v3s16(L, -1);
+	lua_pop(L, 1);
+	if (size.X <= 0 || size.Y <= 0 || size.Z <= 0) {
+		errorstream << "read_schematic: invalid size" << std::endl;
+		return NULL;
+	}
+
+	Schematic *schem = new Schematic;
+	schem->resize(size);
+
+	lua_getfield(L, index, "data");
+	int data = lua_gettop(L);
+	if (!lua_istable(L, data) || lua_objlen(L, data) != schem->getVolume()) {
+		errorstream << "read_schematic: data does not have "
+			<< schem->getVolume() << " nodes" << std::endl;
+		lua_pop(L, 1);
+		delete schem;
+		return NULL;
+	}
+
+	int i = 1;
+	for (s16 z = 0; z != size.Z; z++)
+	for (s16 y = 0; y != size.Y; y++)
+	for (s16 x = 0; x != size.X; x++, i++) {
+		lua_rawgeti(L, data, i);
+		std::string name = getstringfield_default(L, -1, "name", "air");
+		u8 prob   = getintfield_default(L, -1, "prob", SCHEMATIC_PROB_ALWAYS);
+		u8 param2 = getintfield_default(L, -1, "param2", 0);
+		schem->setNode(v3s16(x, y, z), name, prob, param2);
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+
+	return schem;
+}
+
+
+static int l_register_decoration(lua_State *L)
+{
+	int index = 1;
+	luaL_checktype(L, index, LUA_TTABLE);
+
+	EmergeManager *emerge = get_server(L)->getEmergeManager();
+
+	Decoration *deco = new Decoration;
+	deco->place_on_name = getstringfield_default(L, index, "place_on", "");
+	deco->sidelen       = getintfield_default(L, index, "sidelen", 8);
+	deco->fill_ratio    = getfloatfield_default(L, index, "fill_ratio", 0.02);
+	deco->height_min    = getintfield_default(L, index, "height_min", -31000);
+	deco->height_max    = getintfield_default(L, index, "height_max", 31000);
+	deco->flags         = readFlagString(
+		getstringfield_default(L, index, "flags", ""), flagdesc_deco);
+
+	std::string rotation = getstringfield_default(L, index, "rotation", "0");
+	if (rotation == "random")
+		deco->rotation = -1;
+	else
+		deco->rotation = (stoi(rotation) / 90) & 3;
+
+	lua_getfield(L, index, "noise_params");
+	deco->np = read_noiseparams(L, -1);
+	lua_pop(L, 1);
+
+	lua_getfield(L, index, "schematic");
+	deco->schematic = read_schematic(L, -1);
+	lua_pop(L, 1);
+
+	if (!deco->schematic || deco->sidelen <= 0) {
+		errorstream << "register_decoration: a schematic and a sidelen "
+			"greater than 0 are needed" << std::endl;
+		delete deco;
+		return 0;
+	}
+
+	emerge->decorations.push_back(deco);
+
+	verbosestream << "register_decoration: decoration on '"
+		<< deco->place_on_name << "' registered" << std::endl;
+	return 0;
+}
+
+// create_schematic(p1, p2, filename)
+// Saves the nodes from p1 to p2 as a schematic file in the world directory
+static int l_create_schematic(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	v3s16 a = read_v3s16(L, 1);
+	v3s16 b = read_v3s16(L, 2);
+	std::string filename = luaL_checkstring(L, 3);
+	v3s16 p1(MYMIN(a.X, b.X), MYMIN(a.Y, b.Y), MYMIN(a.Z, b.Z));
+	v3s16 p2(MYMAX(a.X, b.X), MYMAX(a.Y, b.Y), MYMAX(a.Z, b.Z));
+
+	if (!is_contained_path(filename)) {
+		errorstream << "create_schematic: " << filename << ": the path "
+			"must be relative to the world and not contain \"..\""
+			<< std::endl;
+		return 0;
+	}
+
+	// The sizes overflow s16 for the widest areas
+	v3s16 size = p2 - p1 + v3s16(1,1,1);
+	if (size.X <= 0 || size.Y <= 0 || size.Z <= 0 ||
+			(u64)size.X * size.Y * size.Z > SCHEMATIC_MAX_VOLUME) {
+		errorstream << "create_schematic: area too large, at most "
+			<< SCHEMATIC_MAX_VOLUME << " nodes" << std::endl;
+		return 0;
+	}
+
+	ServerEnvironment *env = get_env(L);
+	INodeDefManager *ndef = get_server(L)->ndef();
+
+	Schematic schem;
+	schem.resize(size);
+	v3s16 p;
+	for (p.Z = p1.Z; p.Z <= p2.Z; p.Z++)
+	for (p.Y = p1.Y; p.Y <= p2.Y; p.Y++)
+	for (p.X = p1.X; p.X <= p2.X; p.X++) {
+		MapNode n = env->getMap().getNodeNoEx(p);
+		schem.setNode(p - p1, ndef->get(n).name,
+			SCHEMATIC_PROB_ALWAYS, n.param2);
+	}
+
+	std::string path = get_server(L)->getWorldPath() + DIR_DELIM + filename;
+	size_t delim = path.find_last_of(DIR_DELIM_C);
+	fs::CreateAllDirs(path.substr(0, delim));
+	std::ofstream os(path.c_str(), std::ios_base::binary);
+	if (!os.good()) {
+		errorstream << "create_schematic: could not open "
+			<< path << std::endl;
+		return 0;
+	}
+	schem.serialize(os);
+	os.close();
+	if (os.fail()) {
+		errorstream << "create_schematic: could not write "
+			<< path << std::endl;
+		return 0;
+	}
+
+	lua_pushboolean(L, true);
+	return 1;
+}
+
 // setting_set(name, value)
 static int l_setting_set(lua_State *L)
 {
@@ -918,6 +1148,28 @@ static int l_get_hit_params(lua_State *L)
 	return 1;
 }
 
+// get_content_id(name) -> content ID of a node, as used by VoxelManip
+static int l_get_content_id(lua_State *L)
+{
+	std::string name = luaL_checkstring(L, 1);
+	IGameDef *gamedef = get_server(L);
+	name = gamedef->idef()->getAlias(name);
+	content_t c;
+	if(!gamedef->ndef()->getId(name, c))
+		throw LuaError(L, "Unknown node: " + name);
+	lua_pushinteger(L, c);
+	return 1;
+}
+
+// get_name_from_content_id(id) -> node name
+static int l_get_name_from_content_id(lua_State *L)
+{
+	INodeDefManager *ndef = get_server(L)->ndef();
+	content_t c = checkcontentid(L, 1, ndef);
+	lua_pushstring(L, ndef->get(c).name.c_str());
+	return 1;
+}
+
 // get_current_modname()
 static int l_get_current_modname(lua_State *L)
 {
@@ -1044,6 +1296,31 @@ static int l_get_password_hash(lua_State *L)
 	return 1;
 }
 
+// get_auth_entry(name) -> password hash, privilege string or nil
+static int l_get_auth_entry(lua_State *L)
+{
+	std::string name = luaL_checkstring(L, 1);
+	std::string password;
+	std::string privileges;
+	if(!get_server(L)->getAuthDatabase()->get(name, password, privileges))
+		return 0;
+	lua_pushstring(L, password.c_str());
+	lua_pushstring(L, privileges.c_str());
+	return 2;
+}
+
+// set_auth_entry(name, password hash, privilege string) -> true on success
+static int l_set_auth_entry(lua_State *L)
+{
+	std::string name = luaL_checkstring(L, 1);
+	std::string password = luaL_checkstring(L, 2);
+	std::string privileges = luaL_checkstring(L, 3);
+	bool success = get_server(L)->getAuthDatabase()->set(name,
+			password, privileges);
+	lua_pushboolean(L, success);
+	return 1;
+}
+
 // notify_authentication_modified(name)
 static int l_notify_authentication_modified(lua_State *L)
 {
@@ -1114,6 +1391,8 @@ static const struct luaL_Reg minetest_f [] = {
 	{"register_biome", l_register_biome},
 	{"register_biome_groups", l_register_biome_groups},
 	{"register_ore", l_register_ore},
+	{"register_decoration", l_register_decoration},
+	{"create_schematic", l_create_schematic},
 	{"setting_set", l_setting_set},
 	{"setting_get", l_setting_get},
 	{"setting_getbool", l_setting_getbool},
@@ -1130,6 +1409,8 @@ static const struct luaL_Reg minetest_f [] = {
 	{"show_formspec", l_show_formspec},
 	{"get_dig_params", l_get_dig_params},
 	{"get_hit_params", l_get_hit_params},
+	{"get_content_id", l_get_content_id},
+	{"get_name_from_content_id", l_get_name_from_content_id},
 	{"get_current_modname", l_get_current_modname},
 	{"get_modpath", l_get_modpath},
 	{"get_modnames", l_get_modnames},
@@ -1138,6 +1419,13 @@ static const struct luaL_Reg minetest_f [] = {
 	{"sound_stop", l_sound_stop},
 	{"is_singleplayer", l_is_singleplayer},
 	{"get_password_hash", l_get_password_hash},
+	{"serialize_binary", l_serialize_binary},
+	{"deserialize_binary", l_deserialize_binary},
+	{"set_callback_profiling", l_set_callback_profiling},
+	{"get_callback_profile", l_get_callback_profile},
+	{"reset_callback_profile", l_reset_callback_profile},
+	{"get_auth_entry", l_get_auth_entry},
+	{"set_auth_entry", l_set_auth_entry},
 	{"notify_authentication_modified", l_notify_authentication_modified},
 	{"get_craft_result", l_get_craft_result},
 	{"get_craft_recipe", l_get_craft_recipe},
@@ -1166,6 +1454,8 @@ void scriptapi_export(lua_State *L, Server *server)
 	lua_pushlightuserdata(L, server);
 	lua_setfield(L, LUA_REGISTRYINDEX, "minetest_server");
 
+	g_callback_profiling = g_settings->getBool("callback_profiling");
+
 	// Register global functions in table minetest
 	lua_newtable(L);
 	luaL_register(L, NULL, minetest_f);
@@ -1179,6 +1469,8 @@ void scriptapi_export(lua_State *L, Server *server)
 	lua_setfield(L, -2, "object_refs");
 	lua_newtable(L);
 	lua_setfield(L, -2, "luaentities");
+	lua_newtable(L);
+	lua_setfield(L, -2, "callback_origins");
 
 	// Register wrappers
 	LuaItemStack::Register(L);
@@ -1190,4 +1482,5 @@ void scriptapi_export(lua_State *L, Server *server)
 	LuaPseudoRandom::Register(L);
 	LuaPerlinNoise::Register(L);
 	LuaPerlinNoiseMap::Register(L);
+	LuaVoxelManip::Register(L);
 }
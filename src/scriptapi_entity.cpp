@@ -29,6 +29,7 @@ extern "C" {
 #include "scriptapi_types.h"
 #include "scriptapi_object.h"
 #include "scriptapi_common.h"
+#include "scriptapi_profiler.h"
 
 
 void luaentity_get(lua_State *L, u16 id)
@@ -43,11 +44,177 @@ void luaentity_get(lua_State *L, u16 id)
 	lua_remove(L, -2); // minetest
 }
 
+// Pushes the Lua table of an entity
+static void luaentity_push(lua_State *L, const LuaEntityRefs *refs)
+{
+	lua_rawgeti(L, LUA_REGISTRYINDEX, refs->object);
+}
+
+static const char *luaentity_callback_names[LUAENTITY_CALLBACK_COUNT] = {
+	"on_step",
+	"on_punch",
+	"on_rightclick",
+};
+
+// Changed whenever a callback is set on an entity or a definition
+static u32 g_callback_version = 1;
+
+// Returns the LuaEntityCallback named by the key at index, or -1
+static int luaentity_callback_index(lua_State *L, int index)
+{
+	if(lua_type(L, index) != LUA_TSTRING)
+		return -1;
+	const char *key = lua_tostring(L, index);
+	for(int i = 0; i < LUAENTITY_CALLBACK_COUNT; i++)
+		if(strcmp(key, luaentity_callback_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+// __newindex of the entities of a definition: self.key = value
+static int l_luaentity_newindex(lua_State *L)
+{
+	lua_settop(L, 3);
+	if(luaentity_callback_index(L, 2) != -1)
+		g_callback_version++;
+	lua_rawset(L, 1);
+	return 0;
+}
+
+// __newindex of the metatable of a definition: def.key = value
+static int l_luaentity_def_newindex(lua_State *L)
+{
+	lua_settop(L, 3);
+	if(luaentity_callback_index(L, 2) == -1){
+		lua_rawset(L, 1);
+		return 0;
+	}
+	g_callback_version++;
+	// The callbacks are kept in the __index table of the metatable
+	lua_getmetatable(L, 1);
+	lua_pushstring(L, "__index");
+	lua_rawget(L, -2);
+	lua_pushvalue(L, 2);
+	lua_pushvalue(L, 3);
+	lua_rawset(L, -3);
+	return 0;
+}
+
+/*
+	Moves the callbacks of an entity definition to the __index table of
+	a new metatable of it, so that they are never raw fields of the
+	definition, and makes setting one on the definition or an entity of
+	it go through the __newindex handlers above. Returns false if the
+	definition has a metatable or a __newindex of its own.
+*/
+static bool luaentity_watch_definition(lua_State *L, int def)
+{
+	lua_pushstring(L, "__newindex");
+	lua_rawget(L, def);
+	bool watched = lua_tocfunction(L, -1) == l_luaentity_newindex;
+	bool has_newindex = !lua_isnil(L, -1);
+	lua_pop(L, 1);
+	if(watched)
+		return true;
+	if(has_newindex)
+		return false;
+	if(lua_getmetatable(L, def)){
+		lua_pop(L, 1);
+		return false;
+	}
+
+	lua_newtable(L);
+	int metatable = lua_gettop(L);
+	lua_newtable(L);
+	int callbacks = lua_gettop(L);
+	for(int i = 0; i < LUAENTITY_CALLBACK_COUNT; i++)
+	{
+		const char *name = luaentity_callback_names[i];
+		lua_pushstring(L, name);
+		lua_rawget(L, def);
+		lua_setfield(L, callbacks, name);
+		lua_pushstring(L, name);
+		lua_pushnil(L);
+		lua_rawset(L, def);
+	}
+	lua_setfield(L, metatable, "__index");
+	lua_pushcfunction(L, l_luaentity_def_newindex);
+	lua_setfield(L, metatable, "__newindex");
+	lua_setmetatable(L, def);
+
+	lua_pushstring(L, "__newindex");
+	lua_pushcfunction(L, l_luaentity_newindex);
+	lua_rawset(L, def);
+	return true;
+}
+
+// Looks up the callbacks of the entity and keeps references to them
+static void luaentity_cache_callbacks(lua_State *L, LuaEntityRefs *refs)
+{
+	luaentity_push(L, refs);
+	int object = lua_gettop(L);
+	for(int i = 0; i < LUAENTITY_CALLBACK_COUNT; i++)
+	{
+		const char *name = luaentity_callback_names[i];
+		luaL_unref(L, LUA_REGISTRYINDEX, refs->callbacks[i]);
+		refs->callbacks[i] = LUA_REFNIL;
+		// A callback set on the entity itself can be replaced unnoticed
+		lua_pushstring(L, name);
+		lua_rawget(L, object);
+		if(!lua_isnil(L, -1))
+			refs->lookup_callbacks = true;
+		lua_pop(L, 1);
+		lua_getfield(L, object, name);
+		if(lua_isnil(L, -1)){
+			lua_pop(L, 1);
+			continue;
+		}
+		luaL_checktype(L, -1, LUA_TFUNCTION);
+		refs->callbacks[i] = luaL_ref(L, LUA_REGISTRYINDEX);
+	}
+	lua_pop(L, 1);
+	refs->callback_version = g_callback_version;
+}
+
+/*
+	Pushes the entity and its callback and returns true, or pushes
+	nothing and returns false if there is no such callback.
+	The cached callbacks are looked up again after a callback has been
+	set on any entity or definition; those of an entity that has one of
+	its own are looked up on every call.
+*/
+static bool luaentity_push_callback(lua_State *L, LuaEntityRefs *refs,
+		LuaEntityCallback callback)
+{
+	if(!refs->lookup_callbacks
+			&& refs->callback_version != g_callback_version)
+		luaentity_cache_callbacks(L, refs);
+
+	if(refs->lookup_callbacks){
+		luaentity_push(L, refs);
+		lua_getfield(L, -1, luaentity_callback_names[callback]);
+		if(lua_isnil(L, -1)){
+			lua_pop(L, 2);
+			return false;
+		}
+		luaL_checktype(L, -1, LUA_TFUNCTION);
+		lua_insert(L, -2); // self after the function
+		return true;
+	}
+
+	if(refs->callbacks[callback] == LUA_REFNIL)
+		return false;
+	lua_rawgeti(L, LUA_REGISTRYINDEX, refs->callbacks[callback]);
+	luaentity_push(L, refs);
+	return true;
+}
+
 /*
 	luaentity
 */
 
-bool scriptapi_luaentity_add(lua_State *L, u16 id, const char *name)
+bool scriptapi_luaentity_add(lua_State *L, u16 id, const char *name,
+		LuaEntityRefs *refs)
 {
 	realitycheck(L);
 	assert(lua_checkstack(L, 20));
@@ -70,6 +237,10 @@ bool scriptapi_luaentity_add(lua_State *L, u16 id, const char *name)
 	int prototype_table = lua_gettop(L);
 	//dump2(L, "prototype_table");
 
+	// Without it, changes of the callbacks could not be noticed
+	if(!luaentity_watch_definition(L, prototype_table))
+		refs->lookup_callbacks = true;
+
 	// Create entity object
 	lua_newtable(L);
 	int object = lua_gettop(L);
@@ -94,19 +265,25 @@ bool scriptapi_luaentity_add(lua_State *L, u16 id, const char *name)
 	lua_pushvalue(L, object); // Copy object to top of stack
 	lua_settable(L, -3);
 
+	// Keep a reference to the object
+	lua_pushvalue(L, object);
+	refs->object = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	std::string mod_origin = "??";
+	getstringfield(L, prototype_table, "mod_origin", mod_origin);
+	refs->step_profile_slot = callback_profile_slot("entity_step", mod_origin);
+
 	return true;
 }
 
-void scriptapi_luaentity_activate(lua_State *L, u16 id,
+void scriptapi_luaentity_activate(lua_State *L, LuaEntityRefs *refs,
 		const std::string &staticdata, u32 dtime_s)
 {
 	realitycheck(L);
 	assert(lua_checkstack(L, 20));
-	verbosestream<<"scriptapi_luaentity_activate: id="<<id<<std::endl;
 	StackUnroller stack_unroller(L);
 
-	// Get minetest.luaentities[id]
-	luaentity_get(L, id);
+	luaentity_push(L, refs);
 	int object = lua_gettop(L);
 
 	// Get on_activate function
@@ -122,9 +299,13 @@ void scriptapi_luaentity_activate(lua_State *L, u16 id,
 			script_error(L, "error running function on_activate: %s\n",
 					lua_tostring(L, -1));
 	}
+
+	// on_activate may have set callbacks
+	if(!refs->lookup_callbacks)
+		luaentity_cache_callbacks(L, refs);
 }
 
-void scriptapi_luaentity_rm(lua_State *L, u16 id)
+void scriptapi_luaentity_rm(lua_State *L, u16 id, LuaEntityRefs *refs)
 {
 	realitycheck(L);
 	assert(lua_checkstack(L, 20));
@@ -142,17 +323,25 @@ void scriptapi_luaentity_rm(lua_State *L, u16 id)
 	lua_settable(L, objectstable);
 
 	lua_pop(L, 2); // pop luaentities, minetest
+
+	luaL_unref(L, LUA_REGISTRYINDEX, refs->object);
+	refs->object = 0;
+	for(int i = 0; i < LUAENTITY_CALLBACK_COUNT; i++)
+	{
+		luaL_unref(L, LUA_REGISTRYINDEX, refs->callbacks[i]);
+		refs->callbacks[i] = LUA_REFNIL;
+	}
+	refs->callback_version = 0;
 }
 
-std::string scriptapi_luaentity_get_staticdata(lua_State *L, u16 id)
+std::string scriptapi_luaentity_get_staticdata(lua_State *L,
+		LuaEntityRefs *refs)
 {
 	realitycheck(L);
 	assert(lua_checkstack(L, 20));
-	//infostream<<"scriptapi_luaentity_get_staticdata: id="<<id<<std::endl;
 	StackUnroller stack_unroller(L);
 
-	// Get minetest.luaentities[id]
-	luaentity_get(L, id);
+	luaentity_push(L, refs);
 	int object = lua_gettop(L);
 
 	// Get get_staticdata function
@@ -173,16 +362,14 @@ std::string scriptapi_luaentity_get_staticdata(lua_State *L, u16 id)
 	return std::string(s, len);
 }
 
-void scriptapi_luaentity_get_properties(lua_State *L, u16 id,
+void scriptapi_luaentity_get_properties(lua_State *L, LuaEntityRefs *refs,
 		ObjectProperties *prop)
 {
 	realitycheck(L);
 	assert(lua_checkstack(L, 20));
-	//infostream<<"scriptapi_luaentity_get_properties: id="<<id<<std::endl;
 	StackUnroller stack_unroller(L);
 
-	// Get minetest.luaentities[id]
-	luaentity_get(L, id);
+	luaentity_push(L, refs);
 	//int object = lua_gettop(L);
 
 	// Set default values that differ from ObjectProperties defaults
@@ -214,50 +401,34 @@ void scriptapi_luaentity_get_properties(lua_State *L, u16 id,
 	lua_pop(L, 1);
 }
 
-void scriptapi_luaentity_step(lua_State *L, u16 id, float dtime)
+void scriptapi_luaentity_step(lua_State *L, LuaEntityRefs *refs, float dtime)
 {
 	realitycheck(L);
 	assert(lua_checkstack(L, 20));
-	//infostream<<"scriptapi_luaentity_step: id="<<id<<std::endl;
 	StackUnroller stack_unroller(L);
 
-	// Get minetest.luaentities[id]
-	luaentity_get(L, id);
-	int object = lua_gettop(L);
-	// State: object is at top of stack
-	// Get step function
-	lua_getfield(L, -1, "on_step");
-	if(lua_isnil(L, -1))
+	// Most entities that don't move by themselves have no on_step
+	if(!luaentity_push_callback(L, refs, LUAENTITY_ON_STEP))
 		return;
-	luaL_checktype(L, -1, LUA_TFUNCTION);
-	lua_pushvalue(L, object); // self
 	lua_pushnumber(L, dtime); // dtime
 	// Call with 2 arguments, 0 results
+	CallbackProfileScope profile_scope(refs->step_profile_slot);
 	if(lua_pcall(L, 2, 0, 0))
 		script_error(L, "error running function 'on_step': %s\n", lua_tostring(L, -1));
 }
 
 // Calls entity:on_punch(ObjectRef puncher, time_from_last_punch,
 //                       tool_capabilities, direction)
-void scriptapi_luaentity_punch(lua_State *L, u16 id,
+void scriptapi_luaentity_punch(lua_State *L, LuaEntityRefs *refs,
 		ServerActiveObject *puncher, float time_from_last_punch,
 		const ToolCapabilities *toolcap, v3f dir)
 {
 	realitycheck(L);
 	assert(lua_checkstack(L, 20));
-	//infostream<<"scriptapi_luaentity_step: id="<<id<<std::endl;
 	StackUnroller stack_unroller(L);
 
-	// Get minetest.luaentities[id]
-	luaentity_get(L, id);
-	int object = lua_gettop(L);
-	// State: object is at top of stack
-	// Get function
-	lua_getfield(L, -1, "on_punch");
-	if(lua_isnil(L, -1))
+	if(!luaentity_push_callback(L, refs, LUAENTITY_ON_PUNCH))
 		return;
-	luaL_checktype(L, -1, LUA_TFUNCTION);
-	lua_pushvalue(L, object); // self
 	objectref_get_or_create(L, puncher); // Clicker reference
 	lua_pushnumber(L, time_from_last_punch);
 	push_tool_capabilities(L, *toolcap);
@@ -268,24 +439,15 @@ void scriptapi_luaentity_punch(lua_State *L, u16 id,
 }
 
 // Calls entity:on_rightclick(ObjectRef clicker)
-void scriptapi_luaentity_rightclick(lua_State *L, u16 id,
+void scriptapi_luaentity_rightclick(lua_State *L, LuaEntityRefs *refs,
 		ServerActiveObject *clicker)
 {
 	realitycheck(L);
 	assert(lua_checkstack(L, 20));
-	//infostream<<"scriptapi_luaentity_step: id="<<id<<std::endl;
 	StackUnroller stack_unroller(L);
 
-	// Get minetest.luaentities[id]
-	luaentity_get(L, id);
-	int object = lua_gettop(L);
-	// State: object is at top of stack
-	// Get function
-	lua_getfield(L, -1, "on_rightclick");
-	if(lua_isnil(L, -1))
+	if(!luaentity_push_callback(L, refs, LUAENTITY_ON_RIGHTCLICK))
 		return;
-	luaL_checktype(L, -1, LUA_TFUNCTION);
-	lua_pushvalue(L, object); // self
 	objectref_get_or_create(L, clicker); // Clicker reference
 	// Call with 2 arguments, 0 results
 	if(lua_pcall(L, 2, 0, 0))
@@ -29,12 +29,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/pointedthing.h"
 #include "scriptapi_types.h"
 #include "scriptapi_noise.h"
+#include "scriptapi_voxelmanip.h"
 #include "scriptapi_nodemeta.h"
 #include "scriptapi_nodetimer.h"
 #include "scriptapi_object.h"
 #include "scriptapi_common.h"
 #include "scriptapi_item.h"
 #include "scriptapi_node.h"
+#include "scriptapi_profiler.h"
 
 
 //TODO
@@ -52,17 +54,20 @@ class LuaABM : public ActiveBlockModifier
 	std::set<std::string> m_required_neighbors;
 	float m_trigger_interval;
 	u32 m_trigger_chance;
+	u32 m_profile_slot;
 public:
 	LuaABM(lua_State *L, int id,
 			const std::set<std::string> &trigger_contents,
 			const std::set<std::string> &required_neighbors,
-			float trigger_interval, u32 trigger_chance):
+			float trigger_interval, u32 trigger_chance,
+			const std::string &mod_origin):
 		m_lua(L),
 		m_id(id),
 		m_trigger_contents(trigger_contents),
 		m_required_neighbors(required_neighbors),
 		m_trigger_interval(trigger_interval),
-		m_trigger_chance(trigger_chance)
+		m_trigger_chance(trigger_chance),
+		m_profile_slot(callback_profile_slot("abm", mod_origin))
 	{
 	}
 	virtual std::set<std::string> getTriggerContents()
@@ -110,6 +115,7 @@ class LuaABM : public ActiveBlockModifier
 		pushnode(L, n, env->getGameDef()->ndef());
 		lua_pushnumber(L, active_object_count);
 		lua_pushnumber(L, active_object_count_wider);
+		CallbackProfileScope profile_scope(m_profile_slot);
 		if(lua_pcall(L, 4, 0, 0))
 			script_error(L, "error: %s", lua_tostring(L, -1));
 	}
@@ -572,13 +578,9 @@ int EnvRef::l_find_nodes_in_area(lua_State *L)
 		ndef->getIds(lua_tostring(L, 4), filter);
 	}
 
-	// Get the table insert function
-	lua_getglobal(L, "table");
-	lua_getfield(L, -1, "insert");
-	int table_insert = lua_gettop(L);
-
 	lua_newtable(L);
 	int table = lua_gettop(L);
+	int i = 0;
 	for(s16 x=minp.X; x<=maxp.X; x++)
 	for(s16 y=minp.Y; y<=maxp.Y; y++)
 	for(s16 z=minp.Z; z<=maxp.Z; z++)
@@ -586,11 +588,8 @@ int EnvRef::l_find_nodes_in_area(lua_State *L)
 		v3s16 p(x,y,z);
 		content_t c = env->getMap().getNodeNoEx(p).getContent();
 		if(filter.count(c) != 0){
-			lua_pushvalue(L, table_insert);
-			lua_pushvalue(L, table);
 			push_v3s16(L, p);
-			if(lua_pcall(L, 2, 0, 0))
-				script_error(L, "error: %s", lua_tostring(L, -1));
+			lua_rawseti(L, table, ++i);
 		}
 	}
 	return 1;
@@ -697,6 +696,18 @@ int EnvRef::l_spawn_tree(lua_State *L)
 }
 
 
+// EnvRef:get_voxel_manip()
+// returns a VoxelManip for bulk reads and writes of the map
+int EnvRef::l_get_voxel_manip(lua_State *L)
+{
+	EnvRef *o = checkobject(L, 1);
+	ServerEnvironment *env = o->m_env;
+	if(env == NULL) return 0;
+
+	LuaVoxelManip::create(L, &env->getMap());
+	return 1;
+}
+
 EnvRef::EnvRef(ServerEnvironment *env):
 	m_env(env)
 {
@@ -778,6 +789,7 @@ const luaL_reg EnvRef::methods[] = {
 	luamethod(EnvRef, find_nodes_in_area),
 	luamethod(EnvRef, get_perlin),
 	luamethod(EnvRef, get_perlin_map),
+	luamethod(EnvRef, get_voxel_manip),
 	luamethod(EnvRef, clear_objects),
 	luamethod(EnvRef, spawn_tree),
 	{0,0}
@@ -895,8 +907,12 @@ void scriptapi_add_environment(lua_State *L, ServerEnvironment *env)
 			int trigger_chance = 50;
 			getintfield(L, current_abm, "chance", trigger_chance);
 
+			std::string mod_origin = "??";
+			getstringfield(L, current_abm, "mod_origin", mod_origin);
+
 			LuaABM *abm = new LuaABM(L, id, trigger_contents,
-					required_neighbors, trigger_interval, trigger_chance);
+					required_neighbors, trigger_interval, trigger_chance,
+					mod_origin);
 
 			env->addActiveBlockModifier(abm);
 
@@ -131,6 +131,10 @@ class EnvRef
 	//  returns world-specific PerlinNoiseMap
 	static int l_get_perlin_map(lua_State *L);
 
+	// EnvRef:get_voxel_manip()
+	// returns a VoxelManip for bulk reads and writes of the map
+	static int l_get_voxel_manip(lua_State *L);
+
 	// EnvRef:clear_objects()
 	// clear all objects in the environment
 	static int l_clear_objects(lua_State *L);
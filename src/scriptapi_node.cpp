@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "scriptapi_types.h"
 #include "scriptapi_item.h"
 #include "scriptapi_object.h"
+#include "scriptapi_profiler.h"
 
 
 struct EnumString es_DrawType[] =
@@ -186,15 +187,23 @@ bool scriptapi_node_on_timer(lua_State *L, v3s16 p, MapNode node, f32 dtime)
 
 	INodeDefManager *ndef = get_server(L)->ndef();
 
+	const std::string &name = ndef->get(node).name;
+
 	// Push callback function on stack
-	if(!get_item_callback(L, ndef->get(node).name.c_str(), "on_timer"))
+	if(!get_item_callback(L, name.c_str(), "on_timer"))
 		return false;
 
 	// Call function
 	push_v3s16(L, p);
 	lua_pushnumber(L,dtime);
-	if(lua_pcall(L, 2, 1, 0))
-		script_error(L, "error: %s", lua_tostring(L, -1));
+	{
+		u32 slot = CALLBACK_PROFILE_NONE;
+		if(g_callback_profiling)
+			slot = callback_profile_item_slot(L, "node_timer", name);
+		CallbackProfileScope profile_scope(slot);
+		if(lua_pcall(L, 2, 1, 0))
+			script_error(L, "error: %s", lua_tostring(L, -1));
+	}
 	if((bool)lua_isboolean(L,-1) && (bool)lua_toboolean(L,-1) == true)
 		return true;
 
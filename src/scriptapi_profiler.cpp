@@ -0,0 +1,188 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "scriptapi.h"
+#include "scriptapi_profiler.h"
+#include "scriptapi_types.h"
+#include "script.h"
+#include <cassert>
+#include <vector>
+#include <map>
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+bool g_callback_profiling = false;
+
+struct CallbackProfileEntry
+{
+	std::string kind;
+	std::string mod;
+	u32 calls;
+	u64 time_us;
+	u32 max_us;
+
+	CallbackProfileEntry(const std::string &kind_, const std::string &mod_):
+		kind(kind_),
+		mod(mod_),
+		calls(0),
+		time_us(0),
+		max_us(0)
+	{}
+};
+
+// Slot n is in g_entries[n - 1]
+static std::vector<CallbackProfileEntry> g_entries;
+static std::map<std::pair<std::string, std::string>, u32> g_slots;
+
+u32 callback_profile_slot(const std::string &kind, const std::string &mod)
+{
+	std::pair<std::string, std::string> key(kind, mod);
+	std::map<std::pair<std::string, std::string>, u32>::iterator
+			i = g_slots.find(key);
+	if(i != g_slots.end())
+		return i->second;
+	g_entries.push_back(CallbackProfileEntry(kind, mod));
+	u32 slot = g_entries.size();
+	g_slots[key] = slot;
+	return slot;
+}
+
+u32 callback_profile_function_slot(lua_State *L, int index)
+{
+	if(index < 0)
+		index = lua_gettop(L) + 1 + index;
+
+	// Get minetest.callback_origins[func]
+	lua_getglobal(L, "minetest");
+	lua_getfield(L, -1, "callback_origins");
+	lua_remove(L, -2);
+	if(!lua_istable(L, -1)){
+		lua_pop(L, 1);
+		return CALLBACK_PROFILE_NONE;
+	}
+	lua_pushvalue(L, index);
+	lua_rawget(L, -2);
+	lua_remove(L, -2);
+	if(!lua_istable(L, -1)){
+		lua_pop(L, 1);
+		return callback_profile_slot("unknown", "??");
+	}
+	int origin = lua_gettop(L);
+
+	// The slot is cached in the origin table
+	lua_getfield(L, origin, "profile_slot");
+	if(lua_isnumber(L, -1)){
+		u32 slot = lua_tointeger(L, -1);
+		lua_pop(L, 2);
+		return slot;
+	}
+	lua_pop(L, 1);
+
+	std::string kind = "unknown";
+	std::string mod = "??";
+	getstringfield(L, origin, "kind", kind);
+	getstringfield(L, origin, "mod", mod);
+	u32 slot = callback_profile_slot(kind, mod);
+	lua_pushinteger(L, slot);
+	lua_setfield(L, origin, "profile_slot");
+	lua_pop(L, 1);
+	return slot;
+}
+
+u32 callback_profile_item_slot(lua_State *L, const char *kind,
+		const std::string &itemname)
+{
+	std::string mod = "??";
+	// Get minetest.registered_items[itemname].mod_origin
+	lua_getglobal(L, "minetest");
+	lua_getfield(L, -1, "registered_items");
+	if(lua_istable(L, -1)){
+		lua_getfield(L, -1, itemname.c_str());
+		if(lua_istable(L, -1))
+			getstringfield(L, -1, "mod_origin", mod);
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 2);
+	return callback_profile_slot(kind, mod);
+}
+
+void callback_profile_add(u32 slot, u32 time_us)
+{
+	assert(slot != CALLBACK_PROFILE_NONE && slot <= g_entries.size());
+	CallbackProfileEntry &entry = g_entries[slot - 1];
+	entry.calls++;
+	entry.time_us += time_us;
+	if(time_us > entry.max_us)
+		entry.max_us = time_us;
+}
+
+/*
+	Mod API
+*/
+
+// set_callback_profiling(enabled)
+int l_set_callback_profiling(lua_State *L)
+{
+	g_callback_profiling = lua_toboolean(L, 1);
+	return 0;
+}
+
+// get_callback_profile() -> list of {kind=, mod=, calls=, time=, max=}
+// Times are in microseconds
+int l_get_callback_profile(lua_State *L)
+{
+	lua_newtable(L);
+	int table = lua_gettop(L);
+	int n = 0;
+	for(u32 i = 0; i < g_entries.size(); i++)
+	{
+		const CallbackProfileEntry &entry = g_entries[i];
+		if(entry.calls == 0)
+			continue;
+		lua_newtable(L);
+		lua_pushstring(L, entry.kind.c_str());
+		lua_setfield(L, -2, "kind");
+		lua_pushstring(L, entry.mod.c_str());
+		lua_setfield(L, -2, "mod");
+		lua_pushnumber(L, entry.calls);
+		lua_setfield(L, -2, "calls");
+		lua_pushnumber(L, entry.time_us);
+		lua_setfield(L, -2, "time");
+		lua_pushnumber(L, entry.max_us);
+		lua_setfield(L, -2, "max");
+		lua_rawseti(L, table, ++n);
+	}
+	return 1;
+}
+
+// reset_callback_profile()
+int l_reset_callback_profile(lua_State *L)
+{
+	// Slot numbers are cached by the callers, so keep the entries
+	for(u32 i = 0; i < g_entries.size(); i++)
+	{
+		g_entries[i].calls = 0;
+		g_entries[i].time_us = 0;
+		g_entries[i].max_us = 0;
+	}
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef LUA_PROFILER_H_
+#define LUA_PROFILER_H_
+
+extern "C" {
+#include <lua.h>
+}
+
+#include <string>
+#include "irrlichttypes.h"
+#include "porting.h"
+
+/*
+	Callback profiler
+
+	Counts the calls of and the time spent in Lua callbacks, per kind of
+	callback ("globalstep", "abm", "node_timer", ...) and per mod that
+	registered the callback. Every (kind, mod) pair has a slot number;
+	the callers look up the slot of the callback they are about to run
+	and time the call with a CallbackProfileScope.
+
+	While profiling is disabled, only g_callback_profiling is checked.
+*/
+
+// Slot number that records nothing
+#define CALLBACK_PROFILE_NONE 0
+
+extern bool g_callback_profiling;
+
+// Returns the slot of (kind, mod), creating it on first use
+u32 callback_profile_slot(const std::string &kind, const std::string &mod);
+
+// Returns the slot of the callback function at index, as registered in
+// minetest.callback_origins
+u32 callback_profile_function_slot(lua_State *L, int index);
+
+// Returns the slot of kind attributed to the mod that registered the
+// item named itemname
+u32 callback_profile_item_slot(lua_State *L, const char *kind,
+		const std::string &itemname);
+
+void callback_profile_add(u32 slot, u32 time_us);
+
+class CallbackProfileScope
+{
+public:
+	CallbackProfileScope(u32 slot):
+		m_slot(g_callback_profiling ? slot : CALLBACK_PROFILE_NONE),
+		m_start(m_slot != CALLBACK_PROFILE_NONE ? porting::getTimeUs() : 0)
+	{
+	}
+	~CallbackProfileScope()
+	{
+		if(m_slot != CALLBACK_PROFILE_NONE)
+			callback_profile_add(m_slot, porting::getTimeUs() - m_start);
+	}
+private:
+	u32 m_slot;
+	u32 m_start;
+};
+
+/*****************************************************************************/
+/* Mod API                                                                   */
+/*****************************************************************************/
+int l_set_callback_profiling(lua_State *L);
+int l_get_callback_profile(lua_State *L);
+int l_reset_callback_profile(lua_State *L);
+
+#endif /* LUA_PROFILER_H_ */
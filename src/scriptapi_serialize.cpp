@@ -0,0 +1,320 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "scriptapi.h"
+#include "scriptapi_serialize.h"
+#include "script.h"
+#include "exceptions.h"
+#include "util/serialize.h"
+#include <cstring> // memcpy
+#include <cmath> // floor
+#include <map>
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+/*
+	Binary serialization of Lua values
+
+	The data starts with a zero byte, so that it can't be mistaken for
+	the output of minetest.serialize() or a plain string, and the format
+	version. Then follows a single value:
+		u8 type
+		SER_NIL, SER_FALSE, SER_TRUE: nothing more
+		SER_INT: s32
+		SER_NUMBER: u64 bits of an IEEE 754 double
+		SER_SHORTSTRING: u8 length, data
+		SER_STRING: u32 length, data
+		SER_TABLE: u32 number of pairs, then the key and value of each pair
+		SER_TABLEREF: u32 number of an earlier SER_TABLE, counting from 1
+			in the order they appear; used for shared tables and cycles
+
+	Deserializing only creates values; nothing is ever run.
+*/
+
+#define SER_BIN_VERSION 1
+// Keeps the recursion from running out of C stack
+#define SER_BIN_MAX_DEPTH 200
+
+enum BinarySerializationType
+{
+	SER_NIL = 0,
+	SER_FALSE = 1,
+	SER_TRUE = 2,
+	SER_INT = 3,
+	SER_NUMBER = 4,
+	SER_SHORTSTRING = 5,
+	SER_STRING = 6,
+	SER_TABLE = 7,
+	SER_TABLEREF = 8,
+};
+
+static void append_u32(std::string &os, u32 i)
+{
+	char buf[4];
+	writeU32((u8*)buf, i);
+	os.append(buf, 4);
+}
+
+static void serialize_binary_value(lua_State *L, int index, std::string &os,
+		std::map<const void*, u32> &tables, int depth)
+{
+	switch(lua_type(L, index))
+	{
+	case LUA_TNIL:
+		os += (char)SER_NIL;
+		break;
+	case LUA_TBOOLEAN:
+		os += (char)(lua_toboolean(L, index) ? SER_TRUE : SER_FALSE);
+		break;
+	case LUA_TNUMBER: {
+		lua_Number n = lua_tonumber(L, index);
+		if(n >= -2147483648.0 && n <= 2147483647.0 && n == floor(n))
+		{
+			os += (char)SER_INT;
+			append_u32(os, (u32)(s32)n);
+		}
+		else
+		{
+			double d = n;
+			u64 bits;
+			memcpy(&bits, &d, 8);
+			char buf[8];
+			writeU64((u8*)buf, bits);
+			os += (char)SER_NUMBER;
+			os.append(buf, 8);
+		}
+		break;
+	}
+	case LUA_TSTRING: {
+		size_t len;
+		const char *s = lua_tolstring(L, index, &len);
+		if(len < 256)
+		{
+			os += (char)SER_SHORTSTRING;
+			os += (char)len;
+		}
+		else
+		{
+			os += (char)SER_STRING;
+			append_u32(os, len);
+		}
+		os.append(s, len);
+		break;
+	}
+	case LUA_TTABLE: {
+		const void *p = lua_topointer(L, index);
+		std::map<const void*, u32>::iterator i = tables.find(p);
+		if(i != tables.end())
+		{
+			os += (char)SER_TABLEREF;
+			append_u32(os, i->second);
+			break;
+		}
+		if(depth >= SER_BIN_MAX_DEPTH)
+			throw LuaError(L, "serialize_binary: tables are nested too deeply");
+		if(!lua_checkstack(L, 2))
+			throw LuaError(L, "serialize_binary: out of stack space");
+		u32 id = tables.size() + 1;
+		tables[p] = id;
+
+		os += (char)SER_TABLE;
+		// The number of pairs is filled in afterwards
+		size_t count_pos = os.size();
+		append_u32(os, 0);
+		u32 count = 0;
+		lua_pushnil(L);
+		while(lua_next(L, index) != 0)
+		{
+			int top = lua_gettop(L);
+			serialize_binary_value(L, top - 1, os, tables, depth + 1);
+			serialize_binary_value(L, top, os, tables, depth + 1);
+			lua_pop(L, 1);
+			count++;
+		}
+		writeU32((u8*)&os[count_pos], count);
+		break;
+	}
+	default:
+		throw LuaError(L, std::string("serialize_binary: can't serialize a ")
+				+ lua_typename(L, lua_type(L, index)));
+	}
+}
+
+class BinaryDeserializer
+{
+public:
+	BinaryDeserializer(lua_State *L, const char *data, size_t size,
+			int refs_table):
+		m_L(L),
+		m_data((const u8*)data),
+		m_size(size),
+		m_pos(0),
+		m_refs(refs_table),
+		m_table_count(0)
+	{}
+
+	bool atEnd()
+	{
+		return m_pos == m_size;
+	}
+
+	u8 readU8()
+	{
+		need(1);
+		return m_data[m_pos++];
+	}
+
+	u32 readU32()
+	{
+		need(4);
+		u32 i = ::readU32(&m_data[m_pos]);
+		m_pos += 4;
+		return i;
+	}
+
+	// Pushes the next value onto the stack
+	void pushValue(int depth)
+	{
+		lua_State *L = m_L;
+		if(!lua_checkstack(L, 3))
+			throw SerializationError("out of stack space");
+		u8 type = readU8();
+		switch(type)
+		{
+		case SER_NIL:
+			lua_pushnil(L);
+			break;
+		case SER_FALSE:
+		case SER_TRUE:
+			lua_pushboolean(L, type == SER_TRUE);
+			break;
+		case SER_INT:
+			lua_pushnumber(L, (s32)readU32());
+			break;
+		case SER_NUMBER: {
+			need(8);
+			u64 bits = readU64(&m_data[m_pos]);
+			m_pos += 8;
+			double d;
+			memcpy(&d, &bits, 8);
+			lua_pushnumber(L, d);
+			break;
+		}
+		case SER_SHORTSTRING:
+		case SER_STRING: {
+			u32 len = (type == SER_SHORTSTRING) ? readU8() : readU32();
+			need(len);
+			lua_pushlstring(L, (const char*)&m_data[m_pos], len);
+			m_pos += len;
+			break;
+		}
+		case SER_TABLE: {
+			if(depth >= SER_BIN_MAX_DEPTH)
+				throw SerializationError("tables are nested too deeply");
+			u32 count = readU32();
+			// Every key and value takes at least one byte
+			if(count > (m_size - m_pos) / 2)
+				throw SerializationError("truncated data");
+			lua_newtable(L);
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, m_refs, ++m_table_count);
+			for(u32 i = 0; i < count; i++)
+			{
+				pushValue(depth + 1);
+				if(lua_isnil(L, -1))
+					throw SerializationError("nil table key");
+				if(lua_type(L, -1) == LUA_TNUMBER
+						&& lua_tonumber(L, -1) != lua_tonumber(L, -1))
+					throw SerializationError("NaN table key");
+				pushValue(depth + 1);
+				lua_rawset(L, -3);
+			}
+			break;
+		}
+		case SER_TABLEREF: {
+			u32 id = readU32();
+			if(id == 0 || id > m_table_count)
+				throw SerializationError("invalid table reference");
+			lua_rawgeti(L, m_refs, id);
+			break;
+		}
+		default:
+			throw SerializationError("unknown value type");
+		}
+	}
+
+private:
+	void need(size_t len)
+	{
+		if(len > m_size - m_pos)
+			throw SerializationError("truncated data");
+	}
+
+	lua_State *m_L;
+	const u8 *m_data;
+	size_t m_size;
+	size_t m_pos;
+	int m_refs;
+	u32 m_table_count;
+};
+
+// serialize_binary(value) -> string
+int l_serialize_binary(lua_State *L)
+{
+	luaL_checkany(L, 1);
+	lua_settop(L, 1);
+	std::string os;
+	os += (char)0;
+	os += (char)SER_BIN_VERSION;
+	std::map<const void*, u32> tables;
+	serialize_binary_value(L, 1, os, tables, 0);
+	lua_pushlstring(L, os.c_str(), os.size());
+	return 1;
+}
+
+// deserialize_binary(string) -> value or nil, error message
+int l_deserialize_binary(lua_State *L)
+{
+	size_t len;
+	const char *s = luaL_checklstring(L, 1, &len);
+	lua_settop(L, 1);
+	try{
+		if(len < 2 || s[0] != 0)
+			throw SerializationError("not binary serialized data");
+		if(s[1] != SER_BIN_VERSION)
+			throw SerializationError("unsupported format version");
+		// Tables by number, for SER_TABLEREF
+		lua_newtable(L);
+		BinaryDeserializer d(L, s + 2, len - 2, lua_gettop(L));
+		d.pushValue(0);
+		if(!d.atEnd())
+			throw SerializationError("trailing data");
+	}
+	catch(SerializationError &e){
+		lua_settop(L, 1);
+		lua_pushnil(L);
+		lua_pushstring(L, e.what());
+		return 2;
+	}
+	return 1;
+}
+
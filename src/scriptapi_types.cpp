@@ -360,6 +360,14 @@ MapNode readnode(lua_State *L, int index, INodeDefManager *ndef)
 	return MapNode(ndef, name, param1, param2);
 }
 
+content_t checkcontentid(lua_State *L, int index, INodeDefManager *ndef)
+{
+	lua_Integer c = luaL_checkinteger(L, index);
+	if(c < 0 || c > MAX_CONTENT || ndef->get((content_t)c).name.empty())
+		luaL_error(L, "invalid content id %d", (int)c);
+	return (content_t)c;
+}
+
 void pushnode(lua_State *L, const MapNode &n, INodeDefManager *ndef)
 {
 	lua_newtable(L);
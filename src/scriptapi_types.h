@@ -82,6 +82,8 @@ void          push_v3f                      (lua_State *L, v3f p);
 
 
 MapNode readnode(lua_State *L, int index, INodeDefManager *ndef);
+// Raises a Lua error unless the value is a registered content id
+content_t checkcontentid(lua_State *L, int index, INodeDefManager *ndef);
 void pushnode(lua_State *L, const MapNode &n, INodeDefManager *ndef);
 
 #endif /* LUA_TYPES_H_ */
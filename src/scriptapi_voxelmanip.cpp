@@ -0,0 +1,236 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "scriptapi.h"
+#include "scriptapi_voxelmanip.h"
+#include "scriptapi_types.h"
+#include "scriptapi_common.h"
+#include "script.h"
+#include "map.h"
+#include "mapblock.h"
+
+/*
+	LuaVoxelManip
+*/
+
+// garbage collector
+int LuaVoxelManip::gc_object(lua_State *L)
+{
+	LuaVoxelManip *o = *(LuaVoxelManip **)(lua_touserdata(L, 1));
+	delete o;
+	return 0;
+}
+
+// read_from_map(self, p1, p2) -> minp, maxp
+int LuaVoxelManip::l_read_from_map(lua_State *L)
+{
+	LuaVoxelManip *o = checkobject(L, 1);
+	v3s16 p1 = read_v3s16(L, 2);
+	v3s16 p2 = read_v3s16(L, 3);
+	v3s16 bp1 = getNodeBlockPos(v3s16(MYMIN(p1.X, p2.X),
+			MYMIN(p1.Y, p2.Y), MYMIN(p1.Z, p2.Z)));
+	v3s16 bp2 = getNodeBlockPos(v3s16(MYMAX(p1.X, p2.X),
+			MYMAX(p1.Y, p2.Y), MYMAX(p1.Z, p2.Z)));
+
+	ManualMapVoxelManipulator *vm = o->vm;
+	vm->clear();
+	vm->initialEmerge(bp1, bp2);
+
+	push_v3s16(L, vm->m_area.MinEdge);
+	push_v3s16(L, vm->m_area.MaxEdge);
+	return 2;
+}
+
+// get_emerged_area(self) -> minp, maxp
+int LuaVoxelManip::l_get_emerged_area(lua_State *L)
+{
+	LuaVoxelManip *o = checkobject(L, 1);
+	push_v3s16(L, o->vm->m_area.MinEdge);
+	push_v3s16(L, o->vm->m_area.MaxEdge);
+	return 2;
+}
+
+// get_data(self) -> array of content IDs
+int LuaVoxelManip::l_get_data(lua_State *L)
+{
+	LuaVoxelManip *o = checkobject(L, 1);
+	ManualMapVoxelManipulator *vm = o->vm;
+	s32 volume = vm->m_area.getVolume();
+
+	lua_createtable(L, volume, 0);
+	for(s32 i = 0; i < volume; i++)
+	{
+		content_t c = (vm->m_flags[i] & VOXELFLAG_INEXISTENT) ?
+				CONTENT_IGNORE : vm->m_data[i].getContent();
+		lua_pushinteger(L, c);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+// set_data(self, data)
+int LuaVoxelManip::l_set_data(lua_State *L)
+{
+	LuaVoxelManip *o = checkobject(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	ManualMapVoxelManipulator *vm = o->vm;
+	INodeDefManager *ndef = get_server(L)->ndef();
+	s32 volume = vm->m_area.getVolume();
+
+	for(s32 i = 0; i < volume; i++)
+	{
+		lua_rawgeti(L, 2, i + 1);
+		if(!lua_isnil(L, -1))
+			vm->m_data[i].setContent(checkcontentid(L, -1, ndef));
+		lua_pop(L, 1);
+	}
+	return 0;
+}
+
+// get_param2_data(self) -> array of param2 values
+int LuaVoxelManip::l_get_param2_data(lua_State *L)
+{
+	LuaVoxelManip *o = checkobject(L, 1);
+	ManualMapVoxelManipulator *vm = o->vm;
+	s32 volume = vm->m_area.getVolume();
+
+	lua_createtable(L, volume, 0);
+	for(s32 i = 0; i < volume; i++)
+	{
+		lua_pushinteger(L, vm->m_data[i].param2);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+// set_param2_data(self, data)
+int LuaVoxelManip::l_set_param2_data(lua_State *L)
+{
+	LuaVoxelManip *o = checkobject(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	ManualMapVoxelManipulator *vm = o->vm;
+	s32 volume = vm->m_area.getVolume();
+
+	for(s32 i = 0; i < volume; i++)
+	{
+		lua_rawgeti(L, 2, i + 1);
+		if(!lua_isnil(L, -1))
+			vm->m_data[i].param2 = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	return 0;
+}
+
+// write_to_map(self)
+int LuaVoxelManip::l_write_to_map(lua_State *L)
+{
+	LuaVoxelManip *o = checkobject(L, 1);
+	Map *map = o->m_map;
+
+	std::map<v3s16, MapBlock*> modified_blocks;
+	o->vm->blitBackAll(&modified_blocks);
+
+	// Update lighting of all written blocks at once
+	std::map<v3s16, MapBlock*> lighting_modified_blocks;
+	lighting_modified_blocks.insert(modified_blocks.begin(),
+			modified_blocks.end());
+	map->updateLighting(lighting_modified_blocks, modified_blocks);
+
+	// Save and send the blocks
+	MapEditEvent event;
+	event.type = MEET_OTHER;
+	for(std::map<v3s16, MapBlock*>::iterator
+			i = modified_blocks.begin();
+			i != modified_blocks.end(); ++i)
+	{
+		i->second->raiseModified(MOD_STATE_WRITE_NEEDED,
+				"LuaVoxelManip::write_to_map");
+		event.modified_blocks.insert(i->first);
+	}
+	map->dispatchEvent(&event);
+	return 0;
+}
+
+LuaVoxelManip::LuaVoxelManip(Map *map):
+	m_map(map),
+	vm(new ManualMapVoxelManipulator(map))
+{
+}
+
+LuaVoxelManip::~LuaVoxelManip()
+{
+	delete vm;
+}
+
+// Creates a LuaVoxelManip and leaves it on top of stack
+void LuaVoxelManip::create(lua_State *L, Map *map)
+{
+	LuaVoxelManip *o = new LuaVoxelManip(map);
+	*(void **)(lua_newuserdata(L, sizeof(void *))) = o;
+	luaL_getmetatable(L, className);
+	lua_setmetatable(L, -2);
+}
+
+LuaVoxelManip* LuaVoxelManip::checkobject(lua_State *L, int narg)
+{
+	luaL_checktype(L, narg, LUA_TUSERDATA);
+	void *ud = luaL_checkudata(L, narg, className);
+	if(!ud) luaL_typerror(L, narg, className);
+	return *(LuaVoxelManip**)ud;  // unbox pointer
+}
+
+void LuaVoxelManip::Register(lua_State *L)
+{
+	lua_newtable(L);
+	int methodtable = lua_gettop(L);
+	luaL_newmetatable(L, className);
+	int metatable = lua_gettop(L);
+
+	lua_pushliteral(L, "__metatable");
+	lua_pushvalue(L, methodtable);
+	lua_settable(L, metatable);  // hide metatable from Lua getmetatable()
+
+	lua_pushliteral(L, "__index");
+	lua_pushvalue(L, methodtable);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__gc");
+	lua_pushcfunction(L, gc_object);
+	lua_settable(L, metatable);
+
+	lua_pop(L, 1);  // drop metatable
+
+	luaL_openlib(L, 0, methods, 0);  // fill methodtable
+	lua_pop(L, 1);  // drop methodtable
+
+	// Cannot be created from Lua; use EnvRef:get_voxel_manip()
+	//lua_register(L, className, create_object);
+}
+
+const char LuaVoxelManip::className[] = "VoxelManip";
+const luaL_reg LuaVoxelManip::methods[] = {
+	luamethod(LuaVoxelManip, read_from_map),
+	luamethod(LuaVoxelManip, get_emerged_area),
+	luamethod(LuaVoxelManip, get_data),
+	luamethod(LuaVoxelManip, set_data),
+	luamethod(LuaVoxelManip, get_param2_data),
+	luamethod(LuaVoxelManip, set_param2_data),
+	luamethod(LuaVoxelManip, write_to_map),
+	{0,0}
+};
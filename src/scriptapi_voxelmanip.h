@@ -0,0 +1,86 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef LUA_VOXELMANIP_H_
+#define LUA_VOXELMANIP_H_
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+}
+
+#include "irr_v3d.h"
+
+class Map;
+class ManualMapVoxelManipulator;
+
+/*
+	VoxelManip
+
+	Reads an area of the map into memory once, lets Lua work on flat
+	arrays of content IDs and param2 values, and writes everything back
+	with a single blit and lighting update.
+*/
+
+class LuaVoxelManip
+{
+private:
+	Map *m_map;
+	ManualMapVoxelManipulator *vm;
+
+	static const char className[];
+	static const luaL_reg methods[];
+
+	static int gc_object(lua_State *L);
+
+	// read_from_map(self, p1, p2) -> minp, maxp
+	// Loads the map blocks containing p1...p2; returns the loaded area
+	static int l_read_from_map(lua_State *L);
+
+	// get_emerged_area(self) -> minp, maxp
+	static int l_get_emerged_area(lua_State *L);
+
+	// get_data(self) -> array of content IDs
+	static int l_get_data(lua_State *L);
+	// set_data(self, data)
+	static int l_set_data(lua_State *L);
+
+	// get_param2_data(self) -> array of param2 values
+	static int l_get_param2_data(lua_State *L);
+	// set_param2_data(self, data)
+	static int l_set_param2_data(lua_State *L);
+
+	// write_to_map(self)
+	// Writes back the blocks, updates lighting and sends them to clients
+	static int l_write_to_map(lua_State *L);
+
+public:
+	LuaVoxelManip(Map *map);
+
+	~LuaVoxelManip();
+
+	// Creates a LuaVoxelManip and leaves it on top of stack
+	static void create(lua_State *L, Map *map);
+
+	static LuaVoxelManip *checkobject(lua_State *L, int narg);
+
+	static void Register(lua_State *L);
+};
+
+#endif /* LUA_VOXELMANIP_H_ */
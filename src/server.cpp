@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <iostream>
 #include <queue>
 #include <algorithm>
+#include <cstdio> // rename()
 #include "clientserver.h"
 #include "map.h"
 #include "jmutexautolock.h"
@@ -642,6 +643,7 @@ Server::Server(
 	m_env(NULL),
 	m_con(PROTOCOL_ID, 512, CONNECTION_TIMEOUT, this),
 	m_banmanager(path_world+DIR_DELIM+"ipban.txt"),
+	m_authdb(NULL),
 	m_rollback(NULL),
 	m_rollback_sink_enabled(true),
 	m_enable_rollback_recording(false),
@@ -709,6 +711,26 @@ Server::Server(
 	if(!initializeWorld(m_path_world, m_gamespec.id))
 		throw ServerError("Failed to initialize world");
 
+	// Open the authentication database
+	m_authdb = new AuthDatabase(m_path_world+DIR_DELIM+"auth.sqlite");
+
+	// Import the auth.txt of older worlds once
+	std::string authtxt_path = m_path_world+DIR_DELIM+"auth.txt";
+	if(fs::PathExists(authtxt_path))
+	{
+		// Without the accounts anybody could take the names, so don't
+		// start; auth.txt is kept for the next try
+		u32 count = 0;
+		if(!m_authdb->importAuthFile(authtxt_path, count))
+			throw ServerError("Failed to import "+authtxt_path);
+		actionstream<<"Imported "<<count<<" players from "
+				<<authtxt_path<<std::endl;
+		std::string backup_path = authtxt_path + ".imported";
+		if(rename(authtxt_path.c_str(), backup_path.c_str()) != 0)
+			errorstream<<"Could not rename "<<authtxt_path<<" to "
+					<<backup_path<<std::endl;
+	}
+
 	ModConfiguration modconf(m_path_world);
 	m_mods = modconf.getMods();
 	std::list<ModSpec> unsatisfied_mods = modconf.getUnsatisfiedMods();
@@ -930,6 +952,7 @@ Server::~Server()
 	// Delete things in the reverse order of creation
 	delete m_env;
 	delete m_rollback;
+	delete m_authdb;
 	delete m_emerge;
 	delete m_event;
 	delete m_itemdef;
@@ -1109,7 +1132,9 @@ void Server::AsyncRunStep()
 		// Run Map's timers and unload unused data
 		ScopeProfiler sp(g_profiler, "Server: map timer and unload");
 		m_env->getMap().timerUpdate(map_timer_and_unload_dtime,
-				g_settings->getFloat("server_unload_unused_data_timeout"));
+				g_settings->getFloat("server_unload_unused_data_timeout"),
+				g_settings->getFloat("server_pack_unused_data_timeout"),
+				MYMAX(g_settings->getS32("server_unload_max_blocks"), 0));
 	}
 
 	/*
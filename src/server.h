@@ -28,6 +28,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "map.h"
 #include "inventory.h"
 #include "ban.h"
+#include "authdatabase.h"
 #include "gamedef.h"
 #include "serialization.h" // For SER_FMT_VER_INVALID
 #include "mods.h"
@@ -497,6 +498,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// Envlock should be locked when using the rollback manager
 	IRollbackManager *getRollbackManager(){ return m_rollback; }
 
+	// Envlock should be locked when using the auth database
+	AuthDatabase *getAuthDatabase(){ return m_authdb; }
+
 	//TODO:  determine what should be locked when accessing the emerge manager
 	EmergeManager *getEmergeManager(){ return m_emerge; }
 
@@ -726,6 +730,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// Bann checking
 	BanManager m_banmanager;
 
+	// Authentication data (behind m_env_mutex)
+	AuthDatabase *m_authdb;
+
 	// Rollback manager (behind m_env_mutex)
 	IRollbackManager *m_rollback;
 	bool m_rollback_sink_enabled;
@@ -840,6 +847,7 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 	friend class EmergeThread;
 	friend class RemoteClient;
+	friend class WorldPregenerator;
 
 	std::map<std::string,MediaInfo> m_media;
 
@@ -33,17 +33,38 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "content_mapnode.h"
 #include "nodedef.h"
 #include "mapsector.h"
+#include "mapblock.h"
+#include "mapblockindex.h"
+#include "mapliquid.h"
+#include "heightmapcache.h"
+#include "noisemapcache.h"
+#include "schematic.h"
+#include "emerge.h"
+#include "mapgen_v6.h"
+#include "content_sao.h"
+#include "scriptapi_entity.h"
+#include "scriptapi_object.h"
+#include "scriptapi_serialize.h"
 #include "settings.h"
 #include "log.h"
 #include "util/string.h"
 #include "voxelalgorithms.h"
+#include "gamedef.h"
+#include "util/directiontables.h"
 #include "inventory.h"
 #include "util/numeric.h"
 #include "util/serialize.h"
+#include "util/thread.h"
 #include "noise.h" // PseudoRandom used for random data for compression
 #include "clientserver.h" // LATEST_PROTOCOL_VERSION
 #include <algorithm>
 
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
 /*
 	Asserts that the exception occurs
 */
@@ -72,6 +93,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define CONTENT_STONE 0
 #define CONTENT_GRASS 0x800
 #define CONTENT_TORCH 100
+#define CONTENT_WATER 101
+#define CONTENT_WATERSOURCE 102
 
 void define_some_nodes(IWritableItemDefManager *idef, IWritableNodeDefManager *ndef)
 {
@@ -138,6 +161,38 @@ void define_some_nodes(IWritableItemDefManager *idef, IWritableNodeDefManager *n
 	f.light_source = LIGHT_MAX-1;
 	idef->registerItem(itemdef);
 	ndef->set(i, f);
+
+	/*
+		Water (minimal definitions for liquid tests)
+	*/
+	f = ContentFeatures();
+	f.param_type = CPT_LIGHT;
+	f.light_propagates = true;
+	f.walkable = false;
+	f.buildable_to = true;
+	f.liquid_alternative_flowing = "default:water_flowing";
+	f.liquid_alternative_source = "default:water_source";
+	f.liquid_viscosity = 1;
+
+	i = CONTENT_WATER;
+	itemdef = ItemDefinition();
+	itemdef.type = ITEM_NODE;
+	itemdef.name = "default:water_flowing";
+	f.name = itemdef.name;
+	f.liquid_type = LIQUID_FLOWING;
+	f.param_type_2 = CPT2_FLOWINGLIQUID;
+	idef->registerItem(itemdef);
+	ndef->set(i, f);
+
+	i = CONTENT_WATERSOURCE;
+	itemdef = ItemDefinition();
+	itemdef.type = ITEM_NODE;
+	itemdef.name = "default:water_source";
+	f.name = itemdef.name;
+	f.liquid_type = LIQUID_SOURCE;
+	f.param_type_2 = CPT2_NONE;
+	idef->registerItem(itemdef);
+	ndef->set(i, f);
 }
 
 struct TestBase
@@ -493,6 +548,407 @@ struct TestMapNode: public TestBase
 	}
 };
 
+struct TestPackedNodeData: public TestBase
+{
+	void checkPacking(MapNode *nodes)
+	{
+		const u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
+		PackedNodeData packed;
+		packed.pack(nodes);
+		MapNode unpacked[nodecount];
+		packed.unpack(unpacked);
+		for(u32 i = 0; i < nodecount; i++)
+		{
+			UASSERT(unpacked[i].getContent() == nodes[i].getContent());
+			UASSERT(unpacked[i].getParam1() == nodes[i].getParam1());
+			UASSERT(unpacked[i].getParam2() == nodes[i].getParam2());
+		}
+	}
+
+	void Run(INodeDefManager *nodedef)
+	{
+		const u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
+		MapNode nodes[nodecount];
+		content_t c_stone = LEGN(nodedef, "CONTENT_STONE");
+		PseudoRandom pr(1234);
+
+		// Uniform
+		for(u32 i = 0; i < nodecount; i++)
+			nodes[i] = MapNode(c_stone);
+		checkPacking(nodes);
+		{
+			PackedNodeData packed;
+			packed.pack(nodes);
+			UASSERT(packed.getMemoryUsage() < 256);
+		}
+
+		// A few values of each, with every packed width
+		u32 counts[] = {2, 3, 16, 17, 256};
+		for(u32 j = 0; j < sizeof(counts) / sizeof(*counts); j++)
+		{
+			for(u32 i = 0; i < nodecount; i++)
+				nodes[i] = MapNode(pr.range(0, counts[j] - 1),
+						pr.range(0, counts[j] - 1) & 0xff, i % 3);
+			checkPacking(nodes);
+		}
+
+		// More contents than fit in a byte
+		for(u32 i = 0; i < nodecount; i++)
+			nodes[i] = MapNode(i % 1000, i & 0xff, 255 - (i & 0xff));
+		checkPacking(nodes);
+
+		// Accessing a packed block unpacks it transparently
+		MapBlock block(NULL, v3s16(0,0,0), NULL);
+		MapNode n(c_stone, 0, 7);
+		for(u16 z = 0; z < MAP_BLOCKSIZE; z++)
+		for(u16 y = 0; y < MAP_BLOCKSIZE; y++)
+		for(u16 x = 0; x < MAP_BLOCKSIZE; x++)
+			block.setNode(x, y, z, n);
+		block.packData();
+		UASSERT(block.isDataPacked());
+		UASSERT(!block.isDummy());
+		UASSERT(block.getNodeNoEx(v3s16(1,2,3)).getContent() == c_stone);
+		UASSERT(!block.isDataPacked());
+		UASSERT(block.getNodeNoEx(v3s16(1,2,3)).getParam2() == 7);
+
+		// Only blocks that aren't accessed are due for packing
+		block.incrementUsageTimer(5.0);
+		UASSERT(block.getPackTimer() > 4.0);
+		block.getNodeNoEx(v3s16(0,0,0));
+		UASSERT(block.getPackTimer() == 0);
+	}
+};
+
+struct TestMapBlockIndex: public TestBase
+{
+	void Run()
+	{
+		// The index only stores the pointers; fake ones are enough
+		const u32 count = 3000;
+		std::vector<char> storage(count);
+		std::map<v3s16, MapBlock*> reference;
+		MapBlockIndex index;
+		PseudoRandom pr(4321);
+
+		for(u32 i = 0; i < count; i++)
+		{
+			v3s16 p(pr.range(-20, 20), pr.range(-5, 5), pr.range(-20, 20));
+			MapBlock *block = (MapBlock*)&storage[i];
+			index.insert(p, block);
+			reference[p] = block;
+		}
+		UASSERT(index.size() == reference.size());
+
+		// Remove every other one, which also shrinks the table
+		u32 i = 0;
+		for(std::map<v3s16, MapBlock*>::iterator
+				j = reference.begin(); j != reference.end(); i++)
+		{
+			if(i % 2 == 0){
+				index.remove(j->first);
+				reference.erase(j++);
+			} else {
+				++j;
+			}
+		}
+		UASSERT(index.size() == reference.size());
+
+		v3s16 p;
+		for(p.X = -21; p.X <= 21; p.X++)
+		for(p.Y = -6; p.Y <= 6; p.Y++)
+		for(p.Z = -21; p.Z <= 21; p.Z++)
+		{
+			std::map<v3s16, MapBlock*>::iterator j = reference.find(p);
+			MapBlock *expected = (j == reference.end()) ? NULL : j->second;
+			UASSERT(index.get(p) == expected);
+		}
+	}
+};
+
+struct TestNodeTimerList: public TestBase
+{
+	void Run()
+	{
+		NodeTimerList timers;
+		std::vector<std::pair<v3s16, NodeTimer> > elapsed;
+
+		timers.set(v3s16(0,0,0), NodeTimer(1.5, 0));
+		timers.set(v3s16(1,0,0), NodeTimer(3.0, 0));
+		timers.set(v3s16(2,0,0), NodeTimer(3.0, 0));
+		timers.set(v3s16(3,0,0), NodeTimer(10.0, 9.5));
+		// Replacing and removing leave stale heap entries behind
+		timers.set(v3s16(1,0,0), NodeTimer(5.0, 0));
+		timers.remove(v3s16(2,0,0));
+
+		timers.step(1.0, elapsed);
+		UASSERT(elapsed.size() == 1);
+		UASSERT(elapsed[0].first == v3s16(3,0,0));
+		UASSERT(fabs(elapsed[0].second.elapsed - 10.5) < 0.001);
+		UASSERT(fabs(timers.get(v3s16(0,0,0)).elapsed - 1.0) < 0.001);
+
+		// Survives serialization
+		std::ostringstream os(std::ios_base::binary);
+		timers.serialize(os, 25);
+		std::istringstream is(os.str(), std::ios_base::binary);
+		NodeTimerList timers2;
+		timers2.deSerialize(is, 25);
+		UASSERT(fabs(timers2.get(v3s16(1,0,0)).elapsed - 1.0) < 0.001);
+		UASSERT(timers2.get(v3s16(2,0,0)).timeout == 0);
+
+		timers2.step(1.0, elapsed);
+		UASSERT(elapsed.size() == 1);
+		UASSERT(elapsed[0].first == v3s16(0,0,0));
+		timers2.step(2.0, elapsed);
+		UASSERT(elapsed.size() == 0);
+		timers2.step(1.0, elapsed);
+		UASSERT(elapsed.size() == 1);
+		UASSERT(elapsed[0].first == v3s16(1,0,0));
+		UASSERT(fabs(elapsed[0].second.elapsed - 5.0) < 0.001);
+		timers2.step(100.0, elapsed);
+		UASSERT(elapsed.size() == 0);
+
+		// An elapsed timer counts as removed until it is set again
+		timers2.set(v3s16(4,0,0), NodeTimer(1.0, 0));
+		timers2.set(v3s16(5,0,0), NodeTimer(1.0, 0));
+		timers2.step(1.0, elapsed);
+		UASSERT(elapsed.size() == 2);
+		UASSERT(timers2.get(v3s16(4,0,0)).timeout == 0);
+		timers2.set(v3s16(4,0,0), NodeTimer(2.0, 0));
+		UASSERT(timers2.get(v3s16(4,0,0)).timeout == 2.0);
+		std::ostringstream os2(std::ios_base::binary);
+		timers2.serialize(os2, 25);
+		UASSERT(os2.str().size() == 1 + 2 + 2 + 4 + 4);
+		timers2.step(1.0, elapsed);
+		UASSERT(elapsed.size() == 0);
+		timers2.step(1.0, elapsed);
+		UASSERT(elapsed.size() == 1);
+		UASSERT(elapsed[0].first == v3s16(4,0,0));
+	}
+};
+
+struct TestHeightmapCache: public TestBase
+{
+	// Ground level x + 2 * z; counts the tiles computed
+	struct TestHeightmapSource: public HeightmapSource
+	{
+		u32 tiles;
+
+		TestHeightmapSource(): tiles(0) {}
+
+		void getTile(v2s16 p0, s16 size, s16 *heights)
+		{
+			u32 i = 0;
+			for(s16 z = p0.Y; z < p0.Y + size; z++)
+			for(s16 x = p0.X; x < p0.X + size; x++)
+				heights[i++] = x + 2 * z;
+			tiles++;
+		}
+	};
+
+	// Looks up more sectors than fit in the cache on every thread
+	struct LookupJob : public WorkerPool::Job
+	{
+		HeightmapCache *cache;
+		u32 wrong;
+		JMutex mutex;
+
+		LookupJob(HeightmapCache *a_cache):
+			cache(a_cache),
+			wrong(0)
+		{
+			mutex.Init();
+		}
+
+		void work()
+		{
+			u32 w = 0;
+			for(s16 i = 0; i < 2000; i++)
+			{
+				v2s16 p((i * 7) % 64, (i * 13) % 48);
+				if(cache->getGroundLevel(p) != p.X + 2 * p.Y)
+					w++;
+			}
+			JMutexAutoLock lock(mutex);
+			wrong += w;
+		}
+	};
+
+	void Run()
+	{
+		TestHeightmapSource *source = new TestHeightmapSource;
+		HeightmapCache cache(source, 2);
+
+		UASSERT(cache.getGroundLevel(v2s16(3, 5)) == 13);
+		UASSERT(cache.getGroundLevel(v2s16(-1, -20)) == -41);
+		UASSERT(source->tiles == 2);
+
+		// Both sectors are cached
+		UASSERT(cache.getGroundLevel(v2s16(15, 15)) == 45);
+		UASSERT(cache.getGroundLevel(v2s16(-16, -17)) == -50);
+		UASSERT(source->tiles == 2);
+
+		s16 min, max;
+		cache.getGroundLevelRange(v2s16(-1, -2), min, max);
+		UASSERT(min == -16 - 2 * 32);
+		UASSERT(max == -1 - 2 * 17);
+
+		// Both were looked up since they were added; sector (0, 0) was
+		// added first and makes room
+		cache.getGroundLevel(v2s16(100, 0));
+		UASSERT(cache.getTileCount() == 2);
+		UASSERT(source->tiles == 3);
+		cache.getGroundLevel(v2s16(-1, -17));
+		UASSERT(source->tiles == 3);
+		cache.getGroundLevel(v2s16(0, 0));
+		UASSERT(source->tiles == 4);
+
+		cache.clear();
+		UASSERT(cache.getTileCount() == 0);
+
+		WorkerPool pool("TestHeightmapCache");
+		LookupJob job(&cache);
+		pool.run(&job, 4);
+		UASSERT(job.wrong == 0);
+		UASSERT(cache.getTileCount() == 2);
+	}
+};
+
+struct TestNoiseMapCache: public TestBase
+{
+	void Run()
+	{
+		NoiseParams np = {0.0, 1.0, v3f(50.0, 50.0, 50.0), 5, 3, 0.5};
+		Noise noise(&np, 1, 16, 16);
+		float expected[16 * 16];
+		memcpy(expected, noise.perlinMap2D(100.5, -40.5), sizeof(expected));
+
+		// Room for two maps
+		NoiseMapCache cache(2 * 16 * 16);
+		for(u32 k = 0; k < 2; k++)
+		{
+			memset(noise.result, 0, sizeof(expected));
+			cache.perlinMap2D(&noise, 100.5, -40.5);
+			UASSERT(memcmp(noise.result, expected, sizeof(expected)) == 0);
+			UASSERT(cache.getMapCount() == 1);
+		}
+
+		// Other areas and parameters are other maps
+		cache.perlinMap2D(&noise, 101.5, -40.5);
+		UASSERT(cache.getMapCount() == 2);
+		np.seed = 6;
+		cache.perlinMap2D(&noise, 100.5, -40.5);
+		UASSERT(cache.getMapCount() == 2);
+		UASSERT(memcmp(noise.result, expected, sizeof(expected)) != 0);
+
+		// The first map was the least recently used one
+		np.seed = 5;
+		memset(noise.result, 0, sizeof(expected));
+		cache.perlinMap2D(&noise, 100.5, -40.5);
+		UASSERT(memcmp(noise.result, expected, sizeof(expected)) == 0);
+
+		cache.clear();
+		UASSERT(cache.getMapCount() == 0);
+	}
+};
+
+struct TestChunkScheduler: public TestBase
+{
+	void Run()
+	{
+		ChunkScheduler chunks;
+		v3s16 cs(5,5,5);
+		v3s16 c0(-2,-2,-2);
+
+		UASSERT(chunks.tryStart(c0, c0 + cs - v3s16(1,1,1)) == true);
+		// The same chunk and the neighbours, also diagonal, conflict
+		UASSERT(chunks.tryStart(c0, c0 + cs - v3s16(1,1,1)) == false);
+		UASSERT(chunks.tryStart(c0 + v3s16(5,0,0),
+				c0 + v3s16(9,4,4)) == false);
+		UASSERT(chunks.tryStart(c0 - v3s16(5,5,5),
+				c0 - v3s16(1,1,1)) == false);
+		// Two chunks away, the borders do not overlap
+		UASSERT(chunks.tryStart(c0 + v3s16(10,0,0),
+				c0 + v3s16(14,4,4)) == true);
+		// With single block chunks they do
+		UASSERT(chunks.tryStart(v3s16(0,-20,0), v3s16(0,-20,0)) == true);
+		UASSERT(chunks.tryStart(v3s16(2,-20,0), v3s16(2,-20,0)) == false);
+		UASSERT(chunks.tryStart(v3s16(3,-20,0), v3s16(3,-20,0)) == true);
+
+		// Deferred blocks come back once their chunk is free
+		chunks.defer(v3s16(-5,-5,-5), 1, 10, c0 - v3s16(5,5,5),
+				c0 - v3s16(1,1,1));
+		chunks.defer(v3s16(0,-20,0), 0, 20, v3s16(0,-20,0), v3s16(0,-20,0));
+		v3s16 p;
+		u8 flags;
+		u32 time;
+		UASSERT(chunks.popDeferred(&p, &flags, &time) == false);
+		chunks.finish(c0);
+		UASSERT(chunks.popDeferred(&p, &flags, &time) == true);
+		UASSERT(p == v3s16(-5,-5,-5) && flags == 1 && time == 10);
+		UASSERT(chunks.getDeferredCount() == 1);
+		chunks.finish(v3s16(0,-20,0));
+		UASSERT(chunks.popDeferred(&p, &flags, &time) == true);
+		UASSERT(p == v3s16(0,-20,0) && time == 20);
+		UASSERT(chunks.getDeferredCount() == 0);
+	}
+};
+
+struct TestWorkerPool: public TestBase
+{
+	// Hands out items 0 to count-1 and counts the calls of work()
+	struct CountJob : public WorkerPool::Job
+	{
+		u32 count;
+		u32 next;
+		u32 calls;
+		std::vector<u32> done;
+		JMutex mutex;
+
+		CountJob(u32 a_count):
+			count(a_count),
+			next(0),
+			calls(0),
+			done(a_count, 0)
+		{
+			mutex.Init();
+		}
+
+		void work()
+		{
+			{
+				JMutexAutoLock lock(mutex);
+				calls++;
+			}
+			for(;;)
+			{
+				u32 i;
+				{
+					JMutexAutoLock lock(mutex);
+					if(next >= count)
+						return;
+					i = next++;
+				}
+				done[i]++;
+			}
+		}
+	};
+
+	void Run()
+	{
+		WorkerPool pool("TestWorkerPool");
+		// The threads are kept between passes of different sizes
+		u32 threads[4] = {4, 1, 3, 4};
+		for(u32 pass = 0; pass < 4; pass++)
+		{
+			CountJob job(1000);
+			pool.run(&job, threads[pass]);
+			UASSERT(job.calls == threads[pass]);
+			for(u32 i = 0; i < job.count; i++)
+				UASSERT(job.done[i] == 1);
+		}
+	}
+};
+
 struct TestVoxelManipulator: public TestBase
 {
 	void Run(INodeDefManager *nodedef)
@@ -562,6 +1018,125 @@ struct TestVoxelManipulator: public TestBase
 
 		UASSERT(v.getNode(v3s16(-1,0,-1)).getContent() == CONTENT_GRASS);
 		EXCEPTION_CHECK(InvalidPositionException, v.getNode(v3s16(0,1,1)));
+
+		/*
+			Stamping
+		*/
+
+		VoxelManipulator s;
+		VoxelArea sa(v3s16(0,0,0), v3s16(3,3,3));
+		s.addArea(sa);
+		s.setNodes(sa, MapNode(CONTENT_STONE));
+
+		// Clipped to the area, leaving the nodes with avoid_flags
+		s.m_flags[sa.index(2,2,2)] |= VOXELFLAG_CHECKED1;
+		s.setNodes(VoxelArea(v3s16(1,1,1), v3s16(5,5,5)),
+				MapNode(CONTENT_GRASS), VOXELFLAG_CHECKED1, VOXELFLAG_CHECKED2);
+		UASSERT(s.getNodeNoExNoEmerge(v3s16(3,3,3)).getContent() == CONTENT_GRASS);
+		UASSERT(s.getNodeNoExNoEmerge(v3s16(2,2,2)).getContent() == CONTENT_STONE);
+		UASSERT(s.getNodeNoExNoEmerge(v3s16(0,1,1)).getContent() == CONTENT_STONE);
+		UASSERT(s.m_flags[sa.index(1,2,3)] & VOXELFLAG_CHECKED2);
+		UASSERT(!(s.m_flags[sa.index(0,2,3)] & VOXELFLAG_CHECKED2));
+
+		s.setColumn(v3s16(0,-5,0), 1, MapNode(CONTENT_WATER));
+		s.setColumn(v3s16(4,0,0), 3, MapNode(CONTENT_WATER));
+		UASSERT(s.getNodeNoExNoEmerge(v3s16(0,1,0)).getContent() == CONTENT_WATER);
+		UASSERT(s.getNodeNoExNoEmerge(v3s16(0,2,0)).getContent() == CONTENT_STONE);
+
+		content_t keep[1] = {CONTENT_WATER};
+		s.replaceColumn(v3s16(0,0,0), 10, MapNode(CONTENT_TORCH), keep, 1);
+		UASSERT(s.getNodeNoExNoEmerge(v3s16(0,0,0)).getContent() == CONTENT_WATER);
+		UASSERT(s.getNodeNoExNoEmerge(v3s16(0,3,0)).getContent() == CONTENT_TORCH);
+	}
+};
+
+struct TestSchematic: public TestBase
+{
+	void Run(INodeDefManager *ndef)
+	{
+		Schematic schem;
+		schem.resize(v3s16(2,1,3));
+		schem.setNode(v3s16(0,0,0), "default:stone");
+		schem.setNode(v3s16(1,0,0), "default:dirt_with_grass", 255, 7);
+		schem.setNode(v3s16(0,0,2), "ignore");
+		schem.setNode(v3s16(1,0,2), "default:stone", 0);
+
+		// Serialization keeps everything
+		{
+			std::ostringstream os(std::ios_base::binary);
+			schem.serialize(os);
+			std::istringstream is(os.str(), std::ios_base::binary);
+			Schematic schem2;
+			schem2.deSerialize(is);
+			UASSERT(schem2.getSize() == v3s16(2,1,3));
+			UASSERT(schem2.getPaletteSize() == 4);
+			UASSERT(schem2.getNodeName(v3s16(1,0,0)) == "default:dirt_with_grass");
+			UASSERT(schem2.getNodeName(v3s16(0,0,1)) == "air");
+			UASSERT(schem2.getNodeName(v3s16(0,0,2)) == "ignore");
+			UASSERT(schem2.getParam2(v3s16(1,0,0)) == 7);
+			UASSERT(schem2.getProbability(v3s16(1,0,2)) == 0);
+			UASSERT(schem2.getProbability(v3s16(0,0,0)) == 255);
+
+			std::istringstream is2(os.str().substr(0, 10), std::ios_base::binary);
+			bool thrown = false;
+			try {
+				schem2.deSerialize(is2);
+			} catch(SerializationError &e) {
+				thrown = true;
+			}
+			UASSERT(thrown);
+
+			// Too large schematics are refused before their data is read
+			std::ostringstream os3(std::ios_base::binary);
+			writeU32(os3, SCHEMATIC_SIGNATURE);
+			writeU16(os3, SCHEMATIC_VERSION);
+			writeV3S16(os3, v3s16(300,300,300));
+			writeU16(os3, 1);
+			os3<<serializeString("air");
+			std::istringstream is3(os3.str(), std::ios_base::binary);
+			std::string error;
+			try {
+				schem2.deSerialize(is3);
+			} catch(SerializationError &e) {
+				error = e.what();
+			}
+			UASSERT(error.find("too large") != std::string::npos);
+		}
+
+		schem.resolveNodeNames(ndef);
+
+		VoxelManipulator v;
+		VoxelArea a(v3s16(0,0,0), v3s16(4,4,4));
+		v.addArea(a);
+		v.setNodes(a, MapNode(CONTENT_AIR));
+		v.setNode(v3s16(0,0,2), MapNode(CONTENT_TORCH));
+		PseudoRandom pr(42);
+
+		schem.place(&v, v3s16(0,0,0), 0, false, pr);
+		UASSERT(v.getNodeNoExNoEmerge(v3s16(0,0,0)).getContent() == CONTENT_STONE);
+		UASSERT(v.getNodeNoExNoEmerge(v3s16(1,0,0)).getContent() == CONTENT_GRASS);
+		UASSERT(v.getNodeNoExNoEmerge(v3s16(1,0,0)).param2 == 7);
+		// Ignore keeps the node and probability 0 never places
+		UASSERT(v.getNodeNoExNoEmerge(v3s16(0,0,2)).getContent() == CONTENT_TORCH);
+		UASSERT(v.getNodeNoExNoEmerge(v3s16(1,0,2)).getContent() == CONTENT_AIR);
+
+		// A quarter turn puts X to -Z and Z to X
+		UASSERT(schem.getRotatedSize(1) == v3s16(3,1,2));
+		schem.place(&v, v3s16(0,1,0), 1, false, pr);
+		UASSERT(v.getNodeNoExNoEmerge(v3s16(0,1,1)).getContent() == CONTENT_STONE);
+		UASSERT(v.getNodeNoExNoEmerge(v3s16(0,1,0)).getContent() == CONTENT_GRASS);
+
+		// Only air is replaced unless forced
+		v.setNode(v3s16(2,2,2), MapNode(CONTENT_TORCH));
+		schem.place(&v, v3s16(2,2,2), 0, false, pr);
+		UASSERT(v.getNodeNoExNoEmerge(v3s16(2,2,2)).getContent() == CONTENT_TORCH);
+		schem.place(&v, v3s16(2,2,2), 0, true, pr);
+		UASSERT(v.getNodeNoExNoEmerge(v3s16(2,2,2)).getContent() == CONTENT_STONE);
+
+		// What is outside of the area is left out
+		schem.place(&v, v3s16(4,3,2), 2, false, pr);
+		UASSERT(v.getNodeNoExNoEmerge(v3s16(4,3,4)).getContent() == CONTENT_GRASS);
+		UASSERT(v.getNodeNoExNoEmerge(v3s16(4,3,2)).getContent() == CONTENT_AIR);
 	}
 };
 
@@ -714,6 +1289,784 @@ struct TestVoxelAlgorithms: public TestBase
 	}
 };
 
+/*
+	Lighting of Map, compared to the recursive code that Map had before
+	MapLightEngine. The old code is kept here as a reference.
+*/
+
+class TestGameDef: public IGameDef
+{
+public:
+	TestGameDef(IItemDefManager *idef, INodeDefManager *ndef):
+		m_idef(idef),
+		m_ndef(ndef)
+	{}
+
+	IItemDefManager* getItemDefManager(){ return m_idef; }
+	INodeDefManager* getNodeDefManager(){ return m_ndef; }
+	ICraftDefManager* getCraftDefManager(){ return NULL; }
+	ITextureSource* getTextureSource(){ return NULL; }
+	IShaderSource* getShaderSource(){ return NULL; }
+	u16 allocateUnknownNodeId(const std::string &name){ return CONTENT_IGNORE; }
+	ISoundManager* getSoundManager(){ return NULL; }
+	MtEventManager* getEventManager(){ return NULL; }
+
+private:
+	IItemDefManager *m_idef;
+	INodeDefManager *m_ndef;
+};
+
+struct ReferenceLighting
+{
+	Map *map;
+	INodeDefManager *ndef;
+
+	ReferenceLighting(Map *map_, INodeDefManager *ndef_):
+		map(map_),
+		ndef(ndef_)
+	{}
+
+	bool getNode(v3s16 p, MapNode &n)
+	{
+		try{
+			n = map->getNode(p);
+		}
+		catch(InvalidPositionException &e)
+		{
+			return false;
+		}
+		return true;
+	}
+
+	void unspreadLight(enum LightBank bank, std::map<v3s16, u8> from_nodes,
+			std::set<v3s16> &light_sources)
+	{
+		while(!from_nodes.empty())
+		{
+			std::map<v3s16, u8> unlighted_nodes;
+			for(std::map<v3s16, u8>::iterator j = from_nodes.begin();
+					j != from_nodes.end(); ++j)
+			{
+				MapNode n;
+				if(!getNode(j->first, n))
+					continue;
+				for(u16 i = 0; i < 6; i++)
+				{
+					v3s16 p2 = j->first + g_6dirs[i];
+					MapNode n2;
+					if(!getNode(p2, n2))
+						continue;
+					u8 light2 = n2.getLight(bank, ndef);
+					if(light2 < j->second)
+					{
+						if(ndef->get(n2).light_propagates && light2 != 0)
+						{
+							n2.setLight(bank, 0, ndef);
+							map->setNode(p2, n2);
+							unlighted_nodes[p2] = light2;
+						}
+					}
+					else
+					{
+						light_sources.insert(p2);
+					}
+				}
+			}
+			from_nodes.swap(unlighted_nodes);
+		}
+	}
+
+	void unLightNeighbors(enum LightBank bank, v3s16 p, u8 lightwas,
+			std::set<v3s16> &light_sources)
+	{
+		std::map<v3s16, u8> from_nodes;
+		from_nodes[p] = lightwas;
+		unspreadLight(bank, from_nodes, light_sources);
+	}
+
+	void spreadLight(enum LightBank bank, std::set<v3s16> from_nodes)
+	{
+		while(!from_nodes.empty())
+		{
+			std::set<v3s16> lighted_nodes;
+			for(std::set<v3s16>::iterator j = from_nodes.begin();
+					j != from_nodes.end(); ++j)
+			{
+				MapNode n;
+				if(!getNode(*j, n))
+					continue;
+				u8 oldlight = n.getLight(bank, ndef);
+				u8 newlight = diminish_light(oldlight);
+				for(u16 i = 0; i < 6; i++)
+				{
+					v3s16 p2 = *j + g_6dirs[i];
+					MapNode n2;
+					if(!getNode(p2, n2))
+						continue;
+					if(n2.getLight(bank, ndef) > undiminish_light(oldlight))
+						lighted_nodes.insert(p2);
+					if(n2.getLight(bank, ndef) < newlight
+							&& ndef->get(n2).light_propagates)
+					{
+						n2.setLight(bank, newlight, ndef);
+						map->setNode(p2, n2);
+						lighted_nodes.insert(p2);
+					}
+				}
+			}
+			from_nodes.swap(lighted_nodes);
+		}
+	}
+
+	void lightNeighbors(enum LightBank bank, v3s16 p)
+	{
+		std::set<v3s16> from_nodes;
+		from_nodes.insert(p);
+		spreadLight(bank, from_nodes);
+	}
+
+	void updateLighting(enum LightBank bank,
+			std::map<v3s16, MapBlock*> &blocks)
+	{
+		std::set<v3s16> light_sources;
+		std::map<v3s16, u8> unlight_from;
+		for(std::map<v3s16, MapBlock*>::iterator i = blocks.begin();
+				i != blocks.end(); ++i)
+		{
+			MapBlock *block = i->second;
+			for(;;)
+			{
+				v3s16 posnodes = block->getPosRelative();
+				for(s16 z=0; z<MAP_BLOCKSIZE; z++)
+				for(s16 y=0; y<MAP_BLOCKSIZE; y++)
+				for(s16 x=0; x<MAP_BLOCKSIZE; x++)
+				{
+					v3s16 p(x,y,z);
+					MapNode n = block->getNode(p);
+					u8 oldlight = n.getLight(bank, ndef);
+					n.setLight(bank, 0, ndef);
+					block->setNode(p, n);
+					if(ndef->get(n).light_source != 0)
+						light_sources.insert(p + posnodes);
+					if((x==0 || x == MAP_BLOCKSIZE-1
+					|| y==0 || y == MAP_BLOCKSIZE-1
+					|| z==0 || z == MAP_BLOCKSIZE-1)
+					&& oldlight != 0)
+						unlight_from[p + posnodes] = oldlight;
+				}
+				if(bank == LIGHTBANK_NIGHT
+						|| block->propagateSunlight(light_sources))
+					break;
+				block = map->getBlockNoCreateNoEx(
+						block->getPos() - v3s16(0,1,0));
+			}
+		}
+		unspreadLight(bank, unlight_from, light_sources);
+		spreadLight(bank, light_sources);
+	}
+
+	bool isUnderSunlight(v3s16 p)
+	{
+		MapNode top;
+		return !getNode(p + v3s16(0,1,0), top)
+				|| top.getLight(LIGHTBANK_DAY, ndef) == LIGHT_SUN;
+	}
+
+	void addNode(v3s16 p, MapNode n)
+	{
+		bool node_under_sunlight = isUnderSunlight(p);
+		std::set<v3s16> light_sources;
+		for(s32 i = 0; i < 2; i++)
+		{
+			enum LightBank bank = i == 0 ? LIGHTBANK_DAY : LIGHTBANK_NIGHT;
+			unLightNeighbors(bank, p, map->getNode(p).getLight(bank, ndef),
+					light_sources);
+			n.setLight(bank, 0, ndef);
+		}
+		if(node_under_sunlight && ndef->get(n).sunlight_propagates)
+			n.setLight(LIGHTBANK_DAY, LIGHT_SUN, ndef);
+		map->setNode(p, n);
+		if(node_under_sunlight && !ndef->get(n).sunlight_propagates)
+		{
+			for(s16 y = p.Y - 1;; y--)
+			{
+				v3s16 p2(p.X, y, p.Z);
+				MapNode n2;
+				if(!getNode(p2, n2)
+						|| n2.getLight(LIGHTBANK_DAY, ndef) != LIGHT_SUN)
+					break;
+				unLightNeighbors(LIGHTBANK_DAY, p2, LIGHT_SUN, light_sources);
+				n2.setLight(LIGHTBANK_DAY, 0, ndef);
+				map->setNode(p2, n2);
+			}
+		}
+		spreadLight(LIGHTBANK_DAY, light_sources);
+		spreadLight(LIGHTBANK_NIGHT, light_sources);
+	}
+
+	void removeNode(v3s16 p)
+	{
+		bool node_under_sunlight = isUnderSunlight(p);
+		std::set<v3s16> light_sources;
+		for(s32 i = 0; i < 2; i++)
+		{
+			enum LightBank bank = i == 0 ? LIGHTBANK_DAY : LIGHTBANK_NIGHT;
+			unLightNeighbors(bank, p, map->getNode(p).getLight(bank, ndef),
+					light_sources);
+		}
+		MapNode n(CONTENT_AIR);
+		map->setNode(p, n);
+		spreadLight(LIGHTBANK_DAY, light_sources);
+		spreadLight(LIGHTBANK_NIGHT, light_sources);
+		if(node_under_sunlight)
+		{
+			s16 y = p.Y;
+			for(;; y--)
+			{
+				v3s16 p2(p.X, y, p.Z);
+				MapNode n2;
+				if(!getNode(p2, n2) || !ndef->get(n2).sunlight_propagates)
+					break;
+				n2.setLight(LIGHTBANK_DAY, LIGHT_SUN, ndef);
+				map->setNode(p2, n2);
+			}
+			for(s16 y2 = p.Y; y2 > y; y2--)
+				lightNeighbors(LIGHTBANK_DAY, v3s16(p.X, y2, p.Z));
+		}
+		else
+		{
+			n = map->getNode(p);
+			n.setLight(LIGHTBANK_DAY, 0, ndef);
+			map->setNode(p, n);
+		}
+		for(s32 i = 0; i < 2; i++)
+		{
+			enum LightBank bank = i == 0 ? LIGHTBANK_DAY : LIGHTBANK_NIGHT;
+			lightNeighbors(bank, map->getBrightestNeighbour(bank, p));
+		}
+	}
+};
+
+struct TestMapLighting: public TestBase
+{
+	// The test maps are 3x3x3 blocks around the origin
+	static void makeMap(Map &map, IGameDef *gamedef,
+			std::map<v3s16, MapBlock*> &blocks)
+	{
+		for(s16 z = -1; z <= 1; z++)
+		for(s16 x = -1; x <= 1; x++)
+		{
+			v2s16 p2d(x, z);
+			MapSector *sector = new ServerMapSector(&map, p2d, gamedef);
+			(*map.getSectorsPtr())[p2d] = sector;
+			for(s16 y = -1; y <= 1; y++)
+			{
+				MapBlock *block = sector->createBlankBlock(y);
+				blocks[block->getPos()] = block;
+			}
+		}
+
+		v3s16 p;
+		for(p.Z = -MAP_BLOCKSIZE; p.Z < MAP_BLOCKSIZE * 2; p.Z++)
+		for(p.Y = -MAP_BLOCKSIZE; p.Y < MAP_BLOCKSIZE * 2; p.Y++)
+		for(p.X = -MAP_BLOCKSIZE; p.X < MAP_BLOCKSIZE * 2; p.X++)
+		{
+			// Uneven ground at y=6...9 with a torch-lit cave under it
+			s16 ground = 6 + ((p.X * 7 + p.Z * 13) & 3);
+			bool cave = p.X >= 0 && p.X <= 12 && p.Z >= 0 && p.Z <= 12
+					&& p.Y >= -10 && p.Y <= -4;
+			MapNode n(CONTENT_STONE);
+			if(p.Y >= ground || cave)
+				n = MapNode(CONTENT_AIR);
+			if(p == v3s16(10,-10,10))
+				n = MapNode(CONTENT_TORCH);
+			map.setNode(p, n);
+		}
+	}
+
+	bool sameLight(Map &map1, Map &map2)
+	{
+		v3s16 p;
+		for(p.Z = -MAP_BLOCKSIZE; p.Z < MAP_BLOCKSIZE * 2; p.Z++)
+		for(p.Y = -MAP_BLOCKSIZE; p.Y < MAP_BLOCKSIZE * 2; p.Y++)
+		for(p.X = -MAP_BLOCKSIZE; p.X < MAP_BLOCKSIZE * 2; p.X++)
+		{
+			MapNode n1 = map1.getNode(p);
+			MapNode n2 = map2.getNode(p);
+			if(n1.getContent() != n2.getContent() || n1.param1 != n2.param1)
+			{
+				infostream<<"TestMapLighting: light differs at ("
+						<<p.X<<","<<p.Y<<","<<p.Z<<")"
+						<<": "<<(int)n1.param1<<" != "<<(int)n2.param1
+						<<std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/*
+		Digs the given nodes if they are there and places n if not, then
+		does the opposite, for a number of rounds. The light of both maps
+		is compared after every change of the first round. Adds up the
+		time taken by the map and by the reference.
+	*/
+	void digAndPlace(Map &map, ReferenceLighting &reference,
+			const std::vector<v3s16> &nodes, MapNode n, u32 rounds,
+			const char *what)
+	{
+		u32 time_map = 0;
+		u32 time_reference = 0;
+		bool same = true;
+		for(u32 round = 0; round < rounds; round++)
+		for(u32 j = 0; j < nodes.size() * 2; j++)
+		{
+			v3s16 p = nodes[j % nodes.size()];
+			bool dig = map.getNode(p).getContent() != CONTENT_AIR;
+			std::map<v3s16, MapBlock*> modified_blocks;
+
+			u32 t0 = porting::getTimeUs();
+			if(dig)
+				map.removeNodeAndUpdate(p, modified_blocks);
+			else
+				map.addNodeAndUpdate(p, n, modified_blocks);
+			u32 t1 = porting::getTimeUs();
+			if(dig)
+				reference.removeNode(p);
+			else
+				reference.addNode(p, n);
+			u32 t2 = porting::getTimeUs();
+
+			time_map += t1 - t0;
+			time_reference += t2 - t1;
+			if(round == 0 && same)
+				same = sameLight(map, *reference.map);
+		}
+		UASSERT(same);
+		infostream<<"TestMapLighting: dig/place "<<what<<": "
+				<<time_map<<"us, reference "<<time_reference<<"us"
+				<<std::endl;
+	}
+
+	void Run(IItemDefManager *idef, INodeDefManager *ndef)
+	{
+		TestGameDef gamedef(idef, ndef);
+		Map map(infostream, &gamedef);
+		Map reference_map(infostream, &gamedef);
+		ReferenceLighting reference(&reference_map, ndef);
+
+		std::map<v3s16, MapBlock*> blocks;
+		std::map<v3s16, MapBlock*> reference_blocks;
+		makeMap(map, &gamedef, blocks);
+		makeMap(reference_map, &gamedef, reference_blocks);
+
+		// Lighting of whole blocks
+		std::map<v3s16, MapBlock*> modified_blocks;
+		map.updateLighting(blocks, modified_blocks);
+		reference.updateLighting(LIGHTBANK_DAY, reference_blocks);
+		reference.updateLighting(LIGHTBANK_NIGHT, reference_blocks);
+		UASSERT(sameLight(map, reference_map));
+		UASSERT(map.getNode(v3s16(0,20,0)).getLight(LIGHTBANK_DAY, ndef)
+				== LIGHT_SUN);
+		UASSERT(map.getNode(v3s16(2,-8,2)).getLight(LIGHTBANK_NIGHT, ndef)
+				!= 0);
+
+		// A shaft from the surface into the cave, and a torch in it
+		std::vector<v3s16> shaft;
+		for(s16 y = 9; y >= -3; y--)
+			shaft.push_back(v3s16(2,y,2));
+		digAndPlace(map, reference, shaft, MapNode(CONTENT_STONE), 5,
+				"in caves");
+		std::vector<v3s16> torch;
+		torch.push_back(v3s16(6,-10,6));
+		digAndPlace(map, reference, torch, MapNode(CONTENT_TORCH), 5,
+				"of a torch in caves");
+
+		// A roof over open terrain
+		std::vector<v3s16> roof;
+		for(s16 z = -10; z <= -4; z++)
+		for(s16 x = -10; x <= -4; x++)
+			roof.push_back(v3s16(x,14,z));
+		digAndPlace(map, reference, roof, MapNode(CONTENT_STONE), 2,
+				"in open terrain");
+	}
+};
+
+struct TestMapLiquids: public TestBase
+{
+	bool sameNodes(Map &map1, Map &map2)
+	{
+		v3s16 p;
+		for(p.Z = -MAP_BLOCKSIZE; p.Z < MAP_BLOCKSIZE * 2; p.Z++)
+		for(p.Y = -MAP_BLOCKSIZE; p.Y < MAP_BLOCKSIZE * 2; p.Y++)
+		for(p.X = -MAP_BLOCKSIZE; p.X < MAP_BLOCKSIZE * 2; p.X++)
+		{
+			MapNode n1 = map1.getNode(p);
+			MapNode n2 = map2.getNode(p);
+			if(n1.getContent() != n2.getContent() || n1.param2 != n2.param2)
+			{
+				infostream<<"TestMapLiquids: node differs at ("
+						<<p.X<<","<<p.Y<<","<<p.Z<<")"<<std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// The blocks of a LiquidQueue take turns in pop_front()
+	void testQueueOrder()
+	{
+		LiquidQueue queue;
+		queue.push_back(v3s16(0,0,0));
+		queue.push_back(v3s16(1,0,0));
+		queue.push_back(v3s16(2,0,0));
+		queue.push_back(v3s16(16,0,0));
+		queue.push_back(v3s16(-16,0,0));
+		UASSERT(queue.pop_front() == v3s16(-16,0,0));
+		UASSERT(queue.pop_front() == v3s16(0,0,0));
+		UASSERT(queue.pop_front() == v3s16(16,0,0));
+		UASSERT(queue.pop_front() == v3s16(1,0,0));
+		queue.push_back(v3s16(32,0,0));
+		UASSERT(queue.pop_front() == v3s16(32,0,0));
+		UASSERT(queue.pop_front() == v3s16(2,0,0));
+		UASSERT(queue.size() == 0);
+	}
+
+	void Run(IItemDefManager *idef, INodeDefManager *ndef)
+	{
+		testQueueOrder();
+
+		TestGameDef gamedef(idef, ndef);
+		Map map(infostream, &gamedef);
+		Map threaded_map(infostream, &gamedef);
+		std::map<v3s16, MapBlock*> blocks;
+		TestMapLighting::makeMap(map, &gamedef, blocks);
+		TestMapLighting::makeMap(threaded_map, &gamedef, blocks);
+
+		/*
+			Water sources in the air over the blocks at the corner of
+			the ground, spilling down into the cave through a shaft
+		*/
+		LiquidQueue queue;
+		LiquidQueue threaded_queue;
+		for(s16 z = -12; z <= 28; z += 8)
+		for(s16 x = -12; x <= 28; x += 8)
+		{
+			v3s16 p(x, 14, z);
+			MapNode n(CONTENT_WATERSOURCE);
+			map.setNode(p, n);
+			threaded_map.setNode(p, n);
+			queue.push_back(p);
+			threaded_queue.push_back(p);
+		}
+		for(s16 y = 9; y >= -3; y--)
+		{
+			MapNode n(CONTENT_AIR);
+			map.setNode(v3s16(4,y,4), n);
+			threaded_map.setNode(v3s16(4,y,4), n);
+		}
+
+		// Both maps have to go through the same steps
+		MapLiquidEngine engine(&map, &gamedef);
+		MapLiquidEngine threaded_engine(&threaded_map, &gamedef);
+		// The flood is far too small to be worth threads otherwise
+		threaded_engine.setNodesPerThread(1);
+		std::map<v3s16, MapBlock*> modified_blocks;
+		std::map<v3s16, MapBlock*> lighting_modified_blocks;
+		u32 steps = 0;
+		u32 nodes = 0;
+		u32 threaded_steps = 0;
+		u32 time_serial = 0;
+		u32 time_threaded = 0;
+		while(queue.size() != 0 && steps < 1000)
+		{
+			u32 t0 = porting::getTimeUs();
+			nodes += engine.transform(queue, 1, 0,
+					modified_blocks, lighting_modified_blocks);
+			u32 t1 = porting::getTimeUs();
+			threaded_engine.transform(threaded_queue, 4, 0,
+					modified_blocks, lighting_modified_blocks);
+			u32 t2 = porting::getTimeUs();
+			time_serial += t1 - t0;
+			time_threaded += t2 - t1;
+			UASSERT(engine.getLastThreadCount() == 1);
+			if(threaded_engine.getLastThreadCount() > 1)
+				threaded_steps++;
+			UASSERT(queue.size() == threaded_queue.size());
+			steps++;
+		}
+		UASSERT(queue.size() == 0);
+		UASSERT(threaded_steps > 0);
+		UASSERT(sameNodes(map, threaded_map));
+		UASSERT(lighting_modified_blocks.empty());
+		infostream<<"TestMapLiquids: "<<nodes<<" nodes in "<<steps
+				<<" steps ("<<threaded_steps<<" with threads): "
+				<<time_serial<<"us, with threads "<<time_threaded<<"us"
+				<<std::endl;
+
+		// The water has flowed down onto the ground and into the cave
+		UASSERT(map.getNode(v3s16(4,13,4)).getContent() == CONTENT_WATER);
+		UASSERT(map.getNode(v3s16(-4,6,4)).getContent() == CONTENT_WATER);
+		UASSERT(map.getNode(v3s16(4,-10,4)).getContent() == CONTENT_WATER);
+		UASSERT(map.getNode(v3s16(4,-11,4)).getContent() == CONTENT_STONE);
+	}
+};
+
+struct TestMapgenV6: public TestBase
+{
+	// Defines the nodes the mapgen and its dungeons and trees look up
+	void defineNodes(IWritableNodeDefManager *ndef)
+	{
+		const char *names[] = {
+			"mapgen_stone", "mapgen_dirt", "mapgen_dirt_with_grass",
+			"mapgen_sand", "mapgen_water_source", "mapgen_lava_source",
+			"mapgen_gravel", "mapgen_cobble", "mapgen_desert_sand",
+			"mapgen_desert_stone", "mapgen_mossycobble", "mapgen_tree",
+			"mapgen_leaves", "mapgen_apple", "mapgen_junglegrass",
+			"mapgen_jungletree", "mapgen_jungleleaves", "stairs:stair_cobble",
+		};
+		for(u32 i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		{
+			ContentFeatures f;
+			f.name = names[i];
+			std::string name = names[i];
+			if(name == "mapgen_water_source" || name == "mapgen_lava_source")
+			{
+				f.param_type = CPT_LIGHT;
+				f.light_propagates = true;
+				f.walkable = false;
+				f.liquid_type = LIQUID_SOURCE;
+			}
+			else if(name == "mapgen_leaves" || name == "mapgen_apple" ||
+					name == "mapgen_junglegrass" ||
+					name == "mapgen_jungleleaves")
+			{
+				f.param_type = CPT_LIGHT;
+				f.light_propagates = true;
+				f.walkable = name != "mapgen_junglegrass";
+			}
+			ndef->set(10 + i, f);
+		}
+	}
+
+	// Hash of the content and param2 of the area of a generated chunk
+	u32 generate(MapgenV6 *mapgen, INodeDefManager *ndef, u64 seed,
+			v3s16 blockpos_min)
+	{
+		BlockMakeData data;
+		data.seed = seed;
+		data.nodedef = ndef;
+		data.blockpos_min = blockpos_min;
+		data.blockpos_max = blockpos_min + v3s16(4,4,4);
+		data.blockpos_requested = blockpos_min;
+		data.vmanip = new ManualMapVoxelManipulator(NULL);
+		VoxelManipulator *vm = data.vmanip;
+		vm->addArea(VoxelArea((blockpos_min - v3s16(1,1,1)) * MAP_BLOCKSIZE,
+				(data.blockpos_max + v3s16(2,2,2)) * MAP_BLOCKSIZE
+				- v3s16(1,1,1)));
+		for(s32 i = 0; i < vm->m_area.getVolume(); i++)
+			vm->m_data[i] = MapNode(CONTENT_IGNORE);
+
+		mapgen->makeChunk(&data);
+
+		// FNV-1a
+		u32 hash = 2166136261U;
+		for(s32 i = 0; i < vm->m_area.getVolume(); i++)
+		{
+			MapNode &n = vm->m_data[i];
+			hash = (hash ^ (n.getContent() & 0xff)) * 16777619U;
+			hash = (hash ^ (n.getContent() >> 8)) * 16777619U;
+			hash = (hash ^ n.param2) * 16777619U;
+		}
+		return hash;
+	}
+
+	void Run()
+	{
+		IWritableNodeDefManager *ndef = createNodeDefManager();
+		defineNodes(ndef);
+
+		MapgenV6Params params;
+		params.seed = 1234;
+		params.flags |= MG_DUNGEONS;
+		MapgenV6 mapgen(0, &params, NULL);
+
+		/*
+			Made by the per-node ground generation that the row by row one
+			replaced; a change of these means that the worlds of a seed
+			don't look the same anymore
+		*/
+		u32 surface = generate(&mapgen, ndef, params.seed, v3s16(-2,-2,-2));
+		u32 underground = generate(&mapgen, ndef, params.seed, v3s16(3,-7,-2));
+		infostream<<"TestMapgenV6: surface "<<surface<<", underground "
+				<<underground<<std::endl;
+		UASSERT(surface == 63400723U);
+		UASSERT(underground == 2173679892U);
+
+		delete ndef;
+	}
+};
+
+struct TestLuaEntityStaticData: public TestBase
+{
+	void Run()
+	{
+		lua_State *L = lua_open();
+		luaL_openlibs(L);
+		ObjectRef::Register(L);
+
+		// The parts of the minetest table an entity needs, and an entity
+		// that keeps its staticdata like the builtin item entity
+		lua_newtable(L);
+		lua_pushcfunction(L, l_serialize_binary);
+		lua_setfield(L, -2, "serialize_binary");
+		lua_pushcfunction(L, l_deserialize_binary);
+		lua_setfield(L, -2, "deserialize_binary");
+		lua_newtable(L);
+		lua_setfield(L, -2, "registered_entities");
+		lua_newtable(L);
+		lua_setfield(L, -2, "luaentities");
+		lua_newtable(L);
+		lua_setfield(L, -2, "object_refs");
+		lua_setglobal(L, "minetest");
+		UASSERT(luaL_dostring(L,
+				"local def = {\n"
+				"	on_activate = function(self, staticdata)\n"
+				"		self.data = minetest.deserialize_binary(staticdata)\n"
+				"	end,\n"
+				"	get_staticdata = function(self)\n"
+				"		return minetest.serialize_binary(self.data)\n"
+				"	end,\n"
+				"}\n"
+				"def.__index = def\n"
+				"minetest.registered_entities['test:item'] = def\n"
+				"return minetest.serialize_binary({itemstring='default:stone 5'})"
+				) == 0);
+		size_t len = 0;
+		const char *s = lua_tolstring(L, -1, &len);
+		std::string state(s, len);
+		lua_pop(L, 1);
+		// Binary staticdata starts with a zero byte
+		UASSERT(state.size() > 1 && state[0] == 0);
+
+		// Static data of an object that is not active
+		std::ostringstream os(std::ios::binary);
+		writeU8(os, 1);
+		os<<serializeString("test:item");
+		os<<serializeLongString(state);
+		writeS16(os, 1);
+		writeV3F1000(os, v3f(0,0,0));
+		writeF1000(os, 0);
+		ServerActiveObject *obj = LuaEntitySAO::create(NULL, v3f(0,0,0),
+				os.str());
+		UASSERT(obj->getStaticData() == os.str());
+
+		// Activated with the same state, the entity gets all of it
+		lua_getglobal(L, "minetest");
+		lua_getfield(L, -1, "object_refs");
+		lua_pushnumber(L, 1);
+		ObjectRef::create(L, obj);
+		lua_settable(L, -3);
+		lua_pop(L, 2);
+		LuaEntityRefs refs;
+		UASSERT(scriptapi_luaentity_add(L, 1, "test:item", &refs));
+		scriptapi_luaentity_activate(L, &refs, state, 0);
+		UASSERT(scriptapi_luaentity_get_staticdata(L, &refs) == state);
+		scriptapi_luaentity_rm(L, 1, &refs);
+
+		lua_close(L);
+		delete obj;
+	}
+};
+
+struct TestLuaEntityCallbacks: public TestBase
+{
+	// Returns the value of the global counter
+	int counter(lua_State *L)
+	{
+		lua_getglobal(L, "counter");
+		int n = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		return n;
+	}
+
+	void Run()
+	{
+		lua_State *L = lua_open();
+		luaL_openlibs(L);
+		ObjectRef::Register(L);
+
+		lua_newtable(L);
+		lua_newtable(L);
+		lua_setfield(L, -2, "registered_entities");
+		lua_newtable(L);
+		lua_setfield(L, -2, "luaentities");
+		lua_newtable(L);
+		lua_setfield(L, -2, "object_refs");
+		lua_setglobal(L, "minetest");
+		UASSERT(luaL_dostring(L,
+				"counter = 0\n"
+				"local def = {\n"
+				"	on_step = function(self, dtime)\n"
+				"		counter = counter + 1\n"
+				"		self.steps = (self.steps or 0) + 1\n"
+				"	end,\n"
+				"}\n"
+				"def.__index = def\n"
+				"minetest.registered_entities['test:callbacks'] = def\n"
+				) == 0);
+
+		ServerActiveObject *obj = new LuaEntitySAO(NULL, v3f(0,0,0),
+				"test:callbacks", "");
+		lua_getglobal(L, "minetest");
+		lua_getfield(L, -1, "object_refs");
+		lua_pushnumber(L, 1);
+		ObjectRef::create(L, obj);
+		lua_settable(L, -3);
+		lua_pop(L, 2);
+		LuaEntityRefs refs;
+		UASSERT(scriptapi_luaentity_add(L, 1, "test:callbacks", &refs));
+		scriptapi_luaentity_activate(L, &refs, "", 0);
+		UASSERT(!refs.lookup_callbacks);
+		UASSERT(refs.callbacks[LUAENTITY_ON_STEP] != -1);
+		UASSERT(refs.callbacks[LUAENTITY_ON_PUNCH] == -1);
+
+		// The cached callback is called
+		scriptapi_luaentity_step(L, &refs, 0.1);
+		scriptapi_luaentity_step(L, &refs, 0.1);
+		UASSERT(counter(L) == 2);
+		// Callbacks stay readable from the definition
+		UASSERT(luaL_dostring(L, "assert(type(minetest.registered_entities"
+				"['test:callbacks'].on_step) == 'function')") == 0);
+
+		// A callback replaced on the definition is used
+		UASSERT(luaL_dostring(L,
+				"minetest.registered_entities['test:callbacks'].on_step ="
+				" function(self, dtime) counter = counter + 10 end") == 0);
+		scriptapi_luaentity_step(L, &refs, 0.1);
+		UASSERT(counter(L) == 12);
+		UASSERT(!refs.lookup_callbacks);
+
+		// So is one set on the entity itself, and then one replacing it
+		UASSERT(luaL_dostring(L,
+				"local self = minetest.luaentities[1]\n"
+				"self.on_step = function(self, dtime)"
+				" counter = counter + 100 end") == 0);
+		scriptapi_luaentity_step(L, &refs, 0.1);
+		UASSERT(counter(L) == 112);
+		UASSERT(refs.lookup_callbacks);
+		UASSERT(luaL_dostring(L,
+				"local self = minetest.luaentities[1]\n"
+				"self.on_step = nil") == 0);
+		scriptapi_luaentity_step(L, &refs, 0.1);
+		UASSERT(counter(L) == 122);
+
+		scriptapi_luaentity_rm(L, 1, &refs);
+		lua_close(L);
+		delete obj;
+	}
+};
+
 struct TestInventory: public TestBase
 {
 	void Run(IItemDefManager *idef)
@@ -1760,8 +3113,21 @@ void run_tests()
 	TEST(TestSerialization);
 	TEST(TestNodedefSerialization);
 	TESTPARAMS(TestMapNode, ndef);
+	TESTPARAMS(TestPackedNodeData, ndef);
+	TEST(TestMapBlockIndex);
+	TEST(TestNodeTimerList);
+	TEST(TestHeightmapCache);
+	TEST(TestNoiseMapCache);
+	TEST(TestChunkScheduler);
+	TEST(TestWorkerPool);
 	TESTPARAMS(TestVoxelManipulator, ndef);
+	TESTPARAMS(TestSchematic, ndef);
 	TESTPARAMS(TestVoxelAlgorithms, ndef);
+	TESTPARAMS(TestMapLighting, idef, ndef);
+	TESTPARAMS(TestMapLiquids, idef, ndef);
+	TEST(TestMapgenV6);
+	TEST(TestLuaEntityStaticData);
+	TEST(TestLuaEntityCallbacks);
 	TESTPARAMS(TestInventory, idef);
 	//TEST(TestMapBlock);
 	//TEST(TestMapSector);
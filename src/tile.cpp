@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "main.h" // for g_settings
 #include "filesys.h"
 #include "settings.h"
+#include "porting.h"
 #include "mesh.h"
 #include <ICameraSceneNode.h>
 #include "log.h"
@@ -201,10 +202,15 @@ struct SourceAtlasPointer
 class SourceImageCache
 {
 public:
+	SourceImageCache()
+	{
+		m_mutex.Init();
+	}
 	void insert(const std::string &name, video::IImage *img,
 			bool prefer_local, video::IVideoDriver *driver)
 	{
 		assert(img);
+		JMutexAutoLock lock(m_mutex);
 		// Remove old image
 		std::map<std::string, video::IImage*>::iterator n;
 		n = m_images.find(name);
@@ -229,6 +235,7 @@ class SourceImageCache
 	}
 	video::IImage* get(const std::string &name)
 	{
+		JMutexAutoLock lock(m_mutex);
 		std::map<std::string, video::IImage*>::iterator n;
 		n = m_images.find(name);
 		if(n != m_images.end())
@@ -239,10 +246,13 @@ class SourceImageCache
 	video::IImage* getOrLoad(const std::string &name, IrrlichtDevice *device)
 	{
 		std::map<std::string, video::IImage*>::iterator n;
-		n = m_images.find(name);
-		if(n != m_images.end()){
-			n->second->grab(); // Grab for caller
-			return n->second;
+		{
+			JMutexAutoLock lock(m_mutex);
+			n = m_images.find(name);
+			if(n != m_images.end()){
+				n->second->grab(); // Grab for caller
+				return n->second;
+			}
 		}
 		video::IVideoDriver* driver = device->getVideoDriver();
 		std::string path = getTexturePath(name.c_str());
@@ -253,17 +263,49 @@ class SourceImageCache
 		}
 		infostream<<"SourceImageCache::getOrLoad(): Loading path \""<<path
 				<<"\""<<std::endl;
-		video::IImage *img = driver->createImageFromFile(path.c_str());
+		/*
+			Only opening the file touches shared state of irrlicht; the
+			image is decoded without holding the lock so that the threads
+			of generate_images() can decode several images at once.
+		*/
+		io::IReadFile *file = NULL;
+		{
+			JMutexAutoLock lock(m_mutex);
+			file = device->getFileSystem()->createAndOpenFile(path.c_str());
+		}
+		video::IImage *img = NULL;
+		if(file){
+			img = driver->createImageFromFile(file);
+			file->drop();
+		}
 		// Even if could not be loaded, put as NULL
 		//m_images[name] = img;
-		if(img){
-			m_images[name] = img;
-			img->grab(); // Grab for caller
+		if(img == NULL)
+			return NULL;
+		JMutexAutoLock lock(m_mutex);
+		// Another thread may have loaded it in the meantime
+		n = m_images.find(name);
+		if(n != m_images.end()){
+			img->drop();
+			n->second->grab(); // Grab for caller
+			return n->second;
 		}
+		m_images[name] = img;
+		img->grab(); // Grab for caller
 		return img;
 	}
+	// Drops an image returned by getOrLoad().
+	// Reference counts of irrlicht are not atomic, so this has to be
+	// used instead of IImage::drop() when other threads may be using
+	// the same image.
+	void release(video::IImage *img)
+	{
+		JMutexAutoLock lock(m_mutex);
+		img->drop();
+	}
 private:
 	std::map<std::string, video::IImage*> m_images;
+	JMutex m_mutex;
 };
 
 /*
@@ -409,9 +451,14 @@ class TextureSource : public IWritableTextureSource
 	IrrlichtDevice *m_device;
 	
 	// Cache of source images
-	// This should be only accessed from the main thread
+	// This is accessed from the main thread and from the threads of
+	// m_image_pool
 	SourceImageCache m_sourcecache;
 
+	// Threads that rebuildImagesAndTextures() and buildMainAtlas()
+	// generate images with
+	WorkerPool m_image_pool;
+
 	// Thread-safe cache of what source images are known (true = known)
 	MutexedMap<std::string, bool> m_source_image_existence;
 
@@ -431,6 +478,28 @@ class TextureSource : public IWritableTextureSource
 	RequestQueue<std::string, u32, u8, u8> m_get_texture_queue;
 };
 
+/*
+	TileVariants
+*/
+
+AtlasPointer TileVariants::getCrack(ITextureSource *tsrc, int level,
+		bool overlay)
+{
+	if(level < 0)
+		return single;
+	std::vector<AtlasPointer> &cracks = m_cracks[overlay ? 1 : 0];
+	if((int)cracks.size() <= level)
+		cracks.resize(level + 1, AtlasPointer(0));
+	if(cracks[level].id == 0)
+	{
+		std::ostringstream os(std::ios::binary);
+		os<<tsrc->getTextureName(single.id);
+		os<<(overlay ? "^[cracko" : "^[crack")<<level;
+		cracks[level] = tsrc->getTexture(os.str());
+	}
+	return cracks[level];
+}
+
 IWritableTextureSource* createTextureSource(IrrlichtDevice *device)
 {
 	return new TextureSource(device);
@@ -439,7 +508,8 @@ IWritableTextureSource* createTextureSource(IrrlichtDevice *device)
 TextureSource::TextureSource(IrrlichtDevice *device):
 		m_device(device),
 		m_main_atlas_image(NULL),
-		m_main_atlas_texture(NULL)
+		m_main_atlas_texture(NULL),
+		m_image_pool("ImageGeneratorThread")
 {
 	assert(m_device);
 	
@@ -544,11 +614,37 @@ bool generate_image(std::string part_of_name, video::IImage *& baseimg,
 	Generates an image from a full string like
 	"stone.png^mineral_coal.png^[crack0".
 
-	This is used by buildMainAtlas().
+	This is used by [inventorycube.
 */
 video::IImage* generate_image_from_scratch(std::string name,
 		IrrlichtDevice *device, SourceImageCache *sourcecache);
 
+/*
+	Generates the images of many full names at once.
+
+	Each distinct prefix of the names (eg. "stone.png^mineral_coal.png"
+	of "stone.png^mineral_coal.png^[crack0") is generated only once,
+	and the prefixes of the same length in parts are generated in
+	parallel by num_threads threads of pool.
+
+	images is filled with one image per name; these are owned by the
+	caller. A failed image is NULL.
+
+	This is used by rebuildImagesAndTextures() and buildMainAtlas().
+*/
+void generate_images(const std::vector<std::string> &names,
+		std::vector<video::IImage*> &images,
+		IrrlichtDevice *device, SourceImageCache *sourcecache,
+		WorkerPool *pool, u32 num_threads);
+
+// Number of threads generate_images() is run with
+static u32 get_image_generation_threads()
+{
+	if(g_settings->get("texture_generation_threads").empty())
+		return MYMAX(porting::getNumberOfProcessors(), 1);
+	return MYMAX(g_settings->getU16("texture_generation_threads"), 1);
+}
+
 /*
 	This method generates all the textures
 */
@@ -816,16 +912,26 @@ void TextureSource::rebuildImagesAndTextures()
 		sap->atlas_img->drop();
 		sap->atlas_img = NULL;
 	}*/
+
+	// Generate the images of all textures in one go
+	std::vector<std::string> names;
+	for(u32 i=0; i<m_atlaspointer_cache.size(); i++)
+		names.push_back(m_atlaspointer_cache[i].name);
+	std::vector<video::IImage*> images;
+	generate_images(names, images, m_device, &m_sourcecache,
+			&m_image_pool, get_image_generation_threads());
 	
 	// Recreate textures
 	for(u32 i=0; i<m_atlaspointer_cache.size(); i++){
 		SourceAtlasPointer *sap = &m_atlaspointer_cache[i];
-		video::IImage *img =
-			generate_image_from_scratch(sap->name, m_device, &m_sourcecache);
+		video::IImage *img = images[i];
 		// Create texture from resulting image
 		video::ITexture *t = NULL;
-		if(img)
+		core::dimension2d<u32> dim(0,0);
+		if(img){
 			t = driver->addTexture(sap->name.c_str(), img);
+			dim = img->getDimension();
+		}
 		
 		// Replace texture
 		sap->a.atlas = t;
@@ -834,7 +940,7 @@ void TextureSource::rebuildImagesAndTextures()
 		sap->a.tiled = 0;
 		sap->atlas_img = img;
 		sap->intpos = v2s32(0,0);
-		sap->intsize = img->getDimension();
+		sap->intsize = dim;
 	}
 }
 
@@ -910,15 +1016,16 @@ void TextureSource::buildMainAtlas(class IGameDef *gamedef)
 	pos_in_atlas.X = column_padding;
 	pos_in_atlas.Y = padding;
 
-	for(std::set<std::string>::iterator
-			i = sourcelist.begin();
-			i != sourcelist.end(); ++i)
-	{
-		std::string name = *i;
+	// Generate the images of all of the textures in one go
+	std::vector<std::string> sourcenames(sourcelist.begin(), sourcelist.end());
+	std::vector<video::IImage*> sourceimages;
+	generate_images(sourcenames, sourceimages, m_device, &m_sourcecache,
+			&m_image_pool, get_image_generation_threads());
 
-		// Generate image by name
-		video::IImage *img2 = generate_image_from_scratch(name, m_device,
-				&m_sourcecache);
+	for(u32 k=0; k<sourcenames.size(); k++)
+	{
+		std::string name = sourcenames[k];
+		video::IImage *img2 = sourceimages[k];
 		if(img2 == NULL)
 		{
 			errorstream<<"TextureSource::buildMainAtlas(): "
@@ -1017,8 +1124,6 @@ void TextureSource::buildMainAtlas(class IGameDef *gamedef)
 			atlas_img->setPixel(dst_x,dst_y,c);
 		}
 
-		img2->drop();
-
 		/*
 			Add texture to caches
 		*/
@@ -1057,6 +1162,12 @@ void TextureSource::buildMainAtlas(class IGameDef *gamedef)
 		pos_in_atlas.Y += dim.Height + padding * 2;
 	}
 
+	for(u32 k=0; k<sourceimages.size(); k++)
+	{
+		if(sourceimages[k])
+			sourceimages[k]->drop();
+	}
+
 	/*
 		Make texture
 	*/
@@ -1151,6 +1262,216 @@ video::IImage* generate_image_from_scratch(std::string name,
 	return baseimg;
 }
 
+/*
+	generate_images() builds a tree of the names it is given: every name
+	is a node whose parent is the name without its last part.
+*/
+struct ImageNode
+{
+	// Last part of the name, eg. "[crack0"
+	std::string part;
+	// Node of the rest of the name; -1 = none
+	s32 parent;
+	// Number of parts in the name minus one
+	u32 depth;
+	// Is one of the requested names
+	bool wanted;
+	video::IImage *img;
+
+	ImageNode():
+		parent(-1),
+		depth(0),
+		wanted(false),
+		img(NULL)
+	{}
+};
+
+static u32 add_image_node(const std::string &name,
+		std::vector<ImageNode> &nodes, std::map<std::string, u32> &name_to_node)
+{
+	std::map<std::string, u32>::iterator n = name_to_node.find(name);
+	if(n != name_to_node.end())
+		return n->second;
+
+	ImageNode node;
+	size_t last_separator_position = name.find_last_of('^');
+	if(last_separator_position != std::string::npos)
+	{
+		node.parent = add_image_node(name.substr(0, last_separator_position),
+				nodes, name_to_node);
+		node.depth = nodes[node.parent].depth + 1;
+		node.part = name.substr(last_separator_position + 1);
+	}
+	else
+	{
+		node.part = name;
+	}
+
+	u32 i = nodes.size();
+	nodes.push_back(node);
+	name_to_node[name] = i;
+	return i;
+}
+
+/*
+	Generates the nodes of one depth on the threads of a WorkerPool
+*/
+class ImageNodeGenerator : public WorkerPool::Job
+{
+public:
+	ImageNodeGenerator(std::vector<ImageNode> &nodes,
+			IrrlichtDevice *device, SourceImageCache *sourcecache):
+		m_nodes(nodes),
+		m_device(device),
+		m_sourcecache(sourcecache),
+		m_level(NULL),
+		m_next(0)
+	{
+		m_mutex.Init();
+	}
+
+	void setLevel(const std::vector<u32> *level)
+	{
+		JMutexAutoLock lock(m_mutex);
+		m_level = level;
+		m_next = 0;
+	}
+
+	// Generates nodes of the current level until none are left
+	void work()
+	{
+		for(;;)
+		{
+			u32 i;
+			{
+				JMutexAutoLock lock(m_mutex);
+				if(m_next >= m_level->size())
+					return;
+				i = (*m_level)[m_next++];
+			}
+			generateNode(m_nodes[i]);
+		}
+	}
+
+	// The parent of the node has to be generated already
+	void generateNode(ImageNode &node)
+	{
+		video::IVideoDriver* driver = m_device->getVideoDriver();
+
+		// Copy the image of the parent, which its other children use too
+		video::IImage *baseimg = NULL;
+		if(node.parent != -1 && m_nodes[node.parent].img != NULL)
+		{
+			video::IImage *parentimg = m_nodes[node.parent].img;
+			baseimg = driver->createImage(video::ECF_A8R8G8B8,
+					parentimg->getDimension());
+			parentimg->copyTo(baseimg);
+		}
+
+		if(!generate_image(node.part, baseimg, m_device, m_sourcecache))
+		{
+			errorstream<<"generate_images(): "
+					"failed to generate \""<<node.part<<"\""
+					<<std::endl;
+			if(baseimg)
+				baseimg->drop();
+			baseimg = NULL;
+		}
+		node.img = baseimg;
+	}
+
+private:
+	std::vector<ImageNode> &m_nodes;
+	IrrlichtDevice *m_device;
+	SourceImageCache *m_sourcecache;
+	const std::vector<u32> *m_level;
+	u32 m_next;
+	JMutex m_mutex;
+};
+
+void generate_images(const std::vector<std::string> &names,
+		std::vector<video::IImage*> &images,
+		IrrlichtDevice *device, SourceImageCache *sourcecache,
+		WorkerPool *pool, u32 num_threads)
+{
+	/*
+		Build the tree of names
+	*/
+	std::vector<ImageNode> nodes;
+	std::map<std::string, u32> name_to_node;
+	std::vector<u32> name_nodes;
+	for(u32 i=0; i<names.size(); i++)
+	{
+		u32 n = add_image_node(names[i], nodes, name_to_node);
+		nodes[n].wanted = true;
+		name_nodes.push_back(n);
+	}
+
+	/*
+		Sort the nodes by depth. [inventorycube renders with the video
+		driver, so it can only be generated in the calling thread.
+	*/
+	std::vector<std::vector<u32> > levels;
+	std::vector<std::vector<u32> > main_thread_levels;
+	for(u32 i=0; i<nodes.size(); i++)
+	{
+		u32 depth = nodes[i].depth;
+		if(levels.size() <= depth)
+		{
+			levels.resize(depth + 1);
+			main_thread_levels.resize(depth + 1);
+		}
+		if(nodes[i].part.substr(0,14) == "[inventorycube")
+			main_thread_levels[depth].push_back(i);
+		else
+			levels[depth].push_back(i);
+	}
+
+	/*
+		Generate the nodes level by level; the parents of a level are
+		all in the previous one
+	*/
+	ImageNodeGenerator generator(nodes, device, sourcecache);
+	for(u32 depth=0; depth<levels.size(); depth++)
+	{
+		generator.setLevel(&levels[depth]);
+		pool->run(&generator, MYMIN(num_threads, levels[depth].size()));
+
+		for(u32 i=0; i<main_thread_levels[depth].size(); i++)
+			generator.generateNode(nodes[main_thread_levels[depth][i]]);
+
+		// Drop the prefixes that were only needed by this level
+		if(depth == 0)
+			continue;
+		for(u32 i=0; i<nodes.size(); i++)
+		{
+			ImageNode &node = nodes[i];
+			if(node.depth == depth - 1 && !node.wanted && node.img)
+			{
+				node.img->drop();
+				node.img = NULL;
+			}
+		}
+	}
+
+	/*
+		Hand out the images; a name can be in the list more than once
+	*/
+	images.clear();
+	for(u32 i=0; i<name_nodes.size(); i++)
+	{
+		video::IImage *img = nodes[name_nodes[i]].img;
+		if(img)
+			img->grab();
+		images.push_back(img);
+	}
+	for(u32 i=0; i<nodes.size(); i++)
+	{
+		if(nodes[i].img)
+			nodes[i].img->drop();
+	}
+}
+
 bool generate_image(std::string part_of_name, video::IImage *& baseimg,
 		IrrlichtDevice *device, SourceImageCache *sourcecache)
 {
@@ -1202,7 +1523,7 @@ bool generate_image(std::string part_of_name, video::IImage *& baseimg,
 			core::dimension2d<u32> dim = image->getDimension();
 			baseimg = driver->createImage(video::ECF_A8R8G8B8, dim);
 			image->copyTo(baseimg);
-			image->drop();
+			sourcecache->release(image);
 		}
 		// Else blit on base.
 		else
@@ -1222,7 +1543,7 @@ bool generate_image(std::string part_of_name, video::IImage *& baseimg,
 					NULL);*/
 			blit_with_alpha(image, baseimg, pos_from, pos_to, dim);
 			// Drop image
-			image->drop();
+			sourcecache->release(image);
 		}
 	}
 	else
@@ -1346,7 +1667,7 @@ bool generate_image(std::string part_of_name, video::IImage *& baseimg,
 				if(img_crack_cropped)
 					img_crack_cropped->drop();
 				
-				img_crack->drop();
+				sourcecache->release(img_crack);
 			}
 		}
 		/*
@@ -1384,7 +1705,7 @@ bool generate_image(std::string part_of_name, video::IImage *& baseimg,
 					video::IImage *img2 =
 							driver->createImage(video::ECF_A8R8G8B8, dim);
 					img->copyTo(img2);
-					img->drop();
+					sourcecache->release(img);
 					/*img2->copyToWithAlpha(baseimg, pos_base,
 							core::rect<s32>(v2s32(0,0), dim),
 							video::SColor(255,255,255,255),
@@ -1657,7 +1978,7 @@ bool generate_image(std::string part_of_name, video::IImage *& baseimg,
 				video::IImage *img2 =
 						driver->createImage(video::ECF_A8R8G8B8, dim);
 				img->copyTo(img2);
-				img->drop();
+				sourcecache->release(img);
 				core::position2d<s32> clippos(0, 0);
 				clippos.Y = dim.Height * (100-percent) / 100;
 				core::dimension2d<u32> clipdim = dim;
@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <IrrlichtDevice.h>
 #include "threads.h"
 #include <string>
+#include <vector>
 
 class IGameDef;
 
@@ -180,6 +181,41 @@ enum MaterialType{
 // Whether liquid shader should be used
 #define MATERIAL_FLAG_
 
+/*
+	Textures derived from the texture of a tile, resolved by the main
+	thread when the node definitions get their textures. This way mesh
+	generation and animation never look up textures by name, and the
+	mesh update thread never waits for the main thread.
+
+	Owned by the node definition manager.
+*/
+struct TileVariants
+{
+	// The texture outside of any atlas; cracks and animations use this
+	AtlasPointer single;
+	// Animation frames of single (empty if not animated)
+	std::vector<AtlasPointer> frames;
+	// Variants of the texture rotated by 90 degrees, for the posts of
+	// fencelike nodes (NULL for other nodes)
+	TileVariants *rotated90;
+
+	TileVariants():
+		single(0),
+		rotated90(NULL)
+	{}
+
+	/*
+		Cracked versions of single. The set of crack levels depends on
+		the crack texture, so these are generated on first use and then
+		looked up by level. Only called from the main thread (by
+		MapBlockMesh::animate()).
+	*/
+	AtlasPointer getCrack(ITextureSource *tsrc, int level, bool overlay);
+
+private:
+	std::vector<AtlasPointer> m_cracks[2];
+};
+
 /*
 	This fully defines the looks of a tile.
 	The SMaterial of a tile is constructed according to this.
@@ -195,7 +231,9 @@ struct TileSpec
 			MATERIAL_FLAG_BACKFACE_CULLING
 		),
 		animation_frame_count(1),
-		animation_frame_length_ms(0)
+		animation_frame_length_ms(0),
+		rotation(0),
+		variants(NULL)
 	{
 	}
 
@@ -266,6 +304,8 @@ struct TileSpec
 	u8 animation_frame_count;
 	u16 animation_frame_length_ms;
 	u8 rotation;
+	// NULL for tiles that are not from node definitions
+	TileVariants *variants;
 };
 
 #endif
@@ -0,0 +1,103 @@
+/*
+Minetest
+Copyright (C) 2010-2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "../porting.h" // sleep_ms() for thread.h
+#include "thread.h"
+
+#include "../debug.h"
+#include "../log.h"
+
+class WorkerPool::Worker : public JThread
+{
+public:
+	Worker(WorkerPool *pool):
+		m_pool(pool)
+	{}
+
+	void * Thread()
+	{
+		ThreadStarted();
+		log_register_thread(m_pool->m_name);
+		DSTACK(__FUNCTION_NAME);
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		for(;;)
+		{
+			m_start.wait();
+			if(m_pool->m_stopping)
+				break;
+			m_pool->m_job->work();
+			m_done.signal();
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER(errorstream)
+		return NULL;
+	}
+
+	// Signalled when a pass starts or the pool stops
+	Event m_start;
+	// Signalled when the part of the worker in a pass is done
+	Event m_done;
+
+private:
+	WorkerPool *m_pool;
+};
+
+WorkerPool::WorkerPool(const std::string &name):
+	m_name(name),
+	m_job(NULL),
+	m_stopping(false)
+{
+	m_mutex.Init();
+}
+
+WorkerPool::~WorkerPool()
+{
+	m_stopping = true;
+	for(u32 i = 0; i < m_workers.size(); i++)
+		m_workers[i]->m_start.signal();
+	for(u32 i = 0; i < m_workers.size(); i++)
+	{
+		while(m_workers[i]->IsRunning())
+			sleep_ms(1);
+		delete m_workers[i];
+	}
+}
+
+void WorkerPool::run(Job *job, u32 num_threads)
+{
+	JMutexAutoLock lock(m_mutex);
+
+	u32 num_workers = num_threads > 1 ? num_threads - 1 : 0;
+	while(m_workers.size() < num_workers)
+	{
+		Worker *worker = new Worker(this);
+		worker->Start();
+		m_workers.push_back(worker);
+	}
+
+	// The Events order the accesses to m_job
+	m_job = job;
+	for(u32 i = 0; i < num_workers; i++)
+		m_workers[i]->m_start.signal();
+	job->work();
+	for(u32 i = 0; i < num_workers; i++)
+		m_workers[i]->m_done.wait();
+	m_job = NULL;
+}
@@ -24,6 +24,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <jthread.h>
 #include <jmutex.h>
 #include <jmutexautolock.h>
+#include <string>
+#include <vector>
+#include <list>
+#include "container.h"
 
 template<typename T>
 class MutexedVariable
@@ -60,6 +64,58 @@ class MutexedVariable
 	JMutex m_mutex;
 };
 
+/*
+	A lock that is held by any number of readers or by one writer. A
+	waiting writer keeps new readers out, so writers don't starve.
+*/
+
+class RWLock
+{
+public:
+	RWLock():
+		m_readers(0)
+	{
+		m_turnstile.Init();
+		m_readers_mutex.Init();
+		// Nobody holds the lock
+		m_empty.signal();
+	}
+
+	void readLock()
+	{
+		m_turnstile.Lock();
+		m_turnstile.Unlock();
+		JMutexAutoLock lock(m_readers_mutex);
+		if(++m_readers == 1)
+			m_empty.wait();
+	}
+	void readUnlock()
+	{
+		JMutexAutoLock lock(m_readers_mutex);
+		if(--m_readers == 0)
+			m_empty.signal();
+	}
+
+	void writeLock()
+	{
+		m_turnstile.Lock();
+		m_empty.wait();
+		m_turnstile.Unlock();
+	}
+	void writeUnlock()
+	{
+		m_empty.signal();
+	}
+
+private:
+	// Held by a writer while it waits
+	JMutex m_turnstile;
+	JMutex m_readers_mutex;
+	u32 m_readers;
+	// Signalled when neither readers nor a writer hold the lock
+	Event m_empty;
+};
+
 /*
 	A base class for simple background thread implementation
 */
@@ -102,6 +158,46 @@ class SimpleThread : public JThread
 	}
 };
 
+/*
+	Threads that help the calling thread with a job that is done in
+	passes. They are started by the first pass that needs them and wait
+	on an Event for the next one, so a pass doesn't start any threads.
+*/
+
+class WorkerPool
+{
+public:
+	class Job
+	{
+	public:
+		virtual ~Job()
+		{}
+		// Called on every thread of a pass; returns when nothing is left
+		virtual void work() = 0;
+	};
+
+	WorkerPool(const std::string &name);
+	// Stops the threads
+	~WorkerPool();
+
+	/*
+		Calls job->work() on num_threads threads, including the calling
+		one, and returns when every call has returned.
+	*/
+	void run(Job *job, u32 num_threads);
+
+private:
+	class Worker;
+	friend class Worker;
+
+	std::string m_name;
+	std::vector<Worker*> m_workers;
+	Job *m_job;
+	bool m_stopping;
+	// Only one pass at a time
+	JMutex m_mutex;
+};
+
 /*
 	A single worker thread - multiple client threads queue framework.
 */
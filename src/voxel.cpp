@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "gettime.h"
 #include "nodedef.h"
 #include "util/timetaker.h"
+#include "util/numeric.h"
 
 /*
 	Debug stuff
@@ -254,6 +255,78 @@ void VoxelManipulator::copyTo(MapNode *dst, VoxelArea dst_area,
 	}
 }
 
+void VoxelManipulator::setNodes(VoxelArea a, MapNode n,
+		u8 avoid_flags, u8 or_flags)
+{
+	v3s16 p0(MYMAX(a.MinEdge.X, m_area.MinEdge.X),
+			MYMAX(a.MinEdge.Y, m_area.MinEdge.Y),
+			MYMAX(a.MinEdge.Z, m_area.MinEdge.Z));
+	v3s16 p1(MYMIN(a.MaxEdge.X, m_area.MaxEdge.X),
+			MYMIN(a.MaxEdge.Y, m_area.MaxEdge.Y),
+			MYMIN(a.MaxEdge.Z, m_area.MaxEdge.Z));
+
+	for(s16 z=p0.Z; z<=p1.Z; z++)
+	for(s16 y=p0.Y; y<=p1.Y; y++)
+	{
+		u32 i = m_area.index(p0.X, y, z);
+		for(s16 x=p0.X; x<=p1.X; x++, i++)
+		{
+			if(m_flags[i] & avoid_flags)
+				continue;
+			m_flags[i] |= or_flags;
+			m_data[i] = n;
+		}
+	}
+}
+
+void VoxelManipulator::setColumn(v3s16 p, s16 y_max, MapNode n,
+		u8 avoid_flags, u8 or_flags)
+{
+	if(p.X < m_area.MinEdge.X || p.X > m_area.MaxEdge.X ||
+			p.Z < m_area.MinEdge.Z || p.Z > m_area.MaxEdge.Z)
+		return;
+	s16 y_min = MYMAX(p.Y, m_area.MinEdge.Y);
+	y_max = MYMIN(y_max, m_area.MaxEdge.Y);
+
+	v3s16 em = m_area.getExtent();
+	u32 i = m_area.index(p.X, y_min, p.Z);
+	for(s16 y=y_min; y<=y_max; y++)
+	{
+		if(!(m_flags[i] & avoid_flags))
+		{
+			m_flags[i] |= or_flags;
+			m_data[i] = n;
+		}
+		m_area.add_y(em, i, 1);
+	}
+}
+
+void VoxelManipulator::replaceColumn(v3s16 p, s16 y_max, MapNode n,
+		const content_t *keep, u32 keep_count, u8 or_flags)
+{
+	if(p.X < m_area.MinEdge.X || p.X > m_area.MaxEdge.X ||
+			p.Z < m_area.MinEdge.Z || p.Z > m_area.MaxEdge.Z)
+		return;
+	s16 y_min = MYMAX(p.Y, m_area.MinEdge.Y);
+	y_max = MYMIN(y_max, m_area.MaxEdge.Y);
+
+	v3s16 em = m_area.getExtent();
+	u32 i = m_area.index(p.X, y_min, p.Z);
+	for(s16 y=y_min; y<=y_max; y++)
+	{
+		content_t c = m_data[i].getContent();
+		u32 k = 0;
+		while(k < keep_count && keep[k] != c)
+			k++;
+		if(k == keep_count)
+		{
+			m_flags[i] |= or_flags;
+			m_data[i] = n;
+		}
+		m_area.add_y(em, i, 1);
+	}
+}
+
 /*
 	Algorithms
 	-----------------------------------------------------
@@ -512,6 +512,23 @@ class VoxelManipulator /*: public NodeContainer*/
 	void copyTo(MapNode *dst, VoxelArea dst_area,
 			v3s16 dst_pos, v3s16 from_pos, v3s16 size);
 
+	/*
+		Stamping of shapes. The part of the shape that is inside the area
+		is found once and then written span by span; nodes that have any
+		of avoid_flags set are left alone and or_flags are set on the
+		written ones.
+	*/
+
+	// All nodes of a box
+	void setNodes(VoxelArea a, MapNode n,
+			u8 avoid_flags=0, u8 or_flags=0);
+	// Nodes from p up to y_max, inclusive
+	void setColumn(v3s16 p, s16 y_max, MapNode n,
+			u8 avoid_flags=0, u8 or_flags=0);
+	// Like setColumn, but leaves the nodes whose content is in keep
+	void replaceColumn(v3s16 p, s16 y_max, MapNode n,
+			const content_t *keep, u32 keep_count, u8 or_flags=0);
+
 	/*
 		Algorithms
 	*/